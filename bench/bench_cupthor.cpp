@@ -0,0 +1,620 @@
+// In-process benchmarks of the oven model, no server involved. Run from the root of the repository
+// (the camera reads CameraFakeInput/ and writes OutputCamera/):
+//
+//   make bench
+//   ./cupthor-bench --benchmark_filter=Camera
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "cupthor/auth.h"
+#include "cupthor/camera_stats.h"
+#include "cupthor/clock.h"
+#include "cupthor/cook_predictor.h"
+#include "cupthor/cupthor.h"
+#include "cupthor/executor.h"
+#include "cupthor/heap_count.h"
+#include "cupthor/image_encoder.h"
+#include "cupthor/logger.h"
+#include "cupthor/playback.h"
+#include "cupthor/pool.h"
+#include "cupthor/rate_limiter.h"
+#include "cupthor/rpc.h"
+#include "cupthor/safety.h"
+#include "cupthor/settings_graph.h"
+#include "cupthor/shm_state.h"
+#include "cupthor/song_store.h"
+#include "cupthor/state_store.h"
+
+// Every operator new of the process is counted (heap_count.h), for the `allocs` counters: the number of heap
+// allocations per iteration
+static std::atomic<uint64_t>& heap_allocations = AllocatorCounters::global().heap_allocations;
+
+static void count_allocations(benchmark::State& state, uint64_t before) {
+    state.counters["allocs"] = benchmark::Counter(heap_allocations.load() - before, benchmark::Counter::kAvgIterations);
+}
+
+// A Base64 song of about `bytes` characters
+static std::string make_song(size_t bytes) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string song;
+    song.reserve(bytes);
+    for (size_t i = 0; i < bytes / 4 * 4; i++)
+        song += alphabet[(i * 7) % 64];
+    return song;
+}
+
+static void BM_SetSetting(benchmark::State& state) {
+    CupThor cth;
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cth.set_setting("desired_temperature", std::to_string(20 + i % 280)));
+        benchmark::DoNotOptimize(cth.set_setting("ventilation", std::to_string(i % 7)));
+        i++;
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_SetSetting);
+
+// The same kind of command as BM_SetSetting through the binary protocol, range(0) commands per frame. The
+// first one runs the frame in process, the second goes through a Unix socket to a running RpcServer.
+static std::vector<rpc::Command> setpoint_batch(int64_t size) {
+    std::vector<rpc::Command> commands;
+    for (int64_t i = 0; i < size; i++) {
+        if (i % 2 == 0)
+            commands.push_back({rpc::SET_SETTING, CupThor::DESIRED_TEMPERATURE, 150.0 + i % 100});
+        else
+            commands.push_back({rpc::SET_SETTING, CupThor::VENTILATION, double(i % 3)});
+    }
+    return commands;
+}
+
+static void BM_RpcExecute(benchmark::State& state) {
+    CupThor cth;
+    std::mutex lock;
+    RpcServer server(cth, lock);
+    std::string frame, reply;
+    rpc::encode_request(setpoint_batch(state.range(0)), frame);
+    for (auto _ : state) {
+        reply.clear();
+        server.execute(frame.data() + 4, frame.size() - 4, reply);
+        benchmark::DoNotOptimize(reply.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RpcExecute)->Arg(1)->Arg(16)->Arg(256);
+
+static void BM_RpcUnixSocket(benchmark::State& state) {
+    std::string path = "/tmp/cupthor-bench-rpc-" + std::to_string(getpid()) + ".sock";
+    CupThor cth;
+    std::mutex lock;
+    RpcServer server(cth, lock);
+    RpcClient client;
+    if (!server.listen_unix(path)) {
+        state.SkipWithError("can't listen on the Unix socket");
+        return;
+    }
+    server.start(4);
+    if (!client.connect_unix(path)) {
+        state.SkipWithError("can't connect to the Unix socket");
+        return;
+    }
+    std::vector<rpc::Command> commands = setpoint_batch(state.range(0));
+    std::vector<rpc::Result> results;
+    for (auto _ : state) {
+        if (!client.call(commands, results)) {
+            state.SkipWithError("rpc call failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RpcUnixSocket)->Arg(1)->Arg(16)->Arg(256)->UseRealTime();
+
+// Reading the shared memory snapshot, with range(0) = 1 while another thread keeps publishing as fast as it can
+static void BM_ShmStateRead(benchmark::State& state) {
+    std::string name = "/cupthor-bench-" + std::to_string(getpid());
+    ShmStatePublisher publisher;
+    ShmStateReader reader;
+    if (!publisher.open(name)) {
+        state.SkipWithError("shm_open failed");
+        return;
+    }
+    ShmState published;
+    memset(&published, 0, sizeof(published));
+    publisher.publish(published);
+    if (!reader.open(name)) {
+        state.SkipWithError("can't map the segment");
+        return;
+    }
+
+    std::atomic<bool> writing{state.range(0) == 1};
+    std::thread writer([&] {
+        ShmState s = published;
+        while (writing.load(std::memory_order_relaxed)) {
+            s.temperature += 0.5;
+            publisher.publish(s);
+        }
+    });
+
+    ShmState snapshot;
+    size_t failed = 0;
+    for (auto _ : state) {
+        if (!reader.read(snapshot))
+            failed++;
+        benchmark::DoNotOptimize(snapshot);
+    }
+    writing = false;
+    writer.join();
+    state.counters["failed"] = failed;
+}
+BENCHMARK(BM_ShmStateRead)->Arg(0)->Arg(1);
+
+static void BM_SetSilentMode(benchmark::State& state) {
+    CupThor cth;
+    bool on = false;
+    for (auto _ : state) {
+        on = !on;
+        benchmark::DoNotOptimize(cth.set_setting("silent_mode", on ? "true" : "false"));
+    }
+}
+BENCHMARK(BM_SetSilentMode);
+
+// One change in a graph of range(0) rules, of which only one reads the changed node (and sets a second node).
+// The time should stay flat as the rule count grows.
+static void BM_SettingsGraphSet(benchmark::State& state) {
+    int rules = (int)state.range(0);
+    SettingsGraph graph(rules + 2);
+    graph.add_rule({0}, [](SettingsGraph& g) { g.set(1, g.get(0) * 2); });
+    for (int i = 1; i < rules; i++)
+        graph.add_rule({i + 1}, [i](SettingsGraph& g) { g.set(1, i); });
+    size_t notified = 0;
+    graph.subscribe([&notified](const std::vector<SettingsGraph::Change>& changes) { notified += changes.size(); });
+
+    int i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(graph.set(0, ++i & 1));
+    state.counters["rules_run"] = benchmark::Counter(graph.evaluations(), benchmark::Counter::kAvgIterations);
+    benchmark::DoNotOptimize(notified);
+}
+BENCHMARK(BM_SettingsGraphSet)->RangeMultiplier(8)->Range(8, 4096);
+
+static void BM_GetSetting(benchmark::State& state) {
+    CupThor cth;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cth.get_setting("ventilation"));
+}
+BENCHMARK(BM_GetSetting);
+
+static void BM_SetCook(benchmark::State& state) {
+    CupThor cth;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cth.set_cook("vegetables"));
+}
+BENCHMARK(BM_SetCook);
+
+// One tick of the cook state machine while nothing changes
+static void BM_ControlStep(benchmark::State& state) {
+    CupThor cth;
+    while (cth.set_cook("vegetables") != 1) { }
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cth.control_step());
+}
+BENCHMARK(BM_ControlStep);
+
+// One sample and one estimate of the cook predictor, what every control tick and GET /cook/ add per oven
+static void BM_CookPredictorSample(benchmark::State& state) {
+    CookPredictor predictor;
+    predictor.start("chicken", 20, 200, 600, 0);
+    int64_t now = 0;
+    double temperature = 20;
+    for (auto _ : state) {
+        now += 100;
+        temperature = temperature < 195 ? temperature + 0.1 : 20;
+        predictor.sample(temperature, now);
+        benchmark::DoNotOptimize(predictor.eta_preheat(temperature, 200));
+    }
+}
+BENCHMARK(BM_CookPredictorSample);
+
+// A whole chicken cook with 30 minutes of keep-warm on virtual time: the control loop's 100 ms ticks are
+// stepped by hand, so the scenario takes as long as the computation and gives the same result every run
+static void BM_CookScenario30min(benchmark::State& state) {
+    int64_t ticks = 0;
+    for (auto _ : state) {
+        auto clock = std::make_shared<VirtualClock>(Clock::real() -> now_ms());
+        {
+            CupThor cth(clock, 42);
+            cth.configure_keep_warm(60, 75, 1800);
+            if (cth.set_cook_mode("chicken", "true") != 1) {
+                state.SkipWithError("cook didn't start");
+                return;
+            }
+            while (cth.get_cook_phase() != CupThor::DONE) {
+                clock -> advance(100);
+                cth.control_step();
+                ticks++;
+            }
+        }
+        // Let the timer threads sleeping on this clock run out before it goes away
+        while (clock.use_count() > 1) {
+            clock -> advance(1000);
+            std::this_thread::yield();
+        }
+    }
+    state.counters["ticks"] = benchmark::Counter(ticks, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_CookScenario30min)->Unit(benchmark::kMillisecond);
+
+static void BM_CameraFeed(benchmark::State& state) {
+    if (access("./CameraFakeInput/peppers.bmp", R_OK) != 0 || access("./OutputCamera", W_OK) != 0) {
+        state.SkipWithError("run from the root of the repository");
+        return;
+    }
+    CupThor cth;
+    // The first capture fills the frame pool
+    cth.get_sensor("camera");
+    uint64_t before = heap_allocations.load();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cth.get_sensor("camera"));
+    count_allocations(state, before);
+}
+BENCHMARK(BM_CameraFeed)->Unit(benchmark::kMillisecond);
+
+// A response body of five pieces, what a /settings handler sends: in the request arena, reset after every
+// request, and as a std::string
+static void BM_ResponseBody(benchmark::State& state) {
+    Arena arena(4096);
+    std::string name = "desired_temperature";
+    std::string value = "180";
+    bool use_arena = state.range(0) == 1;
+    uint64_t before = heap_allocations.load();
+    for (auto _ : state) {
+        if (use_arena) {
+            benchmark::DoNotOptimize(arena.concat({name, " was set to ", value, " at ", name}).data());
+            arena.reset();
+        }
+        else {
+            std::string body = name + " was set to " + value + " at " + name;
+            benchmark::DoNotOptimize(body.data());
+        }
+    }
+    count_allocations(state, before);
+}
+BENCHMARK(BM_ResponseBody)->Arg(0)->Arg(1);
+
+// Encoding the camera picture (800x800, 1.9 MB of pixels). MB/s are of the raw pixels, the same for every
+// encoder. Arg 0: BMP, 1: QOI, 2: JPEG; second arg: executor threads, 0 = on the calling thread.
+static void BM_ImageEncode(benchmark::State& state) {
+    std::ifstream in("./CameraFakeInput/peppers.bmp", std::ios::binary);
+    std::string file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ImageView view;
+    if (!view.from_bmp(reinterpret_cast<const unsigned char*>(file.data()), file.size())) {
+        state.SkipWithError("run from the root of the repository");
+        return;
+    }
+    ImageEncoders encoders;
+    const ImageEncoder* encoder[] = {&encoders.bmp, &encoders.qoi, &encoders.jpeg};
+    const ImageEncoder& chosen = *encoder[state.range(0)];
+    WorkStealingExecutor executor;
+    if (state.range(1) > 0)
+        executor.start(state.range(1));
+
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        chosen.encode(view, out, state.range(1) > 0 ? &executor : nullptr);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetLabel(chosen.mime());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(view.width) * view.height * 3);
+    state.counters["ratio"] = static_cast<double>(view.width) * view.height * 3 / out.size();
+}
+BENCHMARK(BM_ImageEncode)->ArgsProduct({{0, 1, 2}, {0, 4}})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Mean color, browning index and histograms of the camera picture. Arg: sampling step (1 = every pixel); the
+// last one looks at a 200x200 region in the middle with step 1.
+static void BM_CameraStats(benchmark::State& state) {
+    std::ifstream in("./CameraFakeInput/peppers.bmp", std::ios::binary);
+    std::string file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ImageView view;
+    if (!view.from_bmp(reinterpret_cast<const unsigned char*>(file.data()), file.size())) {
+        state.SkipWithError("run from the root of the repository");
+        return;
+    }
+    CameraStatsOptions options;
+    if (state.range(0) > 0) {
+        options.step = state.range(0);
+    }
+    else {
+        options.roi_x = view.width / 2 - 100;
+        options.roi_y = view.height / 2 - 100;
+        options.roi_width = 200;
+        options.roi_height = 200;
+    }
+    CameraStats stats;
+    for (auto _ : state) {
+        stats = analyze_frame(view, options);
+        benchmark::DoNotOptimize(stats);
+        benchmark::ClobberMemory();
+    }
+    state.counters["pixels"] = static_cast<double>(stats.pixels);
+}
+BENCHMARK(BM_CameraStats)->Arg(1)->Arg(2)->Arg(4)->Arg(0)->Unit(benchmark::kMicrosecond);
+
+static void BM_MediaPlayerPlay(benchmark::State& state) {
+    MediaPlayer player;
+    std::string song = make_song(state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(player.play(song));
+    state.SetBytesProcessed(state.iterations() * song.size());
+}
+BENCHMARK(BM_MediaPlayerPlay)->RangeMultiplier(8)->Range(64, 4096);
+
+// Decoding a song into the engine's format, what an upload costs on the executor besides the validation
+static void BM_DecodeSong(benchmark::State& state) {
+    std::string song = make_song(state.range(0));
+    AudioFormat format;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(decode_song(song, format));
+    state.SetBytesProcessed(state.iterations() * song.size());
+}
+BENCHMARK(BM_DecodeSong)->RangeMultiplier(16)->Range(4096, 1 << 20);
+
+// A song sent again: hashing it and finding it in the store, instead of BM_MediaPlayerPlay + BM_DecodeSong
+static void BM_SongStoreHit(benchmark::State& state) {
+    std::string song = make_song(state.range(0));
+    SongStore store;
+    store.insert(xxhash64(song.data(), song.size()), decode_song(song, AudioFormat()));
+    for (auto _ : state) {
+        std::shared_ptr<const Song> found;
+        benchmark::DoNotOptimize(store.find(xxhash64(song.data(), song.size()), found));
+    }
+    state.SetBytesProcessed(state.iterations() * song.size());
+}
+BENCHMARK(BM_SongStoreHit)->RangeMultiplier(16)->Range(4096, 1 << 20);
+
+// Two seconds of sound with range(0) threads decoding songs as fast as they can next to it, the way the executor
+// does under a flood of uploads. What counts is the underruns counter, it should stay at 0.
+static void BM_PlaybackUnderLoad(benchmark::State& state) {
+    std::string upload = make_song(256 * 1024);
+    for (auto _ : state) {
+        PlaybackEngine engine;
+        PlaybackEngine::Options options;
+        options.buffer_ms = 200;
+        if (!engine.start(options, std::unique_ptr<AudioSink>(new NullSink()))) {
+            state.SkipWithError("playback didn't start");
+            return;
+        }
+        std::shared_ptr<const Song> song = decode_song(make_song(4 * 44100 * 2 * 4 / 3), engine.format());
+        engine.enqueue(song);
+        engine.set_playing(true);
+
+        std::atomic<bool> busy{true};
+        std::vector<std::thread> load;
+        for (int i = 0; i < state.range(0); i++)
+            load.emplace_back([&] {
+                while (busy.load(std::memory_order_relaxed))
+                    benchmark::DoNotOptimize(decode_song(upload, engine.format()));
+            });
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+        busy = false;
+        for (std::thread& thread : load)
+            thread.join();
+
+        PlaybackEngine::Stats stats = engine.stats();
+        engine.stop();
+        state.counters["blocks"] = static_cast<double>(stats.blocks_played);
+        state.counters["underruns"] = static_cast<double>(stats.underruns);
+    }
+}
+BENCHMARK(BM_PlaybackUnderLoad)->Arg(0)->Arg(4)->Iterations(1)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Time from smoke in the oven to the water jet on, with range(0) threads taking turns on the oven lock and holding
+// it for a millisecond each time, the way saturated HTTP workers would. The monitor never takes that lock, so the
+// reaction should stay within a period (10 ms) plus scheduling; max_ms is the worst one seen. The run fails when a
+// reaction takes longer than the period plus REACTION_SLACK_MS.
+static const int REACTION_SLACK_MS = 50;
+
+static void BM_SafetyReaction(benchmark::State& state) {
+    std::mutex lock;
+    CupThor cth(Clock::real(), 42);
+    SafetyMonitor monitor;
+    SafetyMonitor::Options options;
+    monitor.start(options, cth);
+
+    std::atomic<bool> busy{true};
+    std::vector<std::thread> workers;
+    for (int i = 0; i < state.range(0); i++)
+        workers.emplace_back([&, i] {
+            while (busy.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> guard(lock);
+                cth.set_setting(CupThor::VENTILATION, i % 4);
+                auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+                while (std::chrono::steady_clock::now() < until)
+                    ;
+            }
+        });
+
+    double worst = 0;
+    int iteration = 0;
+    for (auto _ : state) {
+        // Smoke comes at any point of the monitor's period, not always right after the check that saw the last one
+        std::this_thread::sleep_for(std::chrono::microseconds(iteration++ * 1370 % 10000));
+        auto start = std::chrono::steady_clock::now();
+        cth.let_smoke_in(true);
+        while (cth.get_sensor_value(CupThor::WATER_JET) == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        state.SetIterationTime(seconds);
+        worst = std::max(worst, seconds);
+
+        cth.let_smoke_in(false);
+        std::lock_guard<std::mutex> guard(lock);
+        monitor.reset();
+    }
+
+    busy = false;
+    for (std::thread& worker : workers)
+        worker.join();
+    monitor.stop();
+    state.counters["max_ms"] = worst * 1000;
+    state.counters["late_checks"] = static_cast<double>(monitor.stats().late_checks);
+    if (worst * 1000 > options.period_ms + REACTION_SLACK_MS)
+        state.SkipWithError("the water jet came later than a period plus the slack");
+}
+BENCHMARK(BM_SafetyReaction)->Arg(0)->Arg(8)->Arg(32)->Iterations(50)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+static void BM_StateStoreUpdate(benchmark::State& state) {
+    char dir[] = "/tmp/cupthor-bench-XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    StateStore store;
+    StateStore::State s;
+    store.open(dir);
+    store.recover(s);
+    store.start();
+    int i = 0;
+    for (auto _ : state) {
+        s.desired_temperature = 20 + i++ % 280;
+        benchmark::DoNotOptimize(store.update(s));
+    }
+    store.close();
+    unlink((std::string(dir) + "/cupthor.wal").c_str());
+    unlink((std::string(dir) + "/cupthor.snapshot").c_str());
+    rmdir(dir);
+}
+BENCHMARK(BM_StateStoreUpdate);
+
+// One event with three fields, as the settings subscriber logs it, from range(0) threads at once. The rings are big
+// enough for every iteration, so what is measured is the copy into the ring and not the cheaper drop; the dropped
+// counter should stay at 0.
+static Logger bench_logger;
+static char bench_log_path[] = "/tmp/cupthor-bench-log-XXXXXX";
+
+static void BM_LogEvent(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        int fd = mkstemp(bench_log_path);
+        if (fd >= 0)
+            close(fd);
+        Logger::Options options;
+        options.path = bench_log_path;
+        options.ring_bytes = 1024 * 1024;
+        bench_logger.start(options);
+    }
+    int i = 0;
+    for (auto _ : state) {
+        bench_logger.info("setting", {{"name", "desired_temperature"}, {"before", 180.0}, {"after", 20.0 + i++ % 280}});
+    }
+    if (state.thread_index() == 0) {
+        bench_logger.stop();
+        state.counters["dropped"] = static_cast<double>(bench_logger.dropped());
+        unlink(bench_log_path);
+        strcpy(bench_log_path + strlen(bench_log_path) - 6, "XXXXXX");
+    }
+}
+BENCHMARK(BM_LogEvent)->Iterations(8000)->Threads(1)->Threads(4);
+
+// A debug event in a build with the default CUPTHOR_LOG_LEVEL: nothing is left of it
+static void BM_LogEventCompiledOut(benchmark::State& state) {
+    Logger logger;
+    int i = 0;
+    for (auto _ : state) {
+        logger.log<LOG_DEBUG>("setting", {{"name", "desired_temperature"}, {"after", 20.0 + i++ % 280}});
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_LogEventCompiledOut);
+
+// A POST's token check: Arg 0 a token already in the cache (one hash and one lookup), Arg 1 a different token
+// every time, whose HMAC has to be checked
+static void BM_VerifyToken(benchmark::State& state) {
+    static TokenAuthority authority;
+    static std::vector<std::string> tokens;
+    if (state.thread_index() == 0) {
+        TokenAuthority::Options options;
+        options.key = "bench";
+        options.cache_entries = 1024;
+        authority.configure(options);
+        tokens.clear();
+        for (int i = 0; i < 4096; i++)
+            tokens.push_back(authority.issue(1000));
+    }
+    bool cached = state.range(0) == 0;
+    size_t i = state.thread_index();
+    for (auto _ : state) {
+        const std::string& token = cached ? tokens[state.thread_index()] : tokens[i++ % tokens.size()];
+        benchmark::DoNotOptimize(authority.verify(token, 2000));
+    }
+}
+BENCHMARK(BM_VerifyToken)->Arg(0)->Arg(1)->Threads(1)->Threads(4);
+
+// What POST /settings/:name/:value does once the http layer has parsed it, with authentication off (Arg 0) and on
+// (Arg 1: the client's token is checked first, a cache hit after the first request). make auth-compare measures the
+// same through the server.
+static void BM_SettingRequest(benchmark::State& state) {
+    static TokenAuthority authority;
+    static CupThor cth;
+    static std::mutex lock;
+    static std::string token;
+    if (state.thread_index() == 0) {
+        TokenAuthority::Options options;
+        options.key = state.range(0) ? "bench" : "";
+        authority.configure(options);
+        token = authority.issue(1000);
+    }
+    int i = state.thread_index();
+    for (auto _ : state) {
+        if (authority.enabled() && authority.verify(token, 2000) != TokenAuthority::VALID) {
+            state.SkipWithError("token refused");
+            break;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        benchmark::DoNotOptimize(cth.set_setting("desired_temperature", std::to_string(20 + i++ % 280)));
+        cth.persist();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SettingRequest)->Arg(0)->Arg(1)->Threads(1)->Threads(4);
+
+static void BM_RateLimiterAllow(benchmark::State& state) {
+    static RateLimiter limiter;
+    limiter.configure(RateLimiter::CAMERA, 1e9, 1e9);
+    std::string client = "10.0.0." + std::to_string(state.thread_index());
+    for (auto _ : state)
+        benchmark::DoNotOptimize(limiter.allow(client, RateLimiter::CAMERA));
+}
+BENCHMARK(BM_RateLimiterAllow)->Threads(1)->Threads(4)->Threads(8);
+
+static void BM_ExecutorRoundTrip(benchmark::State& state) {
+    WorkStealingExecutor executor;
+    executor.start(state.range(0));
+    uint64_t before = heap_allocations.load();
+    for (auto _ : state) {
+        std::atomic<int> done{0};
+        for (int i = 0; i < 64; i++)
+            executor.submit([&done] { done++; });
+        while (done.load() != 64) { }
+    }
+    count_allocations(state, before);
+    executor.stop();
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+BENCHMARK(BM_ExecutorRoundTrip)->Arg(1)->Arg(4);
+
+BENCHMARK_MAIN();
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <pistache/net.h>
 #include <pistache/http.h>
 #include <pistache/peer.h>
@@ -7,32 +8,99 @@
 #include <pistache/router.h>
 #include <pistache/endpoint.h>
 #include <pistache/common.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <chrono>
+#include <cstdint>
 #include <vector>
-#include <fstream>
-#include <iterator>
-#include <random>
-#include <regex>
 #include <thread>
+#include <iostream>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+
+#include "cupthor/auth.h"
+#include "cupthor/clock.h"
+#include "cupthor/cupthor.h"
+#include "cupthor/executor.h"
+#include "cupthor/fleet.h"
+#include "cupthor/heap_count.h"
+#include "cupthor/image_encoder.h"
+#include "cupthor/logger.h"
+#include "cupthor/playback.h"
+#include "cupthor/pool.h"
+#include "cupthor/rate_limiter.h"
+#include "cupthor/recorder.h"
+#include "cupthor/rpc.h"
+#include "cupthor/safety.h"
+#include "cupthor/server_config.h"
+#include "cupthor/shm_state.h"
+#include "cupthor/song_store.h"
+#include "cupthor/state_store.h"
+#include "cupthor/timelapse.h"
 
 using namespace std;
 using namespace Pistache;
 
 // General advice: pay atetntion to the namespaces that you use in various contexts. Could prevent headaches.
 
-// This is just a helper function to preety-print the Cookies that one of the enpoints shall receive.
-void printCookies(const Http::Request& req) {
+// This is just a helper function to log the Cookies that one of the enpoints shall receive, one field per cookie.
+// It used to print them to std::cout, which made every /auth request wait for the stream's lock and a write().
+void logCookies(Logger& logger, const Http::Request& req) {
+    if (!logger.enabled())
+        return;
     auto cookies = req.cookies();
-    std::cout << "Cookies: [" << std::endl;
-    const std::string indent(4, ' ');
-    for (const auto& c: cookies) {
-        std::cout << indent << c.name << " = " << c.value << std::endl;
+    std::vector<LogField> fields;
+    for (const auto& c: cookies)
+        fields.emplace_back(c.name.c_str(), c.value);
+    logger.write(LOG_INFO, "auth", fields.data(), fields.size());
+}
+
+// The response bodies of the request a Pistache worker is handling. A handler resets it when it returns:
+// send() has copied the body into Pistache's buffer by then. Jobs on the executor build their bodies with text().
+thread_local Arena request_arena(4096);
+
+struct RequestScope {
+    ~RequestScope() {
+        request_arena.reset();
+    }
+};
+
+// Sends a body made of several pieces, assembled in the request arena
+void send_text(Http::ResponseWriter& response, Http::Code code, std::initializer_list<std::string_view> parts) {
+    std::string_view body = request_arena.concat(parts);
+    response.send(code, body.data(), body.size());
+}
+
+// Response bodies made of several pieces, built with one allocation instead of one per '+'
+std::string text(std::initializer_list<std::string_view> parts) {
+    size_t size = 0;
+    for (auto part : parts)
+        size += part.size();
+    std::string result;
+    result.reserve(size);
+    for (auto part : parts)
+        result.append(part.data(), part.size());
+    return result;
+}
+
+// The Accept header as the client sent it ("image/qoi, image/jpeg;q=0.8"), empty if there is none
+std::string accept_header(const Rest::Request& request) {
+    std::string accept;
+    auto header = request.headers().tryGet<Http::Header::Accept>();
+    if (!header)
+        return accept;
+    for (const auto& media : header->media()) {
+        if (!accept.empty())
+            accept += ", ";
+        accept += media.toString();
     }
-    std::cout << "]" << std::endl;
+    return accept;
 }
 
 // Some generic namespace, with a simple function we could use to test the creation of the endpoints.
@@ -44,31 +112,180 @@ namespace Generic {
 
 }
 
+// Runs job on the executor. The promise is resolved with what job returns, or rejected with the exception it threw.
+template<typename Func>
+auto run_async(WorkStealingExecutor& executor, Func job) -> Async::Promise<decltype(job())> {
+    using Result = decltype(job());
+    return Async::Promise<Result>([&executor, job](Async::Resolver& resolve, Async::Rejection& reject) {
+        auto resolver = std::make_shared<Async::Resolver>(resolve.clone());
+        auto rejecter = std::make_shared<Async::Rejection>(reject.clone());
+        executor.submit([job, resolver, rejecter]() {
+            try {
+                (*resolver)(job());
+            }
+            catch (const std::exception& e) {
+                (*rejecter)(std::runtime_error(e.what()));
+            }
+            catch (...) {
+                (*rejecter)(std::runtime_error("job failed"));
+            }
+        });
+    });
+}
+
+// Threads, timeouts and limits of the http endpoint, the same for an oven and for a gateway
+Http::Endpoint::Options endpoint_options(const ServerConfig& config) {
+    auto flags = Flags<Tcp::Options>(Tcp::Options::ReuseAddr);
+    if (config.reuse_port)
+        flags = flags | Tcp::Options::ReusePort;
+
+    return Http::Endpoint::options()
+        .threads(config.threads)
+        .flags(flags)
+        .backlog(config.backlog)
+        .maxRequestSize(config.max_request_size)
+        .maxResponseSize(config.max_response_size)
+        .keepaliveTimeout(std::chrono::seconds(config.keepalive_timeout))
+        .headerTimeout(std::chrono::seconds(config.header_timeout))
+        .bodyTimeout(std::chrono::seconds(config.body_timeout));
+}
+
 // Definition of the OvenEnpoint class 
 class CupThorEndpoint {
 public:
-    explicit CupThorEndpoint(Address addr)
-        : httpEndpoint(std::make_shared<Http::Endpoint>(addr))
+    explicit CupThorEndpoint(Address addr, std::shared_ptr<Clock> clock = Clock::real(), uint64_t seed = 0)
+        : clock(clock), cth(clock, seed), rpc(cth, cupthorLock), httpEndpoint(std::make_shared<Http::Endpoint>(addr))
     { }
 
     // Initialization of the server. Additional options can be provided here
     void init(size_t thr = 2) {
-        auto opts = Http::Endpoint::options()
-            .threads(static_cast<int>(thr));
-        httpEndpoint->init(opts);
+        ServerConfig config;
+        config.threads = static_cast<int>(thr);
+        init(config);
+    }
+
+    void init(const ServerConfig& config) {
+        if (!auth.configure(config.auth))
+            throw std::runtime_error("bad auth_signing_key");
+        // First, so that the controller and the safety monitor find it when they start
+        if (config.log.path != "none") {
+            if (!logger.start(config.log))
+                throw std::runtime_error("can't log to " + config.log.path);
+            cth.attach_logger(&logger);
+        }
+        cth.configure_keep_warm(config.keep_warm_low, config.keep_warm_high, config.keep_warm_duration_s);
+        cth.configure_browning_done(config.cook_browning_done);
+        cth.configure_camera_stats(config.camera_stats);
+        cth.start_controller(cupthorLock);
+        if (!safety.start(config.safety, cth))
+            throw std::runtime_error("can't start the safety monitor");
+        max_pending_jobs = config.max_pending_jobs;
+        // Admission keeps the queues under max_pending_jobs, they never have to grow
+        executor.start(config.executor_threads > 0 ? config.executor_threads : hardware_concurrency(), max_pending_jobs);
+        limiter.configure(RateLimiter::CAMERA, config.camera_rate, config.camera_burst);
+        limiter.configure(RateLimiter::MEDIA, config.media_rate, config.media_burst);
+        max_song_size = config.max_song_size;
+        songs.set_budget(config.song_store_mb * 1024 * 1024);
+        encoders = ImageEncoders(config.jpeg_quality);
+        if (!config.record_file.empty() && recorder.start(config.record_file))
+            std::cout << "Recording requests to " << config.record_file << std::endl;
+
+        httpEndpoint->init(endpoint_options(config));
+        pin_cpus = config.pin_cpus;
         // Server routes are loaded up
         setupRoutes();
+
+        if (config.rpc_port != 0 && !rpc.listen_tcp(config.rpc_port, config.rpc_bind))
+            throw std::runtime_error("can't listen for rpc on " + config.rpc_bind + ":" + std::to_string(config.rpc_port));
+        if (!config.rpc_socket.empty() && !rpc.listen_unix(config.rpc_socket))
+            throw std::runtime_error("can't listen for rpc on " + config.rpc_socket);
+        rpc_max_connections = config.rpc_max_connections;
+        rpc.attach_auth(&auth);
+
+        if (!config.shm_name.empty()) {
+            if (!shm.open(config.shm_name))
+                throw std::runtime_error("can't create the shared memory segment " + config.shm_name);
+            Guard guard(cupthorLock);
+            cth.attach_publisher(&shm);
+        }
+
+        // The engine plays on its own threads; the oven only tells it to play or stop and hands it the songs
+        if (config.playback_output != "none") {
+            std::unique_ptr<AudioSink> sink;
+            if (config.playback_output == "null")
+                sink.reset(new NullSink());
+            else
+                sink.reset(new WavSink(config.playback_output));
+            if (!playback.start(config.playback, std::move(sink)))
+                throw std::runtime_error("can't play to " + config.playback_output);
+            Guard guard(cupthorLock);
+            cth.attach_playback(&playback);
+        }
+
+        // The recorder takes its pictures without the oven lock, the camera has its own
+        if (config.timelapse.dir != "none") {
+            auto capture = [this](std::string& frame) {
+                return cth.get_camera_image(encoders.jpeg, frame);
+            };
+            if (!timelapse.start(config.timelapse, clock, capture))
+                throw std::runtime_error("can't record timelapses in " + config.timelapse.dir);
+            Guard guard(cupthorLock);
+            cth.attach_timelapse(&timelapse);
+        }
+        logger.info("start", {{"port", static_cast<int>(config.port)}, {"threads", config.threads}});
     }
 
     // Server is started threaded.  
     void start() {
         httpEndpoint->setHandler(router.handler());
         httpEndpoint->serveThreaded();
+        rpc.start(rpc_max_connections);
     }
 
     // When signaled server shuts down
     void stop(){
         httpEndpoint->shutdown();
+        rpc.stop();
+        executor.stop();
+        cth.stop_controller();
+        safety.stop();
+        {
+            Guard guard(cupthorLock);
+            cth.attach_logger(nullptr);
+            cth.attach_publisher(nullptr);
+            cth.attach_timelapse(nullptr);
+            cth.attach_playback(nullptr);
+        }
+        if (playback.enabled()) {
+            PlaybackEngine::Stats stats = playback.stats();
+            playback.stop();
+            std::cout << "Playback: " << stats.songs_played << " songs played, " << stats.underruns << " underruns" << std::endl;
+        }
+        if (timelapse.enabled()) {
+            timelapse.stop();
+            std::cout << "Timelapse: " << timelapse.recorded() << " frames recorded, " << timelapse.dropped() << " dropped" << std::endl;
+        }
+        shm.close();
+        if (recorder.enabled()) {
+            recorder.stop();
+            std::cout << "Recorded " << recorder.recorded() << " requests, " << recorder.dropped() << " dropped" << std::endl;
+        }
+        if (auth.enabled()) {
+            TokenAuthority::Stats stats = auth.stats();
+            std::cout << "Auth: " << stats.issued << " tokens issued, " << stats.cache_hits << " cached checks, "
+                      << stats.signatures << " signatures checked, " << stats.rejected << " rejected" << std::endl;
+        }
+        if (logger.enabled()) {
+            logger.stop();
+            std::cout << "Logged " << logger.logged() << " events, " << logger.dropped() << " dropped" << std::endl;
+        }
+    }
+
+    // Brings the oven back to the state found in the store and logs every later change to it
+    void restore(StateStore& store, const StateStore::State& state) {
+        Guard guard(cupthorLock);
+        cth.restore(state);
+        cth.attach_store(&store);
     }
 
 private:
@@ -84,34 +301,146 @@ private:
         //Nu ar trebui sa se sa seteze senzorii
         //Routes::Post(router, "/sensors/:sensorName/:value", Routes::bind(&CupThorEndpoint::setSensor, this));
         Routes::Get(router, "/sensors/:sensorName/", Routes::bind(&CupThorEndpoint::getSensor, this));
+        Routes::Get(router, "/sensors/camera/stats", Routes::bind(&CupThorEndpoint::getCameraStats, this));
                 
         Routes::Post(router, "/cook/:cookName/", Routes::bind(&CupThorEndpoint::setCook, this));
         Routes::Post(router, "/cook/:cookName/:value", Routes::bind(&CupThorEndpoint::setCookMode, this));
         Routes::Get(router, "/cook/", Routes::bind(&CupThorEndpoint::getCook, this));
+        Routes::Get(router, "/cook/:session/frames/:n", Routes::bind(&CupThorEndpoint::getCookFrame, this));
 
         
 
 
         Routes::Get(router, "/mediaplayer/", Routes::bind(&CupThorEndpoint::getMediaPlayer, this));
+        Routes::Get(router, "/mediaplayer/playback", Routes::bind(&CupThorEndpoint::getPlayback, this));
         Routes::Post(router, "/mediaplayer/:mediaCommandName/", Routes::bind(&CupThorEndpoint::setMediaCommand, this));
         Routes::Post(router, "/mediaplayer/:mediaCommandName/:value", Routes::bind(&CupThorEndpoint::setMediaCommandSong, this));
+        Routes::Post(router, "/mediaplayer/play-hash/:hash", Routes::bind(&CupThorEndpoint::playSongHash, this));
+
+        Routes::Get(router, "/safety/", Routes::bind(&CupThorEndpoint::getSafety, this));
+        Routes::Post(router, "/safety/reset/", Routes::bind(&CupThorEndpoint::resetSafety, this));
+
+        Routes::Get(router, "/stats/allocators", Routes::bind(&CupThorEndpoint::getAllocatorStats, this));
 
     }
 
-    
+    // Decides whether an expensive request gets to run. A client over its own limit gets 429; when the executor
+    // is already backed up everybody gets 503, so the queue stays short and the cheap routes keep their latency.
+    // Sends the error response itself and returns false when the request is turned away.
+    bool admit(const Rest::Request& request, RateLimiter::RouteClass route, Http::ResponseWriter& response) {
+        if (!limiter.allow(request.address().host(), route)) {
+            response.headers().addRaw(Http::Header::Raw("Retry-After", "1"));
+            response.send(Http::Code::Too_Many_Requests, "Too many requests, slow down");
+            return false;
+        }
+        if (executor.pending() >= max_pending_jobs) {
+            response.headers().addRaw(Http::Header::Raw("Retry-After", "1"));
+            response.send(Http::Code::Service_Unavailable, "Server is busy, try again later");
+            return false;
+        }
+        return true;
+    }
+
+    // Every worker gets exactly one core, the list is reused round-robin when it's shorter than the number of
+    // workers. Pistache builds pinWorker as a no-op, so each worker pins itself on the first request it serves: the
+    // i-th worker to show up goes on pin_cpus[i % size].
+    void pin_worker() {
+        thread_local bool pinned = false;
+        if (pinned || pin_cpus.empty())
+            return;
+        pinned = true;
+        int cpu = pin_cpus[next_worker.fetch_add(1, std::memory_order_relaxed) % pin_cpus.size()];
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error != 0)
+            std::cout << "Worker: can't run on cpu " << cpu << ": " << strerror(error) << std::endl;
+    }
+
+    // Adds the request to the traffic log, when one is being recorded. Requests on the same connection get the
+    // same connection number. Every route starts here, so it's also where the worker gets pinned.
+    void record(const Rest::Request& request) {
+        pin_worker();
+        if (!recorder.enabled())
+            return;
+        const Address& peer = request.address();
+        uint32_t connection = static_cast<uint32_t>(std::hash<std::string>()(peer.host()) * 31 + static_cast<uint16_t>(peer.port()));
+        RequestRecorder::Method method = request.method() == Http::Method::Post ? RequestRecorder::POST : RequestRecorder::GET;
+        recorder.record(method, request.resource(), connection, static_cast<uint32_t>(request.body().size()));
+    }
+
     void doAuth(const Rest::Request& request, Http::ResponseWriter response) {
-        // Function that prints cookies
-        printCookies(request);
+        pin_worker();
+        // Function that logs cookies
+        logCookies(logger, request);
         // In the response object, it adds a cookie regarding the communications language.
         response.cookies()
             .add(Http::Cookie("lang", "en-US"));
-        // Send the response
-        response.send(Http::Code::Ok);
+        if (!auth.enabled()) {
+            // Send the response
+            response.send(Http::Code::Ok);
+            return;
+        }
+
+        // With authentication on, the client shows the shared key and gets a token for the POST routes
+        std::string key = credentials(request, "Key ");
+        if (!auth.check_key(key)) {
+            logger.warn("auth_refused", {{"client", request.address().host()}});
+            response.headers().addRaw(Http::Header::Raw("WWW-Authenticate", "Key"));
+            response.send(Http::Code::Unauthorized, "Send the key as: Authorization: Key <key>");
+            return;
+        }
+        std::string token = auth.issue(unix_seconds());
+        if (token.empty()) {
+            response.send(Http::Code::Internal_Server_Error, "Can't make a token");
+            return;
+        }
+        Http::Cookie session("session", token);
+        session.httpOnly = true;
+        response.cookies().add(session);
+        response.send(Http::Code::Ok, token);
+    }
+
+    static int64_t unix_seconds() {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // What follows scheme in the Authorization header ("Bearer ", "Key "), empty when it isn't there
+    static std::string credentials(const Rest::Request& request, const char* scheme) {
+        auto header = request.headers().tryGet<Http::Header::Authorization>();
+        if (!header)
+            return "";
+        std::string value = header->value();
+        size_t length = strlen(scheme);
+        if (value.size() < length || strncasecmp(value.c_str(), scheme, length) != 0)
+            return "";
+        return value.substr(length);
+    }
+
+    // Checks the session token of a request that changes the oven, when authentication is on. The token comes in
+    // the Authorization header or in the session cookie. Sends 401 itself and returns false when it isn't valid.
+    bool authorized(const Rest::Request& request, Http::ResponseWriter& response) {
+        if (!auth.enabled())
+            return true;
+        std::string token = credentials(request, "Bearer ");
+        if (token.empty() && request.cookies().has("session"))
+            token = request.cookies().get("session").value;
+        TokenAuthority::Result result = auth.verify(token, unix_seconds());
+        if (result == TokenAuthority::VALID)
+            return true;
+        response.headers().addRaw(Http::Header::Raw("WWW-Authenticate", "Bearer"));
+        send_text(response, Http::Code::Unauthorized, {"Not authorized (", TokenAuthority::result_name(result), "), get a token from /auth"});
+        return false;
     }
 
 // Endpoint to configure one of the Oven's settings.
 
     void setMediaCommand(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        if (!authorized(request, response))
+            return;
         // You don't know what the parameter content that you receive is, but you should
         // try to cast it to some data structure. Here, I cast the settingName to string.
         auto mediaCommandName = request.param(":mediaCommandName").as<std::string>();
@@ -122,6 +451,7 @@ private:
 
         // Setting the Oven's setting to value
         int mediaCommandResponse = cth.set_media_player_command(mediaCommandName);
+        cth.persist();
 
         // Sending some confirmation or error response.
         if (mediaCommandResponse == 1) {
@@ -147,6 +477,10 @@ private:
 
 
     void setMediaCommandSong(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        if (!authorized(request, response))
+            return;
         // You don't know what the parameter content that you receive is, but you should
         // try to cast it to some data structure. Here, I cast the settingName to string.
         auto mediaCommandName = request.param(":mediaCommandName").as<std::string>();
@@ -162,43 +496,124 @@ private:
         else
         {
 
-        // This is a guard that prevents editing the same value by two concurent threads. 
-        Guard guard(cupthorLock);
+        if (!admit(request, RateLimiter::MEDIA, response))
+            return;
 
-        
         string val = "";
         if (request.hasParam(":value")) {
             auto value = request.param(":value");
             val = value.as<string>();
         }
 
-        // Setting the Oven's setting to value
-        int mediaCommandResponse = cth.media_player_play_given_song(mediaCommandName, val);
+        if (val.size() > max_song_size) {
+            response.send(Http::Code::Payload_Too_Large, "The given song is too big");
+            return;
+        }
+
+        // Validating the song (and decoding it, when there is an engine to play it) is the slow part, it runs on
+        // the executor and without the lock. A song already in the store is neither validated nor decoded again.
+        // The response is sent from there once it's done.
+        auto writer = std::make_shared<Http::ResponseWriter>(std::move(response));
+        run_async(executor, [this, mediaCommandName, val]() {
+            uint64_t hash = xxhash64(val.data(), val.size());
+            std::shared_ptr<const Song> song;
+            bool valid = songs.find(hash, song);
+            if (!valid) {
+                int error = SONG_NO_SOUND;
+                if (playback.enabled())
+                    song = decode_song(val, playback.format(), playback.max_song_bytes(), &error);
+                if (error == SONG_TOO_LARGE || error == SONG_BAD_RATE)
+                    return std::make_pair(PLAY_TOO_LARGE, hash);
+                valid = song || CupThor::is_valid_song(val);
+                if (valid)
+                    songs.insert(hash, song);
+            }
+
+            // This is a guard that prevents editing the same value by two concurent threads. 
+            Guard guard(cupthorLock);
+
+            // Setting the Oven's setting to value
+            int mediaCommandResponse = cth.media_player_play_checked_song(mediaCommandName, valid, song);
+            cth.persist();
+            return std::make_pair(mediaCommandResponse, hash);
+        }).then([writer](std::pair<int, uint64_t> result) {
+            // The hash is what /mediaplayer/play-hash/:hash takes to play the song again without sending it
+            if (result.first == 1 || result.first == 4)
+                writer->headers().addRaw(Http::Header::Raw("X-Song-Hash", song_hash_text(result.second)));
+            send_play_result(*writer, result.first);
+        }, [writer](std::exception_ptr&) {
+            writer->send(Http::Code::Internal_Server_Error, "An error has occured when processing the given song");
+        });
+
+        }
+
+    }
+
+
+
+
+    // Plays a song uploaded earlier, by the hash its upload answered with. Nothing to validate or decode, it
+    // doesn't go through the executor.
+    void playSongHash(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        if (!authorized(request, response))
+            return;
+        auto hashText = request.param(":hash").as<std::string>();
+        uint64_t hash;
+        if (!parse_song_hash(hashText, hash)) {
+            response.send(Http::Code::Bad_Request, "The hash is 16 hex digits");
+            return;
+        }
+        std::shared_ptr<const Song> song;
+        if (!songs.find(hash, song)) {
+            send_text(response, Http::Code::Not_Found, {"No song with hash ", hashText, ", send it with /mediaplayer/play/:value"});
+            return;
+        }
+
+        Guard guard(cupthorLock);
+        int mediaCommandResponse = cth.media_player_play_checked_song("play", true, song);
+        cth.persist();
+        send_play_result(response, mediaCommandResponse);
+    }
+
+    // The upload was refused before it got to the oven: decode_song's SONG_TOO_LARGE or SONG_BAD_RATE
+    static constexpr int PLAY_TOO_LARGE = -1;
 
+    // Answer to a play of a given song, for the result codes of CupThor::media_player_play_checked_song, and
+    // PLAY_TOO_LARGE
+    static void send_play_result(Http::ResponseWriter& writer, int mediaCommandResponse) {
         // Sending some confirmation or error response.
         if (mediaCommandResponse == 1) {
-            response.send(Http::Code::Ok, "Playing given song");
+            writer.send(Http::Code::Ok, "Playing given song");
         }
 
 
         else if (mediaCommandResponse == 3){
-            response.send(Http::Code::Ok, "Cant play in silent mode. Deactivate it first");
+            writer.send(Http::Code::Ok, "Cant play in silent mode. Deactivate it first");
         }
 
 
-        else {
-            response.send(Http::Code::Not_Found, "An error has occured when processing the given song");
+        else if (mediaCommandResponse == 4){
+            writer.headers().addRaw(Http::Header::Raw("Retry-After", "1"));
+            writer.send(Http::Code::Service_Unavailable, "The playlist is full, try again later");
         }
 
-        }
-
-    }
 
+        else if (mediaCommandResponse == PLAY_TOO_LARGE){
+            writer.send(Http::Code::Payload_Too_Large, "The song would be too big once decoded, or its sample rate isn't between 8000 and 192000 Hz");
+        }
 
 
+        else {
+            writer.send(Http::Code::Not_Found, "An error has occured when processing the given song");
+        }
+    }
 
     // Setting to get the settings value of one of the configurations of the Oven
     void getMediaPlayer(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
 
         Guard guard(cupthorLock);
 
@@ -212,7 +627,7 @@ private:
                         .add<Header::Server>("pistache/0.1")
                         .add<Header::ContentType>(MIME(Text, Plain));
 
-            response.send(Http::Code::Ok, "MediaPlayer is " + valueStatus);
+            send_text(response, Http::Code::Ok, {"MediaPlayer is ", valueStatus});
         }
         else {
             response.send(Http::Code::Not_Found, "Eroare media player");
@@ -224,13 +639,18 @@ private:
 
     // In mod normal nu ar trebui sa se intre pe aceasta sectiune de cod deoarece senzorii nu ar trebui setati ci doar interogati.
     void setCook(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        if (!authorized(request, response))
+            return;
         auto cookName = request.param(":cookName").as<std::string>();
 
         Guard guard(cupthorLock);
         
         int setResponse = cth.set_cook(cookName);
+        cth.persist();
         if (setResponse == 1) {
-            response.send(Http::Code::Ok, "Cook mode was set to " + cookName);
+            send_text(response, Http::Code::Ok, {"Cook mode was set to ", cookName});
         }
         else if (setResponse == 2){
             response.send(Http::Code::Ok, "Silent mode is activated! \nTurn it off and try again.");
@@ -240,13 +660,21 @@ private:
             response.send(Http::Code::Ok, "No food detected in the oven. Not starting for safety measures");
         }
 
+        else if (setResponse == 4){
+            response.send(Http::Code::Conflict, "The safety cut-off is on. Reset it with POST /safety/reset/");
+        }
+
         else {
-            response.send(Http::Code::Not_Found, cookName + " was not a valid value ");
+            send_text(response, Http::Code::Not_Found, {cookName, " was not a valid value "});
         }
 
 
     }
     void setCookMode(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        if (!authorized(request, response))
+            return;
         auto cookName = request.param(":cookName").as<std::string>();
 
         Guard guard(cupthorLock);
@@ -259,14 +687,15 @@ private:
 
 
         int setResponse = cth.set_cook_mode(cookName, val);
+        cth.persist();
 
         if (setResponse == 1){
 
-            response.send(Http::Code::Ok, "Cook mode was set to " + cookName + " with:- keep-food-warm");
+            send_text(response, Http::Code::Ok, {"Cook mode was set to ", cookName, " with:- keep-food-warm"});
 
         }
         else if (setResponse == 3){
-            response.send(Http::Code::Ok, "Cook mode was set to " + cookName + " without:- keep-food-warm");
+            send_text(response, Http::Code::Ok, {"Cook mode was set to ", cookName, " without:- keep-food-warm"});
         }
         else if (setResponse == 2){
             response.send(Http::Code::Ok, "Silent mode is activated! \nTurn it off and try again.");
@@ -276,6 +705,10 @@ private:
             response.send(Http::Code::Ok, "No food detected in the oven. Not starting for safety measures");
         }
 
+        else if (setResponse == 5){
+            response.send(Http::Code::Conflict, "The safety cut-off is on. Reset it with POST /safety/reset/");
+        }
+
         else{
 
             response.send(Http::Code::Not_Found, "Error! Selected cook mode cannot be set");
@@ -284,11 +717,31 @@ private:
 
     }
     void getCook(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
 
-        Guard guard(cupthorLock);
+        bool cook_mode_checker;
+        string whats_cook;
+        int eta;
+        uint64_t session;
+        {
+            Guard guard(cupthorLock);
+            cook_mode_checker = cth.get_cook_mode_status();
+            whats_cook = cth.get_what_is_cooking();
+            eta = cth.get_cook_eta();
+            session = cth.get_timelapse_session();
+        }
 
-        bool cook_mode_checker = cth.get_cook_mode_status();
-        string whats_cook = cth.get_what_is_cooking();
+        // The phase is read without the lock, it doesn't wait for the control thread
+        int phase = cth.get_cook_phase();
+        int remaining = cth.get_phase_remaining();
+        std::string_view phase_text = request_arena.concat({" phase:", CupThor::cook_phase_name(phase)});
+        if (remaining >= 0)
+            phase_text = request_arena.concat({phase_text, " remaining:", std::to_string(remaining), "s"});
+        if (eta >= 0)
+            phase_text = request_arena.concat({phase_text, " eta:", std::to_string(eta), "s"});
+        if (session > 0)
+            phase_text = request_arena.concat({phase_text, " timelapse:", std::to_string(session)});
 
         if (whats_cook != "") {
 
@@ -298,9 +751,9 @@ private:
                         .add<Header::Server>("pistache/0.1")
                         .add<Header::ContentType>(MIME(Text, Plain));
             if (cook_mode_checker == true)
-                response.send(Http::Code::Ok, "Currently cooking: " + whats_cook + " keep-warm-food:ON");
+                send_text(response, Http::Code::Ok, {"Currently cooking: ", whats_cook, " keep-warm-food:ON", phase_text});
             else
-                response.send(Http::Code::Ok, "Currently cooking: " + whats_cook + " keep-warm-food:OFF");
+                send_text(response, Http::Code::Ok, {"Currently cooking: ", whats_cook, " keep-warm-food:OFF", phase_text});
         }
         else {
             response.send(Http::Code::Not_Found, + "Nothing is cooking right now");
@@ -312,6 +765,8 @@ private:
 
 
     void setSensor(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
         // You don't know what the parameter content that you receive is, but you should
         // try to cast it to some data structure. Here, I cast the settingName to string.
         auto sensorName = request.param(":sensorName").as<std::string>();
@@ -331,12 +786,12 @@ private:
 
         // Sending some confirmation or error response.
         if (setResponse == 1) {
-            response.send(Http::Code::Ok, sensorName + " was set to " + val);
+            send_text(response, Http::Code::Ok, {sensorName, " was set to ", val});
         }
 
 
         else {
-            response.send(Http::Code::Not_Found, sensorName + " was not found and or '" + val + "' was not a valid value ");
+            send_text(response, Http::Code::Not_Found, {sensorName, " was not found and or '", val, "' was not a valid value "});
         }
 
     }
@@ -346,8 +801,51 @@ private:
 
     // Setting to get the settings value of one of the configurations of the Oven
     void getSensor(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
         auto sensorName = request.param(":sensorName").as<std::string>();
 
+        // A capture reads and writes a couple of MB, so it runs on the executor. The camera has its own lock,
+        // the rest of the oven stays available meanwhile.
+        if (sensorName == "camera") {
+            if (!admit(request, RateLimiter::CAMERA, response))
+                return;
+
+            auto writer = std::make_shared<Http::ResponseWriter>(std::move(response));
+
+            // A client that asks for an image type gets the picture itself, encoded on the executor too; the
+            // others keep getting the text answer and the picture in OutputCamera/
+            const ImageEncoder* encoder = encoders.for_accept(accept_header(request));
+            if (encoder != nullptr) {
+                run_async(executor, [this, encoder]() {
+                    std::string image;
+                    if (!cth.get_camera_image(*encoder, image, &executor))
+                        throw std::runtime_error("no picture");
+                    return image;
+                }).then([writer, encoder](const std::string& image) {
+                    writer->headers().add<Http::Header::Server>("pistache/0.1");
+                    writer->send(Http::Code::Ok, image.data(), image.size(), Http::Mime::MediaType::fromString(encoder->mime()));
+                }, [writer](std::exception_ptr&) {
+                    writer->send(Http::Code::Internal_Server_Error, "camera capture failed");
+                });
+                return;
+            }
+
+            run_async(executor, [this]() {
+                return cth.get_camera_feed();
+            }).then([writer, sensorName](const std::string& valueSensor) {
+                using namespace Http;
+                writer->headers()
+                            .add<Header::Server>("pistache/0.1")
+                            .add<Header::ContentType>(MIME(Text, Plain));
+
+                writer->send(Http::Code::Ok, text({sensorName, " is ", valueSensor}));
+            }, [writer](std::exception_ptr&) {
+                writer->send(Http::Code::Internal_Server_Error, "camera capture failed");
+            });
+            return;
+        }
+
         Guard guard(cupthorLock);
 
         string valueSensor = cth.get_sensor(sensorName);
@@ -360,10 +858,10 @@ private:
                         .add<Header::Server>("pistache/0.1")
                         .add<Header::ContentType>(MIME(Text, Plain));
 
-            response.send(Http::Code::Ok, sensorName + " is " + valueSensor);
+            send_text(response, Http::Code::Ok, {sensorName, " is ", valueSensor});
         }
         else {
-            response.send(Http::Code::Not_Found, sensorName + " was not found");
+            send_text(response, Http::Code::Not_Found, {sensorName, " was not found"});
         }
     }
 
@@ -372,6 +870,10 @@ private:
 
     // Endpoint to configure one of the Oven's settings.
     void setSetting(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        if (!authorized(request, response))
+            return;
         // You don't know what the parameter content that you receive is, but you should
         // try to cast it to some data structure. Here, I cast the settingName to string.
         auto settingName = request.param(":settingName").as<std::string>();
@@ -388,10 +890,11 @@ private:
 
         // Setting the Oven's setting to value
         int setResponse = cth.set_setting(settingName, val);
+        cth.persist();
 
         // Sending some confirmation or error response.
         if (setResponse == 1) {
-            response.send(Http::Code::Ok, settingName + " was set to " + val);
+            send_text(response, Http::Code::Ok, {settingName, " was set to ", val});
         }
         else if(setResponse == 2){
             if (val == "true")
@@ -404,13 +907,15 @@ private:
             response.send(Http::Code::Ok, "Silent mode is activated! \nTurn it off and try again.");
         }
         else {
-            response.send(Http::Code::Not_Found, settingName + " was not found and or '" + val + "' was not a valid value ");
+            send_text(response, Http::Code::Not_Found, {settingName, " was not found and or '", val, "' was not a valid value "});
         }
 
     }
 
     // Setting to get the settings value of one of the configurations of the Oven
     void getSetting(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
         auto settingName = request.param(":settingName").as<std::string>();
 
         Guard guard(cupthorLock);
@@ -425,794 +930,332 @@ private:
                         .add<Header::Server>("pistache/0.1")
                         .add<Header::ContentType>(MIME(Text, Plain));
 
-            response.send(Http::Code::Ok, settingName + " is " + valueSetting);
+            send_text(response, Http::Code::Ok, {settingName, " is ", valueSetting});
         }
         else {
-            response.send(Http::Code::Not_Found, settingName + " was not found");
+            send_text(response, Http::Code::Not_Found, {settingName, " was not found"});
         }
     }
 
-    // Defining the class of the Oven. It should model the entire configuration of the Oven
-    class CupThor {
-    public:
-        explicit CupThor(){ 
-
-        this -> silent_mode.name = "silent_mode";
-        this -> silent_mode.value = false;
-
-        this -> ventilation.name = "ventilation";
-        this -> ventilation.value = 0;
-
-        this -> ambient_light.name = "ambient_light";
-        this -> ambient_light.value = false;
-
-        this -> desired_temperature.name = "desired_temperature";
-        this -> desired_temperature.value = 20;
+    // Frame n of the timelapse of a cook, as JPEG. The body is sent straight from the mapped archive.
+    void getCookFrame(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        auto session_text = request.param(":session").as<std::string>();
+        auto n_text = request.param(":n").as<std::string>();
+
+        char* end = nullptr;
+        uint64_t session = std::strtoull(session_text.c_str(), &end, 10);
+        bool valid = !session_text.empty() && *end == '\0';
+        unsigned long long n = std::strtoull(n_text.c_str(), &end, 10);
+        valid = valid && !n_text.empty() && *end == '\0' && n <= UINT32_MAX;
+        if (!valid) {
+            send_text(response, Http::Code::Bad_Request, {"'", session_text, "/frames/", n_text, "' is not a session and a frame number"});
+            return;
         }
 
-
-        int set_media_player_command(std::string name){
-
-            if (name == "play"){
-
-                if (silent_mode.value == true)
-                    return 3;
-
-                media_player.set_status(true);
-                return 1;
-            }
-
-
-            if (name == "stop"){
-                media_player.set_status(false);
-                return 2;
-            }
-
-            return 0;
+        std::shared_ptr<FrameArchive> archive = timelapse.archive(session);
+        if (!archive) {
+            send_text(response, Http::Code::Not_Found, {"no timelapse for session ", session_text});
+            return;
         }
-
-
-        int media_player_play_given_song(std::string name, std::string value){
-
-            if (name == "play"){
-
-                if (silent_mode.value == true)
-                    return 3;
-
-                if (media_player.play(value))
-                    return 1;
-            }
-
-            return 0;
+        FrameArchive::Frame frame;
+        if (!archive->frame(static_cast<uint32_t>(n), frame)) {
+            send_text(response, Http::Code::Not_Found, {"session ", session_text, " has ", std::to_string(archive->frames()), " frames"});
+            return;
         }
 
-        // Setting the value for one of the settings. Hardcoded for the defrosting option
-        int set_setting(std::string name, std::string value){
-            if(name == "defrost"){
-                defrost.name = name;
-                if(value == "true"){
-                    defrost.value = true;
-                    return 1;
-                }
-                if(value == "false"){
-                    defrost.value = false;
-                    return 1;
-                }
-            }
-
-
-
-            if(name == "desired_temperature"){
-                desired_temperature.name = name;
-
-                double valoare;
-                valoare = std::stof(value);
-
-
-                if (valoare <= 300 && valoare >= 20)
-                {
-                    desired_temperature.value = valoare;
-                    thermostat_cupthor.modifica_temperatura_la(valoare);
-                    return 1;
-                }
-                
-            }
-
-            if (name == "ambient_light"){
-                ambient_light.name = name;
-
-                if (value == "true"){
-                    if(silent_mode.value)
-                    {
-                        ambient_light.value = false;
-                        return 3;
-                    }
-                     
-                    else
-                    {
-                    ambient_light.value = true;
-                    return 1;
-                    }
-                }
-                
-                if (value == "false"){
-                    ambient_light.value = false;
-                    return 1;
-                }
-            }
-
-
-            if (name == "ventilation"){
-                ventilation.name = name;
-
-                int valoare;
-                valoare = std::stoi(value);
-
-                if (valoare >= 0 && valoare <=6){
-                    if (silent_mode.value && valoare > 2)
-                        return 3;
-                    else
-                    {
-                    ventilation.value = valoare;
-                    return 1;
-                    }
-                }
-            }
-
-            if (name == "silent_mode"){
-                silent_mode.name = name;
-
-                if (value == "true"){
-                    silent_mode.value = true;
-                    ambient_light.value = false;
-                    media_player.set_status(false);
-                    if (ventilation.value > 2)
-                        ventilation.value = 2;
-
-                    return 2;
-                }
-                
-                if (value == "false"){
-                    silent_mode.value = false;
-                    ambient_light.value = true;
-                    return 2;
-                }
-            }
-
-            return 0;
-        }
-        int set_cook(std::string name){
-            if (cantar_cupthor.get_valoare_greutate() > 0){
-
-                int time = 0;
-                int base_time = 10;
-                int chicken_time = 5;
-                int vegetable_time = 2;
-                int fish_time = 4;
-                int pork_time = 7;
-
-                if (name == "chicken"){
-
-                    if (silent_mode.value == true){
-                        return 2;
-                        cookMode.set_status(false,"");
-                    }
-
-                    else{
-                        time = base_time + (chicken_time * (cantar_cupthor.get_valoare_greutate() / 100));
-                        cooking_timer.set(time, name);
-                        ventilation.value = 4;
-                        desired_temperature.value = 200;
-                        cookMode.set_status(false,name);
-                        return 1;
-                    }
-                }
-                if (name == "vegetables"){
-                    time = base_time + (vegetable_time * (cantar_cupthor.get_valoare_greutate() / 100));
-                    cooking_timer.set(time, name);
-                    ventilation.value = 1;
-                    desired_temperature.value = 100;
-                    cookMode.set_status(false,name);
-                    return 1;
-
-                }
-                if (name == "fish"){
-                    if (silent_mode.value == true){
-                        return 2;
-                        cookMode.set_status(false,"");
-                    }
-
-                    else{
-                        time = base_time + (fish_time * (cantar_cupthor.get_valoare_greutate() / 100));
-                        cooking_timer.set(time, name);
-                        ventilation.value = 4;
-                        desired_temperature.value = 250;
-                        cookMode.set_status(false,name);
-                        return 1;
-                    }
-                }
-                if (name == "pork"){
-                    time = base_time + (pork_time * (cantar_cupthor.get_valoare_greutate() / 100));
-                    cooking_timer.set(time, name);
-                    ventilation.value = 2;
-                    desired_temperature.value = 120;
-                    cookMode.set_status(false,name);
-                    return 1;
-                }
-            }
-
-            if (name == "pork" || name == "chicken" || name == "fish" || name == "vegetables")
-                return 3;
-            return 0;
+        using namespace Http;
+        response.headers()
+                    .add<Header::Server>("pistache/0.1")
+                    .addRaw(Header::Raw("X-Frame-Time-Ms", std::to_string(frame.timestamp_ms)));
+        response.send(Http::Code::Ok, reinterpret_cast<const char*>(frame.data), frame.size, MIME(Image, Jpeg));
+    }
 
+    // Stats of the last camera picture. They take well under a millisecond and are computed once per picture,
+    // so this runs on the Pistache thread; the picture itself comes from GET /sensors/camera/.
+    void getCameraStats(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        CameraStats stats;
+        if (!cth.get_camera_stats(stats)) {
+            response.send(Http::Code::Not_Found, "no picture was taken yet");
+            return;
         }
-        int set_cook_mode(std::string name, std::string value){
-
-            if (value != "true" && value != "false")
-                return 0;
-            
-            if (cantar_cupthor.get_valoare_greutate() > 0){
-                int cook_feed = set_cook(name);
-                if (cook_feed == 1){
-                    
-                    if (value == "true"){
-                    cookMode.set_status(true,name);
-                    return 1;
-                    }
 
-
-                    else if (value == "false"){
-                    cookMode.set_status(false,name);
-                    return 3;
-                    }
-                }
-                else 
-                if (cook_feed == 2)
-                    return 2;
-                
+        std::string body = text({
+            "frame ", std::to_string(stats.frame),
+            "\npixels ", std::to_string(stats.pixels),
+            "\nmean_rgb ", std::to_string(stats.mean_r), " ", std::to_string(stats.mean_g), " ", std::to_string(stats.mean_b),
+            "\nbrowning ", std::to_string(stats.browning)
+        });
+        const uint32_t* histograms[] = {stats.histogram_r, stats.histogram_g, stats.histogram_b};
+        const char* names[] = {"\nhistogram_r", "\nhistogram_g", "\nhistogram_b"};
+        for (int channel = 0; channel < 3; channel++) {
+            body += names[channel];
+            for (int bin = 0; bin < CameraStats::BINS; bin++) {
+                body += ' ';
+                body += std::to_string(histograms[channel][bin]);
             }
-
-            if (name == "pork" || name == "chicken" || name == "fish" || name == "vegetables")
-                return 4;
-
-
-            return 0;
-
         }
-        //SET-SENSOR - nu ar trebui implementat nimic aici
-        int set_sensor(std::string name, std::string value){
-
-            
-            return 0;
-        }
-
-        // Getter
-        string get_setting(std::string name){
-
-            //SETTINGS
-            if (name == "defrost"){
-                return std::to_string(defrost.value);
-            }
-
-
-            else if (name == "desired_temperature"){
-                return std::to_string(desired_temperature.value);
-            }
-
-            else if (name == "ambient_light"){
-                return std::to_string(ambient_light.value);
-            }
-
-            else if (name == "ventilation"){
-                return std::to_string(ventilation.value);
-            }
-
-            else if (name == "silent_mode"){
-                return std::to_string(silent_mode.value);
-            }
+        body += '\n';
 
-            
+        using namespace Http;
+        response.headers()
+                    .add<Header::Server>("pistache/0.1")
+                    .add<Header::ContentType>(MIME(Text, Plain));
+        response.send(Http::Code::Ok, body);
+    }
 
-            else{
-                return "";
-            }
+    // What the playback engine is doing and how the song store is used. Lock free, except for the length of the
+    // playlist and the store counters.
+    void getPlayback(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        SongStore::Stats store = songs.stats();
+        std::string body = text({
+            "store_songs ", std::to_string(store.songs),
+            "\nstore_bytes ", std::to_string(store.bytes),
+            "\nstore_hits ", std::to_string(store.hits),
+            "\nstore_misses ", std::to_string(store.misses),
+            "\nstore_evictions ", std::to_string(store.evictions), "\n"});
+        if (playback.enabled()) {
+            PlaybackEngine::Stats stats = playback.stats();
+            body = text({
+                "playing ", stats.playing ? "1" : "0",
+                "\nqueued ", std::to_string(stats.queued),
+                "\nbuffered_ms ", std::to_string(stats.buffered_ms),
+                "\nsongs_played ", std::to_string(stats.songs_played),
+                "\nblocks_played ", std::to_string(stats.blocks_played),
+                "\nunderruns ", std::to_string(stats.underruns), "\n", body});
         }
 
+        using namespace Http;
+        response.headers()
+                    .add<Header::Server>("pistache/0.1")
+                    .add<Header::ContentType>(MIME(Text, Plain));
+        response.send(Http::Code::Ok, body);
+    }
 
-        string get_sensor(std::string name){
-            
-            //SENSORS
-            if (name == "thermostat"){
-                return std::to_string(thermostat_cupthor.get_temperatura());
-            }
-
-
-            if (name == "camera"){
-                return camera.get_feed();
-            }
-
-            if (name == "foodweight"){
-                return std::to_string(cantar_cupthor.get_valoare_greutate());
-            }
-
-            if (name == "smoke_sensor"){
-                return std::to_string(senzor_fum.get_status_senzor());
-            }
-            if (name == "water_jet"){
-                return std::to_string(water.value);
-            }
-
-            else{
-                return "";
-            }
-
-        }
-
-        bool get_cook_mode_status(){
-            return cookMode.get_status();
-        }
+    // State of the safety cut-off and of the monitor thread. Lock free.
+    void getSafety(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        SafetyMonitor::Stats stats = safety.stats();
+
+        using namespace Http;
+        response.headers()
+                    .add<Header::Server>("pistache/0.1")
+                    .add<Header::ContentType>(MIME(Text, Plain));
+        send_text(response, Http::Code::Ok, {
+            "cut_off ", CupThor::safety_trip_name(cth.safety_tripped()),
+            "\nsmoke ", cth.smoke_detected() ? "1" : "0",
+            "\nwater_jet ", cth.get_sensor_value(CupThor::WATER_JET) != 0 ? "1" : "0",
+            "\ntemperature ", std::to_string((int)cth.get_sensor_value(CupThor::THERMOSTAT)),
+            "\nchecks ", std::to_string(stats.checks),
+            "\nlate_checks ", std::to_string(stats.late_checks),
+            "\nmax_lateness_us ", std::to_string(stats.max_lateness_us),
+            "\ntrips ", std::to_string(stats.trips),
+            "\npinned ", stats.pinned ? "1" : "0",
+            "\nrealtime ", stats.realtime ? "1" : "0", "\n"});
+    }
 
+    void resetSafety(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        if (!authorized(request, response))
+            return;
 
-        string get_what_is_cooking(){
-            return cookMode.get_what_is_cooking();
+        Guard guard(cupthorLock);
+        if (cth.safety_tripped() == CupThor::SAFE) {
+            response.send(Http::Code::Ok, "The safety cut-off is off");
+            return;
         }
-        string get_media_player_status(){
-            return std::to_string(media_player.get_status());
+        if (!safety.reset()) {
+            response.send(Http::Code::Conflict, "Smoke or overheating still detected, the safety cut-off stays on");
+            return;
         }
+        response.send(Http::Code::Ok, "Safety cut-off reset, heater on and water jet off");
+    }
 
+    // What the pools and arenas did since the start, and every heap allocation of the process. Under a steady load
+    // the *_mallocs counters stop moving; heap_allocations still counts what the pools don't cover.
+    void getAllocatorStats(const Rest::Request& request, Http::ResponseWriter response){
+        record(request);
+        RequestScope scope;
+        AllocatorStats stats = allocator_stats();
+
+        using namespace Http;
+        response.headers()
+                    .add<Header::Server>("pistache/0.1")
+                    .add<Header::ContentType>(MIME(Text, Plain));
+        send_text(response, Http::Code::Ok, {
+            "arena_mallocs ", std::to_string(stats.arena_mallocs),
+            "\narena_bytes ", std::to_string(stats.arena_bytes),
+            "\narena_resets ", std::to_string(stats.arena_resets),
+            "\nframe_acquires ", std::to_string(stats.frame_acquires),
+            "\nframe_mallocs ", std::to_string(stats.frame_mallocs),
+            "\nrecord_acquires ", std::to_string(stats.record_acquires),
+            "\nrecord_exhausted ", std::to_string(stats.record_exhausted),
+            "\nqueue_mallocs ", std::to_string(stats.queue_mallocs),
+            "\nheap_allocations ", std::to_string(stats.heap_allocations), "\n"});
+    }
 
-    private:
-        class CookMode{
-            public:
-            CookMode(){
-                this -> keep_food_warm = false;
-                this -> what_is_cooking = "";
-            }
-
-
-            bool get_status(){
-                return this -> keep_food_warm;
-            }
-            string get_what_is_cooking(){
-                return this -> what_is_cooking;
-            }
-
-            void set_status(bool value, string name){
-                this -> keep_food_warm = value;
-                this -> what_is_cooking = name;
-            }
-
-            private:
-            bool keep_food_warm;
-            string what_is_cooking;
-        }cookMode;
-
-        class MediaPlayer{
-            public:
-                MediaPlayer(){
-                    this -> status = false;
-                }
-
-                bool get_status(){
-                    return this -> status;
-                }
+    // Create the lock which prevents concurrent editing of the same variable
+    using Lock = std::mutex;
+    using Guard = std::lock_guard<Lock>;
+    Lock cupthorLock;
 
+    // Segment the oven state is published to for local readers; declared before the oven, which writes to it
+    ShmStatePublisher shm;
 
-                void set_status(bool pornit_sau_oprit){
-                    this -> status = pornit_sau_oprit;
-                }
+    // Time of the oven, the timelapse runs on it too. Declared before the oven, which is built with it.
+    std::shared_ptr<Clock> clock;
 
-                bool play(std::string value){
-                    std::regex expresie("^(?:[A-Za-z0-9+/]{4})*(?:[A-Za-z0-9+/]{2}==|[A-Za-z0-9+/]{3}=|[A-Za-z0-9+/]{4})$");
-                    if (regex_match(value, expresie)){
-                        this -> set_status(true);
-                        return true;
-                    }
+    // Structured log of the oven's events, off when log_file is none. Declared before the oven, which logs to it.
+    Logger logger;
 
-                    return false;
-                }
+    // Instance of the Oven model
+    CupThor cth;
 
-            private:
+    // Runs the slow work of the handlers off the I/O threads
+    WorkStealingExecutor executor;
 
-                bool status;
+    // Formats the camera picture is sent in, chosen by the Accept header
+    ImageEncoders encoders;
 
-        }media_player;
+    // Cuts the heater off on smoke or overheating, from a thread of its own and without the oven lock
+    SafetyMonitor safety;
 
-        class ThermostatCupThor{
-            public:
+    // Plays the media player's songs, off when playback_output is none
+    PlaybackEngine playback;
 
-                ThermostatCupThor(){
-                    this -> valoare_dorita_stored = 20;
-                    this -> temperatura_la_ultima_comanda = 20;
-                    this -> timpul_ultimei_comenzi = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::system_clock::now().time_since_epoch()).count();
-                }
+    // Songs uploaded before, by the hash of their Base64 text
+    SongStore songs;
 
-                void modifica_temperatura_la(double valoare_dorita){
-                    this -> temperatura_la_ultima_comanda = this -> get_temperatura();
-                    this -> timpul_ultimei_comenzi = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::system_clock::now().time_since_epoch()).count();
-                    this -> valoare_dorita_stored = valoare_dorita;
-                    return;
-                }
+    // Pictures of every cook, off when timelapse_dir is none
+    TimelapseRecorder timelapse;
 
-                int get_temperatura(){
+    // Session tokens of the POST routes, off when auth_key is empty
+    TokenAuthority auth;
 
-                    double timp_actual = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::system_clock::now().time_since_epoch()).count();
+    // Admission control for the routes that use the executor
+    RateLimiter limiter;
+    size_t max_pending_jobs = 64;
+    size_t max_song_size = 1024 * 1024;
 
+    // Binary control protocol, same oven and same lock as the REST routes
+    RpcServer rpc;
+    size_t rpc_max_connections = 64;
 
-                    if ((timp_actual - (this -> timpul_ultimei_comenzi)) > abs(((this -> valoare_dorita_stored) - (this -> temperatura_la_ultima_comanda)))){
+    // Traffic log for tools/replay, off unless record_file is set
+    RequestRecorder recorder;
 
-                        return this -> valoare_dorita_stored;
-                    }
+    // Cores of the workers, see pin_worker
+    std::vector<int> pin_cpus;
+    std::atomic<size_t> next_worker{0};
 
-                    else
-                    {
-                        if (valoare_dorita_stored > temperatura_la_ultima_comanda)
-                            return (this -> temperatura_la_ultima_comanda) + (timp_actual - (this -> timpul_ultimei_comenzi));
-                        
-                        else
-                            return (this -> temperatura_la_ultima_comanda) - (timp_actual - (this -> timpul_ultimei_comenzi));
-                    }
+    // Defining the httpEndpoint and a router.
+    std::shared_ptr<Http::Endpoint> httpEndpoint;
+    Rest::Router router;
+};
 
-                }
+// Gateway mode: views of a whole fleet of ovens, each one a cupthor with its rpc port on. This process has no oven
+// of its own.
+class GatewayEndpoint {
+public:
+    explicit GatewayEndpoint(Address addr)
+        : httpEndpoint(std::make_shared<Http::Endpoint>(addr))
+    { }
 
-            private:
-                double valoare_dorita_stored;
-                double temperatura_la_ultima_comanda;
-                double timpul_ultimei_comenzi;
+    void init(const ServerConfig& config) {
+        if (!fleet.configure(config.gateway))
+            throw std::runtime_error("bad gateway backends");
+        max_pending_jobs = config.max_pending_jobs;
+        // A view can wait for the ovens up to the deadline, it does so on the executor and not on a Pistache worker
+        executor.start(config.executor_threads > 0 ? config.executor_threads : hardware_concurrency(), max_pending_jobs);
+        httpEndpoint->init(endpoint_options(config));
+        setupRoutes();
+    }
 
-        }thermostat_cupthor;
+    void start() {
+        httpEndpoint->setHandler(router.handler());
+        httpEndpoint->serveThreaded();
+    }
 
-        //Simulare camera cupthor
-        class Camera{
-            public:
-                Camera(){
+    void stop() {
+        httpEndpoint->shutdown();
+        executor.stop();
+        FleetGateway::Stats stats = fleet.stats();
+        std::cout << "Gateway: " << stats.rounds << " rounds, " << stats.cache_hits << " cached states, "
+                  << stats.timeouts << " timeouts" << std::endl;
+    }
 
-                }
+private:
+    void setupRoutes() {
+        using namespace Rest;
+        Routes::Get(router, "/ready", Routes::bind(&Generic::handleReady));
+        Routes::Get(router, "/fleet/state", Routes::bind(&GatewayEndpoint::getFleetState, this));
+        Routes::Get(router, "/fleet/alarms", Routes::bind(&GatewayEndpoint::getFleetAlarms, this));
+    }
 
-                std::string get_feed(){
-                        
-                        struct pixel{
-                                unsigned char r;
-                                unsigned char g;
-                                unsigned char b;
-                            };
-
-                        struct{
-                            std::vector<unsigned char> header;
-                            std::vector<pixel> pixeli;
-                        }imagine;
-
-                        std::ifstream input("./CameraFakeInput/peppers.bmp", std::ios::binary);
-                        std::ofstream output("./OutputCamera/picture.bmp", std::ios::binary);
-                        
-                        std::vector<unsigned char> buffer (std::istreambuf_iterator<char>(input), {});
-                        
-                        //simulez output-uri diferite
-
-                        int variante = rand()%11;
-
-                        if (variante != 0)
-                        {
-                            //hardcodat pentru imaginea noastra
-                            int trio = 0;
-                            pixel pixi;
-                            for (int i = 0 ; i<= buffer.size(); i++)
-                            {   
-                                if (i <= 54)
-                                    imagine.header.push_back(buffer[i]);
-                                
-                                else if (trio == 0)
-                                {
-                                    pixi.b = buffer[i];
-                                    trio++;
-                                }
-                                else if (trio == 1)
-                                {
-                                    pixi.g = buffer[i];
-                                    trio++;
-                                }
-                                else if (trio == 2)
-                                {
-                                    pixi.r = buffer[i];
-                                    trio = 0;
-
-                                    pixel aux;
-                                    aux.r = pixi.r;
-                                    aux.g = pixi.g;
-                                    aux.b = pixi.b;
-
-                                    imagine.pixeli.push_back(aux);
-                                }
-
-                            }
-
-                            for (int i=0; i<= imagine.header.size(); i++)
-                            {
-                                output << imagine.header[i];
-                            }
-
-                            for (int i=0; i<= imagine.pixeli.size(); i++)
-                            {
-                                if (variante == 1){
-                                output << imagine.pixeli[i].g;
-                                output << imagine.pixeli[i].g;
-                                output << imagine.pixeli[i].b;
-                                }
-                                else if (variante == 2){
-                                output << imagine.pixeli[i].r;
-                                output << imagine.pixeli[i].g;
-                                output << imagine.pixeli[i].g;
-                                }
-
-                                else if (variante == 3){
-                                output << imagine.pixeli[i].g;
-                                output << imagine.pixeli[i].g;
-                                output << imagine.pixeli[i].g;
-                                }
-
-                                else if (variante == 4){
-                                output << imagine.pixeli[i].r;
-                                output << imagine.pixeli[i].g;
-                                output << imagine.pixeli[i].b;
-                                }
-
-                                else if (variante == 5){
-                                output << imagine.pixeli[i].r;
-                                output << imagine.pixeli[i].r;
-                                output << imagine.pixeli[i].b;
-                                }
-
-                                else if (variante == 6){
-                                output << imagine.pixeli[i].r;
-                                output << imagine.pixeli[i].r;
-                                output << imagine.pixeli[i].r;
-                                }
-
-                                else if (variante == 7){
-                                output << imagine.pixeli[i].r;
-                                output << imagine.pixeli[i].g;
-                                output << imagine.pixeli[i].r;
-                                }
-
-                                else if (variante == 8){
-                                output << imagine.pixeli[i].b;
-                                output << imagine.pixeli[i].b;
-                                output << imagine.pixeli[i].b;
-                                }
-
-                                else if (variante == 9){
-                                output << imagine.pixeli[i].r;
-                                output << imagine.pixeli[i].b;
-                                output << imagine.pixeli[i].b;
-                                }
-
-                                else if (variante == 10){
-                                output << imagine.pixeli[i].b;
-                                output << imagine.pixeli[i].g;
-                                output << imagine.pixeli[i].b;
-                                }
-                            }
-                        }
-                        else
-                        {
-
-                        for (int i =0 ; i<= buffer.size() ; i++)
-                            {
-                                output << buffer[i];
-                            }
-                        }
-
-                        input.close();
-                        output.close();
-                    return "storing photo in folder";
-                        
+    // One line per oven, in the order of the gateway key
+    void getFleetState(const Rest::Request&, Http::ResponseWriter response) {
+        send_view(response, [this]() {
+            std::vector<OvenState> ovens = fleet.states();
+            size_t reachable = 0;
+            std::string lines;
+            for (const OvenState& oven : ovens) {
+                if (!oven.reachable) {
+                    lines += text({oven.backend, " reachable 0 error ", oven.error, "\n"});
+                    continue;
                 }
-
-        }camera;
-        // Simulare cantar
-        class Cantar{
-            public:
-
-            Cantar(){
-                this -> valoare_greutate = 0;
-            }
-
-            int get_valoare_greutate(){
-
-
-                unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-                std::default_random_engine generator (seed);
-
-                std::uniform_real_distribution<double> dist_unif (0.0,100.0);
-                std::normal_distribution<double> dist_normal(300,100);
-                double odd = dist_unif(generator);
-                double computed_weight = dist_normal(generator);
-
-                
-                if (odd >= 35){
-                    this -> valoare_greutate  = computed_weight;
-                }  
-                else
-                    return 0;
-                if( this -> valoare_greutate < 100 && this -> valoare_greutate!= 0)	
-                    this -> valoare_greutate  = 100;
-                else
-
-                if (this -> valoare_greutate > 800)
-                    this -> valoare_greutate  = 800;
-
-                return (int)valoare_greutate;
-
+                reachable++;
+                lines += text({oven.backend, " reachable 1 temperature ", std::to_string(static_cast<int>(oven.temperature)),
+                    " phase ", CupThor::cook_phase_name(oven.cook_phase),
+                    " remaining ", std::to_string(static_cast<int>(oven.phase_remaining))});
+                for (int setting = 0; setting < CupThor::SETTINGS; setting++)
+                    lines += text({" ", CupThor::setting_name(setting), " ", std::to_string(static_cast<int>(oven.settings[setting]))});
+                lines += text({" smoke ", oven.smoke ? "1" : "0", " water_jet ", oven.water_jet ? "1" : "0", "\n"});
             }
+            return text({"ovens ", std::to_string(ovens.size()), " reachable ", std::to_string(reachable), "\n", lines});
+        });
+    }
 
-            private:
-                double valoare_greutate;
-        }cantar_cupthor;
-
-
-        class Timer{
-            public:
-
-                Timer(){
-                    this -> time = 0;
-                    this -> name = "";
-                    this -> setted = 0;
-                    this -> pinter_aux_timer = &(this -> setted);
-                }
-
-                void set(int value, std::string name_timer){
-                    this -> name = name_timer;
-                    this -> time = value;
-                    
-                    if (this -> setted == 1){
-                        this -> setted = 0 ;
-                        std::this_thread::sleep_for(std::chrono::seconds(1));
-                        this -> setted = 1;
-                    }
-                    else
-                        this -> setted = 1;
-
-                    std::string path = "./Timers/" + this -> name + ".txt";
-                    std::ofstream output(path);
-                    output << "working";
-                    output.close();
-
-
-                    std::thread t(functie_aux, this -> time, this -> name, this -> pinter_aux_timer);
-
-
-                    t.detach();
-
-
-                }
-
-
-            private:
-
-                int *pinter_aux_timer;
-                int time;
-                int setted;
-                std::string name;
-
-                static void functie_aux(int time, std::string name, int *bikini){
-
-                    while (time > 0){
-                        std::this_thread::sleep_for(std::chrono::seconds(1));
-                        time = time - 1;
-                        if (*bikini == 0){
-                            std::string path = "./Timers/" + name + ".txt";
-                            std::ofstream output(path);
-                            output << "done";
-                            break;
-                            }
-                        
-                        if (time <= 0)
-                            {
-                                std::string path = "./Timers/" + name + ".txt";
-                                std::ofstream output(path);
-                                output << "done";
-                            }
-                    }
-
-                }
-        };
-
-
-        //TODO  TREBUIE APELATA SI IN CONSTRUCTORUL CUP-THORULUI CU alaram.set_alarm()
-        //senzorii importanti ar fi temperatura si senzorul de fum
-        class Alarma{
-            public:
-                void set_alarm(){
-                    std::thread t(functie_aux);
-                    t.detach();
-                }
-
-            private:
-                static void functie_aux(){
-                    std::this_thread::sleep_for(std::chrono::seconds(1));
-                    std::string path = "./Alarm/firealarm.txt";
-                    std::ofstream output(path);
-
-                    while (true){
-                        int senzor = 0;
-                        int dummy_utilitati = 1;
-
-                        if (senzor == 1)
-                            output << "The alarm has been triggerd";
-                            dummy_utilitati = 0;
-                            break;
-                    }
-                    
-                    output.close();
-                    //ceva gen exit(0) gen iesire fortata sa se inchida
-                }
-        }alarm;
-
-
-        //TODO Asta ar trebui apelat la alarma sa se vada statusul
-        //Ar fi frumos sa-i faceti path-ul pt get ca la ceilalti senzori
-        class SenzorFum{
-            public:
-                bool get_status_senzor(){
-                    bool sansa;
-                    int nr = rand() % 1000;
-                    if(nr == 0)
-                        sansa = 1;
-                    else
-                        sansa = 0;
-                    sansa = 0 ; //Pentru motive didactice
-                    return sansa;
-                }
-        }senzor_fum;
-
-        // Defining and instantiating settings.
-        struct boolSetting{
-            std::string name;
-            bool value;
-        }defrost;
-
-
-        struct temperatureSetting{
-            std::string name;
-            double value;
-        }desired_temperature;
-
-
-        struct ambient_lightSetting{
-            std::string name;
-            bool value;
-        }ambient_light;
-
-
-        struct ventilationSetting{
-            std::string name;
-            int value;
-        }ventilation;
-
-
-        struct silent_modeSetting{
-            std::string name;
-            bool value;
-        }silent_mode;
-
-
-        struct water_jet{
-            std::string name;
-            bool value;
-        }water;
-
-        Timer cooking_timer;
-    };
+    void getFleetAlarms(const Rest::Request&, Http::ResponseWriter response) {
+        send_view(response, [this]() {
+            std::vector<FleetAlarm> alarms = fleet.alarms();
+            std::string body = text({"alarms ", std::to_string(alarms.size()), "\n"});
+            for (const FleetAlarm& alarm : alarms)
+                body += text({alarm.backend, " ", alarm.kind, alarm.detail.empty() ? "" : " ", alarm.detail, "\n"});
+            return body;
+        });
+    }
 
-    // Create the lock which prevents concurrent editing of the same variable
-    using Lock = std::mutex;
-    using Guard = std::lock_guard<Lock>;
-    Lock cupthorLock;
+    // Builds the view on the executor and sends it from there
+    template<typename View>
+    void send_view(Http::ResponseWriter& response, View view) {
+        if (executor.pending() >= max_pending_jobs) {
+            response.headers().addRaw(Http::Header::Raw("Retry-After", "1"));
+            response.send(Http::Code::Service_Unavailable, "Server is busy, try again later");
+            return;
+        }
+        auto writer = std::make_shared<Http::ResponseWriter>(std::move(response));
+        run_async(executor, view).then([writer](std::string body) {
+            using namespace Http;
+            writer->headers()
+                        .add<Header::Server>("pistache/0.1")
+                        .add<Header::ContentType>(MIME(Text, Plain));
+            writer->send(Http::Code::Ok, body);
+        }, [writer](std::exception_ptr&) {
+            writer->send(Http::Code::Internal_Server_Error, "The fleet view failed");
+        });
+    }
 
-    // Instance of the Oven model
-    CupThor cth;
+    FleetGateway fleet;
+    WorkStealingExecutor executor;
+    size_t max_pending_jobs = 64;
 
-    // Defining the httpEndpoint and a router.
     std::shared_ptr<Http::Endpoint> httpEndpoint;
     Rest::Router router;
 };
@@ -1230,29 +1273,59 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    // Set a port on which your server to communicate
-    Port port(9080);
-
-    // Number of threads used by the server
-    int thr = 2;
+    // Port, number of threads and the rest of the endpoint tuning
+    ServerConfig config;
+    if (!config.parse_args(argc, argv))
+        return 1;
+    if (config.keep_warm_low > config.keep_warm_high) {
+        std::cerr << "keep_warm_low must not be above keep_warm_high" << std::endl;
+        return 1;
+    }
 
-    if (argc >= 2) {
-        port = static_cast<uint16_t>(std::stol(argv[1]));
+    // Pick the seed here rather than in the oven, so that it shows up in the log and the run can be repeated
+    if (config.seed == 0)
+        config.seed = Rng::random_seed();
 
-        if (argc == 3)
-            thr = std::stoi(argv[2]);
-    }
+    // Set a port on which your server to communicate
+    Port port(config.port);
 
     Address addr(Ipv4::any(), port);
 
-    cout << "Cores = " << hardware_concurrency() << endl;
-    cout << "Using " << thr << " threads" << endl;
+    config.print(cout);
+
+    if (!config.gateway.backends.empty()) {
+        GatewayEndpoint gateway(addr);
+        gateway.init(config);
+        gateway.start();
+
+        int signal = 0;
+        if (sigwait(&signals, &signal) == 0)
+            std::cout << "received signal " << signal << std::endl;
+        gateway.stop();
+        return 0;
+    }
 
     // Instance of the class that defines what the server can do.
-    CupThorEndpoint stats(addr);
+    std::shared_ptr<Clock> clock = Clock::real();
+    if (config.time_warp != 1)
+        clock = std::make_shared<WarpClock>(config.time_warp);
+    CupThorEndpoint stats(addr, clock, config.seed);
+
+    // Load the last known state of the oven before accepting any request
+    StateStore store;
+    if (config.state_dir != "none") {
+        auto recovery_start = std::chrono::steady_clock::now();
+        StateStore::State state;
+        if (!store.open(config.state_dir, config.wal_commit_interval_ms, config.snapshot_every) || !store.recover(state))
+            return 1;
+        stats.restore(store, state);
+        store.start();
+        auto recovery_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - recovery_start).count();
+        cout << "State recovered in " << recovery_us / 1000.0 << " ms" << endl;
+    }
 
     // Initialize and start the server
-    stats.init(thr);
+    stats.init(config);
     stats.start();
 
 
@@ -1269,4 +1342,5 @@ int main(int argc, char *argv[]) {
     }
 
     stats.stop();
+    store.close();
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+
+// Session tokens for the routes that change the oven. A client shows the shared key (auth_key) to /auth once and
+// gets a token back; from then on it sends the token with every POST, as "Authorization: Bearer <token>" or as the
+// session cookie /auth sets.
+//
+// Token: <session id, 16 hex digits>.<expiry, unix seconds>.<HMAC-SHA256 of the first two parts, 64 hex digits>
+//
+// The server keeps no sessions, the signature is the proof. Checking it costs an HMAC, so the tokens already
+// checked are kept in a cache: a token seen before costs one hash and one lookup. The cache is split in shards,
+// each with its own lock and its own LRU list, so the request threads don't all wait on one lock.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class TokenAuthority {
+public:
+    struct Options {
+        // What clients show to /auth. Empty turns authentication off: every route is open, as before.
+        std::string key = "";
+        // HMAC key of the tokens, 64 hex digits. Empty picks a random one, tokens then don't survive a restart and
+        // aren't valid on the other processes of a reuse_port group.
+        std::string signing_key = "";
+        // How long a token is valid
+        int token_ttl_s = 3600;
+        // Tokens kept in the cache of checked tokens, over all shards
+        size_t cache_entries = 4096;
+    };
+
+    enum Result { VALID = 0, MISSING, MALFORMED, BAD_SIGNATURE, EXPIRED };
+
+    struct Stats {
+        uint64_t issued = 0;
+        uint64_t cache_hits = 0;
+        // Signatures checked (cache misses)
+        uint64_t signatures = 0;
+        uint64_t rejected = 0;
+    };
+
+    static const int SHARDS = 16;
+
+    TokenAuthority() { }
+
+    TokenAuthority(const TokenAuthority&) = delete;
+    TokenAuthority& operator=(const TokenAuthority&) = delete;
+
+    // False if the signing key isn't 64 hex digits or no random key could be made. Not thread safe, call before
+    // the server starts.
+    bool configure(const Options& options);
+
+    bool enabled() const {
+        return !options.key.empty();
+    }
+
+    // Whether what the client showed is the shared key. Takes the same time whatever the mismatch.
+    bool check_key(const std::string& presented) const;
+
+    // A new token, valid token_ttl_s from now_s (unix seconds)
+    std::string issue(int64_t now_s);
+
+    // Thread safe
+    Result verify(const std::string& token, int64_t now_s);
+
+    Stats stats() const;
+
+    static const char* result_name(int result);
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::string token;
+        int64_t expires;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex lock;
+        // Most recently used first
+        std::list<Entry> entries;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> by_hash;
+    };
+
+    std::string sign(const char* data, size_t size) const;
+
+    Options options;
+    unsigned char signing_key[32] = {};
+    size_t shard_capacity = 256;
+    Shard shards[SHARDS];
+
+    std::atomic<uint64_t> issued{0};
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> signatures{0};
+    std::atomic<uint64_t> rejected{0};
+};
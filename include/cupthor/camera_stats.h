@@ -0,0 +1,51 @@
+#pragma once
+
+// Numbers computed from a camera picture that say how far the food has got, cheap enough for every frame: the
+// mean color, a browning index and a histogram per channel. The camera computes them for its latest picture
+// the first time they're asked for and keeps them until the next picture (Camera::get_stats).
+//
+// The sums run over whole rows in blocks of 16 pixels, which the compiler turns into vector adds; the
+// histograms count every value in two copies, so that neighbouring pixels don't wait on the same counter.
+
+#include <cstdint>
+
+#include "cupthor/image_encoder.h"
+
+struct CameraStatsOptions {
+    // Part of the picture looked at, in pixels from the top left corner. A width or height of 0 means up to the
+    // edge; the region is clipped to the picture.
+    int roi_x = 0;
+    int roi_y = 0;
+    int roi_width = 0;
+    int roi_height = 0;
+    // Only every step-th pixel of every step-th row is looked at, 1 = all of them
+    int step = 1;
+};
+
+struct CameraStats {
+    static const int BINS = 32;
+
+    // Number of the picture these are from (Camera counts its pictures from 1)
+    uint64_t frame = 0;
+    // Pixels looked at
+    uint64_t pixels = 0;
+
+    // Mean of every channel, 0..255
+    double mean_r = 0;
+    double mean_g = 0;
+    double mean_b = 0;
+
+    // Browning index of the mean color, computed in CIE L*a*b*: x = (a* + 1.75 L*) / (5.645 L* + a* - 3.012 b*),
+    // BI = 100 (x - 0.31) / 0.17. Around 0 for white or grey, it grows as the food turns yellow-brown.
+    double browning = 0;
+
+    // Pixels per channel value, BINS bins of 256 / BINS values each
+    uint32_t histogram_r[BINS] = {};
+    uint32_t histogram_g[BINS] = {};
+    uint32_t histogram_b[BINS] = {};
+};
+
+CameraStats analyze_frame(const ImageView& image, const CameraStatsOptions& options = CameraStatsOptions());
+
+// Browning index of a color, as in CameraStats
+double browning_index(double r, double g, double b);
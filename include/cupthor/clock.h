@@ -0,0 +1,66 @@
+#pragma once
+
+// Time source of the oven model. Everything that reads the time or sleeps (thermostat, timers, the cook state
+// machine) goes through a Clock, so a simulation can run on virtual time:
+//   RealClock    - the wall clock
+//   WarpClock    - the wall clock, running `factor` times faster
+//   VirtualClock - only moves when advance() is called; sleeping threads wake up when it gets past their deadline
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+class Clock {
+public:
+    virtual ~Clock() { }
+
+    // Milliseconds since the epoch
+    virtual int64_t now_ms() = 0;
+
+    virtual void sleep_for_ms(int64_t ms) = 0;
+
+    double now_seconds() {
+        return now_ms() / 1000.0;
+    }
+
+    // The process wide wall clock, what the oven uses unless it's given another one
+    static std::shared_ptr<Clock> real();
+};
+
+class RealClock : public Clock {
+public:
+    int64_t now_ms() override;
+    void sleep_for_ms(int64_t ms) override;
+};
+
+class WarpClock : public Clock {
+public:
+    explicit WarpClock(double factor);
+
+    int64_t now_ms() override;
+    void sleep_for_ms(int64_t ms) override;
+
+private:
+    double factor;
+    int64_t origin_ms;
+    std::chrono::steady_clock::time_point origin;
+};
+
+class VirtualClock : public Clock {
+public:
+    explicit VirtualClock(int64_t start_ms = 0);
+
+    int64_t now_ms() override;
+
+    // Blocks until another thread advances the clock far enough
+    void sleep_for_ms(int64_t ms) override;
+
+    void advance(int64_t ms);
+
+private:
+    std::mutex lock;
+    std::condition_variable moved;
+    int64_t now;
+};
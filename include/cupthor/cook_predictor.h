@@ -0,0 +1,73 @@
+#pragma once
+
+// Estimates when the food will be ready. The cooking phase has a known end (the cooking timer), so the
+// uncertain part is the preheat: how long the oven takes to get from its current temperature to the preset one.
+//
+// The predictor keeps, with O(1) work per sample and no per-sample allocation:
+//  - the heating rate seen during the current preheat, a running average from its first sample;
+//  - a heating rate learned from past preheats, used until the current one has enough samples;
+//  - per preset, how long past cooks really took compared to what was predicted when they started, which
+//    scales the estimate for the next cook of that preset.
+//
+// Not thread safe, CupThor calls it under its lock.
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+class CookPredictor {
+public:
+    // Heating rate assumed before anything was measured, in degrees per second
+    explicit CookPredictor(double initial_heat_rate = 1.0);
+
+    // A cook of `preset` starts with the oven at `temperature`, heading for `target`, then cooking for cook_seconds
+    void start(const std::string& preset, double temperature, double target, int cook_seconds, int64_t now_ms);
+
+    // A temperature reading during the preheat, the control thread gives one every tick
+    void sample(double temperature, int64_t now_ms);
+
+    // End of preheat, the cooking timer starts
+    void preheat_done(int64_t now_ms);
+
+    // The food is ready
+    void finished(int64_t now_ms);
+
+    // The cook was cut short (safety cut-off), nothing is learned from it
+    void abort();
+
+    // Seconds of preheat left from `temperature`, learned rate, without the history correction
+    double preheat_seconds(double temperature, double target) const;
+
+    // Seconds until the food is ready while preheating. -1 if no cook was started.
+    int eta_preheat(double temperature, double target) const;
+
+    double heat_rate() const;
+
+    // Real duration / predicted duration of the past cooks of this preset, 1 if none
+    double correction(const std::string& preset) const;
+
+private:
+    struct History {
+        double ratio = 1;
+        int cooks = 0;
+    };
+
+    // How much every new measurement moves the learned values
+    static constexpr double LEARNING_RATE = 0.3;
+    // Seconds of preheat before its own rate is trusted over the learned one
+    static constexpr double MIN_SAMPLE_SECONDS = 2;
+
+    double learned_rate;
+    std::unordered_map<std::string, History> history;
+
+    // Current cook
+    History* current = nullptr;
+    int cook_seconds = 0;
+    int64_t start_ms = 0;
+    double predicted_total_s = 0;
+    bool preheating = false;
+    double first_temperature = 0;
+    int64_t first_sample_ms = -1;
+    double last_temperature = 0;
+    int64_t last_sample_ms = 0;
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+// Defining the class of the Oven. It should model the entire configuration of the Oven.
+//
+// CupThor isn't thread safe: the caller holds one lock around every call, except where a method says otherwise.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "cupthor/cook_predictor.h"
+#include "cupthor/devices.h"
+#include "cupthor/logger.h"
+#include "cupthor/settings_graph.h"
+#include "cupthor/shm_state.h"
+#include "cupthor/state_store.h"
+#include "cupthor/timelapse.h"
+
+class CupThor {
+public:
+    // Everything that reads the time goes through `clock`, the simulated sensors draw from streams of `seed`.
+    // A seed of 0 picks a random one.
+    explicit CupThor(std::shared_ptr<Clock> clock = Clock::real(), uint64_t seed = 0);
+    ~CupThor();
+
+    int set_media_player_command(const std::string& name);
+    int media_player_play_given_song(const std::string& name, const std::string& value);
+
+    // Same as media_player_play_given_song, for a song that was already validated with is_valid_song. A song
+    // decoded with decode_song goes in the playlist of the playback engine; 4 when the playlist is full.
+    int media_player_play_checked_song(const std::string& name, bool valid, std::shared_ptr<const Song> song = nullptr);
+
+    // Checks that the song is Base64. Doesn't touch the oven state, so it doesn't need the lock.
+    static bool is_valid_song(const std::string& value);
+
+    // Takes a picture. The camera has its own lock, the oven lock isn't needed.
+    std::string get_camera_feed();
+
+    // Takes a picture and appends it to image in the encoder's format (Camera::get_feed)
+    bool get_camera_image(const ImageEncoder& encoder, std::string& image, WorkStealingExecutor* executor = nullptr);
+
+    // Mean color, browning index and histograms of the last picture (Camera::get_stats). No oven lock needed.
+    bool get_camera_stats(CameraStats& stats);
+    void configure_camera_stats(const CameraStatsOptions& options);
+
+    // The settings, in the order the binary protocol numbers them
+    enum Setting { DEFROST = 0, DESIRED_TEMPERATURE, AMBIENT_LIGHT, VENTILATION, SILENT_MODE, SETTINGS };
+
+    // Nodes of the settings graph after the settings: device states the settings drive (1 playing, 0 stopped)
+    enum Node { MEDIA_PLAYING = SETTINGS, NODES };
+
+    // Setting the value for one of the settings. Hardcoded for the defrosting option
+    int set_setting(const std::string& name, const std::string& value);
+
+    // Same result codes as the string version, for callers that already have the value as a number. The on/off
+    // settings take 1 and 0.
+    int set_setting(Setting setting, double value);
+    double get_setting_value(Setting setting);
+
+    // Called after every change of the settings (and of MEDIA_PLAYING) with the nodes that changed, the ones
+    // changed by a rule included. The callback runs under the oven lock and must not change settings.
+    int subscribe_settings(SettingsGraph::Subscriber subscriber);
+    void unsubscribe_settings(int id);
+
+    // -1 when there is no setting with this name
+    static int setting_from_name(const std::string& name);
+    static const char* setting_name(int setting);
+
+    double get_temperature();
+    // 4 while the safety cut-off is on
+    int set_cook(const std::string& name);
+    int set_cook_mode(const std::string& name, const std::string& value);
+    //SET-SENSOR - nu ar trebui implementat nimic aici
+    int set_sensor(const std::string& name, const std::string& value);
+
+    // Getter
+    std::string get_setting(const std::string& name);
+    std::string get_sensor(const std::string& name);
+
+    // The sensors that read as a number, in the order the binary protocol numbers them. Smoke and water jet are 1 or 0.
+    enum Sensor { THERMOSTAT = 0, FOOD_WEIGHT, SMOKE_SENSOR, WATER_JET, SENSORS };
+    double get_sensor_value(Sensor sensor);
+
+    bool get_cook_mode_status();
+    std::string get_what_is_cooking();
+    std::string get_media_player_status();
+
+    // Phases of a cook. The control thread moves a cook through them in this order; keep-warm is skipped
+    // when the cook was started without keep-food-warm.
+    enum CookPhase { IDLE = 0, PREHEAT, COOKING, KEEP_WARM, DONE };
+
+    static const char* cook_phase_name(int phase);
+
+    // Temperature band held after cooking and for how long
+    void configure_keep_warm(double low, double high, int duration_s);
+
+    // Browning index (CameraStats::browning) at which the food counts as done before its timer runs out. 0 leaves
+    // it to the timer.
+    void configure_browning_done(double browning);
+
+    // Starts the thread that drives the cook phases. lock is the one the request handlers take
+    // before touching the oven, the thread takes it for every transition. It ticks every 100 ms of the oven's
+    // clock, so on a VirtualClock stop_controller() returns once the clock is advanced past the next tick.
+    void start_controller(std::mutex& lock);
+    void stop_controller();
+
+    // Lock free, can be called without holding the oven lock
+    int get_cook_phase();
+
+    // Seconds left in the current phase, -1 when the phase has no fixed end (idle, preheat, done).
+    // Lock free as well.
+    int get_phase_remaining();
+
+    // Seconds until the food is ready (end of the cooking phase): preheat estimated from the thermal model and
+    // past cooks, then the cooking timer. 0 once cooked, -1 when nothing is cooking. Needs the lock.
+    int get_cook_eta();
+
+    // Every change made from now on is written to the store
+    void attach_store(StateStore* state_store);
+
+    // Logs whatever changed since the last call. Called after every mutation.
+    // Also publishes the new state to the shared memory segment, if there is one.
+    void persist();
+
+    // The state is published to this segment after every change and on every tick of the control thread
+    void attach_publisher(ShmStatePublisher* shm_publisher);
+    void publish();
+
+    // The media player plays its songs on this engine from now on, nullptr detaches it
+    void attach_playback(PlaybackEngine* engine);
+
+    // Cook phases and safety cut-offs are logged here from now on, nullptr detaches it. Set before the controller
+    // and the safety monitor are started, they read it without the lock.
+    void attach_logger(Logger* log);
+
+    // Every cook from now on is recorded: set_cook starts a session, the end of the cook ends it
+    void attach_timelapse(TimelapseRecorder* recorder);
+
+    // Session of the cook in progress or of the last one, 0 if none was recorded
+    uint64_t get_timelapse_session();
+
+    StateStore::State get_state();
+
+    // Puts back the state recovered after a restart. A timer that was still running is resumed with
+    // the time it had left.
+    void restore(const StateStore::State& state);
+
+    // One pass of the cook state machine, what the control thread runs every 100 ms.
+    // Returns true when something changed.
+    bool control_step();
+
+    // Why the safety cut-off is on
+    enum SafetyTrip { SAFE = 0, TRIP_SMOKE, TRIP_OVERHEAT };
+    static const char* safety_trip_name(int trip);
+
+    // Safety cut-off: heater off and water jet on, right away. Lock free, it's what the safety monitor calls from
+    // its own thread; the cook in progress is ended by the control thread on its next pass. The first reason stays.
+    void safety_trip(SafetyTrip reason);
+    // Lock free
+    int safety_tripped();
+
+    // Heater back on (towards the setpoint) and water jet off. Needs the lock.
+    void safety_reset();
+
+    // Lock free. Smoke is only there when it's let in, the simulated sensor doesn't make up fires.
+    bool smoke_detected();
+    void let_smoke_in(bool smoke);
+
+private:
+    // Declared before the devices, they're built from it
+    std::shared_ptr<Clock> clock;
+    uint64_t seed;
+
+    CookMode cookMode;
+    MediaPlayer media_player;
+    ThermostatCupThor thermostat_cupthor;
+    Camera camera;
+    Cantar cantar_cupthor;
+    Alarma alarm;
+    SenzorFum senzor_fum;
+
+    // The settings, indexed by Setting and Node, with the rules that keep them and the devices consistent.
+    // Declared after the devices, its rules drive them.
+    SettingsGraph settings;
+
+    // Turned on by the safety monitor without the lock
+    struct water_jet{
+        std::string name;
+        std::atomic<bool> value;
+    }water;
+
+    std::atomic<int> safety{SAFE};
+
+    Timer cooking_timer;
+
+    // Learns how long preheats and cooks really take, for get_cook_eta
+    CookPredictor predictor;
+
+    StateStore* store = nullptr;
+    ShmStatePublisher* publisher = nullptr;
+    TimelapseRecorder* timelapse = nullptr;
+    Logger* logger = nullptr;
+    uint64_t timelapse_session = 0;
+
+    // Called by set_cook once the preset values are in place. Cooking time only starts counting after preheat.
+    void start_cook(int time, std::string name);
+
+    // The cook is over (done, or keep-warm over): stops its timelapse
+    void finish_cook();
+
+    // Moves the cook to phase and logs it
+    void set_phase(int phase);
+
+    // Sets the temperature the heater goes towards, as the desired_temperature setting would
+    void heat_to(double valoare);
+
+    // What each setting does to the others and to the devices
+    void declare_rules();
+
+    void control_loop(std::mutex& lock);
+
+    // Whether a picture taken during this cook shows the food browned past browning_done
+    bool browned();
+
+    std::atomic<int> cook_phase{IDLE};
+    std::atomic<int64_t> phase_deadline_ms{0};
+    int cook_seconds = 0;
+
+    double keep_warm_low = 60;
+    double keep_warm_high = 75;
+    int keep_warm_duration_s = 1800;
+    double preheat_tolerance = 5;
+    double browning_done = 0;
+    // Number of the last picture taken before the cooking started, the ones up to it don't say anything about the food
+    uint64_t frame_before_cooking = 0;
+
+    std::thread controller;
+    std::atomic<bool> controller_running{false};
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+// The simulated devices of the oven. None of them is thread safe on its own (except the camera, which has
+// its own lock, and what the safety monitor reads: the thermostat and the smoke sensor), CupThor and the endpoint
+// lock take care of that.
+//
+// Devices that read the time take a Clock, devices that simulate noise take their own Rng stream.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "cupthor/camera_stats.h"
+#include "cupthor/clock.h"
+#include "cupthor/image_encoder.h"
+#include "cupthor/playback.h"
+#include "cupthor/pool.h"
+#include "cupthor/rng.h"
+
+class CookMode{
+    public:
+    CookMode();
+
+    bool get_status();
+    std::string get_what_is_cooking();
+    void set_status(bool value, std::string name);
+
+    private:
+    bool keep_food_warm;
+    std::string what_is_cooking;
+};
+
+class MediaPlayer{
+    public:
+        MediaPlayer();
+
+        bool get_status();
+        void set_status(bool pornit_sau_oprit);
+        bool play(std::string value);
+
+        // Puts a decoded song in the playlist of the engine. False when the playlist is full; true without an
+        // engine, there is nowhere to play it.
+        bool queue(std::shared_ptr<const Song> song);
+
+        // The engine plays while the status is on, from now on. nullptr detaches it.
+        void attach_engine(PlaybackEngine* playback);
+
+        // Checks that the song is Base64
+        static bool is_valid(const std::string& value);
+
+    private:
+
+        bool status;
+        PlaybackEngine* engine = nullptr;
+
+};
+
+class ThermostatCupThor{
+    public:
+
+        explicit ThermostatCupThor(std::shared_ptr<Clock> clock = Clock::real());
+
+        // Under the oven lock
+        void modifica_temperatura_la(double valoare_dorita);
+
+        // Lock free, from any thread
+        int get_temperatura();
+
+        // Safety cut-off: from now on the heater doesn't heat, whatever the setpoint, and the oven cools down.
+        // Lock free, called from the safety monitor's thread only.
+        void cut_heater();
+        bool heater_cut();
+
+        // Heater back on, towards the setpoint from the temperature the oven cooled down to. Under the oven lock.
+        void restore_heater();
+
+    private:
+        std::shared_ptr<Clock> clock;
+
+        // The ramp towards the setpoint. Written under the oven lock and read from any thread: a seqlock, the
+        // version is odd while it's being written.
+        std::atomic<uint32_t> version{0};
+        std::atomic<double> valoare_dorita_stored;
+        std::atomic<double> temperatura_la_ultima_comanda;
+        std::atomic<double> timpul_ultimei_comenzi;
+
+        // When the heater was cut (seconds, 0 = it heats) and the temperature then
+        std::atomic<double> cut_time{0};
+        std::atomic<double> cut_temperature{0};
+
+        void write_ramp(double de_la, double timp, double valoare_dorita);
+
+};
+
+//Simulare camera cupthor
+class Camera{
+    public:
+        explicit Camera(Rng rng = Rng(Rng::random_seed()));
+
+        // Takes a picture and stores it in OutputCamera/picture.bmp
+        std::string get_feed();
+
+        // Takes a picture the same way and also appends it to image in the encoder's format. The encoding runs
+        // outside the capture lock, on the executor when there is one. False if there was no picture.
+        bool get_feed(const ImageEncoder& encoder, std::string& image, WorkStealingExecutor* executor = nullptr);
+
+        // Stats of the last picture taken (camera_stats.h), computed the first time they're asked for and kept
+        // until the next picture. False if no picture was taken yet.
+        bool get_stats(CameraStats& stats);
+
+        void set_stats_options(const CameraStatsOptions& options);
+
+    private:
+        using Picture = std::shared_ptr<const FramePool::Buffer>;
+
+        // Captures from several threads would interleave in picture.bmp
+        std::mutex feed_lock;
+        Rng rng;
+
+        // The picture read and the pictures written, kept from one capture to the next. The last picture is held
+        // for the stats and the others while they're being encoded, so a few of them can be out at the same time.
+        FramePool frames{4};
+        Picture last_picture;
+        uint64_t picture_count = 0;
+
+        // Only one thread computes the stats of a picture, the others wait for them
+        std::mutex stats_lock;
+        CameraStatsOptions stats_options;
+        CameraStats stats;
+
+        // The BMP written to picture.bmp, empty if the input couldn't be read. It becomes the last picture.
+        Picture capture();
+
+};
+
+// Simulare cantar
+class Cantar{
+    public:
+
+    explicit Cantar(Rng rng = Rng(Rng::random_seed()));
+
+    int get_valoare_greutate();
+
+    private:
+        double valoare_greutate;
+        Rng rng;
+};
+
+class Timer{
+    public:
+
+        explicit Timer(std::shared_ptr<Clock> clock = Clock::real());
+
+        void set(int value, std::string name_timer);
+
+        // Restarts a timer that was running before a restart, with the time it still had left
+        void resume(int64_t deadline, std::string name_timer);
+
+        std::string get_name();
+
+        // Wall clock time (ms since epoch) when the timer goes off
+        int64_t get_deadline_ms();
+
+        int64_t now_ms();
+
+    private:
+
+        // Shared with the timer threads, so they outlive the Timer if the oven goes away first
+        std::shared_ptr<Clock> clock;
+        std::shared_ptr<std::atomic<int>> generation;
+        int time;
+        int setted;
+        int64_t deadline_ms = 0;
+        std::string name;
+
+};
+
+
+//TODO  TREBUIE APELATA SI IN CONSTRUCTORUL CUP-THORULUI CU alaram.set_alarm()
+//senzorii importanti ar fi temperatura si senzorul de fum
+class Alarma{
+    public:
+        void set_alarm();
+
+    private:
+        static void functie_aux();
+};
+
+
+//TODO Asta ar trebui apelat la alarma sa se vada statusul
+//Ar fi frumos sa-i faceti path-ul pt get ca la ceilalti senzori
+class SenzorFum{
+    public:
+        // Lock free
+        bool get_status_senzor();
+
+        // Lets smoke into the simulated oven (or clears it), for drills and tests
+        void set_smoke(bool value);
+
+    private:
+        std::atomic<bool> smoke{false};
+};
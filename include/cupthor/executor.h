@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread pool for the slow parts of the requests (camera capture, song validation) so they don't hold up the
+// Pistache I/O threads. Every worker has its own queue; an idle worker takes work from the back of its own queue
+// first and then steals from the front of the others', so a burst submitted to one queue still spreads out.
+// The endpoint wraps jobs in a Pistache promise with run_async (cupThor.cpp).
+//
+// The queues are rings of job slots allocated in start(); a ring only grows (and allocates) when a burst doesn't
+// fit, which allocator_stats() counts as queue_mallocs.
+class WorkStealingExecutor {
+public:
+    using Job = std::function<void()>;
+
+    WorkStealingExecutor() { }
+
+    ~WorkStealingExecutor() {
+        stop();
+    }
+
+    // queue_capacity job slots per worker to start with
+    void start(size_t threads, size_t queue_capacity = 64);
+
+    // Runs the jobs already queued, then joins the workers
+    void stop();
+
+    void submit(Job job);
+
+    // Calls body(0) .. body(count - 1) on the workers and the calling thread, returns when all of them are done.
+    // The caller takes indices too, so it may be a worker itself without waiting on its own queue.
+    void parallel_for(size_t count, const std::function<void(size_t)>& body);
+
+    // Jobs submitted and not yet started
+    size_t pending() const {
+        return queued.load();
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+private:
+    // Jobs from head to head + count, modulo the size of the ring
+    struct Worker {
+        std::mutex lock;
+        std::vector<Job> ring;
+        size_t head = 0;
+        size_t count = 0;
+
+        void push_back(Job&& job);
+        Job pop_back();
+        Job pop_front();
+    };
+
+    void worker_loop(size_t index);
+
+    bool take(size_t index, Job& job);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> pool;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> queued{0};
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    bool running = false;
+
+    // Index of the worker running on this thread, -1 on any other thread
+    static inline thread_local int current_worker = -1;
+};
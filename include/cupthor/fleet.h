@@ -0,0 +1,119 @@
+#pragma once
+
+// Gateway mode: one cupthor process in front of many ovens, each a cupthor of its own with its binary rpc port on
+// (rpc.h). The gateway keeps one connection open to every oven and serves views of the whole fleet.
+//
+// A view asks every oven whose cached state is older than the TTL, all of them at once: the request frames go out
+// on every connection, then a single poll() loop collects the replies until the deadline. An oven that hasn't
+// answered by then is shown unreachable for this view and its connection is closed (a late reply would get mixed
+// up with the next one); the next view connects again. A view that comes while another one is asking waits for it
+// and uses what it got, so a burst of dashboard requests costs one round trip per oven.
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cupthor/cupthor.h"
+
+struct OvenState {
+    std::string backend;
+    bool reachable = false;
+    // Why the oven isn't reachable: "connect", "timeout" or "closed"
+    std::string error;
+    // Steady clock time of the last reply, in ms; 0 if the oven never answered. An unreachable oven keeps the
+    // values of that reply.
+    int64_t fetched_ms = 0;
+
+    double temperature = 0;
+    int cook_phase = CupThor::IDLE;
+    double phase_remaining = -1;
+    double settings[CupThor::SETTINGS] = {};
+    bool smoke = false;
+    bool water_jet = false;
+};
+
+struct FleetAlarm {
+    std::string backend;
+    // "unreachable", "smoke", "water_jet" or "overheat"
+    std::string kind;
+    std::string detail;
+};
+
+class FleetGateway {
+public:
+    struct Options {
+        // "host:port" of the rpc listener of every oven, host as an IPv4 address
+        std::vector<std::string> backends;
+        // How long a view waits for the ovens
+        int deadline_ms = 200;
+        // How old a cached state may be and still be shown
+        int cache_ttl_ms = 500;
+        // A temperature above this is an alarm
+        double overheat_c = 250;
+    };
+
+    struct Stats {
+        uint64_t rounds = 0;
+        uint64_t cache_hits = 0;
+        uint64_t timeouts = 0;
+        uint64_t connects = 0;
+    };
+
+    FleetGateway() { }
+    ~FleetGateway();
+
+    FleetGateway(const FleetGateway&) = delete;
+    FleetGateway& operator=(const FleetGateway&) = delete;
+
+    // False if a backend isn't host:port
+    bool configure(const Options& options);
+
+    // State of every oven, in the order of the backends
+    std::vector<OvenState> states();
+
+    // What needs someone's attention, from the same states
+    std::vector<FleetAlarm> alarms();
+
+    Stats stats();
+
+    // "host:port" to its parts, false if it isn't one
+    static bool parse_backend(const std::string& text, std::string& host, uint16_t& port);
+
+private:
+    struct Backend {
+        std::string name;
+        std::string host;
+        uint16_t port = 0;
+        int fd = -1;
+        OvenState state;
+        // When the oven was last asked, answer or not, for the TTL
+        int64_t checked_ms = 0;
+
+        // This round: bytes still to send, reply received so far, and where the exchange is
+        enum Step { IDLE, CONNECTING, SENDING, RECEIVING, DONE };
+        Step step = IDLE;
+        std::string out;
+        size_t sent = 0;
+        std::string in;
+    };
+
+    Options options;
+    // One round at a time; the views that come during a round wait here and find it done
+    std::mutex lock;
+    std::vector<Backend> backends;
+    Stats counters;
+
+    // Asks the ovens whose state is stale. Called with lock held.
+    void refresh(int64_t now_ms);
+
+    // Starts the exchange with one oven, connecting first if needed
+    void begin(Backend& backend);
+    // Handles poll's events for it; moves it on to DONE or closes it
+    void advance(Backend& backend, short events);
+    void fail(Backend& backend, const char* error);
+    bool decode(Backend& backend);
+
+    // The commands of one state request, the same for every oven
+    static const std::string& request_frame();
+};
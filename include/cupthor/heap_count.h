@@ -0,0 +1,56 @@
+#pragma once
+
+// Replaces every global operator new and delete with malloc and free, counting each allocation into
+// AllocatorCounters::global().heap_allocations. The pool counters only see what the pools do; this sees everything
+// else too (std::string, std::to_string, shared_ptr control blocks ...), so a steady state with no allocations at
+// all shows up as a counter that stops moving. Replacement functions can only be defined once per program: include
+// this in exactly one source file (the server's main file, the benchmarks).
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "cupthor/pool.h"
+
+namespace heap_count {
+
+inline void* allocate(size_t size, size_t align) {
+    AllocatorCounters::global().heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0)
+        size = 1;
+    if (align <= alignof(std::max_align_t))
+        return std::malloc(size);
+    void* memory = nullptr;
+    return posix_memalign(&memory, align, size) == 0 ? memory : nullptr;
+}
+
+inline void* allocate_or_throw(size_t size, size_t align) {
+    if (void* memory = allocate(size, align))
+        return memory;
+    throw std::bad_alloc();
+}
+
+}
+
+void* operator new(size_t size) { return heap_count::allocate_or_throw(size, alignof(std::max_align_t)); }
+void* operator new[](size_t size) { return heap_count::allocate_or_throw(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t align) { return heap_count::allocate_or_throw(size, static_cast<size_t>(align)); }
+void* operator new[](size_t size, std::align_val_t align) { return heap_count::allocate_or_throw(size, static_cast<size_t>(align)); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return heap_count::allocate(size, alignof(std::max_align_t)); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return heap_count::allocate(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return heap_count::allocate(size, static_cast<size_t>(align)); }
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return heap_count::allocate(size, static_cast<size_t>(align)); }
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { std::free(memory); }
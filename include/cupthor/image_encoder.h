@@ -0,0 +1,105 @@
+#pragma once
+
+// Encoders for the camera pictures, the stage after the swizzle in Camera::get_feed:
+//   BmpEncoder   - image/bmp, the raw 24 bit picture as before
+//   QoiEncoder   - image/qoi, lossless and fast, smaller than the BMP by as much as the picture allows
+//   JpegEncoder  - image/jpeg, lossy (baseline, 4:2:0), quality 1..100
+//
+// The picture is cut into bands of 16 rows that are encoded independently, on the executor when one is given,
+// and put back together in order. The formats allow it: JPEG restarts its entropy coding at every band (restart
+// markers) and a QOI band starts from the real previous pixel with an empty index, which only costs a few index
+// hits at the start of each band. The output is a normal file for any decoder.
+//
+// ImageEncoders picks the encoder for an Accept header.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class WorkStealingExecutor;
+
+// A 24 bit picture, bytes in BMP order (blue, green, red). Row y starts at pixels + y * stride, the stride is
+// negative for the bottom-up rows of a BMP file.
+struct ImageView {
+    const unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    ptrdiff_t stride = 0;
+
+    const unsigned char* row(int y) const {
+        return pixels + y * stride;
+    }
+
+    // The pixels of a 24 bit uncompressed BMP file. False (and the view untouched) for anything else.
+    bool from_bmp(const unsigned char* file, size_t size);
+};
+
+class ImageEncoder {
+public:
+    virtual ~ImageEncoder() { }
+
+    virtual const char* mime() const = 0;
+
+    // Appends the encoded picture to out. Thread safe, the encoders have no state besides their settings.
+    virtual void encode(const ImageView& image, std::string& out, WorkStealingExecutor* executor = nullptr) const = 0;
+
+    // Rows encoded together, the unit of work handed to the executor
+    static const int BAND_ROWS = 16;
+};
+
+class BmpEncoder : public ImageEncoder {
+public:
+    const char* mime() const override {
+        return "image/bmp";
+    }
+
+    void encode(const ImageView& image, std::string& out, WorkStealingExecutor* executor = nullptr) const override;
+};
+
+class QoiEncoder : public ImageEncoder {
+public:
+    const char* mime() const override {
+        return "image/qoi";
+    }
+
+    void encode(const ImageView& image, std::string& out, WorkStealingExecutor* executor = nullptr) const override;
+};
+
+class JpegEncoder : public ImageEncoder {
+public:
+    explicit JpegEncoder(int quality = 80);
+
+    const char* mime() const override {
+        return "image/jpeg";
+    }
+
+    void encode(const ImageView& image, std::string& out, WorkStealingExecutor* executor = nullptr) const override;
+
+private:
+    int quality;
+    // Quantization tables in zigzag order, as they go in the file, and the factors the DCT output is multiplied
+    // by, in natural order
+    unsigned char luma_table[64];
+    unsigned char chroma_table[64];
+    float luma_scale[64];
+    float chroma_scale[64];
+
+    void encode_band(const ImageView& image, int band, std::string& out) const;
+};
+
+// One encoder of each kind, the JPEG one with the configured quality
+class ImageEncoders {
+public:
+    explicit ImageEncoders(int jpeg_quality = 80)
+        : jpeg(jpeg_quality)
+    { }
+
+    // The encoder for the preferred image type of an Accept header ("image/qoi, image/jpeg;q=0.8"), highest q
+    // first and in the client's order for equal q. image/* gets JPEG, the smallest. nullptr when the header
+    // doesn't ask for any image type we have (or for none at all, */* included).
+    const ImageEncoder* for_accept(const std::string& accept) const;
+
+    BmpEncoder bmp;
+    QoiEncoder qoi;
+    JpegEncoder jpeg;
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+// Structured log of what the server does: events with named fields, written to a file as JSON lines or in a
+// compact binary form (tools/logcat turns that into JSON lines).
+//
+// Same design as the request recorder: a thread that logs serializes the event into its own ring buffer (one
+// producer, the writer thread is the only consumer) and never touches the file or a lock, except for its very
+// first event. The writer thread drains the rings every 50 ms, formats the events and writes them out. When a
+// ring is full the event is dropped and counted, logging never blocks a request thread on I/O. When a thread exits
+// its ring is retired: the writer drains it one last time and frees it, so threads that come and go (one per rpc
+// connection) don't leave their rings behind.
+//
+// The file is rotated when it grows past max_bytes: path becomes path.1, path.1 becomes path.2 and so on, the
+// oldest of the `keep` files is deleted.
+//
+// Levels below CUPTHOR_LOG_LEVEL are compiled out (log<LOG_DEBUG>(...) is an empty function in a build with
+// -DCUPTHOR_LOG_LEVEL=1, the default). The level option filters at run time on top of that.
+//
+// Binary log, native byte order:
+//   header  "CTLG" u32 version
+//   event   u16 size u8 level u8 field count u32 thread u64 time (us since the epoch) u8 length, event name
+//   field   u8 length, name u8 type, value: i64 | f64 | u8 bool | u16 length, bytes
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef CUPTHOR_LOG_LEVEL
+#define CUPTHOR_LOG_LEVEL 1
+#endif
+
+enum LogLevel : uint8_t { LOG_DEBUG = 0, LOG_INFO, LOG_WARN, LOG_ERROR };
+
+// A named value of an event. Names and strings are copied when the event is logged, they only have to live
+// until then. Strings longer than 1 KB are cut.
+struct LogField {
+    enum Type : uint8_t { INT = 0, DOUBLE, BOOL, STRING };
+
+    LogField(const char* name, int value) : name(name), type(INT), i(value) { }
+    LogField(const char* name, long value) : name(name), type(INT), i(value) { }
+    LogField(const char* name, long long value) : name(name), type(INT), i(value) { }
+    LogField(const char* name, unsigned value) : name(name), type(INT), i(value) { }
+    LogField(const char* name, unsigned long value) : name(name), type(INT), i(static_cast<int64_t>(value)) { }
+    LogField(const char* name, unsigned long long value) : name(name), type(INT), i(static_cast<int64_t>(value)) { }
+    LogField(const char* name, double value) : name(name), type(DOUBLE), d(value) { }
+    LogField(const char* name, bool value) : name(name), type(BOOL), b(value) { }
+    LogField(const char* name, const char* value)
+        : name(name), type(STRING), s(value), length(value ? std::char_traits<char>::length(value) : 0) { }
+    LogField(const char* name, const std::string& value) : name(name), type(STRING), s(value.data()), length(value.size()) { }
+
+    const char* name;
+    Type type;
+    union {
+        int64_t i;
+        double d;
+        bool b;
+        const char* s;
+    };
+    size_t length = 0;
+};
+
+class Logger {
+public:
+    enum Format { JSON = 0, BINARY };
+
+    struct Options {
+        // "none" turns logging off
+        std::string path = "./cupthor.log";
+        Format format = JSON;
+        // Events below this level aren't logged
+        LogLevel level = LOG_INFO;
+        // Size a file is rotated at, and how many files are kept (the current one included)
+        size_t max_bytes = 64 * 1024 * 1024;
+        int keep = 4;
+        // Size of every thread's buffer
+        size_t ring_bytes = 256 * 1024;
+    };
+
+    static const uint32_t VERSION = 1;
+
+    Logger() { }
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // Opens the log (appending to it) and starts the writer thread
+    bool start(const Options& options);
+
+    // Writes out what is still buffered and closes the log
+    void stop();
+
+    bool enabled() const {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    // Called from any thread. Does nothing when the logger isn't started.
+    template <LogLevel level>
+    void log(const char* event, std::initializer_list<LogField> fields = {}) {
+        if (level >= CUPTHOR_LOG_LEVEL)
+            write(level, event, fields.begin(), fields.size());
+    }
+
+    void debug(const char* event, std::initializer_list<LogField> fields = {}) { log<LOG_DEBUG>(event, fields); }
+    void info(const char* event, std::initializer_list<LogField> fields = {}) { log<LOG_INFO>(event, fields); }
+    void warn(const char* event, std::initializer_list<LogField> fields = {}) { log<LOG_WARN>(event, fields); }
+    void error(const char* event, std::initializer_list<LogField> fields = {}) { log<LOG_ERROR>(event, fields); }
+
+    // For a number of fields only known at run time. No compile time filtering.
+    void write(LogLevel level, const char* event, const LogField* fields, size_t count);
+
+    // Events logged so far, summed over the threads
+    uint64_t logged();
+    uint64_t dropped() const { return drops.load(std::memory_order_relaxed); }
+
+    static const char* level_name(int level);
+
+    // -1 when there is no level with this name
+    static int level_from_name(const std::string& name);
+
+    // Writes a binary log out as JSON lines. An event cut short by a crash ends the log, it isn't an error.
+    static bool to_json(const std::string& path, std::FILE* out);
+
+private:
+    // Single producer / single consumer byte ring, as in the recorder. Shared by the logger and the thread, which
+    // sets retired when it exits; whichever lets go last frees it.
+    struct Ring {
+        Ring(size_t size, uint32_t thread) : data(size), thread(thread) { }
+        std::vector<char> data;
+        uint32_t thread;
+        // An event that wraps around the end of data is put together here first
+        std::vector<char> scratch;
+        alignas(64) std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> events{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        std::atomic<bool> retired{false};
+    };
+
+    Ring* ring_of_this_thread();
+    size_t drain(Ring& ring, std::vector<char>& out);
+    void writer_loop();
+
+    // Opens path for appending, with the binary header if it's a new binary log
+    bool open_file();
+    void rotate();
+
+    uint64_t id = 0;
+    Options options;
+    std::mutex rings_lock;
+    std::vector<std::shared_ptr<Ring>> rings;
+    // Guarded by rings_lock: number of the next thread, and the events of the rings already freed
+    uint32_t next_thread = 0;
+    uint64_t retired_events = 0;
+
+    std::FILE* file = nullptr;
+    size_t file_bytes = 0;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> drops{0};
+
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread writer;
+};
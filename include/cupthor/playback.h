@@ -0,0 +1,188 @@
+#pragma once
+
+// Playback of the songs sent to the media player. A song is Base64 decoded once, when it's uploaded (on the
+// executor, not under the oven lock), converted to the output format and kept in memory in the playlist.
+//
+// Two threads play it:
+//   decoder - takes the songs off the playlist and cuts them into blocks of samples, into a ring of blocks
+//   output  - takes one block off the ring every block duration, on the wall clock, and writes it to the sink
+// The ring is single producer / single consumer and lock free, the output thread never takes a lock, so the
+// sound doesn't depend on what the request threads are doing. The ring holds buffer_ms of sound; when the
+// output finds it empty in the middle of a song that's an underrun: a block of silence is written instead and
+// counted.
+//
+// Stopping (stop, or silent mode) is seen by the output thread before its next block, what's still in the ring
+// stays there and playing goes on from where it stopped.
+//
+// There is no MP3 decoder here. A song that is a WAV file (16 bit PCM) is played as such, any other bytes are
+// taken as 16 bit mono PCM at 44.1 kHz. The size of the decoded song depends on the sample rate the client wrote in
+// the WAV header: rates outside MIN..MAX_SONG_SAMPLE_RATE are refused, and so is a song that would take more than
+// max_song_bytes once decoded, before any memory is allocated for it.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct AudioFormat {
+    uint32_t sample_rate = 44100;
+    uint16_t channels = 2;
+};
+
+struct Song {
+    // Interleaved 16 bit samples in the format the engine plays
+    std::vector<int16_t> samples;
+    uint16_t channels = 2;
+
+    size_t frames() const {
+        return samples.size() / channels;
+    }
+};
+
+// Strict Base64 (the same strings MediaPlayer::is_valid accepts). False, with out left partly written, otherwise.
+bool base64_decode(const std::string& text, std::string& out);
+
+const uint32_t MIN_SONG_SAMPLE_RATE = 8000;
+const uint32_t MAX_SONG_SAMPLE_RATE = 192000;
+
+// Why decode_song gave no song
+enum SongError { SONG_DECODED = 0, SONG_NO_SOUND, SONG_BAD_RATE, SONG_TOO_LARGE };
+
+// Decodes an uploaded song into format. nullptr if it isn't Base64, has no sound in it, is a WAV at a sample rate
+// outside MIN..MAX_SONG_SAMPLE_RATE or would take more than max_bytes decoded; error (when given) says which.
+std::shared_ptr<const Song> decode_song(const std::string& base64, const AudioFormat& format, size_t max_bytes = SIZE_MAX,
+                                        int* error = nullptr);
+
+// Where the blocks go. write is only called from the output thread.
+class AudioSink {
+public:
+    virtual ~AudioSink() { }
+
+    virtual bool open(const AudioFormat& format) = 0;
+    virtual void write(const int16_t* samples, size_t count) = 0;
+    virtual void close() = 0;
+};
+
+// Throws the sound away, for the machines without a sound card
+class NullSink : public AudioSink {
+public:
+    bool open(const AudioFormat&) override { return true; }
+    void write(const int16_t*, size_t) override { }
+    void close() override { }
+};
+
+// Writes everything that is played into a WAV file, the sizes in its header are filled in by close
+class WavSink : public AudioSink {
+public:
+    explicit WavSink(const std::string& path) : path(path) { }
+    ~WavSink();
+
+    bool open(const AudioFormat& format) override;
+    void write(const int16_t* samples, size_t count) override;
+    void close() override;
+
+private:
+    std::string path;
+    std::FILE* file = nullptr;
+    uint64_t data_bytes = 0;
+};
+
+class PlaybackEngine {
+public:
+    struct Options {
+        AudioFormat format;
+        // Frames in a block, the unit the output thread plays and stop is seen at
+        uint32_t block_frames = 512;
+        // Sound decoded ahead of the output
+        uint32_t buffer_ms = 500;
+        // Songs waiting in the playlist, the song being played not included
+        size_t max_queue = 16;
+        // Largest song once decoded, in bytes of samples
+        size_t max_song_bytes = 64 * 1024 * 1024;
+    };
+
+    struct Stats {
+        bool playing = false;
+        size_t queued = 0;
+        uint32_t buffered_ms = 0;
+        uint64_t songs_played = 0;
+        uint64_t blocks_played = 0;
+        // Blocks of silence written because the ring was empty in the middle of a song
+        uint64_t underruns = 0;
+    };
+
+    PlaybackEngine() { }
+    ~PlaybackEngine() {
+        stop();
+    }
+
+    PlaybackEngine(const PlaybackEngine&) = delete;
+    PlaybackEngine& operator=(const PlaybackEngine&) = delete;
+
+    // Opens the sink and starts both threads, stopped (set_playing starts the sound)
+    bool start(const Options& options, std::unique_ptr<AudioSink> sink);
+    void stop();
+
+    bool enabled() const {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    const AudioFormat& format() const {
+        return options.format;
+    }
+
+    size_t max_song_bytes() const {
+        return options.max_song_bytes;
+    }
+
+    // Adds a song at the end of the playlist. False when the playlist is full.
+    bool enqueue(std::shared_ptr<const Song> song);
+
+    // Lock free, the output thread sees it before its next block
+    void set_playing(bool playing);
+
+    Stats stats();
+
+private:
+    // What the ring holds besides the samples
+    struct Block {
+        uint32_t frames = 0;
+        // Last block of its song
+        bool last = false;
+    };
+
+    Options options;
+    std::unique_ptr<AudioSink> sink;
+    size_t block_samples = 0;
+
+    // Single producer (decoder) / single consumer (output) ring of blocks. head and tail only grow, the slot is
+    // taken modulo the number of blocks.
+    std::vector<Block> blocks;
+    std::vector<int16_t> samples;
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+
+    std::atomic<bool> running{false};
+    std::atomic<bool> playing{false};
+    // Set by the decoder while it has a song that isn't all in the ring yet: an empty ring is then an underrun
+    std::atomic<bool> decoding{false};
+
+    std::mutex playlist_lock;
+    std::deque<std::shared_ptr<const Song>> playlist;
+
+    std::atomic<uint64_t> songs_played{0};
+    std::atomic<uint64_t> blocks_played{0};
+    std::atomic<uint64_t> underruns{0};
+
+    std::thread decoder;
+    std::thread output;
+
+    void decode_loop();
+    void output_loop();
+};
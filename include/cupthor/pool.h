@@ -0,0 +1,174 @@
+#pragma once
+
+// Preallocated storage for the data that lives exactly as long as something else:
+//   Arena         - bump allocation for everything a request builds, dropped all at once when the request ends
+//   FramePool     - camera frames, reused from one capture to the next
+//   FixedPool<T>  - a fixed number of records (running timers), taken and given back
+//
+// They all keep the memory they got once, so after warming up they stop calling malloc. allocator_stats() adds
+// up what every one of them did in the process; the counters of the `*_mallocs` kind should stop moving under a
+// steady load. heap_allocations counts every operator new of the process, in programs that include heap_count.h.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct AllocatorStats {
+    // Arenas: chunks taken from malloc, bytes handed out, resets
+    uint64_t arena_mallocs = 0;
+    uint64_t arena_bytes = 0;
+    uint64_t arena_resets = 0;
+    // Frame pools: frames handed out, and new frames or frames that had to grow
+    uint64_t frame_acquires = 0;
+    uint64_t frame_mallocs = 0;
+    // Fixed pools: records handed out, and requests refused because the pool was empty
+    uint64_t record_acquires = 0;
+    uint64_t record_exhausted = 0;
+    // Job queues of the executor that had to grow
+    uint64_t queue_mallocs = 0;
+    // Every operator new of the process, pools or not (heap_count.h). 0 in programs that don't count them.
+    uint64_t heap_allocations = 0;
+};
+
+// Process wide totals of all the pools
+AllocatorStats allocator_stats();
+
+// Counters behind allocator_stats(), for the pools to add to
+struct AllocatorCounters {
+    std::atomic<uint64_t> arena_mallocs{0};
+    std::atomic<uint64_t> arena_bytes{0};
+    std::atomic<uint64_t> arena_resets{0};
+    std::atomic<uint64_t> frame_acquires{0};
+    std::atomic<uint64_t> frame_mallocs{0};
+    std::atomic<uint64_t> record_acquires{0};
+    std::atomic<uint64_t> record_exhausted{0};
+    std::atomic<uint64_t> queue_mallocs{0};
+    std::atomic<uint64_t> heap_allocations{0};
+
+    static AllocatorCounters& global();
+};
+
+// One thread at a time. Memory comes in chunks of chunk_size (bigger for a single bigger allocation); reset()
+// makes all of it available again without giving it back.
+class Arena {
+public:
+    explicit Arena(size_t chunk_size = 16 * 1024)
+        : chunk_size(chunk_size)
+    { }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    void reset();
+
+    // Copies the pieces one after the other, the view is valid until the next reset
+    std::string_view concat(std::initializer_list<std::string_view> parts);
+
+    // Bytes handed out since the last reset
+    size_t used() const {
+        return used_bytes;
+    }
+
+    // Bytes taken from malloc, kept across resets
+    size_t capacity() const;
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> memory;
+        size_t size;
+    };
+
+    size_t chunk_size;
+    std::vector<Chunk> chunks;
+    // Chunk being filled and how far
+    size_t current = 0;
+    size_t offset = 0;
+    size_t used_bytes = 0;
+};
+
+// Byte buffers for camera frames. A frame goes back to the pool when its handle is dropped, with its capacity,
+// so the next capture of the same size doesn't allocate. Thread safe.
+class FramePool {
+public:
+    using Buffer = std::vector<unsigned char>;
+
+    struct Release {
+        FramePool* pool;
+        void operator()(Buffer* buffer) const {
+            pool -> release(buffer);
+        }
+    };
+    using Frame = std::unique_ptr<Buffer, Release>;
+
+    // At most max_free frames are kept while nobody uses them, the others are freed
+    explicit FramePool(size_t max_free = 4)
+        : max_free(max_free)
+    {
+        free_list.reserve(max_free);
+    }
+
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // A frame of `size` bytes, contents undefined
+    Frame acquire(size_t size);
+
+    size_t free_frames();
+
+private:
+    std::mutex lock;
+    std::vector<Buffer*> free_list;
+    size_t max_free;
+
+    void release(Buffer* buffer);
+};
+
+// N records of type T, built once. acquire() returns nullptr when all of them are taken. Thread safe.
+template<typename T, size_t N>
+class FixedPool {
+public:
+    FixedPool() {
+        for (size_t i = 0; i < N; i++)
+            free_list[i] = &records[N - 1 - i];
+        free_count = N;
+    }
+
+    FixedPool(const FixedPool&) = delete;
+    FixedPool& operator=(const FixedPool&) = delete;
+
+    T* acquire() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (free_count == 0) {
+            AllocatorCounters::global().record_exhausted.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        AllocatorCounters::global().record_acquires.fetch_add(1, std::memory_order_relaxed);
+        return free_list[--free_count];
+    }
+
+    void release(T* record) {
+        std::lock_guard<std::mutex> guard(lock);
+        free_list[free_count++] = record;
+    }
+
+    size_t available() {
+        std::lock_guard<std::mutex> guard(lock);
+        return free_count;
+    }
+
+private:
+    std::mutex lock;
+    T records[N];
+    T* free_list[N];
+    size_t free_count;
+};
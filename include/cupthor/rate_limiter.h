@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Token buckets per (client address, route class). A bucket fills up with `rate` tokens per second up to `burst`,
+// every request takes one. The table is split in shards with their own lock, so clients only contend when they
+// hash to the same shard, and it's never touched by the cheap routes.
+class RateLimiter {
+public:
+    // Routes that are expensive enough to be limited. Cheap routes aren't classified at all.
+    enum RouteClass { CAMERA = 0, MEDIA = 1, ROUTE_CLASSES = 2 };
+
+    RateLimiter() {
+        for (int i = 0; i < ROUTE_CLASSES; i++)
+            configure(static_cast<RouteClass>(i), 5, 10);
+    }
+
+    // rate 0 turns the limit off for that class
+    void configure(RouteClass route, double rate, double burst) {
+        limits[route].rate = rate;
+        limits[route].burst = burst < 1 ? 1 : burst;
+    }
+
+    // Takes a token from the bucket of this client. False means the client is over its limit.
+    bool allow(const std::string& client, RouteClass route);
+
+private:
+    static const size_t SHARDS = 64;
+    static const size_t MAX_BUCKETS_PER_SHARD = 4096;
+
+    struct Limit {
+        double rate = 0;
+        double burst = 1;
+    };
+
+    struct Bucket {
+        double tokens;
+        std::chrono::steady_clock::time_point last;
+    };
+
+    struct Shard {
+        std::mutex lock;
+        std::unordered_map<std::string, Bucket> buckets;
+    };
+
+    // A bucket that has been idle for a minute is full again anyway, dropping it changes nothing
+    static void evict_idle(Shard& shard, std::chrono::steady_clock::time_point now);
+
+    // When more new clients than the cap show up within a minute: drops the count least recently used buckets, a
+    // batch at a time so that the scan is paid once per batch and not for every new client. Those clients start
+    // again with a full bucket.
+    static void evict_oldest(Shard& shard, size_t count);
+
+    Limit limits[ROUTE_CLASSES];
+    Shard shards[SHARDS];
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+// Records the requests the endpoint gets into a compact binary log, so that a day of real traffic can be
+// replayed against another build (tools/replay.cpp).
+//
+// The request threads never lock or touch the file: each one serializes its records into its own ring buffer
+// (one producer, the writer thread is the only consumer) and a background thread drains the rings into the log.
+// When a ring is full the record is dropped and counted, recording never slows the server down. Only the first
+// 64 KB of a path are kept.
+//
+// Log layout, native byte order:
+//   header  "CTRQ" u32 version u64 start time (us since the epoch)
+//   record  u64 timestamp (us since the start) u32 connection u32 body size u8 method u16 path length, path bytes
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct RecordedRequest {
+    uint64_t timestamp_us;
+    // Same value for the requests that came on the same connection, used to replay with the original concurrency
+    uint32_t connection;
+    uint32_t body_size;
+    uint8_t method;
+    std::string path;
+};
+
+class RequestRecorder {
+public:
+    enum Method : uint8_t { GET = 0, POST, PUT, DELETE, OTHER };
+
+    static const uint32_t VERSION = 1;
+
+    RequestRecorder() { }
+    ~RequestRecorder();
+
+    RequestRecorder(const RequestRecorder&) = delete;
+    RequestRecorder& operator=(const RequestRecorder&) = delete;
+
+    // Creates the log and starts the writer thread. ring_bytes is the size of every thread's buffer.
+    bool start(const std::string& path, size_t ring_bytes = 1 << 20);
+
+    // Writes out what is still buffered and closes the log
+    void stop();
+
+    bool enabled() const {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    // Called from the request threads. Does nothing when the recorder isn't started.
+    void record(Method method, const std::string& path, uint32_t connection, uint32_t body_size);
+
+    uint64_t recorded() const { return records.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return drops.load(std::memory_order_relaxed); }
+
+    static const char* method_name(uint8_t method);
+
+    // Reads a whole log. A record cut short by a crash ends the log, it isn't an error.
+    static bool load(const std::string& path, std::vector<RecordedRequest>& requests);
+
+private:
+    // Single producer / single consumer byte ring. head and tail only grow, the position is taken modulo the size.
+    struct Ring {
+        explicit Ring(size_t size) : data(size) { }
+        std::vector<char> data;
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+    };
+
+    Ring* ring_of_this_thread();
+    size_t drain(Ring& ring, std::vector<char>& out);
+    void writer_loop();
+
+    // Told apart by id and not by address, a new recorder can get the address of one that's gone
+    uint64_t id = 0;
+    size_t ring_bytes = 0;
+    std::mutex rings_lock;
+    std::vector<std::unique_ptr<Ring>> rings;
+
+    std::FILE* file = nullptr;
+    std::chrono::steady_clock::time_point origin;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> records{0};
+    std::atomic<uint64_t> drops{0};
+
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread writer;
+};
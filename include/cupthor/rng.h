@@ -0,0 +1,67 @@
+#pragma once
+
+// Seeded random numbers for the simulated devices. Every device gets its own stream (seed, stream id), so a run
+// with the same seed gives the same sensor readings no matter how the requests interleave, and no stream is
+// shared between threads. The distributions are computed here rather than with <random>, whose distributions
+// are allowed to differ between standard libraries.
+
+#include <cmath>
+#include <cstdint>
+
+class Rng {
+public:
+    explicit Rng(uint64_t seed = 0, uint64_t stream = 0) {
+        uint64_t x = seed ^ (stream * 0x9E3779B97F4A7C15ull);
+        for (auto& word : s)
+            word = splitmix64(x);
+    }
+
+    // xoshiro256**
+    uint64_t next() {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, n)
+    uint32_t below(uint32_t n) {
+        return static_cast<uint32_t>(((next() >> 32) * n) >> 32);
+    }
+
+    // Uniform in [a, b)
+    double uniform(double a, double b) {
+        return a + (b - a) * ((next() >> 11) * 0x1.0p-53);
+    }
+
+    double normal(double mean, double stddev) {
+        // Box-Muller, the second value of the pair is dropped to keep the stream position simple
+        double u1 = uniform(0, 1);
+        double u2 = uniform(0, 1);
+        if (u1 < 1e-300)
+            u1 = 1e-300;
+        return mean + stddev * std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+    }
+
+    // A seed picked from the system, for when no seed was configured
+    static uint64_t random_seed();
+
+private:
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    static uint64_t splitmix64(uint64_t& x) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t s[4];
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+// Compact binary control interface, next to the REST one, for supervisory controllers that change the setpoints
+// many times per second. It runs the same CupThor commands as the REST handlers, without URLs, text values or
+// text responses, and a frame can carry many commands that run under a single lock acquisition.
+//
+// Framing, all integers little endian, doubles as their IEEE 754 bits in a little endian u64:
+//   request  u32 payload size, then commands of 10 bytes: u8 op, u8 argument, f64 value
+//   reply    u32 payload size, then one result of 9 bytes per command, in order: u8 status, f64 value
+//
+//   op               argument     value in         status out                          value out
+//   SET_SETTING      Setting      new value        set_setting's result code           the setting after the command
+//   GET_SETTING      Setting      -                1                                   the setting
+//   GET_TEMPERATURE  -            -                1                                   thermostat temperature
+//   GET_COOK_PHASE   -            -                CupThor::CookPhase                  seconds left in the phase, -1 if none
+//   GET_SENSOR       Sensor       -                1                                   the reading
+//
+// An unknown op, setting or sensor gets BAD_COMMAND. A frame that isn't a whole number of commands or is longer than
+// MAX_COMMANDS closes the connection.
+//
+// With an auth_key on the server, SET_SETTING needs a session token from /auth (auth.h), the reads stay open like
+// the REST GETs. The token is sent once per connection in a token frame, whose size has TOKEN_FRAME set:
+//   request  u32 TOKEN_FRAME | token size, then the token text
+//   reply    one result: u8 TokenAuthority::Result (0 = valid), f64 0
+// The token is checked again on every frame that changes something, so it stops working when it expires. Until a
+// valid one is sent, SET_SETTING gets NOT_AUTHORIZED and changes nothing.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cupthor/auth.h"
+#include "cupthor/cupthor.h"
+
+namespace rpc {
+
+enum Op : uint8_t { SET_SETTING = 1, GET_SETTING, GET_TEMPERATURE, GET_COOK_PHASE, GET_SENSOR };
+
+const uint8_t BAD_COMMAND = 255;
+const uint8_t NOT_AUTHORIZED = 254;
+const uint32_t TOKEN_FRAME = 0x80000000;
+const size_t MAX_TOKEN_SIZE = 1024;
+const size_t COMMAND_SIZE = 10;
+const size_t RESULT_SIZE = 9;
+const size_t MAX_COMMANDS = 65536;
+
+struct Command {
+    uint8_t op;
+    uint8_t argument;
+    double value;
+};
+
+struct Result {
+    uint8_t status;
+    double value;
+};
+
+// Appends a whole request frame
+void encode_request(const std::vector<Command>& commands, std::string& out);
+
+// Appends a token frame
+void encode_token(const std::string& token, std::string& out);
+
+// Reads the results out of a reply payload (without the size prefix)
+bool decode_reply(const char* payload, size_t size, std::vector<Result>& results);
+
+}
+
+class RpcServer {
+public:
+    // Every frame runs under `lock`, the one the REST handlers take
+    RpcServer(CupThor& oven, std::mutex& lock);
+    ~RpcServer();
+
+    // Either or both can be used, before start(). address is the IPv4 address to listen on, 0.0.0.0 for all.
+    bool listen_tcp(uint16_t port, const std::string& address = "127.0.0.1");
+    bool listen_unix(const std::string& path);
+
+    // Changes then need a token when authority is enabled. Before start().
+    void attach_auth(TokenAuthority* authority);
+
+    void start(size_t max_connections);
+    void stop();
+
+    // Runs the commands of one request payload and appends the whole reply frame to `reply`. SET_SETTING gets
+    // NOT_AUTHORIZED unless may_change. Returns false when the payload isn't a whole number of commands.
+    bool execute(const char* payload, size_t size, std::string& reply, bool may_change = true);
+
+    uint64_t frames() const { return frame_count.load(std::memory_order_relaxed); }
+    uint64_t commands() const { return command_count.load(std::memory_order_relaxed); }
+
+private:
+    struct Connection {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    void accept_loop(int listen_fd);
+    void serve(Connection& connection);
+
+    // Whether a frame from a connection that sent this token may change the oven
+    bool may_change(const std::string& token);
+
+    CupThor& oven;
+    std::mutex& lock;
+    TokenAuthority* auth = nullptr;
+
+    std::vector<int> listeners;
+    std::vector<std::thread> acceptors;
+    std::string unix_path;
+
+    std::mutex connections_lock;
+    std::vector<std::unique_ptr<Connection>> connections;
+    size_t max_connections = 64;
+    bool running = false;
+
+    std::atomic<uint64_t> frame_count{0};
+    std::atomic<uint64_t> command_count{0};
+};
+
+// Blocking client, one request at a time. Used by the benchmarks, and small enough to copy into a controller.
+class RpcClient {
+public:
+    RpcClient() { }
+    ~RpcClient();
+
+    RpcClient(const RpcClient&) = delete;
+    RpcClient& operator=(const RpcClient&) = delete;
+
+    bool connect_tcp(const std::string& host, uint16_t port);
+    bool connect_unix(const std::string& path);
+
+    // Sends a token frame. Returns the server's TokenAuthority::Result, -1 if the connection broke.
+    int authenticate(const std::string& token);
+
+    // Sends the commands in one frame and waits for their results
+    bool call(const std::vector<rpc::Command>& commands, std::vector<rpc::Result>& results);
+
+private:
+    // Reads one reply frame of `size` payload bytes into `in`
+    bool read_reply(size_t size);
+
+    int fd = -1;
+    std::string out;
+    std::string in;
+};
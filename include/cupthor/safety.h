@@ -0,0 +1,83 @@
+#pragma once
+
+// The safety monitor: a thread of its own that looks at the smoke sensor and the thermostat every period and, when
+// there is smoke or the oven is hotter than it may ever be, cuts the heater off and turns the water jet on.
+//
+// It never takes the oven lock. The thermostat, the smoke sensor and the water jet can be used without it
+// (CupThor::safety_trip), so a trip isn't held up by request handlers that keep the lock busy: from the condition
+// to the water it's at most one period plus the time the thread takes to be scheduled. The cook in progress is
+// ended afterwards by the control thread, under the lock like every other change of the cook.
+//
+// The thread can have a core of its own (cpu) and a real time priority (SCHED_FIFO, needs CAP_SYS_NICE); without
+// them it runs as a normal thread and the bound only holds as long as the machine isn't overloaded. late_checks
+// and max_lateness_us show how well the period was kept.
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "cupthor/cupthor.h"
+
+class SafetyMonitor {
+public:
+    struct Options {
+        // Time between two checks
+        int period_ms = 10;
+        // Above this the oven is overheating. The thermostat can't be set above 300.
+        double max_temperature_c = 310;
+        // Core the thread runs on, -1 for any
+        int cpu = -1;
+        // SCHED_FIFO priority (1-99), 0 for the normal scheduler
+        int priority = 0;
+    };
+
+    struct Stats {
+        uint64_t checks = 0;
+        // Checks that started more than half a period after their time
+        uint64_t late_checks = 0;
+        int64_t max_lateness_us = 0;
+        uint64_t trips = 0;
+        // Whether the thread got its core and its priority
+        bool pinned = false;
+        bool realtime = false;
+    };
+
+    SafetyMonitor() { }
+    ~SafetyMonitor() {
+        stop();
+    }
+
+    SafetyMonitor(const SafetyMonitor&) = delete;
+    SafetyMonitor& operator=(const SafetyMonitor&) = delete;
+
+    // Starts watching the oven. A core or a priority that can't be had is reported and the thread runs without it.
+    bool start(const Options& options, CupThor& oven);
+    void stop();
+
+    bool enabled() const {
+        return running;
+    }
+
+    // The conditions that trip the cut-off, as the thread checks them. Lock free.
+    int check_conditions();
+
+    // Ends the cut-off, false while its condition is still there. Needs the oven lock.
+    bool reset();
+
+    Stats stats() const;
+
+private:
+    void run();
+
+    Options options;
+    CupThor* cth = nullptr;
+    std::thread thread;
+    std::atomic<bool> running{false};
+
+    std::atomic<uint64_t> checks{0};
+    std::atomic<uint64_t> late_checks{0};
+    std::atomic<int64_t> max_lateness_us{0};
+    std::atomic<uint64_t> trips{0};
+    std::atomic<bool> pinned{false};
+    std::atomic<bool> realtime{false};
+};
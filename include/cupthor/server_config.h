@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cupthor/auth.h"
+#include "cupthor/camera_stats.h"
+#include "cupthor/fleet.h"
+#include "cupthor/logger.h"
+#include "cupthor/playback.h"
+#include "cupthor/safety.h"
+#include "cupthor/timelapse.h"
+
+// Configuration of the http endpoint. Values come from the built-in defaults, then from the
+// config file (if one is given), then from the command line flags - the last one wins.
+struct ServerConfig {
+    uint16_t port = 9080;
+    // Number of threads used by the server
+    int threads = 2;
+    // Limits for a single request / response, in bytes
+    size_t max_request_size = 4096 * 1024;
+    size_t max_response_size = 4096 * 1024;
+    // How long an idle keep-alive connection is kept open, in seconds
+    int keepalive_timeout = 600;
+    // How long a client may take to send the headers / the body of a request before the connection is dropped, in seconds
+    int header_timeout = 60;
+    int body_timeout = 60;
+    // Length of the queue of pending connections given to listen()
+    int backlog = 128;
+    // Cores the worker threads are pinned to, the i-th worker to serve a request goes on pin_cpus[i % size]. Empty
+    // means no pinning.
+    std::vector<int> pin_cpus;
+    // Lets several cupthor processes listen on the same port (SO_REUSEPORT)
+    bool reuse_port = false;
+    // Threads that run camera captures and song validation, 0 means one per core
+    int executor_threads = 0;
+    // Per client limits for the expensive routes: requests per second and the burst allowed above that. Rate 0 = no limit.
+    double camera_rate = 2;
+    double camera_burst = 5;
+    double media_rate = 5;
+    double media_burst = 10;
+    // Camera/media jobs waiting for the executor before new ones are turned away with 503
+    size_t max_pending_jobs = 64;
+    // Longest Base64 song accepted by /mediaplayer/play/:value, in bytes
+    size_t max_song_size = 1024 * 1024;
+    // Where the media player's sound goes: "null" plays it into nothing, a path writes it to a WAV file, "none"
+    // turns the playback engine off (songs are only validated). Then the output format, how much sound is decoded
+    // ahead and the songs that can wait in the playlist.
+    std::string playback_output = "null";
+    PlaybackEngine::Options playback;
+    // Memory for the songs already uploaded, kept by hash so they're played again without validating or decoding
+    // them (/mediaplayer/play-hash/:hash). 0 keeps none.
+    size_t song_store_mb = 64;
+    // Quality of the JPEG pictures of /sensors/camera/, 1..100
+    int jpeg_quality = 80;
+    // Part of the camera picture /sensors/camera/stats looks at (x, y, width, height; 0 width/height = to the edge)
+    // and the pixel step it samples with. Every second pixel of every second row gives the same means.
+    CameraStatsOptions camera_stats = {0, 0, 0, 0, 2};
+    // Where the timelapse of every cook is kept ("none" turns it off), a frame every interval_s of oven time, how
+    // many frames and bytes an archive has room for, and the frames written back together
+    TimelapseRecorder::Options timelapse;
+    // Where the write-ahead log and the snapshot of the oven state are kept. "none" turns persistence off.
+    std::string state_dir = "./State";
+    // After cooking with keep-food-warm the oven holds a temperature between these two (Celsius) for keep_warm_duration_s
+    double keep_warm_low = 60;
+    double keep_warm_high = 75;
+    int keep_warm_duration_s = 1800;
+    // Browning index of the camera picture at which a cook is done before its timer runs out, 0 = timer only
+    double cook_browning_done = 0;
+    // Safety monitor: how often it checks for smoke and overheating, the temperature it cuts the heater off above,
+    // and the core (-1 any) and SCHED_FIFO priority (0 none) of its thread
+    SafetyMonitor::Options safety;
+    // Longest time a state change waits before its batch is fsynced
+    int wal_commit_interval_ms = 5;
+    // Number of log records after which a new snapshot is written and the log starts over
+    size_t snapshot_every = 4096;
+    // How many times faster than the wall clock the oven's time runs, for simulating long cooks
+    double time_warp = 1;
+    // Seed of the simulated sensors (camera and scale). 0 picks a random one; the same seed gives the same readings.
+    uint64_t seed = 0;
+    // Binary control protocol (see rpc.h) on this TCP port and/or this Unix socket. 0 / empty = off.
+    int rpc_port = 0;
+    // IPv4 address the rpc port listens on; 0.0.0.0 for all of them (the ovens of a gateway on other machines)
+    std::string rpc_bind = "127.0.0.1";
+    std::string rpc_socket = "";
+    size_t rpc_max_connections = 64;
+    // POSIX shared memory segment the oven state is published to for local readers (shm_state.h), e.g. "/cupthor". Empty = off.
+    std::string shm_name = "";
+    // Gateway mode: with backends ("host:port,..." of the ovens' rpc listeners) this process serves /fleet/state and
+    // /fleet/alarms for them instead of being an oven. Then how long a view waits for the ovens, how long an oven's
+    // state is cached and the temperature that raises an alarm.
+    FleetGateway::Options gateway;
+    // Session tokens for the POST routes: the key clients show to /auth (empty = no authentication), the HMAC key
+    // of the tokens (64 hex digits, empty = random per run), how long a token lasts and the tokens cached once checked
+    TokenAuthority::Options auth;
+    // Structured log of the server's events: file ("none" = off), json or binary, lowest level logged, the size
+    // (MB) a file is rotated at and the files kept
+    Logger::Options log;
+    // Every request is recorded into this file for tools/replay. Empty means no recording.
+    std::string record_file = "";
+    std::string config_file = "";
+
+    // Reads "key = value" lines. Lines starting with '#' are comments.
+    bool load_file(const std::string& path);
+
+    // Accepts the old positional form "cupthor [port] [threads]" as well as
+    // --key=value / --key value flags with the same keys as the config file.
+    bool parse_args(int argc, char *argv[]);
+
+    bool set(const std::string& key, const std::string& value);
+
+    // Startup self-report, so that the effective configuration shows up in the server log
+    void print(std::ostream& out) const;
+
+private:
+    static std::string trim(const std::string& s);
+
+    // Strict number parsing for set(): the whole value has to be the number, no leading blanks, no trailing
+    // characters, no sign for the unsigned one and no nan or inf. Throw std::invalid_argument or std::out_of_range
+    // otherwise.
+    static int to_int(const std::string& s);
+    static unsigned long long to_unsigned(const std::string& s);
+    static double to_double(const std::string& s);
+};
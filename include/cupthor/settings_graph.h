@@ -0,0 +1,96 @@
+#pragma once
+
+// The settings of the oven and the rules between them, declared once instead of written out in every setter.
+//
+// A node is a value (a setting, or a device state that settings drive). A rule names the nodes it reads; it runs
+// when one of them changed and may set other nodes, which runs the rules that read those, and so on. Every node
+// keeps the list of rules that read it, so a change only costs the rules downstream of it, however many rules
+// there are in total. In a wave of changes a rule runs once, again only if a later rule changes its inputs.
+//
+// When a wave settles, the subscribers get the nodes whose value really changed, with the value before the wave
+// and the value after it. A node that changed and changed back isn't reported.
+//
+//   SettingsGraph graph(2);
+//   graph.add_rule({0}, [](SettingsGraph& g) { if (g.get(0) > 10) g.set(1, 1); });
+//   graph.subscribe([](const std::vector<SettingsGraph::Change>& changes) { ... });
+//   graph.set(0, 20);
+//
+// Not thread safe, CupThor calls it under its lock.
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+class SettingsGraph {
+public:
+    struct Change {
+        int node;
+        double before;
+        double after;
+    };
+
+    using Rule = std::function<void(SettingsGraph&)>;
+    using Subscriber = std::function<void(const std::vector<Change>&)>;
+
+    // Nodes are numbered from 0 to nodes - 1, all starting at 0
+    explicit SettingsGraph(int nodes);
+
+    // The rule runs after a change of any of `inputs`. Rules that change each other's inputs in a loop are cut
+    // off after every rule ran a few times in the same wave.
+    void add_rule(std::initializer_list<int> inputs, Rule rule);
+
+    double get(int node) const {
+        return values[node];
+    }
+
+    // From outside a rule: changes the node, runs whatever depends on it and notifies the subscribers.
+    // From inside a rule: the change joins the wave that is running.
+    // Returns the number of nodes that ended up changed, 0 when the value was already there.
+    size_t set(int node, double value);
+
+    // Puts a value in place without running the rules or notifying anyone, for a state that is already
+    // consistent (a restore)
+    void load(int node, double value) {
+        values[node] = value;
+    }
+
+    int subscribe(Subscriber subscriber);
+    void unsubscribe(int id);
+
+    size_t rule_count() const {
+        return rules.size();
+    }
+
+    // Rules that ran since the graph was built, every run counts
+    uint64_t evaluations() const {
+        return evaluation_count;
+    }
+
+private:
+    static const int MAX_RUNS_PER_RULE = 8;
+
+    std::vector<double> values;
+    // dependents[node]: the rules that read the node
+    std::vector<std::vector<int>> dependents;
+    std::vector<Rule> rules;
+
+    // The current wave. A rule waits in the queue at most once at a time and a node has one entry in
+    // `changes`: both are stamped with the wave instead of being cleared after it. Stamps start at 0.
+    uint64_t wave = 1;
+    bool propagating = false;
+    std::vector<int> queue;
+    std::vector<uint64_t> queued_in;
+    std::vector<int> runs;
+    std::vector<Change> changes;
+    std::vector<uint64_t> changed_in;
+    std::vector<Change> reported;
+
+    std::vector<std::pair<int, Subscriber>> subscribers;
+    int next_subscriber = 0;
+
+    uint64_t evaluation_count = 0;
+
+    void record(int node, double before);
+};
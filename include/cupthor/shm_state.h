@@ -0,0 +1,106 @@
+#pragma once
+
+// Publishes the oven state into a POSIX shared memory segment, so processes on the same machine (the UI, a logger)
+// can read it without HTTP and without a single syscall per read.
+//
+// The segment has a fixed layout, checked by the reader through magic, version and size. The snapshot is guarded
+// by a seqlock: the writer makes the sequence odd, stores the words of the snapshot and makes it even again; a
+// reader copies the words and keeps the copy only when it saw the same even sequence before and after. The words
+// are atomics, so a reader racing the writer gets a torn copy that it throws away, never undefined behaviour.
+//
+//   ShmStateReader reader;
+//   reader.open("/cupthor");
+//   ShmState state;
+//   if (reader.read(state)) ...
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// One snapshot. Fixed size types only, this is what other processes see: new fields go at the end and bump
+// SHM_STATE_VERSION.
+struct ShmState {
+    // Incremented on every publish, a reader can tell it already has this snapshot
+    uint64_t publish_count;
+    // Wall clock time of the publish, ms since the epoch
+    int64_t updated_ms;
+    double temperature;
+    double desired_temperature;
+    int32_t ventilation;
+    // CupThor::CookPhase, and the seconds left in it (-1 when the phase has no end)
+    int32_t cook_phase;
+    int32_t phase_remaining_s;
+    uint8_t ambient_light;
+    uint8_t silent_mode;
+    uint8_t defrost;
+    uint8_t media_player;
+    uint8_t keep_food_warm;
+    uint8_t reserved[3];
+    // Zero terminated, cut at 31 characters
+    char what_is_cooking[32];
+};
+
+const uint32_t SHM_STATE_MAGIC = 0x48535443;  // "CTSH"
+const uint32_t SHM_STATE_VERSION = 1;
+
+struct ShmStateSegment {
+    static const size_t WORDS = (sizeof(ShmState) + 7) / 8;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t writer_pid;
+    // Own cache line, the readers spin on it
+    alignas(64) std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> words[WORDS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the seqlock needs lock free 64 bit atomics in shared memory");
+
+class ShmStatePublisher {
+public:
+    ShmStatePublisher() { }
+    ~ShmStatePublisher() {
+        close();
+    }
+
+    ShmStatePublisher(const ShmStatePublisher&) = delete;
+    ShmStatePublisher& operator=(const ShmStatePublisher&) = delete;
+
+    // name is a shm_open name, "/cupthor". An existing segment of that name is replaced.
+    bool open(const std::string& name);
+
+    // Removes the segment; readers that have it mapped keep the last snapshot
+    void close();
+
+    // Single writer: calls must not overlap (CupThor publishes under its lock)
+    void publish(const ShmState& state);
+
+private:
+    std::string name;
+    ShmStateSegment* segment = nullptr;
+    uint64_t count = 0;
+};
+
+class ShmStateReader {
+public:
+    ShmStateReader() { }
+    ~ShmStateReader() {
+        close();
+    }
+
+    ShmStateReader(const ShmStateReader&) = delete;
+    ShmStateReader& operator=(const ShmStateReader&) = delete;
+
+    // Fails when the segment doesn't exist or has another layout version
+    bool open(const std::string& name);
+    void close();
+
+    // Copies a consistent snapshot. Gives up and returns false only if the writer kept it busy for max_tries
+    // attempts, or before the first publish. No syscall unless the first attempts all collide with the writer.
+    bool read(ShmState& state, int max_tries = 1000) const;
+
+private:
+    const ShmStateSegment* segment = nullptr;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+// Songs already uploaded, keyed by the XXH64 hash of their Base64 text. A controller that sends the same jingle
+// again gets it played without validating or decoding it a second time, and one that knows the hash can skip the
+// upload altogether (/mediaplayer/play-hash/:hash).
+//
+// The store keeps the decoded songs within a memory budget: the least recently played ones go first. XXH64 is
+// fast (the hash of a 1 MB song costs far less than its validation) but not a cryptographic hash, a client that
+// wants to can make two songs with the same hash.
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "cupthor/playback.h"
+
+// 64 bit xxHash (XXH64)
+uint64_t xxhash64(const void* data, size_t size, uint64_t seed = 0);
+
+// The hash as the clients see it, 16 lowercase hex digits
+std::string song_hash_text(uint64_t hash);
+
+// False unless text is exactly 16 hex digits
+bool parse_song_hash(const std::string& text, uint64_t& hash);
+
+class SongStore {
+public:
+    struct Stats {
+        size_t songs = 0;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    // budget_bytes 0 keeps nothing
+    explicit SongStore(size_t budget_bytes = 64 * 1024 * 1024) : budget(budget_bytes) { }
+
+    void set_budget(size_t budget_bytes);
+
+    // A song uploaded before. song is nullptr for a valid song that wasn't decoded (no playback engine).
+    bool find(uint64_t hash, std::shared_ptr<const Song>& song);
+
+    // Keeps a valid song, the least recently used ones make room for it. A song bigger than the whole budget
+    // isn't kept.
+    void insert(uint64_t hash, std::shared_ptr<const Song> song);
+
+    Stats stats();
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::shared_ptr<const Song> song;
+        size_t bytes;
+    };
+
+    // What an entry counts against the budget: the samples and the bookkeeping around them
+    static size_t cost(const std::shared_ptr<const Song>& song);
+
+    // Drops the least recently used entries until used fits in the budget. Called with lock held.
+    void evict();
+
+    std::mutex lock;
+    size_t budget;
+    size_t used = 0;
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> by_hash;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
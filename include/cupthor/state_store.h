@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sys/types.h>
+
+// Persistent copy of the oven state. Every mutation is appended to a write-ahead log (WAL); a background
+// thread writes the log in batches and fsyncs once per batch (group commit). Every few thousand records the
+// whole state is written as a compact binary snapshot and the log starts over. On startup the snapshot is
+// loaded and the log tail is replayed on top of it.
+//
+// Log record:  u32 payload length | u8 type | payload | u32 crc32(type + payload)
+// Snapshot:    "CTSN" | u32 version | payload of every field | u32 crc32
+class StateStore {
+public:
+    enum RecordType : uint8_t {
+        DESIRED_TEMPERATURE = 1,
+        VENTILATION = 2,
+        AMBIENT_LIGHT = 3,
+        SILENT_MODE = 4,
+        DEFROST = 5,
+        COOK = 6,
+        TIMER = 7,
+        MEDIA_PLAYER = 8,
+        COOK_PHASE = 9,
+    };
+
+    // Everything that has to survive a restart. Timers are kept as an absolute deadline so the remaining
+    // time is still correct after the server was down for a while.
+    struct State {
+        double desired_temperature = 20;
+        int ventilation = 0;
+        bool ambient_light = false;
+        bool silent_mode = false;
+        bool defrost = false;
+        std::string what_is_cooking = "";
+        bool keep_food_warm = false;
+        std::string timer_name = "";
+        int64_t timer_deadline_ms = 0;
+        bool media_player = false;
+        // Lifecycle of the current cook, see CupThor::CookPhase
+        uint8_t cook_phase = 0;
+        int64_t phase_deadline_ms = 0;
+        int cook_seconds = 0;
+    };
+
+    StateStore() { }
+
+    ~StateStore() {
+        close();
+    }
+
+    // Opens (or creates) the log in dir. commit_interval_ms is the longest a record waits before it's fsynced.
+    bool open(const std::string& dir, int commit_interval_ms = 5, size_t snapshot_every = 4096);
+
+    // Loads the snapshot and replays the log on top of it. A torn record at the end of the log
+    // (crash in the middle of a write) is cut off. Must be called before the first append.
+    bool recover(State& state);
+
+    // Starts the group commit thread
+    void start() {
+        running = true;
+        flusher = std::thread(&StateStore::flush_loop, this);
+    }
+
+    void close();
+
+    // Appends the fields of state that differ from what was logged last. Cheap: the record is only
+    // serialized into a memory buffer here, the write and the fsync happen on the flusher thread.
+    // Returns the sequence number of the last record, to be used with wait_durable().
+    uint64_t update(const State& state);
+
+    // Blocks until every record up to lsn is on disk. False when the store was closed before they got there.
+    bool wait_durable(uint64_t lsn) {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.notify_one();
+        durable.wait(guard, [&] { return durable_lsn >= lsn || !running; });
+        return durable_lsn >= lsn;
+    }
+
+    // Whether the last commit failed. The batch is kept and written again until it goes through.
+    bool failing() const { return failed.load(std::memory_order_relaxed); }
+
+private:
+    void append(uint8_t type, const std::string& payload);
+
+    void flush_loop();
+
+    // Serializes the snapshot of state, called with the lock held right after a commit
+    static std::string encode_snapshot(const State& state);
+
+    // Writes the snapshot without holding the lock: temporary file, fsync, rename, fsync of the directory. Only
+    // the flusher writes to the log, so once the snapshot is durable the log holds nothing it doesn't cover and
+    // is cut off.
+    bool write_snapshot(const std::string& data);
+
+    void load_snapshot(State& state);
+
+    static void apply(State& state, uint8_t type, const std::string& data, size_t& pos);
+
+    static bool read_file(const std::string& path, std::string& data);
+
+    static bool write_all(int fd, const std::string& data);
+
+    static uint32_t crc32(const char* data, size_t length);
+
+    // Little-endian encoding helpers
+    static std::string encode_u32(uint32_t v) { return std::string(reinterpret_cast<const char*>(&v), 4); }
+    static std::string encode_u64(uint64_t v) { return std::string(reinterpret_cast<const char*>(&v), 8); }
+    static std::string encode_f64(double v) { return std::string(reinterpret_cast<const char*>(&v), 8); }
+    static std::string encode_string(const std::string& s) { return encode_u32(static_cast<uint32_t>(s.size())) + s; }
+    static uint32_t get_u32(const std::string& d, size_t pos) { uint32_t v = 0; if (pos + 4 <= d.size()) memcpy(&v, d.data() + pos, 4); return v; }
+    static uint64_t get_u64(const std::string& d, size_t pos) { uint64_t v = 0; if (pos + 8 <= d.size()) memcpy(&v, d.data() + pos, 8); return v; }
+    static double get_f64(const std::string& d, size_t pos) { double v = 0; if (pos + 8 <= d.size()) memcpy(&v, d.data() + pos, 8); return v; }
+    static std::string get_string(const std::string& d, size_t& pos);
+
+    std::string wal_path() const { return dir + "/cupthor.wal"; }
+    std::string snapshot_path() const { return dir + "/cupthor.snapshot"; }
+
+    std::string dir;
+    int wal_fd = -1;
+    int commit_interval_ms = 5;
+    size_t snapshot_every = 4096;
+    // Records in the log since the last snapshot
+    size_t records = 0;
+    // Size of the log up to the last whole committed batch, what a failed write is cut back to. Flusher only.
+    off_t wal_size = 0;
+    std::atomic<bool> failed{false};
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable durable;
+    std::thread flusher;
+    bool running = false;
+
+    // Serialized records waiting for the next group commit
+    std::string pending;
+    uint64_t last_lsn = 0;
+    uint64_t durable_lsn = 0;
+    // What the log + snapshot say the state is
+    State mirror;
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+// Timelapse of the cooks. While a cook runs (set_cook until the cook is done) the recorder takes a JPEG picture
+// every interval of oven time and appends it to the archive of that cook, one file per session in the
+// timelapse directory: session-<n>.ctl.
+//
+// An archive is allocated on disk in full when the session starts and mapped into memory. Frames are copied into
+// the mapping one after the other and written back in batches (msync of the range appended since the last batch),
+// so the disk sees long sequential writes. Readers get the frames straight from the mapping, no read() and no
+// copy of ours.
+//
+// Only the last `keep` sessions are kept on disk, this run's and the earlier ones': when a session starts, the
+// files of the oldest ones are deleted (a reader that still has one mapped keeps it until it lets go).
+//
+// Archive file:
+//   header      "CTTL" | u32 version | u32 max_frames | u32 reserved | u64 data_offset | u64 data_bytes | u32 frame_count
+//   index       max_frames entries of u64 offset (from data_offset) | u32 size | u32 reserved | i64 timestamp_ms
+//   data        the frames, from data_offset (page aligned) on
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cupthor/clock.h"
+
+const uint32_t TIMELAPSE_MAGIC = 0x4c545443;  // "CTTL"
+const uint32_t TIMELAPSE_VERSION = 1;
+
+struct TimelapseHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t max_frames;
+    uint32_t reserved;
+    uint64_t data_offset;
+    uint64_t data_bytes;
+    // Published after the frame and its index entry are in place
+    std::atomic<uint32_t> frame_count;
+};
+
+struct TimelapseIndexEntry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+    int64_t timestamp_ms;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the frame count is shared through the mapping");
+
+// One session. A single thread appends, any number of threads read the frames already published.
+class FrameArchive {
+public:
+    struct Frame {
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        int64_t timestamp_ms = 0;
+    };
+
+    // Creates path with room for max_frames frames and data_bytes of frame data, all of it allocated up front.
+    // nullptr if the file can't be created.
+    static std::shared_ptr<FrameArchive> create(const std::string& path, uint32_t max_frames, uint64_t data_bytes);
+
+    // Maps an archive written earlier, read only. nullptr if it's missing or not an archive.
+    static std::shared_ptr<FrameArchive> open(const std::string& path);
+
+    ~FrameArchive();
+
+    FrameArchive(const FrameArchive&) = delete;
+    FrameArchive& operator=(const FrameArchive&) = delete;
+
+    // False when the archive is full (or read only)
+    bool append(const void* data, size_t size, int64_t timestamp_ms);
+
+    // Starts the write back of everything appended since the last flush; with wait, returns once it's on disk
+    void flush(bool wait = false);
+
+    // Frames published so far
+    uint32_t frames() const;
+
+    // A view into the mapping, valid as long as the archive is
+    bool frame(uint32_t n, Frame& out) const;
+
+private:
+    FrameArchive() { }
+
+    unsigned char* memory = nullptr;
+    size_t mapped_bytes = 0;
+    bool writable = false;
+
+    TimelapseHeader* header = nullptr;
+    TimelapseIndexEntry* index = nullptr;
+    unsigned char* data = nullptr;
+
+    // Writer only: end of the data appended, and how much of it (and of the index) was flushed
+    uint64_t data_end = 0;
+    uint64_t flushed_data = 0;
+    uint32_t flushed_frames = 0;
+
+    bool map(int fd, size_t bytes, bool write);
+};
+
+class TimelapseRecorder {
+public:
+    // Takes a picture and appends it to frame, false if there is none
+    using Capture = std::function<bool(std::string& frame)>;
+
+    struct Options {
+        std::string dir = "./Timelapse";
+        // Oven time between two frames
+        int interval_s = 10;
+        uint32_t max_frames = 1024;
+        uint64_t archive_bytes = 32 * 1024 * 1024;
+        // Frames appended between two write backs
+        uint32_t batch = 8;
+        // Sessions kept on disk, the newest ones; 0 keeps them all
+        uint32_t keep = 16;
+    };
+
+    TimelapseRecorder() { }
+    ~TimelapseRecorder() {
+        stop();
+    }
+
+    // Creates the directory and starts the recording thread. Sessions are numbered on from the ones already there.
+    bool start(const Options& options, std::shared_ptr<Clock> clock, Capture capture);
+    void stop();
+
+    bool enabled() const {
+        return running;
+    }
+
+    // A new session; the one being recorded, if any, ends. Returns its number, 0 when the recorder isn't running.
+    // Cheap, the archive is created on the recording thread.
+    uint64_t begin();
+
+    // Ends the session being recorded
+    void end();
+
+    // Archive of a session of this run or of an earlier one, nullptr if there is none
+    std::shared_ptr<FrameArchive> archive(uint64_t session);
+
+    uint64_t recorded() const {
+        return frames_recorded.load();
+    }
+
+    // Frames not recorded because the capture failed or the archive was full
+    uint64_t dropped() const {
+        return frames_dropped.load();
+    }
+
+private:
+    // Archives kept mapped for the readers, besides the one being recorded
+    static const size_t OPEN_ARCHIVES = 8;
+
+    Options options;
+    std::shared_ptr<Clock> clock;
+    Capture capture;
+
+    std::thread recorder;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::atomic<bool> running{false};
+
+    // Guarded by lock: the session asked for (0 = none) and the next number to hand out
+    uint64_t wanted_session = 0;
+    uint64_t next_session = 1;
+
+    // Sessions this process has mapped, the one being recorded included. Guarded by lock.
+    std::map<uint64_t, std::shared_ptr<FrameArchive>> archives;
+    // Sessions with a file on disk. Guarded by lock.
+    std::set<uint64_t> on_disk;
+
+    std::atomic<uint64_t> frames_recorded{0};
+    std::atomic<uint64_t> frames_dropped{0};
+
+    std::string path(uint64_t session) const;
+
+    void record_loop();
+
+    // Keeps at most OPEN_ARCHIVES besides the current one, the oldest go first. Called with lock held.
+    void trim_archives(uint64_t current);
+
+    // Takes the sessions over options.keep off the books and returns their files, for the caller to delete without
+    // the lock. Called with lock held.
+    std::vector<std::string> expire_sessions();
+};
@@ -0,0 +1,180 @@
+#include "cupthor/auth.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "cupthor/song_store.h"
+
+namespace {
+
+const size_t ID_DIGITS = 16;
+const size_t SIGNATURE_DIGITS = 64;
+
+std::string hex(const unsigned char* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text(size * 2, '0');
+    for (size_t i = 0; i < size; i++) {
+        text[2 * i] = digits[data[i] >> 4];
+        text[2 * i + 1] = digits[data[i] & 0xf];
+    }
+    return text;
+}
+
+int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool all_hex(const char* p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (hex_digit(p[i]) < 0)
+            return false;
+    }
+    return true;
+}
+
+}
+
+bool TokenAuthority::configure(const Options& authority_options) {
+    if (authority_options.token_ttl_s <= 0)
+        return false;
+    if (authority_options.signing_key.empty()) {
+        if (RAND_bytes(signing_key, sizeof(signing_key)) != 1)
+            return false;
+    }
+    else {
+        const std::string& text = authority_options.signing_key;
+        if (text.size() != 2 * sizeof(signing_key) || !all_hex(text.data(), text.size()))
+            return false;
+        for (size_t i = 0; i < sizeof(signing_key); i++)
+            signing_key[i] = static_cast<unsigned char>(hex_digit(text[2 * i]) << 4 | hex_digit(text[2 * i + 1]));
+    }
+    options = authority_options;
+    shard_capacity = options.cache_entries / SHARDS;
+    if (shard_capacity == 0)
+        shard_capacity = 1;
+    return true;
+}
+
+std::string TokenAuthority::sign(const char* data, size_t size) const {
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int mac_size = 0;
+    HMAC(EVP_sha256(), signing_key, sizeof(signing_key), reinterpret_cast<const unsigned char*>(data), size, mac, &mac_size);
+    return hex(mac, mac_size);
+}
+
+bool TokenAuthority::check_key(const std::string& presented) const {
+    if (options.key.empty())
+        return false;
+    // Compared through their MACs, same length whatever was sent
+    std::string expected = sign(options.key.data(), options.key.size());
+    std::string got = sign(presented.data(), presented.size());
+    return CRYPTO_memcmp(expected.data(), got.data(), expected.size()) == 0;
+}
+
+std::string TokenAuthority::issue(int64_t now_s) {
+    unsigned char id[ID_DIGITS / 2];
+    if (RAND_bytes(id, sizeof(id)) != 1)
+        return "";
+    std::string token = hex(id, sizeof(id)) + "." + std::to_string(now_s + options.token_ttl_s);
+    token += "." + sign(token.data(), token.size());
+    issued.fetch_add(1, std::memory_order_relaxed);
+    return token;
+}
+
+TokenAuthority::Result TokenAuthority::verify(const std::string& token, int64_t now_s) {
+    if (token.empty()) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return MISSING;
+    }
+
+    uint64_t hash = xxhash64(token.data(), token.size());
+    Shard& shard = shards[hash % SHARDS];
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto found = shard.by_hash.find(hash);
+        if (found != shard.by_hash.end() && found->second->token == token) {
+            if (found->second->expires <= now_s) {
+                shard.entries.erase(found->second);
+                shard.by_hash.erase(found);
+                rejected.fetch_add(1, std::memory_order_relaxed);
+                return EXPIRED;
+            }
+            shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+            cache_hits.fetch_add(1, std::memory_order_relaxed);
+            return VALID;
+        }
+    }
+
+    // Not seen before: the signature is checked outside of the shard's lock
+    size_t first_dot = token.find('.');
+    size_t second_dot = first_dot == std::string::npos ? std::string::npos : token.find('.', first_dot + 1);
+    if (first_dot != ID_DIGITS || second_dot == std::string::npos || token.size() - second_dot - 1 != SIGNATURE_DIGITS ||
+        !all_hex(token.data(), ID_DIGITS) || !all_hex(token.data() + second_dot + 1, SIGNATURE_DIGITS)) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return MALFORMED;
+    }
+    char* end = nullptr;
+    int64_t expires = std::strtoll(token.c_str() + first_dot + 1, &end, 10);
+    if (end != token.c_str() + second_dot || second_dot == first_dot + 1) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return MALFORMED;
+    }
+
+    signatures.fetch_add(1, std::memory_order_relaxed);
+    std::string expected = sign(token.data(), second_dot);
+    // The client may have sent upper case digits, the MAC is compared as bytes of lower case text
+    std::string given = token.substr(second_dot + 1);
+    for (char& c : given) {
+        if (c >= 'A' && c <= 'F')
+            c = c - 'A' + 'a';
+    }
+    if (CRYPTO_memcmp(expected.data(), given.data(), SIGNATURE_DIGITS) != 0) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return BAD_SIGNATURE;
+    }
+    if (expires <= now_s) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return EXPIRED;
+    }
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto found = shard.by_hash.find(hash);
+    if (found != shard.by_hash.end()) {
+        // Another thread checked it meanwhile, or a different token with the same hash is in the way: the newer
+        // one takes the slot
+        shard.entries.erase(found->second);
+        shard.by_hash.erase(found);
+    }
+    shard.entries.push_front(Entry{hash, token, expires});
+    shard.by_hash[hash] = shard.entries.begin();
+    while (shard.entries.size() > shard_capacity) {
+        shard.by_hash.erase(shard.entries.back().hash);
+        shard.entries.pop_back();
+    }
+    return VALID;
+}
+
+TokenAuthority::Stats TokenAuthority::stats() const {
+    Stats stats;
+    stats.issued = issued.load(std::memory_order_relaxed);
+    stats.cache_hits = cache_hits.load(std::memory_order_relaxed);
+    stats.signatures = signatures.load(std::memory_order_relaxed);
+    stats.rejected = rejected.load(std::memory_order_relaxed);
+    return stats;
+}
+
+const char* TokenAuthority::result_name(int result) {
+    static const char* names[] = {"valid", "missing", "malformed", "bad signature", "expired"};
+    return (result >= VALID && result <= EXPIRED) ? names[result] : "malformed";
+}
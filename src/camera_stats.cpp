@@ -0,0 +1,144 @@
+#include "cupthor/camera_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// sRGB value 0..255 to linear light 0..1
+double linear(double value) {
+    value /= 255;
+    return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+}
+
+// The f(t) of the L*a*b* definition
+double lab_f(double t) {
+    return t > 216.0 / 24389 ? std::cbrt(t) : (24389.0 / 27 * t + 16) / 116;
+}
+
+// Sums and histograms of the pixels of one row, for a picture in BMP byte order (blue, green, red)
+struct Accumulator {
+    uint64_t sum_b = 0;
+    uint64_t sum_g = 0;
+    uint64_t sum_r = 0;
+    // One counter per value, folded into CameraStats::BINS bins at the end: the index needs no shift. Two
+    // copies, even pixels in the first and odd ones in the second, so that two neighbouring pixels of the same
+    // color don't wait for each other's increment.
+    uint32_t counts[2][3][256] = {};
+
+    void add_row(const unsigned char* row, int count) {
+        // Byte k of a block of 16 pixels belongs to channel k % 3. The 48 sums have no dependency on each other,
+        // so this loop is vector adds.
+        uint32_t block[48] = {};
+        int x = 0;
+        for (; x + 16 <= count; x += 16) {
+            const unsigned char* p = row + x * 3;
+            for (int k = 0; k < 48; k++)
+                block[k] += p[k];
+        }
+        for (int k = 0; k < 48; k += 3) {
+            sum_b += block[k];
+            sum_g += block[k + 1];
+            sum_r += block[k + 2];
+        }
+        for (; x < count; x++) {
+            sum_b += row[x * 3];
+            sum_g += row[x * 3 + 1];
+            sum_r += row[x * 3 + 2];
+        }
+
+        count_values(row, count, 3);
+    }
+
+    // Every step-th pixel of the row, count of them
+    void add_samples(const unsigned char* row, int count, int step) {
+        uint32_t b = 0, g = 0, r = 0;
+        for (int x = 0; x < count; x++) {
+            const unsigned char* p = row + x * step * 3;
+            b += p[0];
+            g += p[1];
+            r += p[2];
+        }
+        sum_b += b;
+        sum_g += g;
+        sum_r += r;
+
+        count_values(row, count, step * 3);
+    }
+
+    void count_values(const unsigned char* p, int count, int pixel_bytes) {
+        int x = 0;
+        for (; x + 2 <= count; x += 2, p += 2 * pixel_bytes) {
+            const unsigned char* q = p + pixel_bytes;
+            counts[0][0][p[0]]++;
+            counts[0][1][p[1]]++;
+            counts[0][2][p[2]]++;
+            counts[1][0][q[0]]++;
+            counts[1][1][q[1]]++;
+            counts[1][2][q[2]]++;
+        }
+        if (x < count) {
+            counts[0][0][p[0]]++;
+            counts[0][1][p[1]]++;
+            counts[0][2][p[2]]++;
+        }
+    }
+};
+
+static_assert(256 % CameraStats::BINS == 0, "every bin has the same number of values");
+
+}
+
+double browning_index(double r, double g, double b) {
+    // sRGB (D65) -> XYZ -> L*a*b*, with the D65 white point
+    double lr = linear(r), lg = linear(g), lb = linear(b);
+    double x = (0.4124564 * lr + 0.3575761 * lg + 0.1804375 * lb) / 0.95047;
+    double y = 0.2126729 * lr + 0.7151522 * lg + 0.0721750 * lb;
+    double z = (0.0193339 * lr + 0.1191920 * lg + 0.9503041 * lb) / 1.08883;
+
+    double fx = lab_f(x), fy = lab_f(y), fz = lab_f(z);
+    double L = 116 * fy - 16;
+    double A = 500 * (fx - fy);
+    double B = 200 * (fy - fz);
+
+    double denominator = 5.645 * L + A - 3.012 * B;
+    if (std::fabs(denominator) < 1e-9)
+        return 0;
+    double ratio = (A + 1.75 * L) / denominator;
+    return 100 * (ratio - 0.31) / 0.17;
+}
+
+CameraStats analyze_frame(const ImageView& image, const CameraStatsOptions& options) {
+    CameraStats stats;
+    int left = std::min(std::max(options.roi_x, 0), image.width);
+    int top = std::min(std::max(options.roi_y, 0), image.height);
+    int right = options.roi_width > 0 ? std::min(image.width, left + options.roi_width) : image.width;
+    int bottom = options.roi_height > 0 ? std::min(image.height, top + options.roi_height) : image.height;
+    int step = std::max(options.step, 1);
+    if (right <= left || bottom <= top)
+        return stats;
+
+    Accumulator acc;
+    int count = (right - left + step - 1) / step;
+    for (int y = top; y < bottom; y += step) {
+        const unsigned char* row = image.row(y) + left * 3;
+        if (step == 1)
+            acc.add_row(row, count);
+        else
+            acc.add_samples(row, count, step);
+        stats.pixels += count;
+    }
+
+    const int values_per_bin = 256 / CameraStats::BINS;
+    for (int value = 0; value < 256; value++) {
+        int bin = value / values_per_bin;
+        stats.histogram_b[bin] += acc.counts[0][0][value] + acc.counts[1][0][value];
+        stats.histogram_g[bin] += acc.counts[0][1][value] + acc.counts[1][1][value];
+        stats.histogram_r[bin] += acc.counts[0][2][value] + acc.counts[1][2][value];
+    }
+    stats.mean_r = static_cast<double>(acc.sum_r) / stats.pixels;
+    stats.mean_g = static_cast<double>(acc.sum_g) / stats.pixels;
+    stats.mean_b = static_cast<double>(acc.sum_b) / stats.pixels;
+    stats.browning = browning_index(stats.mean_r, stats.mean_g, stats.mean_b);
+    return stats;
+}
@@ -0,0 +1,61 @@
+#include "cupthor/clock.h"
+#include "cupthor/rng.h"
+
+#include <random>
+#include <thread>
+
+std::shared_ptr<Clock> Clock::real() {
+    static std::shared_ptr<Clock> clock = std::make_shared<RealClock>();
+    return clock;
+}
+
+int64_t RealClock::now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void RealClock::sleep_for_ms(int64_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+WarpClock::WarpClock(double factor)
+    : factor(factor > 0 ? factor : 1),
+      origin_ms(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()),
+      origin(std::chrono::steady_clock::now())
+{ }
+
+int64_t WarpClock::now_ms() {
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - origin).count();
+    return origin_ms + static_cast<int64_t>(elapsed * factor);
+}
+
+void WarpClock::sleep_for_ms(int64_t ms) {
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms / factor));
+}
+
+VirtualClock::VirtualClock(int64_t start_ms)
+    : now(start_ms)
+{ }
+
+int64_t VirtualClock::now_ms() {
+    std::lock_guard<std::mutex> guard(lock);
+    return now;
+}
+
+void VirtualClock::sleep_for_ms(int64_t ms) {
+    std::unique_lock<std::mutex> guard(lock);
+    int64_t until = now + ms;
+    moved.wait(guard, [&] { return now >= until; });
+}
+
+void VirtualClock::advance(int64_t ms) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        now += ms;
+    }
+    moved.notify_all();
+}
+
+uint64_t Rng::random_seed() {
+    std::random_device device;
+    return (static_cast<uint64_t>(device()) << 32) ^ device();
+}
@@ -0,0 +1,82 @@
+#include "cupthor/cook_predictor.h"
+
+#include <cmath>
+
+CookPredictor::CookPredictor(double initial_heat_rate)
+    : learned_rate(initial_heat_rate > 0 ? initial_heat_rate : 1.0)
+{ }
+
+void CookPredictor::start(const std::string& preset, double temperature, double target, int seconds, int64_t now_ms) {
+    // The history entry is looked up once per cook, the samples only touch the pointer
+    current = &history[preset];
+    cook_seconds = seconds;
+    start_ms = now_ms;
+    preheating = true;
+    first_temperature = temperature;
+    first_sample_ms = now_ms;
+    last_temperature = temperature;
+    last_sample_ms = now_ms;
+    predicted_total_s = preheat_seconds(temperature, target) + seconds;
+}
+
+void CookPredictor::sample(double temperature, int64_t now_ms) {
+    if (!preheating)
+        return;
+    last_temperature = temperature;
+    last_sample_ms = now_ms;
+}
+
+double CookPredictor::heat_rate() const {
+    if (preheating && first_sample_ms >= 0) {
+        double elapsed = (last_sample_ms - first_sample_ms) / 1000.0;
+        double moved = std::fabs(last_temperature - first_temperature);
+        if (elapsed >= MIN_SAMPLE_SECONDS && moved > 0)
+            return moved / elapsed;
+    }
+    return learned_rate;
+}
+
+void CookPredictor::preheat_done(int64_t now_ms) {
+    if (!preheating)
+        return;
+    sample(last_temperature, now_ms);
+    double elapsed = (last_sample_ms - first_sample_ms) / 1000.0;
+    double moved = std::fabs(last_temperature - first_temperature);
+    // A preheat that barely moved (the oven was already hot) says nothing about the rate
+    if (elapsed >= MIN_SAMPLE_SECONDS && moved >= 5)
+        learned_rate += LEARNING_RATE * (moved / elapsed - learned_rate);
+    preheating = false;
+}
+
+void CookPredictor::finished(int64_t now_ms) {
+    if (current == nullptr)
+        return;
+    double actual = (now_ms - start_ms) / 1000.0;
+    if (predicted_total_s > 0 && actual > 0) {
+        double ratio = actual / predicted_total_s;
+        current->ratio = current->cooks == 0 ? ratio : current->ratio + LEARNING_RATE * (ratio - current->ratio);
+        current->cooks++;
+    }
+    current = nullptr;
+    preheating = false;
+}
+
+void CookPredictor::abort() {
+    current = nullptr;
+    preheating = false;
+}
+
+double CookPredictor::preheat_seconds(double temperature, double target) const {
+    return std::fabs(target - temperature) / heat_rate();
+}
+
+int CookPredictor::eta_preheat(double temperature, double target) const {
+    if (current == nullptr)
+        return -1;
+    return (int)std::ceil((preheat_seconds(temperature, target) + cook_seconds) * current->ratio);
+}
+
+double CookPredictor::correction(const std::string& preset) const {
+    auto found = history.find(preset);
+    return found == history.end() ? 1.0 : found->second.ratio;
+}
@@ -0,0 +1,715 @@
+#include "cupthor/cupthor.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+CupThor::CupThor(std::shared_ptr<Clock> clock, uint64_t seed)
+    : clock(clock),
+      seed(seed ? seed : Rng::random_seed()),
+      thermostat_cupthor(clock),
+      camera(Rng(this -> seed, 1)),
+      cantar_cupthor(Rng(this -> seed, 2)),
+      settings(NODES),
+      cooking_timer(clock)
+{
+
+    this -> water.name = "water_jet";
+    this -> water.value = false;
+
+    // Every other setting starts at 0 (off)
+    settings.load(DESIRED_TEMPERATURE, 20);
+    declare_rules();
+}
+
+void CupThor::declare_rules(){
+    // Silent mode turns off everything that makes noise or light; switching it off turns the light back on
+    settings.add_rule({SILENT_MODE}, [](SettingsGraph& s){
+        if (s.get(SILENT_MODE) == 1){
+            s.set(AMBIENT_LIGHT, 0);
+            s.set(MEDIA_PLAYING, 0);
+            if (s.get(VENTILATION) > 2)
+                s.set(VENTILATION, 2);
+        }
+        else
+            s.set(AMBIENT_LIGHT, 1);
+    });
+
+    // The devices follow their nodes
+    settings.add_rule({DESIRED_TEMPERATURE}, [this](SettingsGraph& s){
+        thermostat_cupthor.modifica_temperatura_la(s.get(DESIRED_TEMPERATURE));
+    });
+    settings.add_rule({MEDIA_PLAYING}, [this](SettingsGraph& s){
+        media_player.set_status(s.get(MEDIA_PLAYING) == 1);
+    });
+
+    // Every change, from the REST routes, the binary protocol or a rule, goes to the log
+    settings.subscribe([this](const std::vector<SettingsGraph::Change>& changes){
+        if (logger == nullptr)
+            return;
+        for (const SettingsGraph::Change& change : changes)
+            logger -> info("setting", {{"name", change.node == MEDIA_PLAYING ? "media_playing" : setting_name(change.node)},
+                                       {"before", change.before}, {"after", change.after}});
+    });
+}
+
+CupThor::~CupThor(){
+    stop_controller();
+}
+
+
+int CupThor::set_media_player_command(const std::string& name){
+
+    if (name == "play"){
+
+        if (settings.get(SILENT_MODE) == 1)
+            return 3;
+
+        settings.set(MEDIA_PLAYING, 1);
+        return 1;
+    }
+
+
+    if (name == "stop"){
+        settings.set(MEDIA_PLAYING, 0);
+        return 2;
+    }
+
+    return 0;
+}
+
+
+int CupThor::media_player_play_given_song(const std::string& name, const std::string& value){
+    return media_player_play_checked_song(name, is_valid_song(value));
+}
+
+int CupThor::media_player_play_checked_song(const std::string& name, bool valid, std::shared_ptr<const Song> song){
+
+    if (name == "play"){
+
+        if (settings.get(SILENT_MODE) == 1)
+            return 3;
+
+        if (valid){
+            if (song && !media_player.queue(song))
+                return 4;
+            settings.set(MEDIA_PLAYING, 1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+bool CupThor::is_valid_song(const std::string& value){
+    return MediaPlayer::is_valid(value);
+}
+
+std::string CupThor::get_camera_feed(){
+    return camera.get_feed();
+}
+
+bool CupThor::get_camera_image(const ImageEncoder& encoder, std::string& image, WorkStealingExecutor* executor){
+    return camera.get_feed(encoder, image, executor);
+}
+
+bool CupThor::get_camera_stats(CameraStats& stats){
+    return camera.get_stats(stats);
+}
+
+void CupThor::configure_camera_stats(const CameraStatsOptions& options){
+    camera.set_stats_options(options);
+}
+
+// Setting the value for one of the settings. Hardcoded for the defrosting option
+int CupThor::set_setting(const std::string& name, const std::string& value){
+    int setting = setting_from_name(name);
+    if (setting < 0)
+        return 0;
+
+    double valoare;
+    if (setting == DEFROST || setting == AMBIENT_LIGHT || setting == SILENT_MODE){
+        if (value == "true")
+            valoare = 1;
+        else if (value == "false")
+            valoare = 0;
+        else
+            return 0;
+    }
+    else {
+        // A value that isn't a number is refused like one out of range, it doesn't throw out of the handler
+        const char* start = value.c_str();
+        char* end = nullptr;
+        valoare = std::strtod(start, &end);
+        if (end == start || *end != '\0' || !std::isfinite(valoare))
+            return 0;
+    }
+
+    return set_setting(static_cast<Setting>(setting), valoare);
+}
+
+int CupThor::set_setting(Setting setting, double value){
+
+    if (setting == DEFROST){
+        if (value != 0 && value != 1)
+            return 0;
+        settings.set(DEFROST, value);
+        return 1;
+    }
+
+    if (setting == DESIRED_TEMPERATURE){
+        if (value <= 300 && value >= 20)
+        {
+            settings.set(DESIRED_TEMPERATURE, value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (setting == AMBIENT_LIGHT){
+        if (value != 0 && value != 1)
+            return 0;
+        if (value == 1 && settings.get(SILENT_MODE) == 1)
+            return 3;
+        settings.set(AMBIENT_LIGHT, value);
+        return 1;
+    }
+
+    if (setting == VENTILATION){
+        // Only whole steps
+        if (value >= 0 && value <= 6 && value == std::floor(value)){
+            if (settings.get(SILENT_MODE) == 1 && value > 2)
+                return 3;
+            settings.set(VENTILATION, value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (setting == SILENT_MODE){
+        // What else changes is up to the rules, see declare_rules
+        if (value == 0 || value == 1){
+            settings.set(SILENT_MODE, value);
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+const char* CupThor::setting_name(int setting){
+    static const char* names[SETTINGS] = {"defrost", "desired_temperature", "ambient_light", "ventilation", "silent_mode"};
+    return (setting >= 0 && setting < SETTINGS) ? names[setting] : "";
+}
+
+int CupThor::setting_from_name(const std::string& name){
+    for (int i = 0; i < SETTINGS; i++)
+        if (name == setting_name(i))
+            return i;
+    return -1;
+}
+
+double CupThor::get_setting_value(Setting setting){
+    if (setting < 0 || setting >= SETTINGS)
+        return 0;
+    return settings.get(setting);
+}
+
+int CupThor::subscribe_settings(SettingsGraph::Subscriber subscriber){
+    return settings.subscribe(std::move(subscriber));
+}
+
+void CupThor::unsubscribe_settings(int id){
+    settings.unsubscribe(id);
+}
+
+double CupThor::get_temperature(){
+    return thermostat_cupthor.get_temperatura();
+}
+
+namespace {
+
+// What a preset puts in place before the cook starts. It cooks for BASE_TIME plus time_per_100g for every
+// 100 g of food.
+struct Preset {
+    const char* name;
+    int time_per_100g;
+    int ventilation;
+    double temperature;
+    // Presets that need the fan at full speed are refused in silent mode
+    bool allowed_in_silent_mode;
+};
+
+const int BASE_TIME = 10;
+
+const Preset PRESETS[] = {
+    {"chicken", 5, 4, 200, false},
+    {"vegetables", 2, 1, 100, true},
+    {"fish", 4, 4, 250, false},
+    {"pork", 7, 2, 120, true},
+};
+
+const Preset* find_preset(const std::string& name){
+    for (const Preset& preset : PRESETS)
+        if (name == preset.name)
+            return &preset;
+    return nullptr;
+}
+
+}
+
+int CupThor::set_cook(const std::string& name){
+    // Weighed once: every reading of the scale is a new (noisy) measurement
+    int weight = cantar_cupthor.get_valoare_greutate();
+    const Preset* preset = find_preset(name);
+    if (preset == nullptr)
+        return 0;
+    if (weight <= 0)
+        return 3;
+
+    if (safety_tripped() != SAFE)
+        return 4;
+
+    if (settings.get(SILENT_MODE) == 1 && !preset -> allowed_in_silent_mode)
+        return 2;
+
+    int time = (int)std::lround(BASE_TIME + preset -> time_per_100g * weight / 100.0);
+    settings.set(VENTILATION, preset -> ventilation);
+    settings.set(DESIRED_TEMPERATURE, preset -> temperature);
+    cookMode.set_status(false,name);
+    start_cook(time, name);
+    return 1;
+}
+int CupThor::set_cook_mode(const std::string& name, const std::string& value){
+
+    if (value != "true" && value != "false")
+        return 0;
+    
+    if (cantar_cupthor.get_valoare_greutate() > 0){
+        int cook_feed = set_cook(name);
+        if (cook_feed == 1){
+            
+            if (value == "true"){
+            cookMode.set_status(true,name);
+            return 1;
+            }
+
+
+            else if (value == "false"){
+            cookMode.set_status(false,name);
+            return 3;
+            }
+        }
+        else 
+        if (cook_feed == 2)
+            return 2;
+
+        else
+        if (cook_feed == 4)
+            return 5;
+        
+    }
+
+    if (find_preset(name) != nullptr)
+        return 4;
+
+
+    return 0;
+
+}
+//SET-SENSOR - nu ar trebui implementat nimic aici
+int CupThor::set_sensor(const std::string& name, const std::string& value){
+
+    
+    return 0;
+}
+
+// Getter
+std::string CupThor::get_setting(const std::string& name){
+
+    //SETTINGS
+    if (name == "defrost"){
+        return std::to_string((int)settings.get(DEFROST));
+    }
+
+
+    else if (name == "desired_temperature"){
+        return std::to_string(settings.get(DESIRED_TEMPERATURE));
+    }
+
+    else if (name == "ambient_light"){
+        return std::to_string((int)settings.get(AMBIENT_LIGHT));
+    }
+
+    else if (name == "ventilation"){
+        return std::to_string((int)settings.get(VENTILATION));
+    }
+
+    else if (name == "silent_mode"){
+        return std::to_string((int)settings.get(SILENT_MODE));
+    }
+
+    
+
+    else{
+        return "";
+    }
+}
+
+
+std::string CupThor::get_sensor(const std::string& name){
+    
+    //SENSORS
+    if (name == "thermostat"){
+        return std::to_string(thermostat_cupthor.get_temperatura());
+    }
+
+
+    if (name == "camera"){
+        return camera.get_feed();
+    }
+
+    if (name == "foodweight"){
+        return std::to_string(cantar_cupthor.get_valoare_greutate());
+    }
+
+    if (name == "smoke_sensor"){
+        return std::to_string(senzor_fum.get_status_senzor());
+    }
+    if (name == "water_jet"){
+        return std::to_string(water.value);
+    }
+
+    else{
+        return "";
+    }
+
+}
+
+double CupThor::get_sensor_value(Sensor sensor){
+    switch (sensor){
+        case THERMOSTAT: return thermostat_cupthor.get_temperatura();
+        case FOOD_WEIGHT: return cantar_cupthor.get_valoare_greutate();
+        case SMOKE_SENSOR: return senzor_fum.get_status_senzor();
+        case WATER_JET: return water.value;
+        default: return 0;
+    }
+}
+
+bool CupThor::get_cook_mode_status(){
+    return cookMode.get_status();
+}
+
+
+std::string CupThor::get_what_is_cooking(){
+    return cookMode.get_what_is_cooking();
+}
+std::string CupThor::get_media_player_status(){
+    return std::to_string(media_player.get_status());
+}
+
+const char* CupThor::cook_phase_name(int phase){
+    static const char* names[] = {"idle", "preheat", "cooking", "keep-warm", "done"};
+    return (phase >= IDLE && phase <= DONE) ? names[phase] : "idle";
+}
+
+void CupThor::configure_keep_warm(double low, double high, int duration_s){
+    keep_warm_low = low;
+    keep_warm_high = high;
+    keep_warm_duration_s = duration_s;
+}
+
+void CupThor::configure_browning_done(double browning){
+    browning_done = browning;
+}
+
+void CupThor::start_controller(std::mutex& lock){
+    controller_running = true;
+    controller = std::thread(&CupThor::control_loop, this, std::ref(lock));
+}
+
+void CupThor::stop_controller(){
+    controller_running = false;
+    if (controller.joinable())
+        controller.join();
+}
+
+int CupThor::get_cook_phase(){
+    return cook_phase.load(std::memory_order_acquire);
+}
+
+int CupThor::get_cook_eta(){
+    int phase = get_cook_phase();
+    if (phase == PREHEAT){
+        int temperatura = thermostat_cupthor.get_temperatura();
+        int eta = predictor.eta_preheat(temperatura, settings.get(DESIRED_TEMPERATURE));
+        // A cook recovered after a restart has no history in the predictor, only the learned heating rate
+        if (eta < 0)
+            eta = (int)std::ceil(predictor.preheat_seconds(temperatura, settings.get(DESIRED_TEMPERATURE)) + cook_seconds);
+        return eta;
+    }
+    if (phase == COOKING)
+        return get_phase_remaining();
+    if (phase == KEEP_WARM || phase == DONE)
+        return 0;
+    return -1;
+}
+
+int CupThor::get_phase_remaining(){
+    int phase = get_cook_phase();
+    if (phase != COOKING && phase != KEEP_WARM)
+        return -1;
+    int64_t remaining = phase_deadline_ms.load(std::memory_order_acquire) - clock -> now_ms();
+    return remaining > 0 ? (int)((remaining + 999) / 1000) : 0;
+}
+
+void CupThor::attach_store(StateStore* state_store){
+    this -> store = state_store;
+}
+
+void CupThor::persist(){
+    if (store != nullptr)
+        store -> update(get_state());
+    publish();
+}
+
+void CupThor::attach_playback(PlaybackEngine* engine){
+    media_player.attach_engine(engine);
+}
+
+void CupThor::attach_logger(Logger* log){
+    this -> logger = log;
+}
+
+void CupThor::attach_timelapse(TimelapseRecorder* recorder){
+    this -> timelapse = recorder;
+}
+
+uint64_t CupThor::get_timelapse_session(){
+    return timelapse_session;
+}
+
+void CupThor::attach_publisher(ShmStatePublisher* shm_publisher){
+    this -> publisher = shm_publisher;
+    publish();
+}
+
+void CupThor::publish(){
+    if (publisher == nullptr)
+        return;
+
+    ShmState state;
+    memset(&state, 0, sizeof(state));
+    state.updated_ms = clock -> now_ms();
+    state.temperature = thermostat_cupthor.get_temperatura();
+    state.desired_temperature = settings.get(DESIRED_TEMPERATURE);
+    state.ventilation = (int32_t)settings.get(VENTILATION);
+    state.cook_phase = get_cook_phase();
+    state.phase_remaining_s = get_phase_remaining();
+    state.ambient_light = settings.get(AMBIENT_LIGHT) == 1;
+    state.silent_mode = settings.get(SILENT_MODE) == 1;
+    state.defrost = settings.get(DEFROST) == 1;
+    state.media_player = media_player.get_status();
+    state.keep_food_warm = cookMode.get_status();
+    std::string cooking = cookMode.get_what_is_cooking();
+    strncpy(state.what_is_cooking, cooking.c_str(), sizeof(state.what_is_cooking) - 1);
+    publisher -> publish(state);
+}
+
+StateStore::State CupThor::get_state(){
+    StateStore::State state;
+    state.desired_temperature = settings.get(DESIRED_TEMPERATURE);
+    state.ventilation = (int)settings.get(VENTILATION);
+    state.ambient_light = settings.get(AMBIENT_LIGHT) == 1;
+    state.silent_mode = settings.get(SILENT_MODE) == 1;
+    state.defrost = settings.get(DEFROST) == 1;
+    state.what_is_cooking = cookMode.get_what_is_cooking();
+    state.keep_food_warm = cookMode.get_status();
+    state.timer_name = cooking_timer.get_name();
+    state.timer_deadline_ms = cooking_timer.get_deadline_ms();
+    state.media_player = media_player.get_status();
+    state.cook_phase = (uint8_t)get_cook_phase();
+    state.phase_deadline_ms = phase_deadline_ms.load();
+    state.cook_seconds = cook_seconds;
+    return state;
+}
+
+void CupThor::restore(const StateStore::State& state){
+    // The saved state already went through the rules, it's put back as it was and the devices are set directly
+    settings.load(DESIRED_TEMPERATURE, state.desired_temperature);
+    thermostat_cupthor.modifica_temperatura_la(state.desired_temperature);
+    settings.load(VENTILATION, state.ventilation);
+    settings.load(AMBIENT_LIGHT, state.ambient_light);
+    settings.load(SILENT_MODE, state.silent_mode);
+    settings.load(DEFROST, state.defrost);
+    cookMode.set_status(state.keep_food_warm, state.what_is_cooking);
+    settings.load(MEDIA_PLAYING, state.media_player);
+    media_player.set_status(state.media_player);
+    if (state.timer_name != "")
+        cooking_timer.resume(state.timer_deadline_ms, state.timer_name);
+
+    // The control thread picks the cook up from where it was
+    cook_seconds = state.cook_seconds;
+    phase_deadline_ms = state.phase_deadline_ms;
+    cook_phase = state.cook_phase <= DONE ? state.cook_phase : (uint8_t)IDLE;
+    if (cook_phase == KEEP_WARM)
+        thermostat_cupthor.modifica_temperatura_la(keep_warm_high);
+}
+
+
+
+void CupThor::start_cook(int time, std::string name){
+    cook_seconds = time;
+    phase_deadline_ms = 0;
+    predictor.start(name, thermostat_cupthor.get_temperatura(), settings.get(DESIRED_TEMPERATURE), time, clock -> now_ms());
+    thermostat_cupthor.modifica_temperatura_la(settings.get(DESIRED_TEMPERATURE));
+    set_phase(PREHEAT);
+    if (timelapse != nullptr)
+        timelapse_session = timelapse -> begin();
+}
+
+void CupThor::finish_cook(){
+    heat_to(20);
+    set_phase(DONE);
+    if (timelapse != nullptr)
+        timelapse -> end();
+}
+
+void CupThor::set_phase(int phase){
+    cook_phase.store(phase, std::memory_order_release);
+    if (logger != nullptr)
+        logger -> info("cook_phase", {{"phase", cook_phase_name(phase)}, {"cooking", cookMode.get_what_is_cooking()},
+                                      {"temperature", thermostat_cupthor.get_temperatura()}});
+}
+
+void CupThor::heat_to(double valoare){
+    settings.set(DESIRED_TEMPERATURE, valoare);
+}
+
+void CupThor::control_loop(std::mutex& lock){
+    while (controller_running){
+        clock -> sleep_for_ms(100);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (control_step())
+            persist();
+        else
+            // The temperature moves even when nothing else does
+            publish();
+    }
+}
+
+bool CupThor::control_step(){
+    int phase = cook_phase.load(std::memory_order_relaxed);
+    int64_t now = clock -> now_ms();
+
+    // The heater is already off, the cook is over
+    if (safety_tripped() != SAFE && phase != IDLE && phase != DONE){
+        if (phase == PREHEAT || phase == COOKING)
+            predictor.abort();
+        finish_cook();
+        return true;
+    }
+
+    if (phase == PREHEAT){
+        int temperatura = thermostat_cupthor.get_temperatura();
+        predictor.sample(temperatura, now);
+
+        // Thermostat within a few degrees of the preset - the food goes in and the cooking timer starts
+        if (std::fabs(temperatura - settings.get(DESIRED_TEMPERATURE)) <= preheat_tolerance){
+            predictor.preheat_done(now);
+            CameraStats stats;
+            frame_before_cooking = (browning_done > 0 && camera.get_stats(stats)) ? stats.frame : 0;
+            cooking_timer.set(cook_seconds, cookMode.get_what_is_cooking());
+            phase_deadline_ms.store(cooking_timer.get_deadline_ms(), std::memory_order_release);
+            set_phase(COOKING);
+            return true;
+        }
+    }
+
+    else if (phase == COOKING){
+        bool timer_done = now >= cooking_timer.get_deadline_ms();
+        if (timer_done || browned()){
+            // Done early by the looks of it: the timer goes off now instead of running on
+            if (!timer_done)
+                cooking_timer.set(0, cookMode.get_what_is_cooking());
+            predictor.finished(now);
+            if (cookMode.get_status()){
+                heat_to(keep_warm_high);
+                phase_deadline_ms.store(now + (int64_t)keep_warm_duration_s * 1000, std::memory_order_release);
+                set_phase(KEEP_WARM);
+            }
+            else{
+                finish_cook();
+            }
+            return true;
+        }
+    }
+
+    else if (phase == KEEP_WARM){
+        if (now >= phase_deadline_ms.load(std::memory_order_relaxed)){
+            finish_cook();
+            return true;
+        }
+
+        // Two-point control: heat up to the top of the band, let it cool down to the bottom, repeat
+        int temperatura = thermostat_cupthor.get_temperatura();
+        if (temperatura <= keep_warm_low && settings.get(DESIRED_TEMPERATURE) != keep_warm_high){
+            heat_to(keep_warm_high);
+            return true;
+        }
+        if (temperatura >= keep_warm_high && settings.get(DESIRED_TEMPERATURE) != keep_warm_low){
+            heat_to(keep_warm_low);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool CupThor::browned(){
+    CameraStats stats;
+    if (browning_done <= 0 || !camera.get_stats(stats) || stats.frame <= frame_before_cooking || stats.browning < browning_done)
+        return false;
+    if (logger != nullptr)
+        logger -> info("cook_browned", {{"cooking", cookMode.get_what_is_cooking()}, {"browning", stats.browning}});
+    return true;
+}
+
+const char* CupThor::safety_trip_name(int trip){
+    static const char* names[] = {"safe", "smoke", "overheat"};
+    return (trip >= SAFE && trip <= TRIP_OVERHEAT) ? names[trip] : "safe";
+}
+
+void CupThor::safety_trip(SafetyTrip reason){
+    // Heater first, then the water: the fire stops getting heat even if this thread is preempted in between
+    thermostat_cupthor.cut_heater();
+    water.value.store(true, std::memory_order_release);
+    int safe = SAFE;
+    if (safety.compare_exchange_strong(safe, reason, std::memory_order_acq_rel) && logger != nullptr)
+        logger -> warn("safety_trip", {{"reason", safety_trip_name(reason)}, {"temperature", thermostat_cupthor.get_temperatura()}});
+}
+
+int CupThor::safety_tripped(){
+    return safety.load(std::memory_order_acquire);
+}
+
+void CupThor::safety_reset(){
+    // A trip that comes in the middle of this finds the cut-off still on and does nothing; the monitor sees the
+    // oven safe again on its next check and trips it then
+    water.value.store(false, std::memory_order_release);
+    thermostat_cupthor.restore_heater();
+    safety.store(SAFE, std::memory_order_release);
+    if (logger != nullptr)
+        logger -> info("safety_reset");
+    publish();
+}
+
+bool CupThor::smoke_detected(){
+    return senzor_fum.get_status_senzor();
+}
+
+void CupThor::let_smoke_in(bool smoke){
+    senzor_fum.set_smoke(smoke);
+}
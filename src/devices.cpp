@@ -0,0 +1,508 @@
+#include "cupthor/devices.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <thread>
+
+
+CookMode::CookMode(){
+    this -> keep_food_warm = false;
+    this -> what_is_cooking = "";
+}
+
+bool CookMode::get_status(){
+    return this -> keep_food_warm;
+}
+
+std::string CookMode::get_what_is_cooking(){
+    return this -> what_is_cooking;
+}
+
+void CookMode::set_status(bool value, std::string name){
+    this -> keep_food_warm = value;
+    this -> what_is_cooking = name;
+}
+
+
+MediaPlayer::MediaPlayer(){
+    this -> status = false;
+}
+
+bool MediaPlayer::get_status(){
+    return this -> status;
+}
+
+void MediaPlayer::set_status(bool pornit_sau_oprit){
+    this -> status = pornit_sau_oprit;
+    if (this -> engine != nullptr)
+        this -> engine -> set_playing(pornit_sau_oprit);
+}
+
+bool MediaPlayer::play(std::string value){
+    if (is_valid(value)){
+        this -> set_status(true);
+        return true;
+    }
+
+    return false;
+}
+
+bool MediaPlayer::queue(std::shared_ptr<const Song> song){
+    if (this -> engine == nullptr)
+        return true;
+    return this -> engine -> enqueue(song);
+}
+
+void MediaPlayer::attach_engine(PlaybackEngine* playback){
+    this -> engine = playback;
+    if (this -> engine != nullptr)
+        this -> engine -> set_playing(this -> status);
+}
+
+bool MediaPlayer::is_valid(const std::string& value){
+    static const std::regex expresie("^(?:[A-Za-z0-9+/]{4})*(?:[A-Za-z0-9+/]{2}==|[A-Za-z0-9+/]{3}=|[A-Za-z0-9+/]{4})$");
+    return regex_match(value, expresie);
+}
+
+
+ThermostatCupThor::ThermostatCupThor(std::shared_ptr<Clock> clock)
+    : clock(clock)
+{
+    this -> valoare_dorita_stored = 20;
+    this -> temperatura_la_ultima_comanda = 20;
+    this -> timpul_ultimei_comenzi = this -> clock -> now_seconds();
+}
+
+void ThermostatCupThor::modifica_temperatura_la(double valoare_dorita){
+    write_ramp(this -> get_temperatura(), this -> clock -> now_seconds(), valoare_dorita);
+    return;
+}
+
+void ThermostatCupThor::write_ramp(double de_la, double timp, double valoare_dorita){
+    // Odd while the ramp is being written, readers wait for it to be even again
+    uint32_t v = version.load(std::memory_order_relaxed);
+    version.store(v + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    this -> temperatura_la_ultima_comanda.store(de_la, std::memory_order_relaxed);
+    this -> timpul_ultimei_comenzi.store(timp, std::memory_order_relaxed);
+    this -> valoare_dorita_stored.store(valoare_dorita, std::memory_order_relaxed);
+    version.store(v + 2, std::memory_order_release);
+}
+
+int ThermostatCupThor::get_temperatura(){
+
+    double timp_actual = this -> clock -> now_seconds();
+
+    // Heater cut off: the oven cools down by a degree a second to the room temperature
+    double cut = this -> cut_time.load(std::memory_order_acquire);
+    if (cut != 0){
+        double la_taiere = this -> cut_temperature.load(std::memory_order_relaxed);
+        if (la_taiere <= 20)
+            return la_taiere;
+        return std::max(20.0, la_taiere - (timp_actual - cut));
+    }
+
+    double dorita, la_ultima, timp_comanda;
+    while (true){
+        uint32_t before = version.load(std::memory_order_acquire);
+        dorita = this -> valoare_dorita_stored.load(std::memory_order_relaxed);
+        la_ultima = this -> temperatura_la_ultima_comanda.load(std::memory_order_relaxed);
+        timp_comanda = this -> timpul_ultimei_comenzi.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((before & 1) == 0 && version.load(std::memory_order_relaxed) == before)
+            break;
+    }
+
+    if ((timp_actual - timp_comanda) > std::abs(dorita - la_ultima)){
+
+        return dorita;
+    }
+
+    else
+    {
+        if (dorita > la_ultima)
+            return la_ultima + (timp_actual - timp_comanda);
+        
+        else
+            return la_ultima - (timp_actual - timp_comanda);
+    }
+
+}
+
+void ThermostatCupThor::cut_heater(){
+    if (this -> cut_time.load(std::memory_order_relaxed) != 0)
+        return;
+    this -> cut_temperature.store(this -> get_temperatura(), std::memory_order_relaxed);
+    this -> cut_time.store(this -> clock -> now_seconds(), std::memory_order_release);
+}
+
+bool ThermostatCupThor::heater_cut(){
+    return this -> cut_time.load(std::memory_order_acquire) != 0;
+}
+
+void ThermostatCupThor::restore_heater(){
+    if (!heater_cut())
+        return;
+    // The ramp starts again from where the oven has cooled to, towards the same setpoint
+    write_ramp(this -> get_temperatura(), this -> clock -> now_seconds(), this -> valoare_dorita_stored.load(std::memory_order_relaxed));
+    this -> cut_time.store(0, std::memory_order_release);
+}
+
+
+Camera::Camera(Rng rng)
+    : rng(rng)
+{
+
+}
+
+namespace {
+
+// Whole file into a pooled frame. Plain read(2), an ifstream would allocate its own buffer every time.
+FramePool::Frame read_file(FramePool& frames, const char* path){
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return FramePool::Frame(nullptr, FramePool::Release{&frames});
+    struct stat info;
+    if (fstat(fd, &info) != 0){
+        close(fd);
+        return FramePool::Frame(nullptr, FramePool::Release{&frames});
+    }
+    FramePool::Frame frame = frames.acquire(info.st_size);
+    size_t got = 0;
+    while (got < frame -> size()){
+        ssize_t n = read(fd, frame -> data() + got, frame -> size() - got);
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+    frame -> resize(got);
+    return frame;
+}
+
+bool write_file(const char* path, const unsigned char* data, size_t size){
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    while (size > 0){
+        ssize_t n = write(fd, data, size);
+        if (n <= 0)
+            break;
+        data += n;
+        size -= n;
+    }
+    close(fd);
+    return size == 0;
+}
+
+// Which byte of the source pixel (b, g, r, in BMP order) goes in each byte of the output pixel, for every
+// simulated output. 0 leaves the picture as it is.
+const unsigned char SWIZZLE[11][3] = {
+    {0, 1, 2},
+    {1, 1, 0},  // g g b
+    {2, 1, 1},  // r g g
+    {1, 1, 1},  // g g g
+    {2, 1, 0},  // r g b
+    {2, 2, 0},  // r r b
+    {2, 2, 2},  // r r r
+    {2, 1, 2},  // r g r
+    {0, 0, 0},  // b b b
+    {2, 0, 0},  // r b b
+    {0, 1, 0},  // b g b
+};
+
+}
+
+Camera::Picture Camera::capture(){
+
+        std::lock_guard<std::mutex> guard(feed_lock);
+
+        FramePool::Frame input = read_file(frames, "./CameraFakeInput/peppers.bmp");
+
+        //simulez output-uri diferite
+        int variante = rng.below(11);
+
+        if (!input || input -> size() < 54)
+            return nullptr;
+
+        // The pixels start where the BMP header says (bfOffBits), 54 bytes for our picture
+        const unsigned char* in = input -> data();
+        size_t size = input -> size();
+        size_t header = in[10] | (in[11] << 8) | (in[12] << 16) | ((size_t)in[13] << 24);
+        if (header > size)
+            header = size;
+
+        FramePool::Frame output = frames.acquire(size);
+        unsigned char* out = output -> data();
+        memcpy(out, in, header);
+
+        const unsigned char* order = SWIZZLE[variante];
+        size_t pixels = (size - header) / 3;
+        const unsigned char* src = in + header;
+        unsigned char* dst = out + header;
+        for (size_t i = 0; i < pixels; i++, src += 3, dst += 3){
+            dst[0] = src[order[0]];
+            dst[1] = src[order[1]];
+            dst[2] = src[order[2]];
+        }
+        // Padding after the last whole pixel, if any
+        memcpy(dst, src, in + size - src);
+
+        write_file("./OutputCamera/picture.bmp", out, size);
+
+        // The frame goes back to the pool when the last of its users lets go of it
+        last_picture = Picture(std::move(output));
+        picture_count++;
+        return last_picture;
+}
+
+std::string Camera::get_feed(){
+    capture();
+    return "storing photo in folder";
+}
+
+bool Camera::get_feed(const ImageEncoder& encoder, std::string& image, WorkStealingExecutor* executor){
+    Picture picture = capture();
+    ImageView view;
+    if (!picture || !view.from_bmp(picture -> data(), picture -> size()))
+        return false;
+    encoder.encode(view, image, executor);
+    return true;
+}
+
+bool Camera::get_stats(CameraStats& result){
+    Picture picture;
+    uint64_t number;
+    {
+        std::lock_guard<std::mutex> guard(feed_lock);
+        picture = last_picture;
+        number = picture_count;
+    }
+    if (!picture)
+        return false;
+
+    std::lock_guard<std::mutex> guard(stats_lock);
+    if (stats.frame != number){
+        ImageView view;
+        if (!view.from_bmp(picture -> data(), picture -> size()))
+            return false;
+        stats = analyze_frame(view, stats_options);
+        stats.frame = number;
+    }
+    result = stats;
+    return true;
+}
+
+void Camera::set_stats_options(const CameraStatsOptions& options){
+    std::lock_guard<std::mutex> guard(stats_lock);
+    stats_options = options;
+    // Computed again with the new options on the next request
+    stats.frame = 0;
+}
+
+
+Cantar::Cantar(Rng rng)
+    : rng(rng)
+{
+    this -> valoare_greutate = 0;
+}
+
+int Cantar::get_valoare_greutate(){
+
+    double odd = rng.uniform(0.0, 100.0);
+    double computed_weight = rng.normal(300, 100);
+
+    
+    if (odd >= 35){
+        this -> valoare_greutate  = computed_weight;
+    }  
+    else
+        return 0;
+    if( this -> valoare_greutate < 100 && this -> valoare_greutate!= 0)	
+        this -> valoare_greutate  = 100;
+    else
+
+    if (this -> valoare_greutate > 800)
+        this -> valoare_greutate  = 800;
+
+    return (int)valoare_greutate;
+
+}
+
+
+namespace {
+
+// What a timer thread needs, from a fixed pool: setting a timer formats its file name once, here, and the
+// thread never builds a string
+struct TimerRecord {
+    char path[128];
+    std::shared_ptr<Clock> clock;
+    std::shared_ptr<std::atomic<int>> generation;
+    int my_generation;
+    int time;
+    bool pooled;
+};
+
+// Timers that were cancelled keep their record for up to a second, until their thread notices. Never destroyed,
+// detached timer threads may still give records back while the process exits.
+FixedPool<TimerRecord, 16>& timer_records(){
+    static FixedPool<TimerRecord, 16>* pool = new FixedPool<TimerRecord, 16>();
+    return *pool;
+}
+
+void timer_path(char* path, size_t size, const std::string& name){
+    snprintf(path, size, "./Timers/%s.txt", name.c_str());
+}
+
+void write_timer_status(const char* path, const char* status){
+    write_file(path, reinterpret_cast<const unsigned char*>(status), strlen(status));
+}
+
+// The thread of one timer, it owns the record
+void functie_aux(TimerRecord* record){
+    int time = record -> time;
+
+    while (time > 0){
+        record -> clock -> sleep_for_ms(1000);
+        time = time - 1;
+        if (record -> generation -> load() != record -> my_generation){
+            break;
+            }
+        
+        if (time <= 0)
+            {
+                write_timer_status(record -> path, "done");
+            }
+    }
+
+    // The clock goes with the record: a VirtualClock's owner waits for the timer threads to let go of it
+    record -> clock.reset();
+    record -> generation.reset();
+    if (record -> pooled)
+        timer_records().release(record);
+    else
+        delete record;
+
+}
+
+}
+
+Timer::Timer(std::shared_ptr<Clock> clock)
+    : clock(clock)
+{
+    this -> time = 0;
+    this -> name = "";
+    this -> setted = 0;
+    this -> generation = std::make_shared<std::atomic<int>>(0);
+}
+
+void Timer::set(int value, std::string name_timer){
+
+    char path[128];
+
+    // A timer that's still running is cancelled right away: its thread sees the generation change
+    // and exits on its next tick without touching the files
+    if (this -> setted == 1 && this -> deadline_ms > now_ms() && this -> name != name_timer){
+        timer_path(path, sizeof(path), this -> name);
+        write_timer_status(path, "done");
+    }
+    int my_generation = ++(*this -> generation);
+
+    this -> name = name_timer;
+    this -> time = value;
+    this -> deadline_ms = now_ms() + (int64_t)value * 1000;
+    this -> setted = 1;
+
+    // More timers running at once than the pool holds only happens when they are set and cancelled in a burst
+    TimerRecord* record = timer_records().acquire();
+    if (record == nullptr){
+        record = new TimerRecord();
+        record -> pooled = false;
+    }
+    else
+        record -> pooled = true;
+    timer_path(record -> path, sizeof(record -> path), this -> name);
+    record -> clock = this -> clock;
+    record -> generation = this -> generation;
+    record -> my_generation = my_generation;
+    record -> time = this -> time;
+
+    write_timer_status(record -> path, "working");
+
+
+    std::thread t(functie_aux, record);
+
+
+    t.detach();
+
+
+}
+
+void Timer::resume(int64_t deadline, std::string name_timer){
+    int64_t remaining_ms = deadline - now_ms();
+
+    if (remaining_ms <= 0){
+        this -> name = name_timer;
+        this -> deadline_ms = deadline;
+        char path[128];
+        timer_path(path, sizeof(path), name_timer);
+        write_timer_status(path, "done");
+        return;
+    }
+
+    this -> set((int)((remaining_ms + 999) / 1000), name_timer);
+    this -> deadline_ms = deadline;
+}
+
+std::string Timer::get_name(){
+    return this -> name;
+}
+
+int64_t Timer::get_deadline_ms(){
+    return this -> deadline_ms;
+}
+
+int64_t Timer::now_ms(){
+    return this -> clock -> now_ms();
+}
+
+void Alarma::set_alarm(){
+    std::thread t(functie_aux);
+    t.detach();
+}
+
+void Alarma::functie_aux(){
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    std::string path = "./Alarm/firealarm.txt";
+    std::ofstream output(path);
+
+    while (true){
+        int senzor = 0;
+
+        if (senzor == 1)
+            output << "The alarm has been triggerd";
+        break;
+    }
+    
+    output.close();
+    //ceva gen exit(0) gen iesire fortata sa se inchida
+}
+
+
+bool SenzorFum::get_status_senzor(){
+    // The sensor doesn't make up fires any more, it only sees the smoke let in with set_smoke
+    return smoke.load(std::memory_order_acquire);
+}
+
+void SenzorFum::set_smoke(bool value){
+    smoke.store(value, std::memory_order_release);
+}
@@ -0,0 +1,146 @@
+#include "cupthor/executor.h"
+
+#include <algorithm>
+
+#include "cupthor/pool.h"
+
+void WorkStealingExecutor::Worker::push_back(Job&& job) {
+    if (count == ring.size()) {
+        std::vector<Job> bigger(ring.size() > 0 ? ring.size() * 2 : 16);
+        for (size_t i = 0; i < count; i++)
+            bigger[i] = std::move(ring[(head + i) % ring.size()]);
+        ring.swap(bigger);
+        head = 0;
+        AllocatorCounters::global().queue_mallocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    ring[(head + count) % ring.size()] = std::move(job);
+    count++;
+}
+
+WorkStealingExecutor::Job WorkStealingExecutor::Worker::pop_back() {
+    count--;
+    return std::move(ring[(head + count) % ring.size()]);
+}
+
+WorkStealingExecutor::Job WorkStealingExecutor::Worker::pop_front() {
+    Job job = std::move(ring[head]);
+    head = (head + 1) % ring.size();
+    count--;
+    return job;
+}
+
+void WorkStealingExecutor::start(size_t threads, size_t queue_capacity) {
+    if (threads == 0)
+        threads = 1;
+    running = true;
+    for (size_t i = 0; i < threads; i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        workers.back()->ring.resize(queue_capacity > 0 ? queue_capacity : 1);
+    }
+    for (size_t i = 0; i < threads; i++)
+        pool.emplace_back(&WorkStealingExecutor::worker_loop, this, i);
+}
+
+void WorkStealingExecutor::stop() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        if (!running)
+            return;
+        running = false;
+    }
+    wake.notify_all();
+    for (auto& t : pool)
+        t.join();
+    pool.clear();
+}
+
+void WorkStealingExecutor::submit(Job job) {
+    // Jobs submitted from a worker stay on that worker, the others pick them up if it's busy
+    size_t index = current_worker >= 0 ? current_worker : next++ % workers.size();
+    {
+        std::lock_guard<std::mutex> guard(workers[index]->lock);
+        workers[index]->push_back(std::move(job));
+    }
+    queued++;
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+    }
+    wake.notify_one();
+}
+
+void WorkStealingExecutor::parallel_for(size_t count, const std::function<void(size_t)>& body) {
+    struct Loop {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        size_t count;
+        const std::function<void(size_t)>* body;
+        std::mutex lock;
+        std::condition_variable finished;
+
+        // Takes indices until none are left. body is only used while something is left to do, so the helpers
+        // that start after the end don't touch it.
+        void run() {
+            size_t index;
+            while ((index = next++) < count) {
+                (*body)(index);
+                if (++done == count) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    finished.notify_all();
+                }
+            }
+        }
+    };
+
+    if (count == 0)
+        return;
+    auto loop = std::make_shared<Loop>();
+    loop -> count = count;
+    loop -> body = &body;
+
+    size_t helpers = std::min(count - 1, workers.size());
+    for (size_t i = 0; i < helpers; i++)
+        submit([loop] { loop -> run(); });
+    loop -> run();
+
+    std::unique_lock<std::mutex> guard(loop -> lock);
+    loop -> finished.wait(guard, [&] { return loop -> done == count; });
+}
+
+void WorkStealingExecutor::worker_loop(size_t index) {
+    current_worker = static_cast<int>(index);
+    Job job;
+    while (true) {
+        if (take(index, job)) {
+            queued--;
+            job();
+            job = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        wake.wait(guard, [&] { return queued > 0 || !running; });
+        if (!running && queued == 0)
+            break;
+    }
+    current_worker = -1;
+}
+
+bool WorkStealingExecutor::take(size_t index, Job& job) {
+    {
+        Worker& own = *workers[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.count > 0) {
+            job = own.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker& victim = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.count > 0) {
+            job = victim.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
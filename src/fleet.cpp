@@ -0,0 +1,309 @@
+#include "cupthor/fleet.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#include "cupthor/rpc.h"
+
+namespace {
+
+int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Replies to request_frame: temperature, cook phase, the settings, smoke and water jet
+const size_t STATE_COMMANDS = 2 + CupThor::SETTINGS + 2;
+const size_t STATE_REPLY = 4 + STATE_COMMANDS * rpc::RESULT_SIZE;
+
+}
+
+FleetGateway::~FleetGateway() {
+    for (Backend& backend : backends) {
+        if (backend.fd >= 0)
+            close(backend.fd);
+    }
+}
+
+bool FleetGateway::parse_backend(const std::string& text, std::string& host, uint16_t& port) {
+    size_t colon = text.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+        return false;
+    char* end = nullptr;
+    long value = std::strtol(text.c_str() + colon + 1, &end, 10);
+    if (end == text.c_str() + colon + 1 || *end != '\0' || value <= 0 || value > 65535)
+        return false;
+    in_addr address;
+    host = text.substr(0, colon);
+    if (inet_pton(AF_INET, host.c_str(), &address) != 1)
+        return false;
+    port = static_cast<uint16_t>(value);
+    return true;
+}
+
+bool FleetGateway::configure(const Options& gateway_options) {
+    std::vector<Backend> configured(gateway_options.backends.size());
+    for (size_t i = 0; i < configured.size(); i++) {
+        configured[i].name = gateway_options.backends[i];
+        configured[i].state.backend = configured[i].name;
+        configured[i].state.error = "connect";
+        if (!parse_backend(configured[i].name, configured[i].host, configured[i].port))
+            return false;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (Backend& backend : backends) {
+        if (backend.fd >= 0)
+            close(backend.fd);
+    }
+    options = gateway_options;
+    backends = std::move(configured);
+    return true;
+}
+
+const std::string& FleetGateway::request_frame() {
+    static const std::string frame = [] {
+        std::vector<rpc::Command> commands;
+        commands.push_back({rpc::GET_TEMPERATURE, 0, 0});
+        commands.push_back({rpc::GET_COOK_PHASE, 0, 0});
+        for (int setting = 0; setting < CupThor::SETTINGS; setting++)
+            commands.push_back({rpc::GET_SETTING, static_cast<uint8_t>(setting), 0});
+        commands.push_back({rpc::GET_SENSOR, CupThor::SMOKE_SENSOR, 0});
+        commands.push_back({rpc::GET_SENSOR, CupThor::WATER_JET, 0});
+        std::string out;
+        rpc::encode_request(commands, out);
+        return out;
+    }();
+    return frame;
+}
+
+void FleetGateway::fail(Backend& backend, const char* error) {
+    if (backend.fd >= 0)
+        close(backend.fd);
+    backend.fd = -1;
+    backend.step = Backend::DONE;
+    backend.state.reachable = false;
+    backend.state.error = error;
+    if (strcmp(error, "timeout") == 0)
+        counters.timeouts++;
+}
+
+void FleetGateway::begin(Backend& backend) {
+    backend.out = request_frame();
+    backend.sent = 0;
+    backend.in.clear();
+
+    // A connection the oven closed since the last round (it restarted) reads as end of file, anything else
+    // waiting on it is a leftover; either way it's replaced
+    if (backend.fd >= 0) {
+        char byte;
+        ssize_t n = recv(backend.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close(backend.fd);
+            backend.fd = -1;
+        }
+    }
+
+    if (backend.fd < 0) {
+        counters.connects++;
+        backend.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (backend.fd < 0) {
+            fail(backend, "connect");
+            return;
+        }
+        int one = 1;
+        setsockopt(backend.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(backend.port);
+        inet_pton(AF_INET, backend.host.c_str(), &addr.sin_addr);
+        if (connect(backend.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            if (errno != EINPROGRESS) {
+                fail(backend, "connect");
+                return;
+            }
+            backend.step = Backend::CONNECTING;
+            return;
+        }
+    }
+    backend.step = Backend::SENDING;
+    advance(backend, POLLOUT);
+}
+
+void FleetGateway::advance(Backend& backend, short events) {
+    if (backend.step == Backend::CONNECTING) {
+        if (!(events & (POLLOUT | POLLERR | POLLHUP)))
+            return;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(backend.fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+            fail(backend, "connect");
+            return;
+        }
+        backend.step = Backend::SENDING;
+    }
+
+    if (backend.step == Backend::SENDING) {
+        while (backend.sent < backend.out.size()) {
+            ssize_t n = send(backend.fd, backend.out.data() + backend.sent, backend.out.size() - backend.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n <= 0) {
+                fail(backend, "closed");
+                return;
+            }
+            backend.sent += n;
+        }
+        backend.step = Backend::RECEIVING;
+        return;
+    }
+
+    if (backend.step == Backend::RECEIVING) {
+        if (!(events & (POLLIN | POLLERR | POLLHUP)))
+            return;
+        char chunk[512];
+        while (backend.in.size() < STATE_REPLY) {
+            ssize_t n = recv(backend.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n <= 0) {
+                fail(backend, "closed");
+                return;
+            }
+            backend.in.append(chunk, n);
+        }
+        if (!decode(backend)) {
+            fail(backend, "closed");
+            return;
+        }
+        backend.step = Backend::DONE;
+    }
+}
+
+bool FleetGateway::decode(Backend& backend) {
+    // Exactly one reply, of the size the request asks for
+    if (backend.in.size() != STATE_REPLY)
+        return false;
+    const unsigned char* size = reinterpret_cast<const unsigned char*>(backend.in.data());
+    if ((size[0] | size[1] << 8 | size[2] << 16 | static_cast<uint32_t>(size[3]) << 24) != STATE_REPLY - 4)
+        return false;
+    std::vector<rpc::Result> results;
+    if (!rpc::decode_reply(backend.in.data() + 4, STATE_REPLY - 4, results))
+        return false;
+
+    OvenState& state = backend.state;
+    size_t at = 0;
+    state.temperature = results[at++].value;
+    state.cook_phase = results[at].status;
+    state.phase_remaining = results[at++].value;
+    for (int setting = 0; setting < CupThor::SETTINGS; setting++)
+        state.settings[setting] = results[at++].value;
+    // An oven older than GET_SENSOR answers BAD_COMMAND, its sensors read as off
+    state.smoke = results[at].status == 1 && results[at].value != 0;
+    at++;
+    state.water_jet = results[at].status == 1 && results[at].value != 0;
+    state.reachable = true;
+    state.error.clear();
+    state.fetched_ms = steady_ms();
+    return true;
+}
+
+void FleetGateway::refresh(int64_t now_ms) {
+    std::vector<Backend*> asking;
+    for (Backend& backend : backends) {
+        // Failures are kept for the TTL as well, an oven that is down doesn't cost every view the deadline
+        if (backend.step != Backend::IDLE && now_ms - backend.checked_ms < options.cache_ttl_ms) {
+            counters.cache_hits++;
+            continue;
+        }
+        begin(backend);
+        asking.push_back(&backend);
+    }
+    if (asking.empty())
+        return;
+    counters.rounds++;
+
+    int64_t deadline = now_ms + options.deadline_ms;
+    std::vector<pollfd> fds;
+    std::vector<Backend*> waiting;
+    while (true) {
+        fds.clear();
+        waiting.clear();
+        for (Backend* backend : asking) {
+            if (backend->step == Backend::DONE)
+                continue;
+            short events = backend->step == Backend::RECEIVING ? POLLIN : POLLOUT;
+            fds.push_back({backend->fd, events, 0});
+            waiting.push_back(backend);
+        }
+        if (fds.empty())
+            break;
+
+        int64_t left = deadline - steady_ms();
+        if (left <= 0) {
+            for (Backend* backend : waiting)
+                fail(*backend, "timeout");
+            break;
+        }
+        int ready = poll(fds.data(), fds.size(), static_cast<int>(left));
+        if (ready < 0 && errno != EINTR) {
+            for (Backend* backend : waiting)
+                fail(*backend, "closed");
+            break;
+        }
+        for (size_t i = 0; i < fds.size() && ready > 0; i++) {
+            if (fds[i].revents != 0)
+                advance(*waiting[i], fds[i].revents);
+        }
+    }
+
+    // A failure is kept from when it was seen
+    int64_t done = steady_ms();
+    for (Backend* backend : asking)
+        backend->checked_ms = backend->state.reachable ? backend->state.fetched_ms : done;
+}
+
+std::vector<OvenState> FleetGateway::states() {
+    std::lock_guard<std::mutex> guard(lock);
+    refresh(steady_ms());
+    std::vector<OvenState> result;
+    result.reserve(backends.size());
+    for (const Backend& backend : backends)
+        result.push_back(backend.state);
+    return result;
+}
+
+std::vector<FleetAlarm> FleetGateway::alarms() {
+    std::lock_guard<std::mutex> guard(lock);
+    refresh(steady_ms());
+    std::vector<FleetAlarm> result;
+    for (const Backend& backend : backends) {
+        const OvenState& oven = backend.state;
+        if (!oven.reachable) {
+            result.push_back({oven.backend, "unreachable", oven.error});
+            continue;
+        }
+        if (oven.smoke)
+            result.push_back({oven.backend, "smoke", ""});
+        if (oven.water_jet)
+            result.push_back({oven.backend, "water_jet", ""});
+        if (oven.temperature > options.overheat_c)
+            result.push_back({oven.backend, "overheat", std::to_string(static_cast<int>(oven.temperature)) + " C"});
+    }
+    return result;
+}
+
+FleetGateway::Stats FleetGateway::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
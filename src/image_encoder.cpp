@@ -0,0 +1,619 @@
+#include "cupthor/image_encoder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "cupthor/executor.h"
+
+namespace {
+
+void put_u16_be(std::string& out, unsigned value) {
+    out += static_cast<char>((value >> 8) & 0xff);
+    out += static_cast<char>(value & 0xff);
+}
+
+void put_u32_be(std::string& out, uint32_t value) {
+    put_u16_be(out, value >> 16);
+    put_u16_be(out, value & 0xffff);
+}
+
+void put_u16_le(unsigned char* p, unsigned value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+void put_u32_le(unsigned char* p, uint32_t value) {
+    put_u16_le(p, value & 0xffff);
+    put_u16_le(p + 2, value >> 16);
+}
+
+uint32_t get_u32_le(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int band_count(const ImageView& image) {
+    return (image.height + ImageEncoder::BAND_ROWS - 1) / ImageEncoder::BAND_ROWS;
+}
+
+// Encodes every band into its own string, in parallel when there is an executor, and appends them in order
+void encode_bands(int bands, WorkStealingExecutor* executor, std::string& out, const std::function<void(int, std::string&)>& encode_band) {
+    std::vector<std::string> parts(bands);
+    auto one = [&](size_t band) {
+        encode_band(static_cast<int>(band), parts[band]);
+    };
+    if (executor != nullptr && executor -> size() > 1)
+        executor -> parallel_for(bands, one);
+    else
+        for (int band = 0; band < bands; band++)
+            one(band);
+
+    size_t size = 0;
+    for (const std::string& part : parts)
+        size += part.size();
+    out.reserve(out.size() + size + 64);
+    for (const std::string& part : parts)
+        out += part;
+}
+
+}
+
+bool ImageView::from_bmp(const unsigned char* file, size_t size) {
+    if (size < 54 || file[0] != 'B' || file[1] != 'M')
+        return false;
+    uint32_t offset = get_u32_le(file + 10);
+    int32_t bmp_width = static_cast<int32_t>(get_u32_le(file + 18));
+    int32_t bmp_height = static_cast<int32_t>(get_u32_le(file + 22));
+    unsigned bits = file[28] | (file[29] << 8);
+    uint32_t compression = get_u32_le(file + 30);
+    if (bits != 24 || compression != 0 || bmp_width <= 0 || bmp_height == 0)
+        return false;
+
+    // Rows are padded to 4 bytes; a positive height means the last row comes first
+    size_t row_size = (static_cast<size_t>(bmp_width) * 3 + 3) & ~static_cast<size_t>(3);
+    size_t rows = static_cast<size_t>(std::abs(bmp_height));
+    if (offset > size || (size - offset) / row_size < rows)
+        return false;
+
+    width = bmp_width;
+    height = static_cast<int>(rows);
+    if (bmp_height > 0) {
+        pixels = file + offset + (rows - 1) * row_size;
+        stride = -static_cast<ptrdiff_t>(row_size);
+    }
+    else {
+        pixels = file + offset;
+        stride = static_cast<ptrdiff_t>(row_size);
+    }
+    return true;
+}
+
+void BmpEncoder::encode(const ImageView& image, std::string& out, WorkStealingExecutor*) const {
+    size_t row_size = (static_cast<size_t>(image.width) * 3 + 3) & ~static_cast<size_t>(3);
+    size_t data_size = row_size * image.height;
+    size_t start = out.size();
+    out.resize(start + 54 + data_size);
+    unsigned char* p = reinterpret_cast<unsigned char*>(&out[start]);
+    memset(p, 0, 54);
+
+    p[0] = 'B';
+    p[1] = 'M';
+    put_u32_le(p + 2, static_cast<uint32_t>(54 + data_size));
+    put_u32_le(p + 10, 54);
+    put_u32_le(p + 14, 40);
+    put_u32_le(p + 18, image.width);
+    put_u32_le(p + 22, image.height);
+    put_u16_le(p + 26, 1);
+    put_u16_le(p + 28, 24);
+    put_u32_le(p + 34, static_cast<uint32_t>(data_size));
+    put_u32_le(p + 38, 2835);
+    put_u32_le(p + 42, 2835);
+
+    // Bottom-up, whatever the order of the view
+    unsigned char* data = p + 54;
+    for (int y = 0; y < image.height; y++) {
+        unsigned char* row = data + (image.height - 1 - y) * row_size;
+        memcpy(row, image.row(y), image.width * 3);
+        memset(row + image.width * 3, 0, row_size - image.width * 3);
+    }
+}
+
+namespace {
+
+// QOI, https://qoiformat.org/qoi-specification.pdf. Pixels are packed as r | g << 8 | b << 16 | a << 24.
+const unsigned char QOI_OP_INDEX = 0x00;
+const unsigned char QOI_OP_DIFF = 0x40;
+const unsigned char QOI_OP_LUMA = 0x80;
+const unsigned char QOI_OP_RUN = 0xc0;
+const unsigned char QOI_OP_RGB = 0xfe;
+
+inline uint32_t qoi_pixel(const unsigned char* bgr) {
+    return bgr[2] | (bgr[1] << 8) | (bgr[0] << 16) | 0xff000000u;
+}
+
+inline int qoi_hash(uint32_t px) {
+    return ((px & 0xff) * 3 + ((px >> 8) & 0xff) * 5 + ((px >> 16) & 0xff) * 7 + (px >> 24) * 11) % 64;
+}
+
+void qoi_band(const ImageView& image, int band, std::string& out) {
+    int first = band * ImageEncoder::BAND_ROWS;
+    int last = std::min(image.height, first + ImageEncoder::BAND_ROWS);
+    // At most 4 bytes a pixel (QOI_OP_RGB), written through a pointer and cut to size at the end
+    out.resize(static_cast<size_t>(last - first) * image.width * 4);
+    unsigned char* at = reinterpret_cast<unsigned char*>(&out[0]);
+
+    // The decoder arrives here with the last pixel of the previous band and an index filled by the earlier
+    // bands. This band only uses the index entries it wrote itself, the decoder has the same ones: the empty
+    // entries (alpha 0) never match an opaque pixel.
+    uint32_t index[64] = {};
+    uint32_t prev = band == 0 ? 0xff000000u : qoi_pixel(image.row(first - 1) + (image.width - 1) * 3);
+    int run = 0;
+
+    for (int y = first; y < last; y++) {
+        const unsigned char* row = image.row(y);
+        for (int x = 0; x < image.width; x++) {
+            uint32_t px = qoi_pixel(row + x * 3);
+            if (px == prev) {
+                run++;
+                if (run == 62) {
+                    *at++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                *at++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            int slot = qoi_hash(px);
+            if (index[slot] == px) {
+                *at++ = QOI_OP_INDEX | slot;
+            }
+            else {
+                index[slot] = px;
+                signed char dr = static_cast<signed char>((px & 0xff) - (prev & 0xff));
+                signed char dg = static_cast<signed char>(((px >> 8) & 0xff) - ((prev >> 8) & 0xff));
+                signed char db = static_cast<signed char>(((px >> 16) & 0xff) - ((prev >> 16) & 0xff));
+                int dr_dg = dr - dg;
+                int db_dg = db - dg;
+                if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                    *at++ = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+                }
+                else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8) {
+                    *at++ = QOI_OP_LUMA | (dg + 32);
+                    *at++ = ((dr_dg + 8) << 4) | (db_dg + 8);
+                }
+                else {
+                    *at++ = QOI_OP_RGB;
+                    *at++ = px & 0xff;
+                    *at++ = (px >> 8) & 0xff;
+                    *at++ = (px >> 16) & 0xff;
+                }
+            }
+            prev = px;
+        }
+    }
+    // A run doesn't go over into the next band, that one starts counting on its own
+    if (run > 0)
+        *at++ = QOI_OP_RUN | (run - 1);
+    out.resize(at - reinterpret_cast<unsigned char*>(&out[0]));
+}
+
+}
+
+void QoiEncoder::encode(const ImageView& image, std::string& out, WorkStealingExecutor* executor) const {
+    out += "qoif";
+    put_u32_be(out, image.width);
+    put_u32_be(out, image.height);
+    out += static_cast<char>(3);  // RGB
+    out += static_cast<char>(0);  // sRGB
+
+    encode_bands(band_count(image), executor, out, [&image](int band, std::string& part) {
+        qoi_band(image, band, part);
+    });
+
+    static const char end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    out.append(end_marker, 8);
+}
+
+namespace {
+
+// Baseline JPEG (ITU T.81) with the example tables of its annex K: quantization K.1 and K.2, Huffman K.3 to K.6
+
+const unsigned char ZIGZAG[64] = {
+    0, 1, 5, 6, 14, 15, 27, 28, 2, 4, 7, 13, 16, 26, 29, 42, 3, 8, 12, 17, 25, 30, 41, 43, 9, 11, 18, 24, 31, 40, 44, 53,
+    10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60, 21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63
+};
+
+const unsigned char LUMA_QUANT[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+
+const unsigned char CHROMA_QUANT[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Number of codes of each length 1..16, then the symbols
+const unsigned char DC_LUMA_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+const unsigned char DC_CHROMA_BITS[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+const unsigned char DC_VALUES[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+const unsigned char AC_LUMA_BITS[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+const unsigned char AC_LUMA_VALUES[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32,
+    0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+    0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
+    0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+    0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+const unsigned char AC_CHROMA_BITS[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+const unsigned char AC_CHROMA_VALUES[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81,
+    0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92,
+    0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6,
+    0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+// Code and length of every symbol of a Huffman table
+struct HuffmanCodes {
+    uint16_t code[256];
+    uint8_t length[256];
+
+    HuffmanCodes(const unsigned char* bits, const unsigned char* values) {
+        memset(length, 0, sizeof(length));
+        unsigned next = 0;
+        int k = 0;
+        for (int size = 1; size <= 16; size++) {
+            for (int i = 0; i < bits[size - 1]; i++, k++) {
+                code[values[k]] = static_cast<uint16_t>(next++);
+                length[values[k]] = static_cast<uint8_t>(size);
+            }
+            next <<= 1;
+        }
+    }
+};
+
+const HuffmanCodes& dc_luma() {
+    static const HuffmanCodes codes(DC_LUMA_BITS, DC_VALUES);
+    return codes;
+}
+
+const HuffmanCodes& dc_chroma() {
+    static const HuffmanCodes codes(DC_CHROMA_BITS, DC_VALUES);
+    return codes;
+}
+
+const HuffmanCodes& ac_luma() {
+    static const HuffmanCodes codes(AC_LUMA_BITS, AC_LUMA_VALUES);
+    return codes;
+}
+
+const HuffmanCodes& ac_chroma() {
+    static const HuffmanCodes codes(AC_CHROMA_BITS, AC_CHROMA_VALUES);
+    return codes;
+}
+
+// Entropy coded bits, with a 0 after every 0xff byte
+class BitWriter {
+public:
+    explicit BitWriter(std::string& out)
+        : out(out)
+    { }
+
+    void write(unsigned code, int length) {
+        bits = (bits << length) | (code & ((1u << length) - 1));
+        count += length;
+        while (count >= 8) {
+            count -= 8;
+            unsigned char byte = static_cast<unsigned char>(bits >> count);
+            out += static_cast<char>(byte);
+            if (byte == 0xff)
+                out += '\0';
+        }
+    }
+
+    // Pads the last byte with 1 bits, before a marker
+    void flush() {
+        if (count > 0)
+            write(0x7f, 8 - count);
+    }
+
+private:
+    std::string& out;
+    uint32_t bits = 0;
+    int count = 0;
+};
+
+// Separable AAN forward DCT of one row or column, the result is scaled (see JpegEncoder's scale tables)
+inline void fdct_1d(float* d, int step) {
+    float tmp0 = d[0] + d[7 * step];
+    float tmp7 = d[0] - d[7 * step];
+    float tmp1 = d[step] + d[6 * step];
+    float tmp6 = d[step] - d[6 * step];
+    float tmp2 = d[2 * step] + d[5 * step];
+    float tmp5 = d[2 * step] - d[5 * step];
+    float tmp3 = d[3 * step] + d[4 * step];
+    float tmp4 = d[3 * step] - d[4 * step];
+
+    float tmp10 = tmp0 + tmp3;
+    float tmp13 = tmp0 - tmp3;
+    float tmp11 = tmp1 + tmp2;
+    float tmp12 = tmp1 - tmp2;
+
+    d[0] = tmp10 + tmp11;
+    d[4 * step] = tmp10 - tmp11;
+    float z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2 * step] = tmp13 + z1;
+    d[6 * step] = tmp13 - z1;
+
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+    float z5 = (tmp10 - tmp12) * 0.382683433f;
+    float z2 = tmp10 * 0.541196100f + z5;
+    float z4 = tmp12 * 1.306562965f + z5;
+    float z3 = tmp11 * 0.707106781f;
+    float z11 = tmp7 + z3;
+    float z13 = tmp7 - z3;
+
+    d[5 * step] = z13 + z2;
+    d[3 * step] = z13 - z2;
+    d[step] = z11 + z4;
+    d[7 * step] = z11 - z4;
+}
+
+// Magnitude category of a coefficient and its bits, as T.81 F.1.2.1 encodes them
+inline void category(int value, unsigned& bits, int& length) {
+    int magnitude = value < 0 ? -value : value;
+    length = 0;
+    while (magnitude) {
+        length++;
+        magnitude >>= 1;
+    }
+    bits = static_cast<unsigned>(value < 0 ? value - 1 : value) & ((1u << length) - 1);
+}
+
+// Transforms, quantizes and writes one 8x8 block (modified in place). Returns its DC coefficient.
+int encode_block(BitWriter& writer, float* block, const float* scale, int previous_dc, const HuffmanCodes& dc, const HuffmanCodes& ac) {
+    for (int row = 0; row < 8; row++)
+        fdct_1d(block + row * 8, 1);
+    for (int column = 0; column < 8; column++)
+        fdct_1d(block + column, 8);
+
+    int zigzag[64];
+    for (int i = 0; i < 64; i++) {
+        float v = block[i] * scale[i];
+        zigzag[ZIGZAG[i]] = static_cast<int>(v < 0 ? v - 0.5f : v + 0.5f);
+    }
+
+    unsigned bits;
+    int length;
+    category(zigzag[0] - previous_dc, bits, length);
+    writer.write(dc.code[length], dc.length[length]);
+    if (length)
+        writer.write(bits, length);
+
+    int last = 63;
+    while (last > 0 && zigzag[last] == 0)
+        last--;
+    int zeros = 0;
+    for (int i = 1; i <= last; i++) {
+        if (zigzag[i] == 0) {
+            zeros++;
+            continue;
+        }
+        while (zeros >= 16) {
+            writer.write(ac.code[0xf0], ac.length[0xf0]);
+            zeros -= 16;
+        }
+        category(zigzag[i], bits, length);
+        int symbol = (zeros << 4) | length;
+        writer.write(ac.code[symbol], ac.length[symbol]);
+        writer.write(bits, length);
+        zeros = 0;
+    }
+    if (last != 63)
+        writer.write(ac.code[0], ac.length[0]);
+    return zigzag[0];
+}
+
+void put_huffman_table(std::string& out, int table_class_id, const unsigned char* bits, const unsigned char* values) {
+    int count = 0;
+    for (int i = 0; i < 16; i++)
+        count += bits[i];
+    out += static_cast<char>(table_class_id);
+    out.append(reinterpret_cast<const char*>(bits), 16);
+    out.append(reinterpret_cast<const char*>(values), count);
+}
+
+}
+
+JpegEncoder::JpegEncoder(int quality)
+    : quality(std::min(100, std::max(1, quality)))
+{
+    // The IJG scaling of the annex K tables
+    int factor = this -> quality < 50 ? 5000 / this -> quality : 200 - this -> quality * 2;
+    for (int i = 0; i < 64; i++) {
+        luma_table[ZIGZAG[i]] = static_cast<unsigned char>(std::min(255, std::max(1, (LUMA_QUANT[i] * factor + 50) / 100)));
+        chroma_table[ZIGZAG[i]] = static_cast<unsigned char>(std::min(255, std::max(1, (CHROMA_QUANT[i] * factor + 50) / 100)));
+    }
+
+    // Undoes the scaling of the AAN DCT and divides by the quantizer in one multiplication
+    static const float aan[8] = {
+        1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
+        1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f
+    };
+    for (int row = 0, k = 0; row < 8; row++) {
+        for (int column = 0; column < 8; column++, k++) {
+            luma_scale[k] = 1.0f / (luma_table[ZIGZAG[k]] * aan[row] * aan[column]);
+            chroma_scale[k] = 1.0f / (chroma_table[ZIGZAG[k]] * aan[row] * aan[column]);
+        }
+    }
+}
+
+void JpegEncoder::encode_band(const ImageView& image, int band, std::string& out) const {
+    // A band is one row of 16x16 MCUs: four luma blocks and one block of each chroma component, subsampled 2x2
+    out.reserve(static_cast<size_t>(image.width) * BAND_ROWS);
+    BitWriter writer(out);
+    int dc_y = 0, dc_cb = 0, dc_cr = 0;
+    int top = band * BAND_ROWS;
+
+    float y[256], cb[256], cr[256];
+    float block[64];
+    for (int left = 0; left < image.width; left += 16) {
+        for (int row = 0; row < 16; row++) {
+            // Outside the picture the edge pixels are repeated
+            const unsigned char* line = image.row(std::min(top + row, image.height - 1));
+            for (int column = 0; column < 16; column++) {
+                const unsigned char* px = line + std::min(left + column, image.width - 1) * 3;
+                float b = px[0], g = px[1], r = px[2];
+                int at = row * 16 + column;
+                y[at] = 0.29900f * r + 0.58700f * g + 0.11400f * b - 128;
+                cb[at] = -0.16874f * r - 0.33126f * g + 0.50000f * b;
+                cr[at] = 0.50000f * r - 0.41869f * g - 0.08131f * b;
+            }
+        }
+
+        for (int by = 0; by < 16; by += 8) {
+            for (int bx = 0; bx < 16; bx += 8) {
+                for (int row = 0; row < 8; row++)
+                    memcpy(block + row * 8, y + (by + row) * 16 + bx, 8 * sizeof(float));
+                dc_y = encode_block(writer, block, luma_scale, dc_y, dc_luma(), ac_luma());
+            }
+        }
+
+        for (int row = 0; row < 8; row++) {
+            for (int column = 0; column < 8; column++) {
+                int at = row * 32 + column * 2;
+                block[row * 8 + column] = (cb[at] + cb[at + 1] + cb[at + 16] + cb[at + 17]) * 0.25f;
+            }
+        }
+        dc_cb = encode_block(writer, block, chroma_scale, dc_cb, dc_chroma(), ac_chroma());
+
+        for (int row = 0; row < 8; row++) {
+            for (int column = 0; column < 8; column++) {
+                int at = row * 32 + column * 2;
+                block[row * 8 + column] = (cr[at] + cr[at + 1] + cr[at + 16] + cr[at + 17]) * 0.25f;
+            }
+        }
+        dc_cr = encode_block(writer, block, chroma_scale, dc_cr, dc_chroma(), ac_chroma());
+    }
+    writer.flush();
+
+    // Every band but the last ends with a restart marker, the decoder resets its DC predictions there
+    if ((band + 1) * BAND_ROWS < image.height) {
+        out += '\xff';
+        out += static_cast<char>(0xd0 + band % 8);
+    }
+}
+
+void JpegEncoder::encode(const ImageView& image, std::string& out, WorkStealingExecutor* executor) const {
+    static const unsigned char head[] = {
+        0xff, 0xd8,                                                                  // SOI
+        0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0          // APP0 JFIF 1.1
+    };
+    out.append(reinterpret_cast<const char*>(head), sizeof(head));
+
+    // DQT, both tables
+    out += '\xff';
+    out += '\xdb';
+    put_u16_be(out, 2 + 2 * 65);
+    out += '\0';
+    out.append(reinterpret_cast<const char*>(luma_table), 64);
+    out += '\1';
+    out.append(reinterpret_cast<const char*>(chroma_table), 64);
+
+    // SOF0: 8 bits, Y sampled 2x2, Cb and Cr 1x1 on the second table
+    out += '\xff';
+    out += '\xc0';
+    put_u16_be(out, 17);
+    out += '\x08';
+    put_u16_be(out, image.height);
+    put_u16_be(out, image.width);
+    static const unsigned char components[] = {3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1};
+    out.append(reinterpret_cast<const char*>(components), sizeof(components));
+
+    // DHT, the four annex K tables
+    out += '\xff';
+    out += '\xc4';
+    put_u16_be(out, 2 + 4 * 17 + 12 + 12 + 162 + 162);
+    put_huffman_table(out, 0x00, DC_LUMA_BITS, DC_VALUES);
+    put_huffman_table(out, 0x10, AC_LUMA_BITS, AC_LUMA_VALUES);
+    put_huffman_table(out, 0x01, DC_CHROMA_BITS, DC_VALUES);
+    put_huffman_table(out, 0x11, AC_CHROMA_BITS, AC_CHROMA_VALUES);
+
+    // DRI: a restart after every row of MCUs, that is every band
+    out += '\xff';
+    out += '\xdd';
+    put_u16_be(out, 4);
+    put_u16_be(out, (image.width + 15) / 16);
+
+    // SOS
+    static const unsigned char scan[] = {0xff, 0xda, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0};
+    out.append(reinterpret_cast<const char*>(scan), sizeof(scan));
+
+    encode_bands(band_count(image), executor, out, [this, &image](int band, std::string& part) {
+        encode_band(image, band, part);
+    });
+
+    out += '\xff';
+    out += '\xd9';
+}
+
+const ImageEncoder* ImageEncoders::for_accept(const std::string& accept) const {
+    const ImageEncoder* best = nullptr;
+    double best_q = 0;
+
+    size_t at = 0;
+    while (at < accept.size()) {
+        size_t end = accept.find(',', at);
+        if (end == std::string::npos)
+            end = accept.size();
+        std::string range = accept.substr(at, end - at);
+        at = end + 1;
+
+        // "type/subtype;param=value;q=0.5"
+        double q = 1;
+        size_t semicolon = range.find(';');
+        std::string type = range.substr(0, semicolon);
+        while (semicolon != std::string::npos) {
+            size_t next = range.find(';', semicolon + 1);
+            std::string param = range.substr(semicolon + 1, next == std::string::npos ? std::string::npos : next - semicolon - 1);
+            param.erase(std::remove_if(param.begin(), param.end(), ::isspace), param.end());
+            if (param.compare(0, 2, "q=") == 0)
+                q = std::atof(param.c_str() + 2);
+            semicolon = next;
+        }
+        type.erase(std::remove_if(type.begin(), type.end(), ::isspace), type.end());
+        std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+        const ImageEncoder* encoder = nullptr;
+        if (type == "image/jpeg" || type == "image/*")
+            encoder = &jpeg;
+        else if (type == "image/qoi")
+            encoder = &qoi;
+        else if (type == "image/bmp")
+            encoder = &bmp;
+        if (encoder != nullptr && q > best_q) {
+            best = encoder;
+            best_q = q;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,444 @@
+#include "cupthor/logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace {
+
+const char MAGIC[4] = {'C', 'T', 'L', 'G'};
+// size, level, field count, thread, time
+const size_t EVENT_HEADER = 2 + 1 + 1 + 4 + 8;
+const size_t MAX_NAME = 0xFF;
+const size_t MAX_STRING = 1024;
+const size_t MAX_FIELDS = 0xFF;
+
+std::atomic<uint64_t> next_logger_id{1};
+
+// The ring of this thread for the logger `owner`. The thread holds a reference to it, and marks it retired when
+// it exits (or starts logging to another logger) so that the writer frees it.
+struct ThreadRing {
+    uint64_t owner = 0;
+    void* ring = nullptr;
+    std::shared_ptr<void> reference;
+    std::atomic<bool>* retired = nullptr;
+
+    void retire() {
+        if (retired != nullptr)
+            retired->store(true, std::memory_order_release);
+        reference.reset();
+        retired = nullptr;
+        ring = nullptr;
+    }
+
+    ~ThreadRing() {
+        retire();
+    }
+};
+
+thread_local ThreadRing this_thread_ring;
+
+template <typename T>
+T get(const char*& p) {
+    T value;
+    memcpy(&value, p, sizeof(value));
+    p += sizeof(value);
+    return value;
+}
+
+void append_json_string(std::string& out, const char* s, size_t n) {
+    out += '"';
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '\r')
+            out += "\\r";
+        else if (c == '\t')
+            out += "\\t";
+        else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+// One event of a ring or of a binary log as a JSON line. False if it doesn't hold together.
+bool append_json_event(std::string& out, const char* event, size_t size) {
+    const char* p = event;
+    const char* end = event + size;
+    if (size < EVENT_HEADER + 1)
+        return false;
+    get<uint16_t>(p);
+    uint8_t level = get<uint8_t>(p);
+    uint8_t count = get<uint8_t>(p);
+    uint32_t thread = get<uint32_t>(p);
+    uint64_t time_us = get<uint64_t>(p);
+    uint8_t name_length = get<uint8_t>(p);
+    if (p + name_length > end)
+        return false;
+
+    char number[64];
+    snprintf(number, sizeof(number), "{\"time_us\":%" PRIu64 ",\"level\":\"", time_us);
+    out += number;
+    out += Logger::level_name(level);
+    snprintf(number, sizeof(number), "\",\"thread\":%" PRIu32 ",\"event\":", thread);
+    out += number;
+    append_json_string(out, p, name_length);
+    p += name_length;
+
+    for (int i = 0; i < count; i++) {
+        if (p + 2 > end)
+            return false;
+        uint8_t key_length = get<uint8_t>(p);
+        if (p + key_length + 1 > end)
+            return false;
+        out += ',';
+        append_json_string(out, p, key_length);
+        p += key_length;
+        out += ':';
+        uint8_t type = get<uint8_t>(p);
+        if (type == LogField::INT && p + 8 <= end) {
+            snprintf(number, sizeof(number), "%" PRId64, get<int64_t>(p));
+            out += number;
+        }
+        else if (type == LogField::DOUBLE && p + 8 <= end) {
+            double value = get<double>(p);
+            // JSON has no NaN or infinity
+            if (value != value || value > 1e308 || value < -1e308)
+                out += "null";
+            else {
+                snprintf(number, sizeof(number), "%.17g", value);
+                out += number;
+            }
+        }
+        else if (type == LogField::BOOL && p + 1 <= end)
+            out += get<uint8_t>(p) ? "true" : "false";
+        else if (type == LogField::STRING && p + 2 <= end) {
+            uint16_t length = get<uint16_t>(p);
+            if (p + length > end)
+                return false;
+            append_json_string(out, p, length);
+            p += length;
+        }
+        else
+            return false;
+    }
+    out += "}\n";
+    return true;
+}
+
+}
+
+Logger::~Logger() {
+    stop();
+}
+
+const char* Logger::level_name(int level) {
+    static const char* names[] = {"debug", "info", "warn", "error"};
+    return (level >= LOG_DEBUG && level <= LOG_ERROR) ? names[level] : "info";
+}
+
+int Logger::level_from_name(const std::string& name) {
+    for (int level = LOG_DEBUG; level <= LOG_ERROR; level++) {
+        if (name == level_name(level))
+            return level;
+    }
+    return -1;
+}
+
+bool Logger::start(const Options& logger_options) {
+    if (running || logger_options.ring_bytes < 4096 || logger_options.keep < 1)
+        return false;
+    options = logger_options;
+    if (!open_file())
+        return false;
+
+    id = next_logger_id++;
+    stopping = false;
+    running = true;
+    writer = std::thread(&Logger::writer_loop, this);
+    return true;
+}
+
+void Logger::stop() {
+    if (!running.exchange(false))
+        return;
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+    if (file != nullptr)
+        std::fclose(file);
+    file = nullptr;
+}
+
+bool Logger::open_file() {
+    file = std::fopen(options.path.c_str(), options.format == BINARY ? "ab" : "a");
+    if (file == nullptr) {
+        perror(("open " + options.path).c_str());
+        return false;
+    }
+    struct stat info;
+    file_bytes = fstat(fileno(file), &info) == 0 ? info.st_size : 0;
+    if (options.format == BINARY && file_bytes == 0) {
+        std::fwrite(MAGIC, 1, sizeof(MAGIC), file);
+        uint32_t version = VERSION;
+        std::fwrite(&version, sizeof(version), 1, file);
+        file_bytes = sizeof(MAGIC) + sizeof(version);
+    }
+    return true;
+}
+
+void Logger::rotate() {
+    std::fclose(file);
+    file = nullptr;
+    for (int n = options.keep - 1; n >= 1; n--) {
+        std::string from = n == 1 ? options.path : options.path + "." + std::to_string(n - 1);
+        std::rename(from.c_str(), (options.path + "." + std::to_string(n)).c_str());
+    }
+    if (options.keep == 1)
+        std::remove(options.path.c_str());
+    // Nowhere to write any more: file stays nullptr and the writer throws away what it drains
+    open_file();
+}
+
+Logger::Ring* Logger::ring_of_this_thread() {
+    ThreadRing& cached = this_thread_ring;
+    if (cached.owner == id)
+        return static_cast<Ring*>(cached.ring);
+
+    // First event of this thread, the only time it takes a lock
+    cached.retire();
+    std::shared_ptr<Ring> ring;
+    {
+        std::lock_guard<std::mutex> guard(rings_lock);
+        ring = std::make_shared<Ring>(options.ring_bytes, next_thread++);
+        rings.push_back(ring);
+    }
+    cached.owner = id;
+    cached.ring = ring.get();
+    cached.retired = &ring->retired;
+    cached.reference = ring;
+    return ring.get();
+}
+
+namespace {
+
+char* put_bytes(char* p, const void* from, size_t n) {
+    memcpy(p, from, n);
+    return p + n;
+}
+
+template <typename T>
+char* put_value(char* p, T value) {
+    memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+}
+
+}
+
+void Logger::write(LogLevel level, const char* event, const LogField* fields, size_t count) {
+    if (level < options.level || !running.load(std::memory_order_relaxed))
+        return;
+
+    count = std::min(count, MAX_FIELDS);
+    uint8_t name_lengths[MAX_FIELDS];
+    size_t event_length = std::min(strlen(event), MAX_NAME);
+    size_t size = EVENT_HEADER + 1 + event_length;
+    for (size_t i = 0; i < count; i++) {
+        name_lengths[i] = static_cast<uint8_t>(std::min(strlen(fields[i].name), MAX_NAME));
+        size += 1 + name_lengths[i] + 1;
+        switch (fields[i].type) {
+            case LogField::BOOL: size += 1; break;
+            case LogField::STRING: size += 2 + std::min(fields[i].length, MAX_STRING); break;
+            default: size += 8; break;
+        }
+    }
+
+    Ring& ring = *ring_of_this_thread();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (size > 0xFFFF || size > ring.data.size() - (head - ring.tail.load(std::memory_order_acquire))) {
+        drops.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Serialized in place; an event that would wrap around the end of the ring goes through the scratch buffer and
+    // is copied in two pieces
+    size_t offset = head % ring.data.size();
+    bool wraps = offset + size > ring.data.size();
+    if (wraps && ring.scratch.size() < size)
+        ring.scratch.resize(0x10000);
+    char* start = wraps ? ring.scratch.data() : ring.data.data() + offset;
+
+    char* p = start;
+    p = put_value<uint16_t>(p, static_cast<uint16_t>(size));
+    p = put_value<uint8_t>(p, level);
+    p = put_value<uint8_t>(p, static_cast<uint8_t>(count));
+    p = put_value<uint32_t>(p, ring.thread);
+    p = put_value<uint64_t>(p, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    p = put_value<uint8_t>(p, static_cast<uint8_t>(event_length));
+    p = put_bytes(p, event, event_length);
+    for (size_t i = 0; i < count; i++) {
+        const LogField& field = fields[i];
+        p = put_value<uint8_t>(p, name_lengths[i]);
+        p = put_bytes(p, field.name, name_lengths[i]);
+        p = put_value<uint8_t>(p, field.type);
+        if (field.type == LogField::INT)
+            p = put_value<int64_t>(p, field.i);
+        else if (field.type == LogField::DOUBLE)
+            p = put_value<double>(p, field.d);
+        else if (field.type == LogField::BOOL)
+            p = put_value<uint8_t>(p, field.b);
+        else {
+            uint16_t length = static_cast<uint16_t>(std::min(field.length, MAX_STRING));
+            p = put_value<uint16_t>(p, length);
+            p = put_bytes(p, field.s, length);
+        }
+    }
+
+    if (wraps) {
+        size_t first = ring.data.size() - offset;
+        memcpy(ring.data.data() + offset, ring.scratch.data(), first);
+        memcpy(ring.data.data(), ring.scratch.data() + first, size - first);
+    }
+    ring.head.store(head + size, std::memory_order_release);
+    // Only this thread writes it, no read-modify-write needed
+    ring.events.store(ring.events.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+uint64_t Logger::logged() {
+    std::lock_guard<std::mutex> guard(rings_lock);
+    uint64_t total = retired_events;
+    for (auto& ring : rings)
+        total += ring->events.load(std::memory_order_relaxed);
+    return total;
+}
+
+size_t Logger::drain(Ring& ring, std::vector<char>& out) {
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    size_t n = head - tail;
+    if (n == 0)
+        return 0;
+
+    size_t offset = tail % ring.data.size();
+    size_t first = std::min(n, ring.data.size() - offset);
+    out.insert(out.end(), ring.data.begin() + offset, ring.data.begin() + offset + first);
+    out.insert(out.end(), ring.data.begin(), ring.data.begin() + (n - first));
+    ring.tail.store(head, std::memory_order_release);
+    return n;
+}
+
+void Logger::writer_loop() {
+    std::vector<char> drained;
+    std::string out;
+    std::vector<std::shared_ptr<Ring>> snapshot;
+    std::vector<Ring*> finished;
+    bool last = false;
+
+    while (!last) {
+        {
+            std::unique_lock<std::mutex> guard(wake_lock);
+            wake.wait_for(guard, std::chrono::milliseconds(50), [this] { return stopping; });
+            last = stopping;
+        }
+        {
+            std::lock_guard<std::mutex> guard(rings_lock);
+            snapshot.assign(rings.begin(), rings.end());
+        }
+        // Every ring only holds whole events. Events of different threads end up slightly out of order, they all
+        // carry their time. A ring retired before its drain gets no more events, it can go once drained.
+        drained.clear();
+        finished.clear();
+        for (auto& ring : snapshot) {
+            if (ring->retired.load(std::memory_order_acquire))
+                finished.push_back(ring.get());
+            drain(*ring, drained);
+        }
+        snapshot.clear();
+        if (!finished.empty()) {
+            std::lock_guard<std::mutex> guard(rings_lock);
+            rings.erase(std::remove_if(rings.begin(), rings.end(), [&](const std::shared_ptr<Ring>& ring) {
+                if (std::find(finished.begin(), finished.end(), ring.get()) == finished.end())
+                    return false;
+                retired_events += ring->events.load(std::memory_order_relaxed);
+                return true;
+            }), rings.end());
+        }
+        if (drained.empty() || file == nullptr)
+            continue;
+
+        // Whole events go to one file, the rotation happens between them
+        size_t at = 0;
+        while (at < drained.size()) {
+            uint16_t size16;
+            memcpy(&size16, drained.data() + at, sizeof(size16));
+            size_t size = size16;
+            out.clear();
+            if (options.format == BINARY)
+                out.assign(drained.data() + at, size);
+            else
+                append_json_event(out, drained.data() + at, size);
+            at += size;
+
+            if (file_bytes > 0 && file_bytes + out.size() > options.max_bytes) {
+                std::fflush(file);
+                rotate();
+                if (file == nullptr)
+                    break;
+            }
+            std::fwrite(out.data(), 1, out.size(), file);
+            file_bytes += out.size();
+        }
+        if (file != nullptr)
+            std::fflush(file);
+    }
+}
+
+bool Logger::to_json(const std::string& path, std::FILE* out) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        perror(("open " + path).c_str());
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        std::fread(&version, sizeof(version), 1, file) != 1 || version != VERSION) {
+        fprintf(stderr, "%s is not a binary log\n", path.c_str());
+        std::fclose(file);
+        return false;
+    }
+
+    std::vector<char> event;
+    std::string line;
+    while (true) {
+        uint16_t size;
+        if (std::fread(&size, sizeof(size), 1, file) != 1 || size < EVENT_HEADER + 1)
+            break;
+        event.resize(size);
+        memcpy(event.data(), &size, sizeof(size));
+        if (std::fread(event.data() + sizeof(size), 1, size - sizeof(size), file) != size - sizeof(size))
+            break;
+        line.clear();
+        if (!append_json_event(line, event.data(), size))
+            break;
+        std::fwrite(line.data(), 1, line.size(), out);
+    }
+    std::fclose(file);
+    return true;
+}
@@ -0,0 +1,356 @@
+#include "cupthor/playback.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+// Value of a Base64 digit, -1 for anything else
+struct Base64Table {
+    int8_t value[256];
+
+    Base64Table() {
+        memset(value, -1, sizeof(value));
+        const char* digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 64; i++)
+            value[static_cast<unsigned char>(digits[i])] = static_cast<int8_t>(i);
+    }
+};
+
+const Base64Table base64_table;
+
+uint16_t read_u16(const unsigned char* p) {
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+uint32_t read_u32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 | static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+void write_u16(unsigned char* p, uint16_t value) {
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+}
+
+void write_u32(unsigned char* p, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        p[i] = (value >> (8 * i)) & 0xff;
+}
+
+// The PCM of an uploaded song: where its samples are and their format
+struct Pcm {
+    const unsigned char* data = nullptr;
+    size_t frames = 0;
+    uint32_t sample_rate = 44100;
+    uint16_t channels = 1;
+};
+
+// The data chunk of a 16 bit PCM WAV file. False if bytes isn't one.
+bool parse_wav(const std::string& bytes, Pcm& pcm) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(bytes.data());
+    size_t size = bytes.size();
+    if (size < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0)
+        return false;
+
+    bool format_found = false;
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        uint32_t chunk = read_u32(p + pos + 4);
+        const unsigned char* body = p + pos + 8;
+        size_t available = std::min<size_t>(chunk, size - pos - 8);
+        if (memcmp(p + pos, "fmt ", 4) == 0 && available >= 16) {
+            // PCM only, 16 bits per sample
+            if (read_u16(body) != 1 || read_u16(body + 14) != 16 || read_u16(body + 2) == 0 || read_u32(body + 4) == 0)
+                return false;
+            pcm.channels = read_u16(body + 2);
+            pcm.sample_rate = read_u32(body + 4);
+            format_found = true;
+        }
+        else if (memcmp(p + pos, "data", 4) == 0 && format_found) {
+            // A data chunk cut short (the file was cut) is played up to where it stops
+            pcm.data = body;
+            pcm.frames = available / (2 * pcm.channels);
+            return true;
+        }
+        pos += 8 + chunk + (chunk & 1);
+    }
+    return false;
+}
+
+}
+
+bool base64_decode(const std::string& text, std::string& out) {
+    size_t size = text.size();
+    if (size == 0 || size % 4 != 0)
+        return false;
+    size_t padding = text[size - 1] == '=' ? (text[size - 2] == '=' ? 2 : 1) : 0;
+
+    out.resize(size / 4 * 3 - padding);
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(text.data());
+    char* p = &out[0];
+    // Whole groups, the last one (which can have padding) is done apart
+    size_t full = size - 4;
+    for (size_t i = 0; i < full; i += 4) {
+        int a = base64_table.value[in[i]], b = base64_table.value[in[i + 1]];
+        int c = base64_table.value[in[i + 2]], d = base64_table.value[in[i + 3]];
+        if ((a | b | c | d) < 0)
+            return false;
+        uint32_t group = a << 18 | b << 12 | c << 6 | d;
+        *p++ = static_cast<char>(group >> 16);
+        *p++ = static_cast<char>(group >> 8);
+        *p++ = static_cast<char>(group);
+    }
+
+    int digits[4];
+    for (int k = 0; k < 4; k++) {
+        if (k >= 4 - static_cast<int>(padding)) {
+            digits[k] = 0;
+            continue;
+        }
+        digits[k] = base64_table.value[in[full + k]];
+        if (digits[k] < 0)
+            return false;
+    }
+    uint32_t group = digits[0] << 18 | digits[1] << 12 | digits[2] << 6 | digits[3];
+    *p++ = static_cast<char>(group >> 16);
+    if (padding < 2)
+        *p++ = static_cast<char>(group >> 8);
+    if (padding < 1)
+        *p++ = static_cast<char>(group);
+    return true;
+}
+
+std::shared_ptr<const Song> decode_song(const std::string& base64, const AudioFormat& format, size_t max_bytes, int* error) {
+    int ignored;
+    if (error == nullptr)
+        error = &ignored;
+    *error = SONG_NO_SOUND;
+    std::string bytes;
+    if (!base64_decode(base64, bytes))
+        return nullptr;
+
+    Pcm pcm;
+    if (!parse_wav(bytes, pcm)) {
+        pcm.data = reinterpret_cast<const unsigned char*>(bytes.data());
+        pcm.frames = bytes.size() / 2;
+    }
+    if (pcm.frames == 0 || format.channels == 0 || format.sample_rate == 0)
+        return nullptr;
+    if (pcm.sample_rate < MIN_SONG_SAMPLE_RATE || pcm.sample_rate > MAX_SONG_SAMPLE_RATE) {
+        *error = SONG_BAD_RATE;
+        return nullptr;
+    }
+
+    // Nearest sample resampling, the position in the song in 32.32 fixed point
+    uint64_t step = (static_cast<uint64_t>(pcm.sample_rate) << 32) / format.sample_rate;
+    uint64_t frames = (static_cast<uint64_t>(pcm.frames) << 32) / step;
+    // The rates are bounded, so this can't overflow: frames is at most 24 times pcm.frames
+    if (frames * format.channels > max_bytes / sizeof(int16_t)) {
+        *error = SONG_TOO_LARGE;
+        return nullptr;
+    }
+
+    *error = SONG_DECODED;
+    std::shared_ptr<Song> song = std::make_shared<Song>();
+    song->channels = format.channels;
+    song->samples.resize(frames * format.channels);
+    int16_t* out = song->samples.data();
+    uint64_t position = 0;
+    for (size_t i = 0; i < frames; i++, position += step) {
+        size_t frame = std::min<size_t>(position >> 32, pcm.frames - 1);
+        const unsigned char* in = pcm.data + frame * 2 * pcm.channels;
+        if (format.channels == 1 && pcm.channels > 1) {
+            // Down to mono: the mean of the first two channels
+            *out++ = static_cast<int16_t>((static_cast<int16_t>(read_u16(in)) + static_cast<int16_t>(read_u16(in + 2))) / 2);
+            continue;
+        }
+        for (uint16_t c = 0; c < format.channels; c++) {
+            uint16_t from = std::min<uint16_t>(c, pcm.channels - 1);
+            *out++ = static_cast<int16_t>(read_u16(in + 2 * from));
+        }
+    }
+    return song;
+}
+
+WavSink::~WavSink() {
+    close();
+}
+
+bool WavSink::open(const AudioFormat& format) {
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        perror(("open " + path).c_str());
+        return false;
+    }
+    data_bytes = 0;
+
+    // The sizes are left at 0 until close
+    unsigned char header[44] = {};
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    write_u32(header + 16, 16);
+    write_u16(header + 20, 1);
+    write_u16(header + 22, format.channels);
+    write_u32(header + 24, format.sample_rate);
+    write_u32(header + 28, format.sample_rate * format.channels * 2);
+    write_u16(header + 32, format.channels * 2);
+    write_u16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    return std::fwrite(header, sizeof(header), 1, file) == 1;
+}
+
+void WavSink::write(const int16_t* samples, size_t count) {
+    if (file == nullptr)
+        return;
+    // WAV is little endian, like every machine the oven runs on
+    data_bytes += std::fwrite(samples, sizeof(int16_t), count, file) * sizeof(int16_t);
+}
+
+void WavSink::close() {
+    if (file == nullptr)
+        return;
+    unsigned char size[4];
+    write_u32(size, static_cast<uint32_t>(std::min<uint64_t>(data_bytes + 36, UINT32_MAX)));
+    if (std::fseek(file, 4, SEEK_SET) == 0)
+        std::fwrite(size, 4, 1, file);
+    write_u32(size, static_cast<uint32_t>(std::min<uint64_t>(data_bytes, UINT32_MAX)));
+    if (std::fseek(file, 40, SEEK_SET) == 0)
+        std::fwrite(size, 4, 1, file);
+    std::fclose(file);
+    file = nullptr;
+}
+
+bool PlaybackEngine::start(const Options& engine_options, std::unique_ptr<AudioSink> engine_sink) {
+    options = engine_options;
+    if (options.block_frames == 0)
+        options.block_frames = 1;
+    sink = std::move(engine_sink);
+    if (!sink || !sink->open(options.format))
+        return false;
+
+    uint64_t buffer_frames = static_cast<uint64_t>(options.format.sample_rate) * options.buffer_ms / 1000;
+    size_t count = std::max<uint64_t>(2, (buffer_frames + options.block_frames - 1) / options.block_frames);
+    block_samples = static_cast<size_t>(options.block_frames) * options.format.channels;
+    blocks.assign(count, Block());
+    samples.assign(count * block_samples, 0);
+
+    running = true;
+    decoder = std::thread(&PlaybackEngine::decode_loop, this);
+    output = std::thread(&PlaybackEngine::output_loop, this);
+    return true;
+}
+
+void PlaybackEngine::stop() {
+    if (!running.exchange(false))
+        return;
+    decoder.join();
+    output.join();
+    sink->close();
+}
+
+bool PlaybackEngine::enqueue(std::shared_ptr<const Song> song) {
+    if (!song || song->channels != options.format.channels)
+        return false;
+    std::lock_guard<std::mutex> guard(playlist_lock);
+    if (playlist.size() >= options.max_queue)
+        return false;
+    playlist.push_back(std::move(song));
+    return true;
+}
+
+void PlaybackEngine::set_playing(bool value) {
+    playing.store(value, std::memory_order_relaxed);
+}
+
+PlaybackEngine::Stats PlaybackEngine::stats() {
+    Stats stats;
+    stats.playing = playing.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(playlist_lock);
+        stats.queued = playlist.size();
+    }
+    uint64_t buffered = head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    if (options.format.sample_rate != 0)
+        stats.buffered_ms = static_cast<uint32_t>(buffered * options.block_frames * 1000 / options.format.sample_rate);
+    stats.songs_played = songs_played.load(std::memory_order_relaxed);
+    stats.blocks_played = blocks_played.load(std::memory_order_relaxed);
+    stats.underruns = underruns.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void PlaybackEngine::decode_loop() {
+    std::shared_ptr<const Song> song;
+    size_t position = 0;
+    // Half a block: the ring has a free slot again well before the output needs the next block
+    auto pause = std::chrono::microseconds(500000ull * options.block_frames / options.format.sample_rate);
+
+    while (running.load(std::memory_order_relaxed)) {
+        if (!song) {
+            std::lock_guard<std::mutex> guard(playlist_lock);
+            if (!playlist.empty()) {
+                song = std::move(playlist.front());
+                playlist.pop_front();
+                position = 0;
+            }
+        }
+        if (!song) {
+            decoding.store(false, std::memory_order_relaxed);
+            std::this_thread::sleep_for(pause);
+            continue;
+        }
+        decoding.store(true, std::memory_order_relaxed);
+
+        uint64_t slot = head.load(std::memory_order_relaxed);
+        if (slot - tail.load(std::memory_order_acquire) >= blocks.size()) {
+            std::this_thread::sleep_for(pause);
+            continue;
+        }
+
+        size_t index = slot % blocks.size();
+        size_t count = std::min(block_samples, song->samples.size() - position);
+        memcpy(&samples[index * block_samples], &song->samples[position], count * sizeof(int16_t));
+        position += count;
+        blocks[index].frames = static_cast<uint32_t>(count / options.format.channels);
+        blocks[index].last = position == song->samples.size();
+        if (blocks[index].last) {
+            song.reset();
+            decoding.store(false, std::memory_order_relaxed);
+        }
+        head.store(slot + 1, std::memory_order_release);
+    }
+}
+
+void PlaybackEngine::output_loop() {
+    using Steady = std::chrono::steady_clock;
+    auto period = std::chrono::nanoseconds(1000000000ull * options.block_frames / options.format.sample_rate);
+    std::vector<int16_t> silence(block_samples, 0);
+    Steady::time_point next = Steady::now();
+
+    while (running.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_until(next);
+        Steady::time_point now = Steady::now();
+        // A late wake up doesn't make the following blocks come out in a burst
+        next = std::max(next, now - period) + period;
+
+        // Stopped: nothing is taken off the ring, playing goes on from the same sample
+        if (!playing.load(std::memory_order_relaxed))
+            continue;
+
+        uint64_t slot = tail.load(std::memory_order_relaxed);
+        if (slot == head.load(std::memory_order_acquire)) {
+            if (decoding.load(std::memory_order_relaxed)) {
+                sink->write(silence.data(), silence.size());
+                underruns.fetch_add(1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        size_t index = slot % blocks.size();
+        sink->write(&samples[index * block_samples], static_cast<size_t>(blocks[index].frames) * options.format.channels);
+        if (blocks[index].last)
+            songs_played.fetch_add(1, std::memory_order_relaxed);
+        blocks_played.fetch_add(1, std::memory_order_relaxed);
+        tail.store(slot + 1, std::memory_order_release);
+    }
+}
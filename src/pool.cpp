@@ -0,0 +1,122 @@
+#include "cupthor/pool.h"
+
+#include <cstring>
+
+AllocatorCounters& AllocatorCounters::global() {
+    static AllocatorCounters counters;
+    return counters;
+}
+
+AllocatorStats allocator_stats() {
+    AllocatorCounters& counters = AllocatorCounters::global();
+    AllocatorStats stats;
+    stats.arena_mallocs = counters.arena_mallocs.load(std::memory_order_relaxed);
+    stats.arena_bytes = counters.arena_bytes.load(std::memory_order_relaxed);
+    stats.arena_resets = counters.arena_resets.load(std::memory_order_relaxed);
+    stats.frame_acquires = counters.frame_acquires.load(std::memory_order_relaxed);
+    stats.frame_mallocs = counters.frame_mallocs.load(std::memory_order_relaxed);
+    stats.record_acquires = counters.record_acquires.load(std::memory_order_relaxed);
+    stats.record_exhausted = counters.record_exhausted.load(std::memory_order_relaxed);
+    stats.queue_mallocs = counters.queue_mallocs.load(std::memory_order_relaxed);
+    stats.heap_allocations = counters.heap_allocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void* Arena::allocate(size_t size, size_t align) {
+    AllocatorCounters& counters = AllocatorCounters::global();
+    counters.arena_bytes.fetch_add(size, std::memory_order_relaxed);
+    used_bytes += size;
+
+    // The chunks left from before the last reset are used again first
+    while (current < chunks.size()) {
+        Chunk& chunk = chunks[current];
+        size_t start = (offset + align - 1) & ~(align - 1);
+        if (start + size <= chunk.size) {
+            offset = start + size;
+            return chunk.memory.get() + start;
+        }
+        current++;
+        offset = 0;
+    }
+
+    size_t size_needed = size + align > chunk_size ? size + align : chunk_size;
+    chunks.push_back({std::unique_ptr<char[]>(new char[size_needed]), size_needed});
+    counters.arena_mallocs.fetch_add(1, std::memory_order_relaxed);
+    current = chunks.size() - 1;
+    char* memory = chunks.back().memory.get();
+    size_t start = (align - reinterpret_cast<uintptr_t>(memory) % align) % align;
+    offset = start + size;
+    return memory + start;
+}
+
+void Arena::reset() {
+    if (used_bytes == 0)
+        return;
+    current = 0;
+    offset = 0;
+    used_bytes = 0;
+    AllocatorCounters::global().arena_resets.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string_view Arena::concat(std::initializer_list<std::string_view> parts) {
+    size_t size = 0;
+    for (auto part : parts)
+        size += part.size();
+    char* out = static_cast<char*>(allocate(size, 1));
+    size_t at = 0;
+    for (auto part : parts) {
+        memcpy(out + at, part.data(), part.size());
+        at += part.size();
+    }
+    return std::string_view(out, size);
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const Chunk& chunk : chunks)
+        total += chunk.size;
+    return total;
+}
+
+FramePool::~FramePool() {
+    for (Buffer* buffer : free_list)
+        delete buffer;
+}
+
+FramePool::Frame FramePool::acquire(size_t size) {
+    AllocatorCounters& counters = AllocatorCounters::global();
+    counters.frame_acquires.fetch_add(1, std::memory_order_relaxed);
+
+    Buffer* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!free_list.empty()) {
+            buffer = free_list.back();
+            free_list.pop_back();
+        }
+    }
+    if (buffer == nullptr) {
+        buffer = new Buffer();
+        counters.frame_mallocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (buffer -> capacity() < size)
+        counters.frame_mallocs.fetch_add(1, std::memory_order_relaxed);
+    buffer -> resize(size);
+    return Frame(buffer, Release{this});
+}
+
+size_t FramePool::free_frames() {
+    std::lock_guard<std::mutex> guard(lock);
+    return free_list.size();
+}
+
+void FramePool::release(Buffer* buffer) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (free_list.size() < max_free) {
+            free_list.push_back(buffer);
+            return;
+        }
+    }
+    delete buffer;
+}
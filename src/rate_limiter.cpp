@@ -0,0 +1,64 @@
+#include "cupthor/rate_limiter.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+bool RateLimiter::allow(const std::string& client, RouteClass route) {
+    const Limit& limit = limits[route];
+    if (limit.rate <= 0)
+        return true;
+
+    auto now = std::chrono::steady_clock::now();
+    std::string key = client;
+    key += static_cast<char>('0' + route);
+    Shard& shard = shards[std::hash<std::string>()(key) % SHARDS];
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto it = shard.buckets.find(key);
+    if (it == shard.buckets.end()) {
+        if (shard.buckets.size() >= MAX_BUCKETS_PER_SHARD)
+            evict_idle(shard, now);
+        if (shard.buckets.size() >= MAX_BUCKETS_PER_SHARD)
+            evict_oldest(shard, MAX_BUCKETS_PER_SHARD / 4);
+        it = shard.buckets.emplace(key, Bucket{limit.burst, now}).first;
+    }
+
+    Bucket& bucket = it->second;
+    double elapsed = std::chrono::duration<double>(now - bucket.last).count();
+    bucket.tokens = std::min(limit.burst, bucket.tokens + elapsed * limit.rate);
+    bucket.last = now;
+    if (bucket.tokens < 1)
+        return false;
+    bucket.tokens -= 1;
+    return true;
+}
+
+void RateLimiter::evict_idle(Shard& shard, std::chrono::steady_clock::time_point now) {
+    for (auto it = shard.buckets.begin(); it != shard.buckets.end(); ) {
+        if (now - it->second.last > std::chrono::seconds(60))
+            it = shard.buckets.erase(it);
+        else
+            ++it;
+    }
+}
+
+void RateLimiter::evict_oldest(Shard& shard, size_t count) {
+    std::vector<std::chrono::steady_clock::time_point> times;
+    times.reserve(shard.buckets.size());
+    for (auto& entry : shard.buckets)
+        times.push_back(entry.second.last);
+    count = std::min(count, times.size());
+    if (count == 0)
+        return;
+    std::nth_element(times.begin(), times.begin() + (count - 1), times.end());
+    auto cutoff = times[count - 1];
+    for (auto it = shard.buckets.begin(); it != shard.buckets.end() && count > 0; ) {
+        if (it->second.last <= cutoff) {
+            it = shard.buckets.erase(it);
+            count--;
+        }
+        else
+            ++it;
+    }
+}
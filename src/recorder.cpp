@@ -0,0 +1,207 @@
+#include "cupthor/recorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char MAGIC[4] = {'C', 'T', 'R', 'Q'};
+// timestamp, connection, body size, method, path length
+const size_t RECORD_HEADER = 8 + 4 + 4 + 1 + 2;
+const size_t MAX_PATH = 0xFFFF;
+
+std::atomic<uint64_t> next_recorder_id{1};
+
+struct ThreadRing {
+    uint64_t owner = 0;
+    void* ring = nullptr;
+};
+
+thread_local ThreadRing this_thread_ring;
+
+template <typename T>
+void put(char*& p, T value) {
+    memcpy(p, &value, sizeof(value));
+    p += sizeof(value);
+}
+
+template <typename T>
+bool get(std::FILE* file, T& value) {
+    return std::fread(&value, sizeof(value), 1, file) == 1;
+}
+
+}
+
+RequestRecorder::~RequestRecorder() {
+    stop();
+}
+
+bool RequestRecorder::start(const std::string& path, size_t ring_size) {
+    if (running || ring_size < 4096)
+        return false;
+
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        perror(("open " + path).c_str());
+        return false;
+    }
+    uint64_t start_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    std::fwrite(MAGIC, 1, sizeof(MAGIC), file);
+    uint32_t version = VERSION;
+    std::fwrite(&version, sizeof(version), 1, file);
+    std::fwrite(&start_us, sizeof(start_us), 1, file);
+
+    id = next_recorder_id++;
+    ring_bytes = ring_size;
+    origin = std::chrono::steady_clock::now();
+    stopping = false;
+    running = true;
+    writer = std::thread(&RequestRecorder::writer_loop, this);
+    return true;
+}
+
+void RequestRecorder::stop() {
+    if (!running.exchange(false))
+        return;
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+    std::fclose(file);
+    file = nullptr;
+}
+
+RequestRecorder::Ring* RequestRecorder::ring_of_this_thread() {
+    ThreadRing& cached = this_thread_ring;
+    if (cached.owner == id)
+        return static_cast<Ring*>(cached.ring);
+
+    // First request of this thread, the only time it takes a lock
+    std::lock_guard<std::mutex> guard(rings_lock);
+    rings.push_back(std::unique_ptr<Ring>(new Ring(ring_bytes)));
+    cached.owner = id;
+    cached.ring = rings.back().get();
+    return rings.back().get();
+}
+
+void RequestRecorder::record(Method method, const std::string& path, uint32_t connection, uint32_t body_size) {
+    if (!running.load(std::memory_order_relaxed))
+        return;
+
+    Ring& ring = *ring_of_this_thread();
+    size_t path_size = std::min(path.size(), MAX_PATH);
+    size_t size = RECORD_HEADER + path_size;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (size > ring.data.size() - (head - ring.tail.load(std::memory_order_acquire))) {
+        drops.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    char header[RECORD_HEADER];
+    char* p = header;
+    put<uint64_t>(p, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count());
+    put<uint32_t>(p, connection);
+    put<uint32_t>(p, body_size);
+    put<uint8_t>(p, method);
+    put<uint16_t>(p, path_size);
+
+    // Copies into the ring, in two pieces when it wraps around
+    auto copy = [&](const char* from, size_t n, uint64_t at) {
+        size_t offset = at % ring.data.size();
+        size_t first = std::min(n, ring.data.size() - offset);
+        memcpy(ring.data.data() + offset, from, first);
+        memcpy(ring.data.data(), from + first, n - first);
+    };
+    copy(header, RECORD_HEADER, head);
+    copy(path.data(), path_size, head + RECORD_HEADER);
+
+    ring.head.store(head + size, std::memory_order_release);
+    records.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t RequestRecorder::drain(Ring& ring, std::vector<char>& out) {
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    size_t n = head - tail;
+    if (n == 0)
+        return 0;
+
+    size_t offset = tail % ring.data.size();
+    size_t first = std::min(n, ring.data.size() - offset);
+    out.insert(out.end(), ring.data.begin() + offset, ring.data.begin() + offset + first);
+    out.insert(out.end(), ring.data.begin(), ring.data.begin() + (n - first));
+    ring.tail.store(head, std::memory_order_release);
+    return n;
+}
+
+void RequestRecorder::writer_loop() {
+    std::vector<char> out;
+    std::vector<Ring*> snapshot;
+    bool last = false;
+
+    while (!last) {
+        {
+            std::unique_lock<std::mutex> guard(wake_lock);
+            wake.wait_for(guard, std::chrono::milliseconds(50), [this] { return stopping; });
+            last = stopping;
+        }
+        {
+            std::lock_guard<std::mutex> guard(rings_lock);
+            snapshot.clear();
+            for (auto& ring : rings)
+                snapshot.push_back(ring.get());
+        }
+        // Every ring only holds whole records, so the rings can be appended one after the other. Records of
+        // different threads end up slightly out of order, the reader sorts them by timestamp.
+        out.clear();
+        for (Ring* ring : snapshot)
+            drain(*ring, out);
+        if (!out.empty()) {
+            std::fwrite(out.data(), 1, out.size(), file);
+            std::fflush(file);
+        }
+    }
+}
+
+const char* RequestRecorder::method_name(uint8_t method) {
+    static const char* names[] = {"GET", "POST", "PUT", "DELETE"};
+    return method < OTHER ? names[method] : "GET";
+}
+
+bool RequestRecorder::load(const std::string& path, std::vector<RecordedRequest>& requests) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        perror(("open " + path).c_str());
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t start_us = 0;
+    if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !get(file, version) || version != VERSION || !get(file, start_us)) {
+        fprintf(stderr, "%s is not a request log\n", path.c_str());
+        std::fclose(file);
+        return false;
+    }
+
+    while (true) {
+        RecordedRequest request;
+        uint16_t path_size;
+        if (!get(file, request.timestamp_us) || !get(file, request.connection) || !get(file, request.body_size) ||
+            !get(file, request.method) || !get(file, path_size))
+            break;
+        request.path.resize(path_size);
+        if (path_size > 0 && std::fread(&request.path[0], 1, path_size, file) != path_size)
+            break;
+        requests.push_back(std::move(request));
+    }
+    std::fclose(file);
+
+    std::stable_sort(requests.begin(), requests.end(), [](const RecordedRequest& a, const RecordedRequest& b) {
+        return a.timestamp_us < b.timestamp_us;
+    });
+    return true;
+}
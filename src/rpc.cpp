@@ -0,0 +1,418 @@
+#include "cupthor/rpc.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+void put_u32(std::string& out, uint32_t value) {
+    char bytes[4];
+    for (int i = 0; i < 4; i++)
+        bytes[i] = static_cast<char>(value >> (8 * i));
+    out.append(bytes, 4);
+}
+
+void put_f64(std::string& out, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    char bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = static_cast<char>(bits >> (8 * i));
+    out.append(bytes, 8);
+}
+
+uint32_t get_u32(const char* p) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return value;
+}
+
+double get_f64(const char* p) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+}
+
+void rpc::encode_request(const std::vector<Command>& commands, std::string& out) {
+    put_u32(out, static_cast<uint32_t>(commands.size() * COMMAND_SIZE));
+    for (const Command& command : commands) {
+        out += static_cast<char>(command.op);
+        out += static_cast<char>(command.argument);
+        put_f64(out, command.value);
+    }
+}
+
+void rpc::encode_token(const std::string& token, std::string& out) {
+    put_u32(out, TOKEN_FRAME | static_cast<uint32_t>(token.size()));
+    out += token;
+}
+
+bool rpc::decode_reply(const char* payload, size_t size, std::vector<Result>& results) {
+    if (size % RESULT_SIZE != 0)
+        return false;
+    results.clear();
+    for (size_t at = 0; at < size; at += RESULT_SIZE)
+        results.push_back({static_cast<uint8_t>(payload[at]), get_f64(payload + at + 1)});
+    return true;
+}
+
+RpcServer::RpcServer(CupThor& oven, std::mutex& lock)
+    : oven(oven), lock(lock)
+{ }
+
+RpcServer::~RpcServer() {
+    stop();
+}
+
+bool RpcServer::listen_tcp(uint16_t port, const std::string& address) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "rpc address isn't an IPv4 address: %s\n", address.c_str());
+        return false;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("rpc socket");
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        perror("rpc listen");
+        close(fd);
+        return false;
+    }
+    listeners.push_back(fd);
+    return true;
+}
+
+bool RpcServer::listen_unix(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "rpc socket path too long: %s\n", path.c_str());
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("rpc socket");
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    // A socket file left behind by a previous run
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        perror("rpc listen");
+        close(fd);
+        return false;
+    }
+    listeners.push_back(fd);
+    unix_path = path;
+    return true;
+}
+
+void RpcServer::attach_auth(TokenAuthority* authority) {
+    auth = authority;
+}
+
+bool RpcServer::may_change(const std::string& token) {
+    if (auth == nullptr || !auth->enabled())
+        return true;
+    // A connection that never sent a token isn't counted as a rejection on every frame
+    return !token.empty() && auth->verify(token, time(nullptr)) == TokenAuthority::VALID;
+}
+
+void RpcServer::start(size_t max) {
+    max_connections = max;
+    running = true;
+    for (int fd : listeners)
+        acceptors.emplace_back(&RpcServer::accept_loop, this, fd);
+}
+
+void RpcServer::stop() {
+    {
+        std::lock_guard<std::mutex> guard(connections_lock);
+        if (!running)
+            return;
+        running = false;
+    }
+
+    // shutdown() wakes up the threads blocked in accept() and recv()
+    for (int fd : listeners)
+        shutdown(fd, SHUT_RDWR);
+    for (auto& t : acceptors)
+        t.join();
+    for (int fd : listeners)
+        close(fd);
+    acceptors.clear();
+    listeners.clear();
+    if (!unix_path.empty())
+        unlink(unix_path.c_str());
+
+    std::lock_guard<std::mutex> guard(connections_lock);
+    for (auto& connection : connections)
+        shutdown(connection->fd, SHUT_RDWR);
+    for (auto& connection : connections) {
+        connection->thread.join();
+        close(connection->fd);
+    }
+    connections.clear();
+}
+
+void RpcServer::accept_loop(int listen_fd) {
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::lock_guard<std::mutex> guard(connections_lock);
+        if (!running) {
+            close(fd);
+            return;
+        }
+        // Threads of the connections that are gone are collected here, not when they end
+        connections.erase(std::remove_if(connections.begin(), connections.end(), [](std::unique_ptr<Connection>& connection) {
+            if (!connection->done)
+                return false;
+            connection->thread.join();
+            close(connection->fd);
+            return true;
+        }), connections.end());
+
+        if (connections.size() >= max_connections) {
+            close(fd);
+            continue;
+        }
+        connections.push_back(std::unique_ptr<Connection>(new Connection()));
+        Connection& connection = *connections.back();
+        connection.fd = fd;
+        connection.thread = std::thread(&RpcServer::serve, this, std::ref(connection));
+    }
+}
+
+void RpcServer::serve(Connection& connection) {
+    std::string in;
+    std::string reply;
+    // The last token this connection sent
+    std::string token;
+    char chunk[65536];
+
+    while (true) {
+        ssize_t n = recv(connection.fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            break;
+        in.append(chunk, n);
+
+        // Every complete frame that arrived is answered, the replies go out together
+        size_t at = 0;
+        reply.clear();
+        bool broken = false;
+        while (in.size() - at >= 4) {
+            uint32_t size = get_u32(in.data() + at);
+            if (size & rpc::TOKEN_FRAME) {
+                size &= ~rpc::TOKEN_FRAME;
+                if (size > rpc::MAX_TOKEN_SIZE) {
+                    broken = true;
+                    break;
+                }
+                if (in.size() - at - 4 < size)
+                    break;
+                token.assign(in.data() + at + 4, size);
+                int result = auth != nullptr && auth->enabled() ? auth->verify(token, time(nullptr)) : TokenAuthority::VALID;
+                put_u32(reply, rpc::RESULT_SIZE);
+                reply += static_cast<char>(result);
+                put_f64(reply, 0);
+                at += 4 + size;
+                continue;
+            }
+            if (size > rpc::MAX_COMMANDS * rpc::COMMAND_SIZE) {
+                broken = true;
+                break;
+            }
+            if (in.size() - at - 4 < size)
+                break;
+            if (!execute(in.data() + at + 4, size, reply, may_change(token))) {
+                broken = true;
+                break;
+            }
+            at += 4 + size;
+        }
+        in.erase(0, at);
+        if (!reply.empty() && !write_all(connection.fd, reply.data(), reply.size()))
+            break;
+        if (broken)
+            break;
+    }
+    connection.done = true;
+}
+
+bool RpcServer::execute(const char* payload, size_t size, std::string& reply, bool may_change) {
+    if (size % rpc::COMMAND_SIZE != 0)
+        return false;
+    size_t count = size / rpc::COMMAND_SIZE;
+    put_u32(reply, static_cast<uint32_t>(count * rpc::RESULT_SIZE));
+
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < count; i++) {
+            const char* command = payload + i * rpc::COMMAND_SIZE;
+            uint8_t op = static_cast<uint8_t>(command[0]);
+            uint8_t argument = static_cast<uint8_t>(command[1]);
+            bool valid_setting = argument < CupThor::SETTINGS;
+            CupThor::Setting setting = static_cast<CupThor::Setting>(argument);
+
+            uint8_t status = rpc::BAD_COMMAND;
+            double value = 0;
+            if (op == rpc::SET_SETTING && valid_setting && !may_change) {
+                status = rpc::NOT_AUTHORIZED;
+                value = oven.get_setting_value(setting);
+            }
+            else if (op == rpc::SET_SETTING && valid_setting) {
+                status = static_cast<uint8_t>(oven.set_setting(setting, get_f64(command + 2)));
+                value = oven.get_setting_value(setting);
+                changed = true;
+            }
+            else if (op == rpc::GET_SETTING && valid_setting) {
+                status = 1;
+                value = oven.get_setting_value(setting);
+            }
+            else if (op == rpc::GET_TEMPERATURE) {
+                status = 1;
+                value = oven.get_temperature();
+            }
+            else if (op == rpc::GET_COOK_PHASE) {
+                status = static_cast<uint8_t>(oven.get_cook_phase());
+                value = oven.get_phase_remaining();
+            }
+            else if (op == rpc::GET_SENSOR && argument < CupThor::SENSORS) {
+                status = 1;
+                value = oven.get_sensor_value(static_cast<CupThor::Sensor>(argument));
+            }
+            reply += static_cast<char>(status);
+            put_f64(reply, value);
+        }
+        // One log record for the whole batch
+        if (changed)
+            oven.persist();
+    }
+
+    frame_count.fetch_add(1, std::memory_order_relaxed);
+    command_count.fetch_add(count, std::memory_order_relaxed);
+    return true;
+}
+
+RpcClient::~RpcClient() {
+    if (fd >= 0)
+        close(fd);
+}
+
+bool RpcClient::connect_tcp(const std::string& host, uint16_t port) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool RpcClient::connect_unix(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool RpcClient::read_reply(size_t size) {
+    in.clear();
+    char chunk[65536];
+    while (in.size() < 4 + size) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return false;
+        in.append(chunk, n);
+    }
+    return get_u32(in.data()) == size;
+}
+
+int RpcClient::authenticate(const std::string& token) {
+    if (fd < 0)
+        return -1;
+    out.clear();
+    rpc::encode_token(token, out);
+    if (!write_all(fd, out.data(), out.size()) || !read_reply(rpc::RESULT_SIZE))
+        return -1;
+    return static_cast<uint8_t>(in[4]);
+}
+
+bool RpcClient::call(const std::vector<rpc::Command>& commands, std::vector<rpc::Result>& results) {
+    if (fd < 0)
+        return false;
+    out.clear();
+    rpc::encode_request(commands, out);
+    if (!write_all(fd, out.data(), out.size()))
+        return false;
+
+    size_t expected = commands.size() * rpc::RESULT_SIZE;
+    if (!read_reply(expected))
+        return false;
+    return rpc::decode_reply(in.data() + 4, expected, results);
+}
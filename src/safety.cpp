@@ -0,0 +1,98 @@
+#include "cupthor/safety.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+bool SafetyMonitor::start(const Options& monitor_options, CupThor& oven) {
+    if (running || monitor_options.period_ms <= 0)
+        return false;
+    options = monitor_options;
+    cth = &oven;
+    running = true;
+    thread = std::thread(&SafetyMonitor::run, this);
+    return true;
+}
+
+void SafetyMonitor::stop() {
+    if (!running.exchange(false))
+        return;
+    if (thread.joinable())
+        thread.join();
+}
+
+int SafetyMonitor::check_conditions() {
+    if (cth -> smoke_detected())
+        return CupThor::TRIP_SMOKE;
+    if (cth -> get_sensor_value(CupThor::THERMOSTAT) > options.max_temperature_c)
+        return CupThor::TRIP_OVERHEAT;
+    return CupThor::SAFE;
+}
+
+bool SafetyMonitor::reset() {
+    if (cth == nullptr)
+        return true;
+    if (check_conditions() != CupThor::SAFE)
+        return false;
+    cth -> safety_reset();
+    return true;
+}
+
+SafetyMonitor::Stats SafetyMonitor::stats() const {
+    Stats stats;
+    stats.checks = checks.load(std::memory_order_relaxed);
+    stats.late_checks = late_checks.load(std::memory_order_relaxed);
+    stats.max_lateness_us = max_lateness_us.load(std::memory_order_relaxed);
+    stats.trips = trips.load(std::memory_order_relaxed);
+    stats.pinned = pinned;
+    stats.realtime = realtime;
+    return stats;
+}
+
+void SafetyMonitor::run() {
+    if (options.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(options.cpu, &cpus);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error != 0)
+            std::cout << "Safety monitor: can't run on cpu " << options.cpu << ": " << strerror(error) << std::endl;
+        pinned = error == 0;
+    }
+    if (options.priority > 0) {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = options.priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0)
+            std::cout << "Safety monitor: no real time priority (" << strerror(error) << "), running as a normal thread" << std::endl;
+        realtime = error == 0;
+    }
+
+    // Fixed deadlines: a late check doesn't push the next ones back
+    const std::chrono::microseconds period(options.period_ms * 1000);
+    auto deadline = std::chrono::steady_clock::now();
+    while (running) {
+        deadline += period;
+        std::this_thread::sleep_until(deadline);
+
+        int64_t lateness = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - deadline).count();
+        checks.fetch_add(1, std::memory_order_relaxed);
+        if (lateness > options.period_ms * 500)
+            late_checks.fetch_add(1, std::memory_order_relaxed);
+        if (lateness > max_lateness_us.load(std::memory_order_relaxed))
+            max_lateness_us.store(lateness, std::memory_order_relaxed);
+        // Overslept by more than a period (suspended, debugger): checks that are already missed aren't made up
+        if (lateness > period.count())
+            deadline = std::chrono::steady_clock::now();
+
+        int condition = check_conditions();
+        if (condition != CupThor::SAFE && cth -> safety_tripped() == CupThor::SAFE) {
+            cth -> safety_trip(static_cast<CupThor::SafetyTrip>(condition));
+            trips.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,643 @@
+#include "cupthor/server_config.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+bool ServerConfig::load_file(const std::string& path) {
+    std::ifstream input(path);
+    if (!input) {
+        std::cerr << "cannot open config file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(input, line)) {
+        line_number++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        auto eq = line.find('=');
+        if (eq == std::string::npos) {
+            std::cerr << path << ":" << line_number << ": expected key = value" << std::endl;
+            return false;
+        }
+        if (!set(trim(line.substr(0, eq)), trim(line.substr(eq + 1)))) {
+            std::cerr << path << ":" << line_number << ": invalid entry '" << line << "'" << std::endl;
+            return false;
+        }
+    }
+    config_file = path;
+    return true;
+}
+
+bool ServerConfig::parse_args(int argc, char *argv[]) {
+    std::vector<std::string> positional;
+
+    // The config file is loaded first so that the flags can override it
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--config") {
+            if (i + 1 >= argc) {
+                std::cerr << "option --config needs a file" << std::endl;
+                return false;
+            }
+            if (!load_file(argv[i + 1]))
+                return false;
+        }
+        else if (arg.rfind("--config=", 0) == 0) {
+            if (!load_file(arg.substr(9)))
+                return false;
+        }
+    }
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+            continue;
+        }
+
+        std::string key = arg.substr(2);
+        std::string value;
+        auto eq = key.find('=');
+        if (eq != std::string::npos) {
+            value = key.substr(eq + 1);
+            key = key.substr(0, eq);
+        }
+        else if (key == "reuse-port" || key == "reuse_port") {
+            // A switch: on when no value follows, so "--reuse-port 8080" still leaves 8080 as the port
+            std::string next = i + 1 < argc ? argv[i + 1] : "";
+            if (next == "true" || next == "false" || next == "1" || next == "0")
+                value = argv[++i];
+            else
+                value = "true";
+        }
+        else if (i + 1 < argc) {
+            value = argv[++i];
+        }
+
+        if (key == "config")
+            continue;
+
+        std::replace(key.begin(), key.end(), '-', '_');
+        if (!set(key, value)) {
+            std::cerr << "invalid option --" << key << " '" << value << "'" << std::endl;
+            return false;
+        }
+    }
+
+    if (positional.size() > 2) {
+        std::cerr << "usage: " << argv[0] << " [port] [threads] [--config file] [--key value ...]" << std::endl;
+        return false;
+    }
+    if (positional.size() >= 1 && !set("port", positional[0]))
+        return false;
+    if (positional.size() == 2 && !set("threads", positional[1]))
+        return false;
+
+    return true;
+}
+
+bool ServerConfig::set(const std::string& key, const std::string& value) {
+    try {
+        if (key == "port") {
+            int p = to_int(value);
+            if (p <= 0 || p > 65535)
+                return false;
+            port = static_cast<uint16_t>(p);
+        }
+        else if (key == "threads") {
+            threads = to_int(value);
+            if (threads <= 0)
+                return false;
+        }
+        else if (key == "max_request_size") {
+            max_request_size = to_unsigned(value);
+        }
+        else if (key == "max_response_size") {
+            max_response_size = to_unsigned(value);
+        }
+        else if (key == "keepalive_timeout") {
+            keepalive_timeout = to_int(value);
+            if (keepalive_timeout < 0)
+                return false;
+        }
+        else if (key == "header_timeout") {
+            header_timeout = to_int(value);
+            if (header_timeout <= 0)
+                return false;
+        }
+        else if (key == "body_timeout") {
+            body_timeout = to_int(value);
+            if (body_timeout <= 0)
+                return false;
+        }
+        else if (key == "backlog") {
+            backlog = to_int(value);
+            if (backlog <= 0)
+                return false;
+        }
+        else if (key == "pin_cpus") {
+            // "none", "auto" (one core per worker, in order) or a list like "0,2,4-7"
+            pin_cpus.clear();
+            if (value == "none" || value.empty())
+                return true;
+            if (value == "auto") {
+                for (size_t cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++)
+                    pin_cpus.push_back(static_cast<int>(cpu));
+                return true;
+            }
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                item = trim(item);
+                auto dash = item.find('-');
+                int first = to_int(item.substr(0, dash));
+                int last = dash == std::string::npos ? first : to_int(item.substr(dash + 1));
+                if (first < 0 || last < first)
+                    return false;
+                for (int cpu = first; cpu <= last; cpu++)
+                    pin_cpus.push_back(cpu);
+            }
+        }
+        else if (key == "executor_threads") {
+            executor_threads = to_int(value);
+            if (executor_threads < 0)
+                return false;
+        }
+        else if (key == "camera_rate") {
+            camera_rate = to_double(value);
+            if (camera_rate < 0)
+                return false;
+        }
+        else if (key == "camera_burst") {
+            camera_burst = to_double(value);
+            if (camera_burst < 0)
+                return false;
+        }
+        else if (key == "media_rate") {
+            media_rate = to_double(value);
+            if (media_rate < 0)
+                return false;
+        }
+        else if (key == "media_burst") {
+            media_burst = to_double(value);
+            if (media_burst < 0)
+                return false;
+        }
+        else if (key == "max_pending_jobs") {
+            max_pending_jobs = to_unsigned(value);
+            if (max_pending_jobs == 0)
+                return false;
+        }
+        else if (key == "max_song_size") {
+            max_song_size = to_unsigned(value);
+        }
+        else if (key == "playback_output") {
+            if (value.empty())
+                return false;
+            playback_output = value;
+        }
+        else if (key == "playback_sample_rate") {
+            int rate = to_int(value);
+            if (rate < 8000 || rate > 192000)
+                return false;
+            playback.format.sample_rate = rate;
+        }
+        else if (key == "playback_channels") {
+            int channels = to_int(value);
+            if (channels < 1 || channels > 2)
+                return false;
+            playback.format.channels = channels;
+        }
+        else if (key == "playback_buffer_ms") {
+            int ms = to_int(value);
+            if (ms < 20 || ms > 10000)
+                return false;
+            playback.buffer_ms = ms;
+        }
+        else if (key == "playback_max_song_mb") {
+            int mb = to_int(value);
+            if (mb < 1)
+                return false;
+            playback.max_song_bytes = static_cast<size_t>(mb) * 1024 * 1024;
+        }
+        else if (key == "playback_queue") {
+            int songs = to_int(value);
+            if (songs < 1)
+                return false;
+            playback.max_queue = songs;
+        }
+        else if (key == "song_store_mb") {
+            int mb = to_int(value);
+            if (mb < 0 || mb > 65536)
+                return false;
+            song_store_mb = mb;
+        }
+        else if (key == "jpeg_quality") {
+            jpeg_quality = to_int(value);
+            if (jpeg_quality < 1 || jpeg_quality > 100)
+                return false;
+        }
+        else if (key == "camera_roi") {
+            // "x,y,width,height", or empty for the whole picture
+            CameraStatsOptions roi;
+            if (!value.empty()) {
+                std::istringstream fields(value);
+                std::string field;
+                int* targets[] = {&roi.roi_x, &roi.roi_y, &roi.roi_width, &roi.roi_height};
+                for (int* target : targets) {
+                    if (!std::getline(fields, field, ','))
+                        return false;
+                    *target = to_int(trim(field));
+                    if (*target < 0)
+                        return false;
+                }
+                if (std::getline(fields, field, ','))
+                    return false;
+            }
+            camera_stats.roi_x = roi.roi_x;
+            camera_stats.roi_y = roi.roi_y;
+            camera_stats.roi_width = roi.roi_width;
+            camera_stats.roi_height = roi.roi_height;
+        }
+        else if (key == "camera_stats_step") {
+            camera_stats.step = to_int(value);
+            if (camera_stats.step < 1 || camera_stats.step > 16)
+                return false;
+        }
+        else if (key == "timelapse_dir") {
+            if (value.empty())
+                return false;
+            timelapse.dir = value;
+        }
+        else if (key == "timelapse_interval_s") {
+            timelapse.interval_s = to_int(value);
+            if (timelapse.interval_s <= 0)
+                return false;
+        }
+        else if (key == "timelapse_max_frames") {
+            int frames = to_int(value);
+            if (frames <= 0)
+                return false;
+            timelapse.max_frames = frames;
+        }
+        else if (key == "timelapse_archive_mb") {
+            int mb = to_int(value);
+            if (mb <= 0 || mb > 4096)
+                return false;
+            timelapse.archive_bytes = (uint64_t)mb * 1024 * 1024;
+        }
+        else if (key == "timelapse_batch") {
+            int batch = to_int(value);
+            if (batch <= 0)
+                return false;
+            timelapse.batch = batch;
+        }
+        else if (key == "timelapse_keep") {
+            int keep = to_int(value);
+            if (keep < 0)
+                return false;
+            timelapse.keep = keep;
+        }
+        else if (key == "gateway") {
+            std::vector<std::string> backends;
+            std::istringstream items(value);
+            std::string item;
+            while (std::getline(items, item, ',')) {
+                item = trim(item);
+                std::string host;
+                uint16_t backend_port;
+                if (!FleetGateway::parse_backend(item, host, backend_port))
+                    return false;
+                backends.push_back(item);
+            }
+            gateway.backends = backends;
+        }
+        else if (key == "gateway_deadline_ms") {
+            gateway.deadline_ms = to_int(value);
+            if (gateway.deadline_ms <= 0)
+                return false;
+        }
+        else if (key == "gateway_cache_ttl_ms") {
+            gateway.cache_ttl_ms = to_int(value);
+            if (gateway.cache_ttl_ms < 0)
+                return false;
+        }
+        else if (key == "gateway_overheat_c") {
+            gateway.overheat_c = to_double(value);
+            if (gateway.overheat_c < 20 || gateway.overheat_c > 500)
+                return false;
+        }
+        else if (key == "auth_key") {
+            auth.key = value;
+        }
+        else if (key == "auth_signing_key") {
+            auth.signing_key = value;
+            if (!value.empty() && value.size() != 64)
+                return false;
+        }
+        else if (key == "auth_token_ttl_s") {
+            auth.token_ttl_s = to_int(value);
+            if (auth.token_ttl_s <= 0)
+                return false;
+        }
+        else if (key == "auth_cache_entries") {
+            int entries = to_int(value);
+            if (entries < 0)
+                return false;
+            auth.cache_entries = entries;
+        }
+        else if (key == "log_file") {
+            if (value.empty())
+                return false;
+            log.path = value;
+        }
+        else if (key == "log_format") {
+            if (value == "json")
+                log.format = Logger::JSON;
+            else if (value == "binary")
+                log.format = Logger::BINARY;
+            else
+                return false;
+        }
+        else if (key == "log_level") {
+            int level = Logger::level_from_name(value);
+            if (level < 0)
+                return false;
+            log.level = static_cast<LogLevel>(level);
+        }
+        else if (key == "log_max_mb") {
+            int mb = to_int(value);
+            if (mb < 1 || mb > 65536)
+                return false;
+            log.max_bytes = static_cast<size_t>(mb) * 1024 * 1024;
+        }
+        else if (key == "log_keep") {
+            int files = to_int(value);
+            if (files < 1 || files > 100)
+                return false;
+            log.keep = files;
+        }
+        else if (key == "state_dir") {
+            if (value.empty())
+                return false;
+            state_dir = value;
+        }
+        else if (key == "keep_warm_low") {
+            keep_warm_low = to_double(value);
+            if (keep_warm_low < 20 || keep_warm_low > 300)
+                return false;
+        }
+        else if (key == "keep_warm_high") {
+            keep_warm_high = to_double(value);
+            if (keep_warm_high < 20 || keep_warm_high > 300)
+                return false;
+        }
+        else if (key == "cook_browning_done") {
+            cook_browning_done = to_double(value);
+            if (cook_browning_done < 0)
+                return false;
+        }
+        else if (key == "keep_warm_duration_s") {
+            keep_warm_duration_s = to_int(value);
+            if (keep_warm_duration_s < 0)
+                return false;
+        }
+        else if (key == "safety_period_ms") {
+            int ms = to_int(value);
+            if (ms < 1 || ms > 1000)
+                return false;
+            safety.period_ms = ms;
+        }
+        else if (key == "safety_max_temperature_c") {
+            // Not below the highest temperature the oven can be set to, or the first hot cook trips it
+            safety.max_temperature_c = to_double(value);
+            if (safety.max_temperature_c < 300 || safety.max_temperature_c > 500)
+                return false;
+        }
+        else if (key == "safety_cpu") {
+            safety.cpu = to_int(value);
+            if (safety.cpu < -1)
+                return false;
+        }
+        else if (key == "safety_priority") {
+            safety.priority = to_int(value);
+            if (safety.priority < 0 || safety.priority > 99)
+                return false;
+        }
+        else if (key == "wal_commit_interval_ms") {
+            wal_commit_interval_ms = to_int(value);
+            if (wal_commit_interval_ms <= 0)
+                return false;
+        }
+        else if (key == "snapshot_every") {
+            snapshot_every = to_unsigned(value);
+            if (snapshot_every == 0)
+                return false;
+        }
+        else if (key == "time_warp") {
+            time_warp = to_double(value);
+            if (time_warp <= 0)
+                return false;
+        }
+        else if (key == "rpc_port") {
+            rpc_port = to_int(value);
+            if (rpc_port < 0 || rpc_port > 65535)
+                return false;
+        }
+        else if (key == "rpc_bind") {
+            in_addr address;
+            if (inet_pton(AF_INET, value.c_str(), &address) != 1)
+                return false;
+            rpc_bind = value;
+        }
+        else if (key == "rpc_socket") {
+            rpc_socket = value;
+        }
+        else if (key == "rpc_max_connections") {
+            rpc_max_connections = to_unsigned(value);
+            if (rpc_max_connections == 0)
+                return false;
+        }
+        else if (key == "shm_name") {
+            // shm_open wants one leading slash and no other
+            if (!value.empty() && (value[0] != '/' || value.find('/', 1) != std::string::npos))
+                return false;
+            shm_name = value;
+        }
+        else if (key == "record_file") {
+            record_file = value;
+        }
+        else if (key == "seed") {
+            seed = to_unsigned(value);
+        }
+        else if (key == "reuse_port") {
+            if (value == "true" || value == "1")
+                reuse_port = true;
+            else if (value == "false" || value == "0")
+                reuse_port = false;
+            else
+                return false;
+        }
+        else {
+            return false;
+        }
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+void ServerConfig::print(std::ostream& out) const {
+    out << "Cores = " << std::thread::hardware_concurrency() << std::endl;
+    out << "Using " << threads << " threads" << std::endl;
+    if (!config_file.empty())
+        out << "  config file       : " << config_file << std::endl;
+    out << "  port              : " << port << std::endl;
+    out << "  max request size  : " << max_request_size << " bytes" << std::endl;
+    out << "  max response size : " << max_response_size << " bytes" << std::endl;
+    out << "  keep-alive timeout: " << keepalive_timeout << " s" << std::endl;
+    out << "  request timeouts  : " << header_timeout << " s / " << body_timeout << " s" << std::endl;
+    out << "  listen backlog    : " << backlog << std::endl;
+    out << "  SO_REUSEPORT      : " << (reuse_port ? "on" : "off") << std::endl;
+    out << "  executor threads  : " << (executor_threads > 0 ? (size_t)executor_threads : std::thread::hardware_concurrency()) << std::endl;
+    out << "  camera limit      : " << camera_rate << "/s burst " << camera_burst << std::endl;
+    out << "  media limit       : " << media_rate << "/s burst " << media_burst << std::endl;
+    out << "  max pending jobs  : " << max_pending_jobs << std::endl;
+    out << "  playback          : ";
+    if (playback_output == "none")
+        out << "off" << std::endl;
+    else
+        out << playback_output << ", " << playback.format.sample_rate << " Hz " << playback.format.channels << " ch, "
+            << playback.buffer_ms << " ms buffered, " << playback.max_queue << " songs queued, songs up to "
+            << playback.max_song_bytes / (1024 * 1024) << " MB decoded" << std::endl;
+    out << "  song store        : " << (song_store_mb ? std::to_string(song_store_mb) + " MB" : "off") << std::endl;
+    out << "  jpeg quality      : " << jpeg_quality << std::endl;
+    out << "  camera stats      : ";
+    if (camera_stats.roi_width || camera_stats.roi_height || camera_stats.roi_x || camera_stats.roi_y)
+        out << "region " << camera_stats.roi_x << "," << camera_stats.roi_y << " " << camera_stats.roi_width << "x" << camera_stats.roi_height << ", ";
+    out << "every " << camera_stats.step << " pixels" << std::endl;
+    out << "  timelapse         : ";
+    if (timelapse.dir == "none")
+        out << "off" << std::endl;
+    else
+        out << timelapse.dir << ", a frame every " << timelapse.interval_s << " s, " << timelapse.max_frames << " frames / "
+            << timelapse.archive_bytes / (1024 * 1024) << " MB per cook, "
+            << (timelapse.keep ? "last " + std::to_string(timelapse.keep) + " cooks kept" : "all cooks kept") << std::endl;
+    out << "  state directory   : " << state_dir << std::endl;
+    out << "  keep warm         : " << keep_warm_low << "-" << keep_warm_high << " C for " << keep_warm_duration_s << " s" << std::endl;
+    out << "  done when browned : ";
+    if (cook_browning_done > 0)
+        out << "browning index " << cook_browning_done << std::endl;
+    else
+        out << "off" << std::endl;
+    out << "  safety monitor    : every " << safety.period_ms << " ms, cut-off above " << safety.max_temperature_c << " C";
+    if (safety.cpu >= 0)
+        out << ", cpu " << safety.cpu;
+    if (safety.priority > 0)
+        out << ", SCHED_FIFO " << safety.priority;
+    out << std::endl;
+    out << "  binary rpc        : ";
+    if (rpc_port == 0 && rpc_socket.empty())
+        out << "off" << std::endl;
+    else
+        out << (rpc_port ? rpc_bind + ":" + std::to_string(rpc_port) + " " : "") << (rpc_socket.empty() ? "" : rpc_socket + " ")
+            << "(" << rpc_max_connections << " connections)" << std::endl;
+    out << "  shared memory     : " << (shm_name.empty() ? "off" : shm_name) << std::endl;
+    out << "  gateway           : ";
+    if (gateway.backends.empty())
+        out << "off" << std::endl;
+    else
+        out << gateway.backends.size() << " ovens, " << gateway.deadline_ms << " ms deadline, " << gateway.cache_ttl_ms
+            << " ms cache, alarm above " << gateway.overheat_c << " C" << std::endl;
+    out << "  authentication    : ";
+    if (auth.key.empty())
+        out << "off" << std::endl;
+    else
+        out << "tokens valid " << auth.token_ttl_s << " s, " << (auth.signing_key.empty() ? "random" : "configured")
+            << " signing key, " << auth.cache_entries << " cached" << std::endl;
+    out << "  log               : ";
+    if (log.path == "none")
+        out << "off" << std::endl;
+    else
+        out << log.path << " (" << (log.format == Logger::JSON ? "json" : "binary") << ", " << Logger::level_name(log.level)
+            << " and up, rotated at " << log.max_bytes / (1024 * 1024) << " MB, " << log.keep << " files)" << std::endl;
+    out << "  request recording : " << (record_file.empty() ? "off" : record_file) << std::endl;
+    out << "  time warp         : " << time_warp << "x" << std::endl;
+    out << "  sensor seed       : " << (seed ? std::to_string(seed) : "random") << std::endl;
+    out << "  worker pinning    : ";
+    if (pin_cpus.empty()) {
+        out << "off" << std::endl;
+    }
+    else {
+        for (int i = 0; i < threads; i++)
+            out << (i ? ", " : "") << "w" << i << "->cpu" << pin_cpus[i % pin_cpus.size()];
+        out << std::endl;
+    }
+}
+
+std::string ServerConfig::trim(const std::string& s) {
+    auto first = s.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+        return "";
+    auto last = s.find_last_not_of(" \t\r");
+    return s.substr(first, last - first + 1);
+}
+
+int ServerConfig::to_int(const std::string& s) {
+    if (s.empty() || isspace(static_cast<unsigned char>(s[0])))
+        throw std::invalid_argument(s);
+    char* end = nullptr;
+    errno = 0;
+    long value = strtol(s.c_str(), &end, 10);
+    if (*end != '\0')
+        throw std::invalid_argument(s);
+    if (errno == ERANGE || value < INT_MIN || value > INT_MAX)
+        throw std::out_of_range(s);
+    return static_cast<int>(value);
+}
+
+unsigned long long ServerConfig::to_unsigned(const std::string& s) {
+    // strtoull takes "-1" and wraps it around
+    if (s.empty() || !isdigit(static_cast<unsigned char>(s[0])))
+        throw std::invalid_argument(s);
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long value = strtoull(s.c_str(), &end, 10);
+    if (*end != '\0')
+        throw std::invalid_argument(s);
+    if (errno == ERANGE)
+        throw std::out_of_range(s);
+    return value;
+}
+
+double ServerConfig::to_double(const std::string& s) {
+    if (s.empty() || isspace(static_cast<unsigned char>(s[0])))
+        throw std::invalid_argument(s);
+    char* end = nullptr;
+    errno = 0;
+    double value = strtod(s.c_str(), &end);
+    if (*end != '\0')
+        throw std::invalid_argument(s);
+    if (errno == ERANGE)
+        throw std::out_of_range(s);
+    // strtod takes nan and inf too, and nan slips through every range check
+    if (!std::isfinite(value))
+        throw std::invalid_argument(s);
+    return value;
+}
@@ -0,0 +1,83 @@
+#include "cupthor/settings_graph.h"
+
+SettingsGraph::SettingsGraph(int nodes)
+    : values(nodes, 0),
+      dependents(nodes),
+      changed_in(nodes, 0)
+{ }
+
+void SettingsGraph::add_rule(std::initializer_list<int> inputs, Rule rule) {
+    int id = static_cast<int>(rules.size());
+    rules.push_back(std::move(rule));
+    queued_in.push_back(0);
+    runs.push_back(0);
+    for (int node : inputs)
+        dependents[node].push_back(id);
+}
+
+void SettingsGraph::record(int node, double before) {
+    if (changed_in[node] == wave)
+        return;
+    changed_in[node] = wave;
+    changes.push_back({node, before, 0});
+}
+
+size_t SettingsGraph::set(int node, double value) {
+    if (values[node] == value)
+        return 0;
+    record(node, values[node]);
+    values[node] = value;
+
+    // queued_in holds the wave a rule is waiting in, 0 once it ran
+    for (int rule : dependents[node]) {
+        if (queued_in[rule] == wave)
+            continue;
+        queued_in[rule] = wave;
+        queue.push_back(rule);
+    }
+    if (propagating)
+        return 0;
+
+    propagating = true;
+    for (size_t at = 0; at < queue.size(); at++) {
+        int rule = queue[at];
+        queued_in[rule] = 0;
+        if (runs[rule] >= MAX_RUNS_PER_RULE)
+            continue;
+        runs[rule]++;
+        evaluation_count++;
+        rules[rule](*this);
+    }
+    for (int rule : queue)
+        runs[rule] = 0;
+    queue.clear();
+    propagating = false;
+
+    reported.clear();
+    for (const Change& change : changes)
+        if (values[change.node] != change.before)
+            reported.push_back({change.node, change.before, values[change.node]});
+    changes.clear();
+    wave++;
+
+    // Subscribers only read: `reported` is reused by the next wave
+    if (!reported.empty())
+        for (auto& subscriber : subscribers)
+            subscriber.second(reported);
+    return reported.size();
+}
+
+int SettingsGraph::subscribe(Subscriber subscriber) {
+    int id = next_subscriber++;
+    subscribers.emplace_back(id, std::move(subscriber));
+    return id;
+}
+
+void SettingsGraph::unsubscribe(int id) {
+    for (auto it = subscribers.begin(); it != subscribers.end(); ++it) {
+        if (it->first == id) {
+            subscribers.erase(it);
+            return;
+        }
+    }
+}
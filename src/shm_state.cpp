@@ -0,0 +1,131 @@
+#include "cupthor/shm_state.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+bool ShmStatePublisher::open(const std::string& segment_name) {
+    close();
+
+    // A new segment every time: a reader that still maps the old one isn't confused by a layout change
+    shm_unlink(segment_name.c_str());
+    int fd = shm_open(segment_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        perror(("shm_open " + segment_name).c_str());
+        return false;
+    }
+    if (ftruncate(fd, sizeof(ShmStateSegment)) != 0) {
+        perror("ftruncate");
+        ::close(fd);
+        shm_unlink(segment_name.c_str());
+        return false;
+    }
+    void* memory = mmap(nullptr, sizeof(ShmStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(segment_name.c_str());
+        return false;
+    }
+
+    segment = new (memory) ShmStateSegment();
+    segment->version = SHM_STATE_VERSION;
+    segment->size = sizeof(ShmState);
+    segment->writer_pid = getpid();
+    segment->sequence.store(0, std::memory_order_relaxed);
+    for (auto& word : segment->words)
+        word.store(0, std::memory_order_relaxed);
+    // The magic goes in last, a reader that sees it sees an initialized segment
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->magic = SHM_STATE_MAGIC;
+    name = segment_name;
+    count = 0;
+    return true;
+}
+
+void ShmStatePublisher::close() {
+    if (segment == nullptr)
+        return;
+    munmap(segment, sizeof(ShmStateSegment));
+    shm_unlink(name.c_str());
+    segment = nullptr;
+}
+
+void ShmStatePublisher::publish(const ShmState& state) {
+    if (segment == nullptr)
+        return;
+
+    uint64_t words[ShmStateSegment::WORDS] = {};
+    memcpy(words, &state, sizeof(state));
+    // The count is the publisher's, whatever the caller put there
+    uint64_t published = ++count;
+    memcpy(words, &published, sizeof(published));
+
+    uint64_t sequence = segment->sequence.load(std::memory_order_relaxed);
+    segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < ShmStateSegment::WORDS; i++)
+        segment->words[i].store(words[i], std::memory_order_relaxed);
+    segment->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool ShmStateReader::open(const std::string& name) {
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    void* memory = mmap(nullptr, sizeof(ShmStateSegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+        return false;
+
+    const ShmStateSegment* mapped = static_cast<const ShmStateSegment*>(memory);
+    uint32_t magic = mapped->magic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (magic != SHM_STATE_MAGIC || mapped->version != SHM_STATE_VERSION || mapped->size != sizeof(ShmState)) {
+        munmap(memory, sizeof(ShmStateSegment));
+        return false;
+    }
+    segment = mapped;
+    return true;
+}
+
+void ShmStateReader::close() {
+    if (segment == nullptr)
+        return;
+    munmap(const_cast<ShmStateSegment*>(segment), sizeof(ShmStateSegment));
+    segment = nullptr;
+}
+
+bool ShmStateReader::read(ShmState& state, int max_tries) const {
+    if (segment == nullptr)
+        return false;
+
+    uint64_t words[ShmStateSegment::WORDS];
+    for (int attempt = 0; attempt < max_tries; attempt++) {
+        // Only under heavy contention: let the writer finish instead of spinning against it
+        if (attempt >= 16)
+            std::this_thread::yield();
+
+        uint64_t before = segment->sequence.load(std::memory_order_acquire);
+        // Odd: the writer is in the middle of a publish. 0: nothing published yet.
+        if (before & 1)
+            continue;
+        if (before == 0)
+            return false;
+        for (size_t i = 0; i < ShmStateSegment::WORDS; i++)
+            words[i] = segment->words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->sequence.load(std::memory_order_relaxed) == before) {
+            memcpy(&state, words, sizeof(state));
+            return true;
+        }
+    }
+    return false;
+}
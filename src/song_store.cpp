@@ -0,0 +1,186 @@
+#include "cupthor/song_store.h"
+
+#include <cstring>
+
+namespace {
+
+const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+const uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+uint64_t rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Unaligned little endian reads; memcpy compiles to a plain load
+uint64_t read64(const unsigned char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t lane_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+uint64_t merge_round(uint64_t acc, uint64_t value) {
+    acc ^= lane_round(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+}
+
+uint64_t xxhash64(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        // Four independent lanes over stripes of 32 bytes
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = lane_round(v1, read64(p));
+            v2 = lane_round(v2, read64(p + 8));
+            v3 = lane_round(v3, read64(p + 16));
+            v4 = lane_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    }
+    else {
+        hash = seed + PRIME5;
+    }
+    hash += size;
+
+    for (; p + 8 <= end; p += 8) {
+        hash ^= lane_round(0, read64(p));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end) {
+        hash ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= *p * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::string song_hash_text(uint64_t hash) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text(16, '0');
+    for (int i = 15; i >= 0; i--, hash >>= 4)
+        text[i] = digits[hash & 0xf];
+    return text;
+}
+
+bool parse_song_hash(const std::string& text, uint64_t& hash) {
+    if (text.size() != 16)
+        return false;
+    uint64_t value = 0;
+    for (char c : text) {
+        int digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false;
+        value = value << 4 | digit;
+    }
+    hash = value;
+    return true;
+}
+
+size_t SongStore::cost(const std::shared_ptr<const Song>& song) {
+    size_t bytes = sizeof(Entry) + 64;
+    if (song)
+        bytes += sizeof(Song) + song->samples.size() * sizeof(int16_t);
+    return bytes;
+}
+
+void SongStore::set_budget(size_t budget_bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    budget = budget_bytes;
+    evict();
+}
+
+bool SongStore::find(uint64_t hash, std::shared_ptr<const Song>& song) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = by_hash.find(hash);
+    if (found == by_hash.end()) {
+        misses++;
+        return false;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    song = found->second->song;
+    return true;
+}
+
+void SongStore::insert(uint64_t hash, std::shared_ptr<const Song> song) {
+    size_t bytes = cost(song);
+    std::lock_guard<std::mutex> guard(lock);
+    if (bytes > budget)
+        return;
+    auto found = by_hash.find(hash);
+    if (found != by_hash.end()) {
+        // Two uploads of the same song decoded at the same time, the first one stays
+        entries.splice(entries.begin(), entries, found->second);
+        return;
+    }
+    entries.push_front(Entry{hash, std::move(song), bytes});
+    by_hash[hash] = entries.begin();
+    used += bytes;
+    evict();
+}
+
+void SongStore::evict() {
+    while (used > budget && !entries.empty()) {
+        // A song still in the playlist stays alive there, only the store lets go of it
+        Entry& oldest = entries.back();
+        used -= oldest.bytes;
+        by_hash.erase(oldest.hash);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+SongStore::Stats SongStore::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+    Stats stats;
+    stats.songs = entries.size();
+    stats.bytes = used;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    return stats;
+}
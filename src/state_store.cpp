@@ -0,0 +1,327 @@
+#include "cupthor/state_store.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool StateStore::open(const std::string& dir, int commit_interval_ms, size_t snapshot_every) {
+    this -> dir = dir;
+    this -> commit_interval_ms = commit_interval_ms;
+    this -> snapshot_every = snapshot_every;
+
+    mkdir(dir.c_str(), 0755);
+    wal_fd = ::open(wal_path().c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (wal_fd < 0) {
+        perror(("cannot open " + wal_path()).c_str());
+        return false;
+    }
+    return true;
+}
+
+bool StateStore::recover(State& state) {
+    state = State();
+    load_snapshot(state);
+
+    std::string wal;
+    if (!read_file(wal_path(), wal))
+        return false;
+
+    size_t pos = 0;
+    while (pos + 9 <= wal.size()) {
+        uint32_t length = get_u32(wal, pos);
+        if (pos + 9 + length > wal.size())
+            break;
+        uint32_t crc = get_u32(wal, pos + 5 + length);
+        if (crc != crc32(wal.data() + pos + 4, length + 1))
+            break;
+
+        size_t at = pos + 5;
+        apply(state, wal[pos + 4], wal, at);
+        pos += 9 + length;
+        records++;
+    }
+
+    if (pos != wal.size() && ftruncate(wal_fd, pos) != 0)
+        perror("cannot truncate the write-ahead log");
+    wal_size = pos;
+
+    mirror = state;
+    return true;
+}
+
+void StateStore::close() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running && wal_fd < 0)
+            return;
+        running = false;
+    }
+    wake.notify_all();
+    if (flusher.joinable())
+        flusher.join();
+    if (wal_fd >= 0) {
+        ::close(wal_fd);
+        wal_fd = -1;
+    }
+}
+
+uint64_t StateStore::update(const State& state) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (state.desired_temperature != mirror.desired_temperature)
+        append(DESIRED_TEMPERATURE, encode_f64(state.desired_temperature));
+    if (state.ventilation != mirror.ventilation)
+        append(VENTILATION, encode_u32(static_cast<uint32_t>(state.ventilation)));
+    if (state.ambient_light != mirror.ambient_light)
+        append(AMBIENT_LIGHT, std::string(1, state.ambient_light));
+    if (state.silent_mode != mirror.silent_mode)
+        append(SILENT_MODE, std::string(1, state.silent_mode));
+    if (state.defrost != mirror.defrost)
+        append(DEFROST, std::string(1, state.defrost));
+    if (state.what_is_cooking != mirror.what_is_cooking || state.keep_food_warm != mirror.keep_food_warm)
+        append(COOK, std::string(1, state.keep_food_warm) + encode_string(state.what_is_cooking));
+    if (state.timer_name != mirror.timer_name || state.timer_deadline_ms != mirror.timer_deadline_ms)
+        append(TIMER, encode_u64(static_cast<uint64_t>(state.timer_deadline_ms)) + encode_string(state.timer_name));
+    if (state.media_player != mirror.media_player)
+        append(MEDIA_PLAYER, std::string(1, state.media_player));
+    if (state.cook_phase != mirror.cook_phase || state.phase_deadline_ms != mirror.phase_deadline_ms || state.cook_seconds != mirror.cook_seconds)
+        append(COOK_PHASE, std::string(1, state.cook_phase) + encode_u64(static_cast<uint64_t>(state.phase_deadline_ms)) + encode_u32(static_cast<uint32_t>(state.cook_seconds)));
+
+    mirror = state;
+    if (pending.size() >= 64 * 1024)
+        wake.notify_one();
+    return last_lsn;
+}
+
+void StateStore::append(uint8_t type, const std::string& payload) {
+    size_t start = pending.size();
+    pending += encode_u32(static_cast<uint32_t>(payload.size()));
+    pending += static_cast<char>(type);
+    pending += payload;
+    pending += encode_u32(crc32(pending.data() + start + 4, payload.size() + 1));
+    last_lsn++;
+}
+
+void StateStore::flush_loop() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (running || !pending.empty()) {
+        if (pending.empty())
+            wake.wait_for(guard, std::chrono::milliseconds(commit_interval_ms));
+        else if (running)
+            wake.wait_for(guard, std::chrono::milliseconds(commit_interval_ms), [&] { return !running || pending.size() >= 64 * 1024; });
+
+        if (pending.empty())
+            continue;
+
+        // The batch is written and synced without holding the lock, so appends don't wait on the disk
+        std::string batch;
+        batch.swap(pending);
+        uint64_t batch_lsn = last_lsn;
+        size_t batch_records = batch_lsn - durable_lsn;
+        guard.unlock();
+
+        bool ok = write_all(wal_fd, batch) && fdatasync(wal_fd) == 0;
+        if (ok)
+            wal_size += batch.size();
+        else {
+            // Nothing of the batch counts as written: a torn record would end the replay there and hide every batch
+            // after it, so the log is cut back to the last whole batch and the batch is written again later
+            if (!failed.exchange(true))
+                perror("write-ahead log commit failed, retrying");
+            if (ftruncate(wal_fd, wal_size) != 0)
+                perror("cannot cut the write-ahead log back");
+        }
+
+        guard.lock();
+        if (!ok) {
+            pending.insert(0, batch);
+            if (!running) {
+                std::cerr << "write-ahead log: " << last_lsn - durable_lsn << " changes not stored" << std::endl;
+                break;
+            }
+            wake.wait_for(guard, std::chrono::milliseconds(100), [&] { return !running; });
+            continue;
+        }
+        if (failed.exchange(false))
+            std::cerr << "write-ahead log commits work again" << std::endl;
+        durable_lsn = batch_lsn;
+        records += batch_records;
+        durable.notify_all();
+
+        if (ok && records >= snapshot_every) {
+            std::string snapshot = encode_snapshot(mirror);
+            guard.unlock();
+            ok = write_snapshot(snapshot);
+            guard.lock();
+            if (ok)
+                records = 0;
+        }
+    }
+}
+
+std::string StateStore::encode_snapshot(const State& state) {
+    std::string data = "CTSN";
+    data += encode_u32(2);
+    data += encode_f64(state.desired_temperature);
+    data += encode_u32(static_cast<uint32_t>(state.ventilation));
+    data += static_cast<char>(state.ambient_light);
+    data += static_cast<char>(state.silent_mode);
+    data += static_cast<char>(state.defrost);
+    data += static_cast<char>(state.keep_food_warm);
+    data += encode_string(state.what_is_cooking);
+    data += encode_u64(static_cast<uint64_t>(state.timer_deadline_ms));
+    data += encode_string(state.timer_name);
+    data += static_cast<char>(state.media_player);
+    data += static_cast<char>(state.cook_phase);
+    data += encode_u64(static_cast<uint64_t>(state.phase_deadline_ms));
+    data += encode_u32(static_cast<uint32_t>(state.cook_seconds));
+    data += encode_u32(crc32(data.data(), data.size()));
+    return data;
+}
+
+bool StateStore::write_snapshot(const std::string& data) {
+    std::string tmp = snapshot_path() + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("cannot write snapshot");
+        return false;
+    }
+    bool ok = write_all(fd, data) && fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmp.c_str(), snapshot_path().c_str()) != 0) {
+        perror("cannot write snapshot");
+        return false;
+    }
+
+    // The rename is only durable once the directory is synced, without it a crash could bring back the old
+    // snapshot next to an empty log
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ok = dir_fd >= 0 && fsync(dir_fd) == 0;
+    if (dir_fd >= 0)
+        ::close(dir_fd);
+    if (!ok) {
+        perror("cannot sync the state directory");
+        return false;
+    }
+
+    // Records are absolute values, so replaying some of them twice after a crash right here is harmless
+    if (ftruncate(wal_fd, 0) != 0) {
+        perror("cannot truncate the write-ahead log");
+        return false;
+    }
+    wal_size = 0;
+    return true;
+}
+
+void StateStore::load_snapshot(State& state) {
+    std::string data;
+    if (!read_file(snapshot_path(), data) || data.size() < 12 || data.compare(0, 4, "CTSN") != 0)
+        return;
+    uint32_t version = get_u32(data, 4);
+    if (get_u32(data, data.size() - 4) != crc32(data.data(), data.size() - 4) || version < 1 || version > 2) {
+        std::cerr << "ignoring corrupt snapshot " << snapshot_path() << std::endl;
+        return;
+    }
+
+    size_t pos = 8;
+    state.desired_temperature = get_f64(data, pos);
+    state.ventilation = static_cast<int>(get_u32(data, pos + 8));
+    pos += 12;
+    state.ambient_light = data[pos++];
+    state.silent_mode = data[pos++];
+    state.defrost = data[pos++];
+    state.keep_food_warm = data[pos++];
+    state.what_is_cooking = get_string(data, pos);
+    state.timer_deadline_ms = static_cast<int64_t>(get_u64(data, pos));
+    pos += 8;
+    state.timer_name = get_string(data, pos);
+    state.media_player = data[pos++];
+
+    // Version 2 added the cook lifecycle
+    if (version >= 2) {
+        state.cook_phase = data[pos++];
+        state.phase_deadline_ms = static_cast<int64_t>(get_u64(data, pos));
+        state.cook_seconds = static_cast<int>(get_u32(data, pos + 8));
+    }
+}
+
+void StateStore::apply(State& state, uint8_t type, const std::string& data, size_t& pos) {
+    switch (type) {
+        case DESIRED_TEMPERATURE: state.desired_temperature = get_f64(data, pos); break;
+        case VENTILATION: state.ventilation = static_cast<int>(get_u32(data, pos)); break;
+        case AMBIENT_LIGHT: state.ambient_light = data[pos]; break;
+        case SILENT_MODE: state.silent_mode = data[pos]; break;
+        case DEFROST: state.defrost = data[pos]; break;
+        case COOK:
+            state.keep_food_warm = data[pos++];
+            state.what_is_cooking = get_string(data, pos);
+            break;
+        case TIMER:
+            state.timer_deadline_ms = static_cast<int64_t>(get_u64(data, pos));
+            pos += 8;
+            state.timer_name = get_string(data, pos);
+            break;
+        case MEDIA_PLAYER: state.media_player = data[pos]; break;
+        case COOK_PHASE:
+            state.cook_phase = data[pos];
+            state.phase_deadline_ms = static_cast<int64_t>(get_u64(data, pos + 1));
+            state.cook_seconds = static_cast<int>(get_u32(data, pos + 9));
+            break;
+    }
+}
+
+bool StateStore::read_file(const std::string& path, std::string& data) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+        return true;
+    data.assign(std::istreambuf_iterator<char>(input), {});
+    return true;
+}
+
+bool StateStore::write_all(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+uint32_t StateStore::crc32(const char* data, size_t length) {
+    static uint32_t table[256] = {0};
+    static bool initialised = false;
+    if (!initialised) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        initialised = true;
+    }
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+std::string StateStore::get_string(const std::string& d, size_t& pos) {
+    uint32_t length = get_u32(d, pos);
+    pos += 4;
+    if (pos + length > d.size())
+        length = d.size() - pos;
+    std::string s = d.substr(pos, length);
+    pos += length;
+    return s;
+}
@@ -0,0 +1,334 @@
+#include "cupthor/timelapse.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+namespace {
+
+size_t page_size() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+uint64_t round_up(uint64_t value, uint64_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+}
+
+bool FrameArchive::map(int fd, size_t bytes, bool write) {
+    void* mapped = mmap(nullptr, bytes, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    memory = static_cast<unsigned char*>(mapped);
+    mapped_bytes = bytes;
+    writable = write;
+    header = reinterpret_cast<TimelapseHeader*>(memory);
+    index = reinterpret_cast<TimelapseIndexEntry*>(memory + round_up(sizeof(TimelapseHeader), alignof(TimelapseIndexEntry)));
+    return true;
+}
+
+std::shared_ptr<FrameArchive> FrameArchive::create(const std::string& path, uint32_t max_frames, uint64_t data_bytes) {
+    uint64_t index_end = round_up(sizeof(TimelapseHeader), alignof(TimelapseIndexEntry)) + uint64_t(max_frames) * sizeof(TimelapseIndexEntry);
+    uint64_t data_offset = round_up(index_end, page_size());
+    uint64_t total = data_offset + data_bytes;
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(("open " + path).c_str());
+        return nullptr;
+    }
+    // Blocks allocated now, in one piece if the file system can; ftruncate (a sparse file) where it can't
+    int error = posix_fallocate(fd, 0, total);
+    if (error != 0 && ftruncate(fd, total) != 0) {
+        perror(("cannot allocate " + path).c_str());
+        ::close(fd);
+        unlink(path.c_str());
+        return nullptr;
+    }
+
+    std::shared_ptr<FrameArchive> archive(new FrameArchive());
+    bool mapped = archive->map(fd, total, true);
+    ::close(fd);
+    if (!mapped) {
+        unlink(path.c_str());
+        return nullptr;
+    }
+
+    TimelapseHeader* header = new (archive->memory) TimelapseHeader();
+    header->version = TIMELAPSE_VERSION;
+    header->max_frames = max_frames;
+    header->reserved = 0;
+    header->data_offset = data_offset;
+    header->data_bytes = data_bytes;
+    header->frame_count.store(0, std::memory_order_relaxed);
+    header->magic = TIMELAPSE_MAGIC;
+    archive->data = archive->memory + data_offset;
+    return archive;
+}
+
+std::shared_ptr<FrameArchive> FrameArchive::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(TimelapseHeader)) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    std::shared_ptr<FrameArchive> archive(new FrameArchive());
+    bool mapped = archive->map(fd, info.st_size, false);
+    ::close(fd);
+    if (!mapped)
+        return nullptr;
+
+    // Everything the reads rely on is checked against the size of the file
+    const TimelapseHeader* header = archive->header;
+    uint64_t index_end = round_up(sizeof(TimelapseHeader), alignof(TimelapseIndexEntry)) + uint64_t(header->max_frames) * sizeof(TimelapseIndexEntry);
+    if (header->magic != TIMELAPSE_MAGIC || header->version != TIMELAPSE_VERSION
+            || header->data_offset < index_end || header->data_offset > archive->mapped_bytes
+            || header->data_bytes > archive->mapped_bytes - header->data_offset)
+        return nullptr;
+    archive->data = archive->memory + header->data_offset;
+    return archive;
+}
+
+FrameArchive::~FrameArchive() {
+    if (memory != nullptr)
+        munmap(memory, mapped_bytes);
+}
+
+bool FrameArchive::append(const void* frame, size_t size, int64_t timestamp_ms) {
+    uint32_t n = header->frame_count.load(std::memory_order_relaxed);
+    if (!writable || n >= header->max_frames || size > header->data_bytes - data_end)
+        return false;
+
+    memcpy(data + data_end, frame, size);
+    index[n].offset = data_end;
+    index[n].size = static_cast<uint32_t>(size);
+    index[n].reserved = 0;
+    index[n].timestamp_ms = timestamp_ms;
+    data_end += size;
+    header->frame_count.store(n + 1, std::memory_order_release);
+    return true;
+}
+
+void FrameArchive::flush(bool wait) {
+    if (!writable)
+        return;
+    int flags = wait ? MS_SYNC : MS_ASYNC;
+
+    // The frames first, in one range from where the last flush stopped, then the index that points at them
+    if (data_end > flushed_data) {
+        uint64_t start = (header->data_offset + flushed_data) / page_size() * page_size();
+        uint64_t end = header->data_offset + data_end;
+        if (msync(memory + start, end - start, flags) != 0)
+            perror("timelapse msync");
+        flushed_data = data_end;
+    }
+    uint32_t n = header->frame_count.load(std::memory_order_relaxed);
+    if (n != flushed_frames || wait) {
+        if (msync(memory, header->data_offset, flags) != 0)
+            perror("timelapse msync");
+        flushed_frames = n;
+    }
+}
+
+uint32_t FrameArchive::frames() const {
+    uint32_t n = header->frame_count.load(std::memory_order_acquire);
+    return n < header->max_frames ? n : header->max_frames;
+}
+
+bool FrameArchive::frame(uint32_t n, Frame& out) const {
+    if (n >= frames())
+        return false;
+    const TimelapseIndexEntry& entry = index[n];
+    if (entry.offset > header->data_bytes || entry.size > header->data_bytes - entry.offset)
+        return false;
+    out.data = data + entry.offset;
+    out.size = entry.size;
+    out.timestamp_ms = entry.timestamp_ms;
+    return true;
+}
+
+std::string TimelapseRecorder::path(uint64_t session) const {
+    return options.dir + "/session-" + std::to_string(session) + ".ctl";
+}
+
+bool TimelapseRecorder::start(const Options& recorder_options, std::shared_ptr<Clock> recorder_clock, Capture recorder_capture) {
+    options = recorder_options;
+    clock = recorder_clock;
+    capture = recorder_capture;
+    if (options.batch == 0)
+        options.batch = 1;
+
+    mkdir(options.dir.c_str(), 0755);
+    DIR* dir = opendir(options.dir.c_str());
+    if (dir == nullptr) {
+        perror(("cannot open " + options.dir).c_str());
+        return false;
+    }
+    // Numbers go on from the sessions of the earlier runs, their archives stay readable
+    while (dirent* entry = readdir(dir)) {
+        unsigned long long session;
+        char extension[8];
+        if (sscanf(entry->d_name, "session-%llu.%7s", &session, extension) == 2 && strcmp(extension, "ctl") == 0) {
+            on_disk.insert(session);
+            if (session >= next_session)
+                next_session = session + 1;
+        }
+    }
+    closedir(dir);
+    for (const std::string& old : expire_sessions())
+        unlink(old.c_str());
+
+    running = true;
+    recorder = std::thread(&TimelapseRecorder::record_loop, this);
+    return true;
+}
+
+void TimelapseRecorder::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running)
+            return;
+        running = false;
+    }
+    wake.notify_all();
+    recorder.join();
+}
+
+uint64_t TimelapseRecorder::begin() {
+    uint64_t session;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running)
+            return 0;
+        session = next_session++;
+        wanted_session = session;
+    }
+    wake.notify_all();
+    return session;
+}
+
+void TimelapseRecorder::end() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        wanted_session = 0;
+    }
+    wake.notify_all();
+}
+
+std::shared_ptr<FrameArchive> TimelapseRecorder::archive(uint64_t session) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = archives.find(session);
+    if (found != archives.end())
+        return found->second;
+    if (session == 0 || session >= next_session)
+        return nullptr;
+
+    std::shared_ptr<FrameArchive> opened = FrameArchive::open(path(session));
+    if (opened) {
+        archives[session] = opened;
+        trim_archives(wanted_session);
+    }
+    return opened;
+}
+
+void TimelapseRecorder::trim_archives(uint64_t current) {
+    size_t others = archives.size() - (archives.count(current) ? 1 : 0);
+    for (auto it = archives.begin(); it != archives.end() && others > OPEN_ARCHIVES; ) {
+        if (it->first == current) {
+            ++it;
+            continue;
+        }
+        // Readers that still hold it keep it mapped
+        it = archives.erase(it);
+        others--;
+    }
+}
+
+std::vector<std::string> TimelapseRecorder::expire_sessions() {
+    std::vector<std::string> paths;
+    while (options.keep > 0 && on_disk.size() > options.keep) {
+        uint64_t oldest = *on_disk.begin();
+        on_disk.erase(on_disk.begin());
+        archives.erase(oldest);
+        paths.push_back(path(oldest));
+    }
+    return paths;
+}
+
+void TimelapseRecorder::record_loop() {
+    uint64_t session = 0;
+    std::shared_ptr<FrameArchive> current;
+    int64_t next_frame_ms = 0;
+    uint32_t appended = 0;
+    std::string frame;
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (running) {
+        if (wanted_session != session) {
+            uint64_t wanted = wanted_session;
+            guard.unlock();
+            // A finished session is complete on disk before the next one starts
+            if (current)
+                current->flush(true);
+            current.reset();
+            if (wanted != 0)
+                current = FrameArchive::create(path(wanted), options.max_frames, options.archive_bytes);
+            guard.lock();
+
+            session = wanted;
+            appended = 0;
+            // The first frame right away, the food as it went in
+            next_frame_ms = clock->now_ms();
+            if (current) {
+                archives[session] = current;
+                trim_archives(session);
+                on_disk.insert(session);
+                std::vector<std::string> expired = expire_sessions();
+                if (!expired.empty()) {
+                    // Deleting a preallocated archive can take a while, begin() mustn't wait for it
+                    guard.unlock();
+                    for (const std::string& old : expired)
+                        unlink(old.c_str());
+                    guard.lock();
+                }
+            }
+            continue;
+        }
+
+        if (current && clock->now_ms() >= next_frame_ms) {
+            guard.unlock();
+            int64_t now = clock->now_ms();
+            frame.clear();
+            if (capture(frame) && current->append(frame.data(), frame.size(), now)) {
+                frames_recorded++;
+                if (++appended % options.batch == 0)
+                    current->flush();
+            }
+            else {
+                frames_dropped++;
+            }
+            next_frame_ms = now + static_cast<int64_t>(options.interval_s) * 1000;
+            guard.lock();
+            continue;
+        }
+
+        wake.wait_for(guard, std::chrono::milliseconds(100));
+    }
+    guard.unlock();
+    if (current)
+        current->flush(true);
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Runs the burst workload (small /settings POSTs) against one server binary with authentication off, then on (every
+# request carries a token from /auth), and prints req/s and latency for both. Environment: PORT, DURATION,
+# CONNECTIONS.
+#
+#   ./tools/auth.sh cupthor-release
+
+PORT=${PORT:-9185}
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-16}
+BINARY=${1:-cupthor}
+KEY=auth-compare
+
+printf "%-8s %10s %10s %10s %8s\n" "auth" "req/s" "p50 us" "p99 us" "errors"
+run() {
+    ./"$BINARY" --port "$PORT" --state-dir none --timelapse-dir none --auth-key "$1" > /dev/null &
+    pid=$!
+    sleep 1
+
+    result=$(./loadgen --port "$PORT" --duration "$DURATION" --connections "$CONNECTIONS" --mix burst ${1:+--key "$1"} | grep '^RESULT')
+
+    kill -INT $pid
+    wait $pid
+    rps=$(echo "$result" | sed -n 's/.*rps=\([0-9]*\).*/\1/p')
+    p50=$(echo "$result" | sed -n 's/.*p50_us=\([0-9]*\).*/\1/p')
+    p99=$(echo "$result" | sed -n 's/.*p99_us=\([0-9]*\).*/\1/p')
+    errors=$(echo "$result" | sed -n 's/.*errors=\([0-9]*\).*/\1/p')
+    printf "%-8s %10s %10s %10s %8s\n" "$2" "${rps:--}" "${p50:--}" "${p99:--}" "${errors:--}"
+}
+
+run "" off
+run "$KEY" on
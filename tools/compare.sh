@@ -0,0 +1,28 @@
+#!/bin/sh
+# Starts every server binary given as argument in turn, runs the same loadgen workload against it and prints one
+# line per binary. Environment: PORT, DURATION, CONNECTIONS, MIX.
+#
+#   ./tools/compare.sh cupthor-debug cupthor cupthor-release cupthor-pgo
+
+PORT=${PORT:-9182}
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-16}
+MIX=${MIX:-mixed}
+
+printf "%-20s %10s %10s %10s %8s\n" "profile" "req/s" "p50 us" "p99 us" "errors"
+for binary in "$@"; do
+    ./"$binary" --port "$PORT" --state-dir none > /dev/null &
+    pid=$!
+    sleep 1
+
+    result=$(./loadgen --port "$PORT" --duration "$DURATION" --connections "$CONNECTIONS" --mix "$MIX" | grep '^RESULT')
+
+    kill -INT $pid
+    wait $pid
+
+    rps=$(echo "$result" | sed -n 's/.*rps=\([0-9]*\).*/\1/p')
+    p50=$(echo "$result" | sed -n 's/.*p50_us=\([0-9]*\).*/\1/p')
+    p99=$(echo "$result" | sed -n 's/.*p99_us=\([0-9]*\).*/\1/p')
+    errors=$(echo "$result" | sed -n 's/.*errors=\([0-9]*\).*/\1/p')
+    printf "%-20s %10s %10s %10s %8s\n" "$binary" "${rps:--}" "${p50:--}" "${p99:--}" "${errors:--}"
+done
@@ -0,0 +1,81 @@
+#pragma once
+
+// The bits of an HTTP/1.1 client shared by the tools: a blocking keep-alive connection and a response reader
+// that understands Content-Length, which is all the cupthor server sends.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+inline int connect_to(const std::string& host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // A response that never comes (a pipelined request the server dropped) is an error, not a hang
+    timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads one response, and its body when asked. Returns the status code, or -1 if the connection broke.
+inline int read_response(int fd, std::string& buffer, std::string* body = nullptr) {
+    size_t header_end;
+    while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        char chunk[16384];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return -1;
+        buffer.append(chunk, n);
+    }
+
+    int status = atoi(buffer.c_str() + 9);
+    size_t body_length = 0;
+    std::string headers = buffer.substr(0, header_end);
+    std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+    size_t cl = headers.find("content-length:");
+    if (cl != std::string::npos)
+        body_length = strtoul(headers.c_str() + cl + 15, nullptr, 10);
+
+    size_t total = header_end + 4 + body_length;
+    while (buffer.size() < total) {
+        char chunk[16384];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return -1;
+        buffer.append(chunk, n);
+    }
+    if (body != nullptr)
+        body->assign(buffer, header_end + 4, body_length);
+    buffer.erase(0, total);
+    return status;
+}
+
+// A session token from /auth for the server's auth_key, empty if the server didn't give one
+inline std::string fetch_token(const std::string& host, int port, const std::string& key) {
+    int fd = connect_to(host, port);
+    if (fd < 0)
+        return "";
+    std::string raw = "GET /auth HTTP/1.1\r\nHost: " + host + "\r\nAuthorization: Key " + key + "\r\n\r\n";
+    std::string buffer, token;
+    if (send(fd, raw.data(), raw.size(), MSG_NOSIGNAL) != (ssize_t)raw.size() || read_response(fd, buffer, &token) != 200)
+        token.clear();
+    close(fd);
+    return token;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Runs the burst workload (small /settings POSTs) against one server binary with and without connection reuse and
+# at several pipeline depths, and prints req/s per connection for each. Environment: PORT, DURATION, CONNECTIONS.
+#
+#   ./tools/keepalive.sh cupthor-release
+
+PORT=${PORT:-9183}
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-4}
+BINARY=${1:-cupthor}
+
+./"$BINARY" --port "$PORT" --state-dir none > /dev/null &
+pid=$!
+sleep 1
+
+printf "%-12s %-10s %10s %14s %10s %10s %8s\n" "connections" "pipeline" "req/s" "req/s per conn" "p50 us" "p99 us" "errors"
+run() {
+    output=$(./loadgen --port "$PORT" --duration "$DURATION" --connections "$CONNECTIONS" --mix burst --reuse "$1" --pipeline "$2")
+    result=$(echo "$output" | grep '^RESULT')
+    rps=$(echo "$result" | sed -n 's/.*rps=\([0-9]*\).*/\1/p')
+    p50=$(echo "$result" | sed -n 's/.*p50_us=\([0-9]*\).*/\1/p')
+    p99=$(echo "$result" | sed -n 's/.*p99_us=\([0-9]*\).*/\1/p')
+    errors=$(echo "$result" | sed -n 's/.*errors=\([0-9]*\).*/\1/p')
+    per_connection=$([ -n "$rps" ] && echo $((rps / CONNECTIONS)))
+    printf "%-12s %-10s %10s %14s %10s %10s %8s\n" "$([ "$1" = on ] && echo reused || echo new)" "$2" \
+        "${rps:--}" "${per_connection:--}" "${p50:--}" "${p99:--}" "${errors:--}"
+}
+
+run off 1
+run on 1
+run on 4
+run on 16
+
+kill -INT $pid
+wait $pid
@@ -0,0 +1,250 @@
+// Load generator for the cupthor server. Opens a number of keep-alive connections, sends a mix of requests on each
+// of them as fast as the server answers and reports throughput and latency percentiles.
+//
+// Used as the training workload for the PGO build and by `make compare`.
+//
+//   ./loadgen [--host 127.0.0.1] [--port 9080] [--connections 16] [--duration 10] [--mix mixed]
+//             [--pipeline 1] [--reuse on] [--key K]
+//
+// Mixes: ready, settings, cook, camera, mixed (mostly settings and sensors, an occasional camera capture),
+// burst (small /settings/:name/:value POSTs, what the kitchen controllers send)
+//
+// --pipeline N writes N requests back to back before reading the N responses (HTTP/1.1 pipelining).
+// --reuse off opens a new connection for every request (or every pipelined batch), to compare with keep-alive.
+// --key K gets a token from /auth with the server's auth_key first and sends it with every request, to compare
+// the throughput with and without authentication.
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_client.h"
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 9080;
+    int connections = 16;
+    int duration = 10;
+    std::string mix = "mixed";
+    int pipeline = 1;
+    bool reuse = true;
+    std::string key;
+    // From /auth, when a key is given
+    std::string token;
+};
+
+struct Request {
+    const char* method;
+    std::string path;
+};
+
+// One request of the chosen mix, picked at random
+static Request pick(const std::string& mix, std::mt19937& rng) {
+    static const char* settings[] = {"desired_temperature", "ventilation", "ambient_light", "silent_mode", "defrost"};
+    std::uniform_int_distribution<int> percent(0, 99);
+    int p = percent(rng);
+
+    if (mix == "ready")
+        return {"GET", "/ready"};
+    if (mix == "camera")
+        return {"GET", "/sensors/camera/"};
+    if (mix == "cook")
+        return p < 50 ? Request{"GET", "/cook/"} : Request{"POST", "/cook/vegetables/"};
+    if (mix == "burst")
+        return p < 50 ? Request{"POST", "/settings/desired_temperature/" + std::to_string(20 + p * 4)}
+                      : Request{"POST", "/settings/ventilation/" + std::to_string(p % 3)};
+    if (mix == "settings") {
+        if (p < 50)
+            return {"GET", std::string("/settings/") + settings[p % 5] + "/"};
+        if (p < 75)
+            return {"POST", "/settings/desired_temperature/" + std::to_string(20 + p * 2)};
+        return {"POST", "/settings/ventilation/" + std::to_string(p % 3)};
+    }
+
+    // mixed
+    if (p < 10)
+        return {"GET", "/ready"};
+    if (p < 40)
+        return {"GET", std::string("/settings/") + settings[p % 5] + "/"};
+    if (p < 60)
+        return {"POST", "/settings/desired_temperature/" + std::to_string(20 + p * 2)};
+    if (p < 70)
+        return {"POST", "/settings/ventilation/" + std::to_string(p % 3)};
+    if (p < 80)
+        return {"GET", "/sensors/thermostat/"};
+    if (p < 88)
+        return {"GET", "/cook/"};
+    if (p < 93)
+        return {"GET", "/mediaplayer/"};
+    if (p < 98)
+        return {"POST", "/mediaplayer/play/SGVsbG8gQ3VwLVRob3I="};
+    return {"GET", "/sensors/camera/"};
+}
+
+struct Result {
+    std::vector<uint32_t> latencies_us;
+    size_t errors = 0;
+    size_t rejected = 0;
+    size_t reconnects = 0;
+    // New connections opened on purpose, with --reuse off
+    size_t connects = 0;
+};
+
+static void client(const Options& options, int id, std::chrono::steady_clock::time_point end, Result& result) {
+    std::mt19937 rng(id * 7919 + 1);
+    std::string buffer;
+    int fd = connect_to(options.host, options.port);
+
+    while (std::chrono::steady_clock::now() < end) {
+        if (fd < 0) {
+            result.reconnects++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            fd = connect_to(options.host, options.port);
+            continue;
+        }
+
+        // The whole batch goes out in one write, the latency of each request counts from there
+        std::string raw;
+        for (int i = 0; i < options.pipeline; i++) {
+            Request request = pick(options.mix, rng);
+            raw += std::string(request.method) + " " + request.path + " HTTP/1.1\r\nHost: " + options.host +
+                   (options.token.empty() ? "" : "\r\nAuthorization: Bearer " + options.token) + "\r\nContent-Length: 0\r\n\r\n";
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (send(fd, raw.data(), raw.size(), MSG_NOSIGNAL) != (ssize_t)raw.size()) {
+            close(fd);
+            fd = -1;
+            buffer.clear();
+            continue;
+        }
+        for (int i = 0; i < options.pipeline; i++) {
+            int status = read_response(fd, buffer);
+            auto stop = std::chrono::steady_clock::now();
+
+            if (status < 0) {
+                close(fd);
+                fd = -1;
+                buffer.clear();
+                result.errors += options.pipeline - i;
+                break;
+            }
+            if (status == 429 || status == 503)
+                result.rejected++;
+            else if (status >= 500 || status == 401)
+                result.errors++;
+            result.latencies_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count());
+        }
+
+        if (!options.reuse && fd >= 0) {
+            close(fd);
+            buffer.clear();
+            fd = connect_to(options.host, options.port);
+            result.connects++;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+static bool parse(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+        if (arg == "--host")
+            options.host = value;
+        else if (arg == "--port")
+            options.port = std::stoi(value);
+        else if (arg == "--connections")
+            options.connections = std::stoi(value);
+        else if (arg == "--duration")
+            options.duration = std::stoi(value);
+        else if (arg == "--mix")
+            options.mix = value;
+        else if (arg == "--pipeline")
+            options.pipeline = std::stoi(value);
+        else if (arg == "--reuse") {
+            if (value != "on" && value != "off")
+                return false;
+            options.reuse = value == "on";
+        }
+        else if (arg == "--key")
+            options.key = value;
+        else
+            return false;
+    }
+    return options.connections > 0 && options.duration > 0 && options.pipeline > 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        if (!parse(argc, argv, options)) {
+            std::cerr << "usage: " << argv[0] << " [--host h] [--port p] [--connections n] [--duration s] [--mix ready|settings|cook|camera|mixed|burst]"
+                      << " [--pipeline n] [--reuse on|off] [--key k]" << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::exception&) {
+        std::cerr << "invalid number in the arguments" << std::endl;
+        return 1;
+    }
+
+    if (!options.key.empty()) {
+        options.token = fetch_token(options.host, options.port, options.key);
+        if (options.token.empty()) {
+            std::cerr << "no token from /auth" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Result> results(options.connections);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(options.duration);
+    for (int i = 0; i < options.connections; i++)
+        clients.emplace_back(client, std::cref(options), i, end, std::ref(results[i]));
+    for (auto& t : clients)
+        t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint32_t> all;
+    size_t errors = 0, rejected = 0, reconnects = 0, connects = 0;
+    for (auto& r : results) {
+        connects += r.connects;
+        all.insert(all.end(), r.latencies_us.begin(), r.latencies_us.end());
+        errors += r.errors;
+        rejected += r.rejected;
+        reconnects += r.reconnects;
+    }
+    if (all.empty()) {
+        std::cerr << "no request completed, is the server running on " << options.host << ":" << options.port << "?" << std::endl;
+        return 1;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[std::min(all.size() - 1, (size_t)(p * all.size()))]; };
+
+    std::cout << "mix " << options.mix << ", " << options.connections << " connections, pipeline " << options.pipeline
+              << ", connections " << (options.reuse ? "reused" : "new for every batch") << ", " << elapsed << " s" << std::endl;
+    std::cout << "  requests   : " << all.size() << " (" << rejected << " rejected with 429/503, " << errors << " errors, " << reconnects << " reconnects)" << std::endl;
+    std::cout << "  throughput : " << (size_t)(all.size() / elapsed) << " req/s, " << (size_t)(all.size() / elapsed / options.connections)
+              << " req/s per connection" << std::endl;
+    if (!options.reuse)
+        std::cout << "  connections: " << connects << " opened, " << (size_t)(connects / elapsed) << "/s" << std::endl;
+    std::cout << "  latency us : p50 " << percentile(0.50) << "  p90 " << percentile(0.90) << "  p99 " << percentile(0.99) << "  max " << all.back() << std::endl;
+    // One line that scripts can grep for
+    std::cout << "RESULT rps=" << (size_t)(all.size() / elapsed) << " p50_us=" << percentile(0.50) << " p99_us=" << percentile(0.99)
+              << " errors=" << errors << std::endl;
+    return errors == 0 ? 0 : 2;
+}
@@ -0,0 +1,20 @@
+// Prints a binary structured log (log_format = binary) as JSON lines, the same lines log_format = json writes.
+//
+//   ./logcat cupthor.log [cupthor.log.1 ...]
+
+#include <cstdio>
+
+#include "cupthor/logger.h"
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s log [log ...]\n", argv[0]);
+        return 2;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!Logger::to_json(argv[i], stdout))
+            status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,314 @@
+// Replays a request log recorded by the server (record_file) against a running cupthor and reports the latency of
+// every route, so two builds can be compared on the same real traffic.
+//
+//   ./replay --log requests.ctrq [--host 127.0.0.1] [--port 9080] [--speed 1|N|max] [--concurrency original|N]
+//            [--save results.txt] [--baseline results.txt]
+//
+// --speed 1 keeps the recorded timing, N replays N times faster, max sends every request as soon as a connection
+// is free. --concurrency original uses one connection per recorded connection, each with its own requests in
+// their order; N spreads the whole log over N connections. --save writes the per route latencies to a file, a later
+// run given that file as --baseline prints the difference next to its own numbers.
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cupthor/recorder.h"
+#include "http_client.h"
+
+struct Options {
+    std::string log;
+    std::string host = "127.0.0.1";
+    int port = 9080;
+    // 0 = as fast as possible
+    double speed = 1;
+    // 0 = the recorded connections
+    int concurrency = 0;
+    std::string save;
+    std::string baseline;
+};
+
+struct Sample {
+    size_t request;
+    uint32_t latency_us;
+    int status;
+};
+
+struct Worker {
+    std::vector<Sample> samples;
+    size_t reconnects = 0;
+    // How far behind its recorded time the worst request was sent, the client couldn't keep up when this is large
+    int64_t max_lag_us = 0;
+};
+
+// Requests are reported per method and first path segment: "POST /settings", "GET /cook"
+static std::string route_of(const RecordedRequest& request) {
+    size_t end = request.path.find('/', 1);
+    return std::string(RequestRecorder::method_name(request.method)) + " " + request.path.substr(0, end);
+}
+
+static void send_all(const Options& options, const std::vector<RecordedRequest>& log, std::chrono::steady_clock::time_point start,
+                     const std::vector<size_t>* own, std::atomic<size_t>* shared, Worker& worker) {
+    std::string buffer;
+    int fd = connect_to(options.host, options.port);
+    size_t position = 0;
+
+    while (true) {
+        size_t index;
+        if (own != nullptr) {
+            if (position >= own->size())
+                break;
+            index = (*own)[position++];
+        }
+        else {
+            index = shared->fetch_add(1);
+            if (index >= log.size())
+                break;
+        }
+        const RecordedRequest& request = log[index];
+
+        if (options.speed > 0) {
+            auto due = start + std::chrono::microseconds((int64_t)((request.timestamp_us - log.front().timestamp_us) / options.speed));
+            std::this_thread::sleep_until(due);
+            worker.max_lag_us = std::max<int64_t>(worker.max_lag_us,
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - due).count());
+        }
+
+        std::string raw = std::string(RequestRecorder::method_name(request.method)) + " " + request.path + " HTTP/1.1\r\nHost: " +
+                          options.host + "\r\nContent-Length: " + std::to_string(request.body_size) + "\r\n\r\n";
+        raw.append(request.body_size, 'x');
+
+        // One reconnect per request, a server that keeps closing the connection shows up as errors
+        int status = -1;
+        auto sent = std::chrono::steady_clock::now();
+        for (int attempt = 0; attempt < 2 && status < 0; attempt++) {
+            if (fd < 0) {
+                worker.reconnects++;
+                fd = connect_to(options.host, options.port);
+                if (fd < 0)
+                    continue;
+            }
+            sent = std::chrono::steady_clock::now();
+            if (send(fd, raw.data(), raw.size(), MSG_NOSIGNAL) == (ssize_t)raw.size())
+                status = read_response(fd, buffer);
+            if (status < 0) {
+                close(fd);
+                fd = -1;
+                buffer.clear();
+            }
+        }
+        auto done = std::chrono::steady_clock::now();
+        worker.samples.push_back({index, (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(done - sent).count(), status});
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+struct RouteStats {
+    size_t count = 0;
+    size_t errors = 0;
+    uint32_t p50 = 0, p90 = 0, p99 = 0;
+};
+
+static bool load_baseline(const std::string& path, std::map<std::string, RouteStats>& baseline) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "can't read " << path << std::endl;
+        return false;
+    }
+    // method<TAB>path count errors p50 p90 p99
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos)
+            continue;
+        RouteStats stats;
+        std::istringstream values(line.substr(tab + 1));
+        if (values >> stats.count >> stats.errors >> stats.p50 >> stats.p90 >> stats.p99)
+            baseline[line.substr(0, tab)] = stats;
+    }
+    return true;
+}
+
+static std::string delta(uint32_t now, uint32_t before) {
+    if (before == 0)
+        return "-";
+    std::ostringstream out;
+    out << std::showpos << std::fixed << std::setprecision(1) << 100.0 * ((double)now - before) / before << "%";
+    return out.str();
+}
+
+static bool parse(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+        if (arg == "--log")
+            options.log = value;
+        else if (arg == "--host")
+            options.host = value;
+        else if (arg == "--port")
+            options.port = std::stoi(value);
+        else if (arg == "--speed")
+            options.speed = value == "max" ? 0 : std::stod(value);
+        else if (arg == "--concurrency")
+            options.concurrency = value == "original" ? 0 : std::stoi(value);
+        else if (arg == "--save")
+            options.save = value;
+        else if (arg == "--baseline")
+            options.baseline = value;
+        else
+            return false;
+    }
+    return !options.log.empty() && options.speed >= 0 && options.concurrency >= 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        if (!parse(argc, argv, options)) {
+            std::cerr << "usage: " << argv[0] << " --log file [--host h] [--port p] [--speed 1|N|max] [--concurrency original|N]"
+                      << " [--save file] [--baseline file]" << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::exception&) {
+        std::cerr << "invalid number in the arguments" << std::endl;
+        return 1;
+    }
+
+    std::vector<RecordedRequest> log;
+    if (!RequestRecorder::load(options.log, log))
+        return 1;
+    if (log.empty()) {
+        std::cerr << options.log << " has no requests" << std::endl;
+        return 1;
+    }
+    std::map<std::string, RouteStats> baseline;
+    if (!options.baseline.empty() && !load_baseline(options.baseline, baseline))
+        return 1;
+
+    // The requests of every recorded connection, in order
+    std::map<uint32_t, std::vector<size_t>> connections;
+    for (size_t i = 0; i < log.size(); i++)
+        connections[log[i].connection].push_back(i);
+    size_t workers_count = options.concurrency == 0 ? connections.size() : options.concurrency;
+
+    std::vector<Worker> workers(workers_count);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next{0};
+    auto start = std::chrono::steady_clock::now();
+    if (options.concurrency == 0) {
+        size_t i = 0;
+        for (auto& connection : connections) {
+            threads.emplace_back(send_all, std::cref(options), std::cref(log), start, &connection.second, nullptr, std::ref(workers[i]));
+            i++;
+        }
+    }
+    else {
+        for (size_t i = 0; i < workers_count; i++)
+            threads.emplace_back(send_all, std::cref(options), std::cref(log), start, nullptr, &next, std::ref(workers[i]));
+    }
+    for (auto& t : threads)
+        t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::map<std::string, std::vector<uint32_t>> latencies;
+    std::map<std::string, RouteStats> routes;
+    std::vector<uint32_t> all;
+    size_t errors = 0, rejected = 0, reconnects = 0;
+    int64_t max_lag_us = 0;
+    for (auto& worker : workers) {
+        for (auto& sample : worker.samples) {
+            std::string route = route_of(log[sample.request]);
+            routes[route].count++;
+            if (sample.status < 0 || sample.status >= 500) {
+                routes[route].errors++;
+                errors++;
+                continue;
+            }
+            // The replay sends no credentials: a 401 or 403 means the server turned the recorded traffic away, and
+            // its quick answer says nothing about the route's latency
+            if (sample.status == 401 || sample.status == 403) {
+                routes[route].errors++;
+                rejected++;
+                continue;
+            }
+            latencies[route].push_back(sample.latency_us);
+            all.push_back(sample.latency_us);
+        }
+        reconnects += worker.reconnects;
+        max_lag_us = std::max(max_lag_us, worker.max_lag_us);
+    }
+    if (all.empty() && rejected > 0) {
+        std::cerr << "every request was refused (401/403), is auth_key set on the server?" << std::endl;
+        return 2;
+    }
+    if (all.empty()) {
+        std::cerr << "no request completed, is the server running on " << options.host << ":" << options.port << "?" << std::endl;
+        return 1;
+    }
+    auto percentile = [](const std::vector<uint32_t>& sorted, double p) {
+        return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+    };
+    for (auto& route : latencies) {
+        std::sort(route.second.begin(), route.second.end());
+        routes[route.first].p50 = percentile(route.second, 0.50);
+        routes[route.first].p90 = percentile(route.second, 0.90);
+        routes[route.first].p99 = percentile(route.second, 0.99);
+    }
+    std::sort(all.begin(), all.end());
+
+    double recorded = (log.back().timestamp_us - log.front().timestamp_us) / 1e6;
+    std::cout << log.size() << " requests recorded over " << recorded << " s on " << connections.size()
+              << " connections, replayed in " << elapsed << " s on " << workers_count << " connections" << std::endl;
+    if (options.speed > 0)
+        std::cout << "  speed " << options.speed << "x, worst send lag " << max_lag_us / 1000.0 << " ms" << std::endl;
+    std::cout << "  " << errors << " errors, " << rejected << " rejected (401/403), " << reconnects << " reconnects" << std::endl;
+    if (rejected > 0)
+        std::cout << "  the server refused requests, is auth_key set on it?" << std::endl;
+
+    std::cout << std::left << std::setw(24) << "route" << std::right << std::setw(8) << "count" << std::setw(10) << "p50 us"
+              << std::setw(10) << "p90 us" << std::setw(10) << "p99 us";
+    if (!baseline.empty())
+        std::cout << std::setw(10) << "p50 diff" << std::setw(10) << "p99 diff";
+    std::cout << std::endl;
+    for (auto& route : routes) {
+        const RouteStats& stats = route.second;
+        std::cout << std::left << std::setw(24) << route.first << std::right << std::setw(8) << stats.count << std::setw(10) << stats.p50
+                  << std::setw(10) << stats.p90 << std::setw(10) << stats.p99;
+        if (!baseline.empty()) {
+            auto before = baseline.find(route.first);
+            std::cout << std::setw(10) << (before == baseline.end() ? "-" : delta(stats.p50, before->second.p50))
+                      << std::setw(10) << (before == baseline.end() ? "-" : delta(stats.p99, before->second.p99));
+        }
+        std::cout << std::endl;
+    }
+
+    if (!options.save.empty()) {
+        std::ofstream out(options.save);
+        for (auto& route : routes)
+            out << route.first << "\t" << route.second.count << " " << route.second.errors << " " << route.second.p50 << " "
+                << route.second.p90 << " " << route.second.p99 << std::endl;
+        if (!out) {
+            std::cerr << "can't write " << options.save << std::endl;
+            return 1;
+        }
+    }
+
+    // One line that scripts can grep for, same as loadgen's
+    std::cout << "RESULT rps=" << (size_t)(all.size() / elapsed) << " p50_us=" << percentile(all, 0.50) << " p99_us=" << percentile(all, 0.99)
+              << " errors=" << errors << " rejected=" << rejected << std::endl;
+    return errors == 0 && rejected == 0 ? 0 : 2;
+}
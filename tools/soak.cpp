@@ -0,0 +1,690 @@
+// Soak test for the cupthor server: many clients at once for a long time, most of them sending what real clients
+// send, the rest sending garbage (non-numeric and huge values, unknown names, long paths, wrong methods), hanging up
+// halfway through a request or without reading the response. With --rpc-port, --rpc-clients more clients do the
+// same on the binary rpc listener (rpc.h): frames of a few commands, some with unknown ops, settings or sensors,
+// hostile values, a size that isn't a whole number of commands or a bogus token. Meant to run for hours against a
+// sanitizer build (make soak-asan or soak-tsan, tools/soak.sh).
+//
+//   ./soak [--host 127.0.0.1] [--port 9080] [--clients 64] [--duration 600] [--interval 10] [--pid P]
+//          [--fuzz 30] [--seed 1] [--key K] [--rpc-port 0] [--rpc-clients 4] [--disk PATH ...]
+//          [--max-rss-growth-mb 64] [--max-thread-growth 8] [--max-disk-growth-mb 0]
+//
+// Every interval prints one line: requests/s and rpc frames/s of that interval, answers by kind and, with --pid, the
+// server's resident memory, threads and open file descriptors read from /proc. With --disk it also prints the space
+// the given files and directories take (a file counts with its rotations, path.1, path.2 ...), which is where the
+// state log, the timelapse archives and the server log keep growing. At the end it compares the second half of the
+// run with the first: throughput, memory and thread count should stay flat once the server is warm (the first
+// interval is left out). Exits with 2 when the server gave a 500, died, or grew past the limits (0 = no limit).
+//
+// 429 and 503 are the server shedding load on purpose and 4xx are the normal answer to garbage, neither is an error.
+
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_client.h"
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 9080;
+    int clients = 64;
+    int duration = 600;
+    int interval = 10;
+    // Server process, for its memory and threads; 0 leaves them out
+    int pid = 0;
+    // Percentage of the requests that are garbage
+    int fuzz = 30;
+    unsigned seed = 1;
+    std::string key;
+    std::string token;
+    // Binary rpc listener of the server, 0 leaves the rpc clients out
+    int rpc_port = 0;
+    int rpc_clients = 4;
+    // Files and directories whose size is sampled
+    std::vector<std::string> disk;
+    int max_rss_growth_mb = 64;
+    int max_thread_growth = 8;
+    int max_disk_growth_mb = 0;
+};
+
+// Counted by every client, read by the sampler
+struct alignas(64) Counters {
+    std::atomic<uint64_t> ok{0};
+    std::atomic<uint64_t> refused{0};
+    std::atomic<uint64_t> shed{0};
+    std::atomic<uint64_t> server_errors{0};
+    std::atomic<uint64_t> broken{0};
+    std::atomic<uint64_t> connect_failures{0};
+    std::atomic<uint64_t> rpc_frames{0};
+};
+
+struct Sample {
+    double elapsed_s;
+    uint64_t requests;
+    double rps;
+    uint64_t rpc_frames = 0;
+    double rpc_rate = 0;
+    long rss_kb = -1;
+    int threads = -1;
+    int fds = -1;
+    long disk_kb = -1;
+};
+
+static const char* setting_names[] = {"desired_temperature", "ventilation", "ambient_light", "silent_mode", "defrost",
+                                      "grill", "timer"};
+static const char* sensor_names[] = {"thermostat", "camera", "scale", "smoke", "water"};
+static const char* cook_names[] = {"chicken", "vegetables", "fish", "pork"};
+
+// Values a handler may choke on
+static std::string hostile_value(std::mt19937& rng) {
+    static const char* values[] = {"abc", "-1", "1e309", "-1e309", "nan", "inf", "99999999999999999999", "0x10",
+                                   "%20", "%00", "..", "../../etc/passwd", "1.5.2", "12abc", "+", "-", ".", "%ZZ",
+                                   "\xc3\xa9", "2147483648", "-2147483649"};
+    std::uniform_int_distribution<int> pick(0, sizeof(values) / sizeof(values[0]) + 1);
+    int i = pick(rng);
+    if (i < (int)(sizeof(values) / sizeof(values[0])))
+        return values[i];
+    // Long runs of one character, and random printable bytes
+    std::uniform_int_distribution<int> length(1, i % 2 ? 4000 : 64);
+    std::uniform_int_distribution<int> byte(33, 126);
+    std::string value(length(rng), 'A');
+    if (i % 2 == 0) {
+        for (char& c : value) {
+            c = (char)byte(rng);
+            if (c == '/' || c == '?' || c == '#')
+                c = 'x';
+        }
+    }
+    return value;
+}
+
+template <size_t N>
+static std::string any_of(const char* (&names)[N], std::mt19937& rng) {
+    return names[std::uniform_int_distribution<size_t>(0, N - 1)(rng)];
+}
+
+// A request line and headers, valid or not
+static std::string make_request(const Options& options, std::mt19937& rng) {
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::string method = "GET", path;
+    int p = percent(rng);
+
+    if (percent(rng) >= options.fuzz) {
+        if (p < 30)
+            path = "/settings/" + any_of(setting_names, rng) + "/";
+        else if (p < 50) {
+            method = "POST";
+            path = p < 40 ? "/settings/desired_temperature/" + std::to_string(20 + p * 5)
+                          : "/settings/ventilation/" + std::to_string(p % 3);
+        }
+        else if (p < 62)
+            path = "/sensors/" + any_of(sensor_names, rng) + "/";
+        else if (p < 70)
+            path = "/cook/";
+        else if (p < 74) {
+            method = "POST";
+            path = "/cook/" + any_of(cook_names, rng) + (p % 2 ? "/" : "/keep-food-warm");
+        }
+        else if (p < 80)
+            path = p % 2 ? "/mediaplayer/" : "/mediaplayer/playback";
+        else if (p < 84) {
+            method = "POST";
+            path = p % 2 ? "/mediaplayer/play/SGVsbG8gQ3VwLVRob3I=" : "/mediaplayer/stop/";
+        }
+        else if (p < 88)
+            path = p % 2 ? "/safety/" : "/stats/allocators";
+        else if (p < 92)
+            path = "/sensors/camera/stats";
+        else if (p < 94)
+            path = "/cook/1/frames/0";
+        else
+            path = "/ready";
+    }
+    else {
+        std::string value = hostile_value(rng);
+        if (p < 25) {
+            method = "POST";
+            path = "/settings/" + (p % 5 ? any_of(setting_names, rng) : hostile_value(rng)) + "/" + value;
+        }
+        else if (p < 35)
+            path = "/settings/" + value + "/";
+        else if (p < 45) {
+            method = "POST";
+            path = "/cook/" + (p % 2 ? any_of(cook_names, rng) : value) + "/" + value;
+        }
+        else if (p < 55) {
+            method = "POST";
+            path = "/mediaplayer/" + (p % 2 ? std::string("play") : value) + "/" + value;
+        }
+        else if (p < 60) {
+            method = "POST";
+            path = "/mediaplayer/play-hash/" + value;
+        }
+        else if (p < 67)
+            path = "/cook/" + value + "/frames/" + hostile_value(rng);
+        else if (p < 74)
+            path = "/sensors/" + value + "/";
+        else if (p < 80)
+            path = "/sensors/camera/?format=" + value + "&q=" + hostile_value(rng) + "&w=" + hostile_value(rng);
+        else if (p < 86) {
+            static const char* methods[] = {"PUT", "DELETE", "PATCH", "OPTIONS"};
+            method = any_of(methods, rng);
+            path = "/settings/desired_temperature/100";
+        }
+        else if (p < 92)
+            path = "/" + value;
+        else {
+            method = "POST";
+            path = "/safety/reset/" + value;
+        }
+    }
+
+    std::string raw = method + " " + path + " HTTP/1.1\r\nHost: " + options.host + "\r\n";
+    if (!options.token.empty())
+        raw += "Authorization: Bearer " + options.token + "\r\n";
+    return raw + "Content-Length: 0\r\n\r\n";
+}
+
+static void client(const Options& options, int id, std::chrono::steady_clock::time_point end, Counters& counters) {
+    std::mt19937 rng(options.seed * 7919 + id);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::string buffer;
+    int fd = -1;
+
+    while (std::chrono::steady_clock::now() < end) {
+        if (fd < 0) {
+            buffer.clear();
+            fd = connect_to(options.host, options.port);
+            if (fd < 0) {
+                counters.connect_failures++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+        }
+
+        int behaviour = percent(rng);
+        // A few pipelined requests at once
+        int batch = behaviour < 5 ? 8 : 1;
+        std::string raw;
+        for (int i = 0; i < batch; i++)
+            raw += make_request(options, rng);
+
+        // Hanging up halfway through the request, or before reading the answer
+        bool cut = behaviour >= 98;
+        bool leave = behaviour == 97;
+        size_t size = cut ? std::uniform_int_distribution<size_t>(1, raw.size() - 1)(rng) : raw.size();
+        if (send(fd, raw.data(), size, MSG_NOSIGNAL) != (ssize_t)size || cut || leave) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        for (int i = 0; i < batch; i++) {
+            int status = read_response(fd, buffer);
+            if (status < 0) {
+                counters.broken++;
+                close(fd);
+                fd = -1;
+                break;
+            }
+            if (status == 429 || status == 503)
+                counters.shed++;
+            else if (status >= 500)
+                counters.server_errors++;
+            else if (status >= 400)
+                counters.refused++;
+            else
+                counters.ok++;
+        }
+
+        // Sometimes a fresh connection
+        if (fd >= 0 && percent(rng) < 2) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+// Binary rpc, as in rpc.h: little endian sizes, commands of u8 op, u8 argument, f64 value; results of u8 status, f64
+namespace rpc {
+enum Op : uint8_t { SET_SETTING = 1, GET_SETTING, GET_TEMPERATURE, GET_COOK_PHASE, GET_SENSOR };
+const uint32_t TOKEN_FRAME = 0x80000000;
+const size_t COMMAND_SIZE = 10;
+const size_t RESULT_SIZE = 9;
+// CupThor::SETTINGS and CupThor::SENSORS
+const int SETTINGS = 5;
+const int SENSORS = 4;
+}
+
+static void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        out += (char)(v >> (8 * i));
+}
+
+static void put_command(std::string& out, uint8_t op, uint8_t argument, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, 8);
+    out += (char)op;
+    out += (char)argument;
+    for (int i = 0; i < 8; i++)
+        out += (char)(bits >> (8 * i));
+}
+
+static bool read_exactly(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = recv(fd, data, size, 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Reads a reply frame and checks that it has `results` results
+static bool read_rpc_reply(int fd, size_t results) {
+    char header[4];
+    if (!read_exactly(fd, header, 4))
+        return false;
+    uint32_t size = 0;
+    memcpy(&size, header, 4);
+    if (size != results * rpc::RESULT_SIZE)
+        return false;
+    std::vector<char> payload(size);
+    return read_exactly(fd, payload.data(), size);
+}
+
+// A frame of commands, valid or not. Sets `closes` when the server is expected to hang up on it instead of answering.
+static std::string make_rpc_frame(const Options& options, std::mt19937& rng, size_t& results, bool& closes) {
+    static const double hostile[] = {NAN, INFINITY, -INFINITY, 1e308, -1e308, -1, 2147483648.0, 1e-300};
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> count(1, 16);
+    std::string payload;
+    results = count(rng);
+    closes = false;
+    bool fuzz = percent(rng) < options.fuzz;
+
+    for (size_t i = 0; i < results; i++) {
+        int p = percent(rng);
+        if (fuzz && p < 20)
+            put_command(payload, (uint8_t)std::uniform_int_distribution<int>(6, 255)(rng), 0, 0);
+        else if (fuzz && p < 40)
+            put_command(payload, p % 2 ? rpc::SET_SETTING : rpc::GET_SENSOR, (uint8_t)std::uniform_int_distribution<int>(rpc::SETTINGS, 255)(rng), 1);
+        else if (fuzz && p < 60)
+            put_command(payload, rpc::SET_SETTING, p % rpc::SETTINGS, hostile[p % (sizeof(hostile) / sizeof(hostile[0]))]);
+        else if (p < 30)
+            put_command(payload, rpc::SET_SETTING, p % 2 ? 1 : 3, p % 2 ? 20 + p * 5 : p % 3);
+        else if (p < 60)
+            put_command(payload, rpc::GET_SETTING, p % rpc::SETTINGS, 0);
+        else if (p < 75)
+            put_command(payload, rpc::GET_TEMPERATURE, 0, 0);
+        else if (p < 85)
+            put_command(payload, rpc::GET_COOK_PHASE, 0, 0);
+        else
+            put_command(payload, rpc::GET_SENSOR, p % rpc::SENSORS, 0);
+    }
+
+    std::string frame;
+    int p = percent(rng);
+    if (fuzz && p < 10) {
+        // Not a whole number of commands
+        payload.resize(payload.size() - std::uniform_int_distribution<size_t>(1, rpc::COMMAND_SIZE - 1)(rng));
+        closes = true;
+    }
+    else if (fuzz && p < 20) {
+        // A token nobody gave out
+        std::string token = hostile_value(rng).substr(0, 512);
+        put_u32(frame, rpc::TOKEN_FRAME | (uint32_t)token.size());
+        frame += token;
+        results = 1;
+        return frame;
+    }
+    put_u32(frame, (uint32_t)payload.size());
+    return frame + payload;
+}
+
+static void rpc_client(const Options& options, int id, std::chrono::steady_clock::time_point end, Counters& counters) {
+    std::mt19937 rng(options.seed * 104729 + id);
+    std::uniform_int_distribution<int> percent(0, 99);
+    int fd = -1;
+
+    while (std::chrono::steady_clock::now() < end) {
+        if (fd < 0) {
+            fd = connect_to(options.host, options.rpc_port);
+            if (fd < 0) {
+                counters.connect_failures++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            // The token goes first, so that the changes are allowed on a server with an auth_key
+            if (!options.token.empty()) {
+                std::string frame;
+                put_u32(frame, rpc::TOKEN_FRAME | (uint32_t)options.token.size());
+                frame += options.token;
+                if (send(fd, frame.data(), frame.size(), MSG_NOSIGNAL) != (ssize_t)frame.size() || !read_rpc_reply(fd, 1)) {
+                    counters.broken++;
+                    close(fd);
+                    fd = -1;
+                    continue;
+                }
+            }
+        }
+
+        size_t results;
+        bool closes;
+        std::string frame = make_rpc_frame(options, rng, results, closes);
+        if (send(fd, frame.data(), frame.size(), MSG_NOSIGNAL) != (ssize_t)frame.size()) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        if (closes) {
+            // The server hangs up on it, there is no answer to wait for
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        if (!read_rpc_reply(fd, results)) {
+            counters.broken++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        counters.rpc_frames++;
+
+        if (percent(rng) < 2) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+// Space taken by a file (with its rotations path.1, path.2 ...) or a whole directory, in KB
+static long disk_usage_kb(const std::string& path) {
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0)
+        return 0;
+    long kb = info.st_blocks / 2;
+    if (S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(path.c_str());
+        if (dir != nullptr) {
+            while (dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name != "." && name != "..")
+                    kb += disk_usage_kb(path + "/" + name);
+            }
+            closedir(dir);
+        }
+    }
+    else {
+        for (int i = 1; lstat((path + "." + std::to_string(i)).c_str(), &info) == 0; i++)
+            kb += info.st_blocks / 2;
+    }
+    return kb;
+}
+
+// VmRSS and Threads from /proc/<pid>/status, and the open descriptors. False once the process is gone.
+static bool read_process(int pid, Sample& sample) {
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    if (!status)
+        return false;
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            sample.rss_kb = strtol(line.c_str() + 6, nullptr, 10);
+        else if (line.compare(0, 8, "Threads:") == 0)
+            sample.threads = atoi(line.c_str() + 8);
+    }
+    DIR* dir = opendir(("/proc/" + std::to_string(pid) + "/fd").c_str());
+    if (dir != nullptr) {
+        sample.fds = 0;
+        while (dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.')
+                sample.fds++;
+        }
+        closedir(dir);
+    }
+    return true;
+}
+
+static bool parse(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+        if (arg == "--host")
+            options.host = value;
+        else if (arg == "--port")
+            options.port = std::stoi(value);
+        else if (arg == "--clients")
+            options.clients = std::stoi(value);
+        else if (arg == "--duration")
+            options.duration = std::stoi(value);
+        else if (arg == "--interval")
+            options.interval = std::stoi(value);
+        else if (arg == "--pid")
+            options.pid = std::stoi(value);
+        else if (arg == "--fuzz")
+            options.fuzz = std::stoi(value);
+        else if (arg == "--seed")
+            options.seed = std::stoul(value);
+        else if (arg == "--key")
+            options.key = value;
+        else if (arg == "--rpc-port")
+            options.rpc_port = std::stoi(value);
+        else if (arg == "--rpc-clients")
+            options.rpc_clients = std::stoi(value);
+        else if (arg == "--disk")
+            options.disk.push_back(value);
+        else if (arg == "--max-rss-growth-mb")
+            options.max_rss_growth_mb = std::stoi(value);
+        else if (arg == "--max-thread-growth")
+            options.max_thread_growth = std::stoi(value);
+        else if (arg == "--max-disk-growth-mb")
+            options.max_disk_growth_mb = std::stoi(value);
+        else
+            return false;
+    }
+    return options.clients > 0 && options.duration > 0 && options.interval > 0 && options.fuzz >= 0 && options.fuzz <= 100 &&
+           options.rpc_clients >= 0;
+}
+
+static double mean(const std::vector<double>& values) {
+    double sum = 0;
+    for (double v : values)
+        sum += v;
+    return values.empty() ? 0 : sum / values.size();
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        if (!parse(argc, argv, options)) {
+            std::cerr << "usage: " << argv[0] << " [--host h] [--port p] [--clients n] [--duration s] [--interval s] [--pid p]"
+                      << " [--fuzz percent] [--seed n] [--key k] [--rpc-port p] [--rpc-clients n] [--disk path ...]"
+                      << " [--max-rss-growth-mb n] [--max-thread-growth n] [--max-disk-growth-mb n]" << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::exception&) {
+        std::cerr << "invalid number in the arguments" << std::endl;
+        return 1;
+    }
+
+    if (!options.key.empty()) {
+        options.token = fetch_token(options.host, options.port, options.key);
+        if (options.token.empty()) {
+            std::cerr << "no token from /auth" << std::endl;
+            return 1;
+        }
+    }
+
+    int rpc_clients = options.rpc_port > 0 ? options.rpc_clients : 0;
+    std::vector<Counters> counters(options.clients + rpc_clients);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(options.duration);
+    for (int i = 0; i < options.clients; i++)
+        clients.emplace_back(client, std::cref(options), i, end, std::ref(counters[i]));
+    for (int i = 0; i < rpc_clients; i++)
+        clients.emplace_back(rpc_client, std::cref(options), i, end, std::ref(counters[options.clients + i]));
+
+    std::printf("%8s %10s %9s %9s %9s %8s %8s %8s %8s %10s %8s %6s %9s\n", "time s", "requests", "req/s", "ok", "4xx", "shed",
+                "5xx", "broken", "rpc/s", "rss MB", "threads", "fds", "disk MB");
+    std::vector<Sample> samples;
+    uint64_t last_requests = 0, last_ok = 0, last_refused = 0, last_shed = 0;
+    bool server_gone = false;
+    auto next = start;
+    while (true) {
+        next += std::chrono::seconds(options.interval);
+        if (next > end)
+            next = end;
+        std::this_thread::sleep_until(next);
+
+        uint64_t ok = 0, refused = 0, shed = 0, server_errors = 0, broken = 0, rpc_frames = 0;
+        for (auto& c : counters) {
+            ok += c.ok.load(std::memory_order_relaxed);
+            refused += c.refused.load(std::memory_order_relaxed);
+            shed += c.shed.load(std::memory_order_relaxed);
+            server_errors += c.server_errors.load(std::memory_order_relaxed);
+            broken += c.broken.load(std::memory_order_relaxed);
+            rpc_frames += c.rpc_frames.load(std::memory_order_relaxed);
+        }
+
+        Sample sample;
+        sample.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sample.requests = ok + refused + shed + server_errors;
+        double seconds = samples.empty() ? sample.elapsed_s : sample.elapsed_s - samples.back().elapsed_s;
+        sample.rps = (sample.requests - last_requests) / seconds;
+        sample.rpc_frames = rpc_frames;
+        sample.rpc_rate = (rpc_frames - (samples.empty() ? 0 : samples.back().rpc_frames)) / seconds;
+        if (options.pid > 0 && !read_process(options.pid, sample))
+            server_gone = true;
+        if (!options.disk.empty()) {
+            sample.disk_kb = 0;
+            for (const std::string& path : options.disk)
+                sample.disk_kb += disk_usage_kb(path);
+        }
+
+        char rss[16] = "-", threads[16] = "-", fds[16] = "-", disk[16] = "-";
+        if (sample.rss_kb >= 0)
+            snprintf(rss, sizeof(rss), "%.1f", sample.rss_kb / 1024.0);
+        if (sample.threads >= 0)
+            snprintf(threads, sizeof(threads), "%d", sample.threads);
+        if (sample.fds >= 0)
+            snprintf(fds, sizeof(fds), "%d", sample.fds);
+        if (sample.disk_kb >= 0)
+            snprintf(disk, sizeof(disk), "%.1f", sample.disk_kb / 1024.0);
+        std::printf("%8.0f %10llu %9.0f %9llu %9llu %8llu %8llu %8llu %8.0f %10s %8s %6s %9s\n", sample.elapsed_s,
+                    (unsigned long long)sample.requests, sample.rps, (unsigned long long)(ok - last_ok),
+                    (unsigned long long)(refused - last_refused), (unsigned long long)(shed - last_shed),
+                    (unsigned long long)server_errors, (unsigned long long)broken, sample.rpc_rate, rss, threads, fds, disk);
+        std::fflush(stdout);
+        samples.push_back(sample);
+        last_requests = sample.requests;
+        last_ok = ok;
+        last_refused = refused;
+        last_shed = shed;
+
+        if (server_gone) {
+            std::cout << "the server (pid " << options.pid << ") is gone" << std::endl;
+            break;
+        }
+        if (next >= end)
+            break;
+    }
+    for (auto& t : clients)
+        t.join();
+
+    uint64_t server_errors = 0, connect_failures = 0;
+    for (auto& c : counters) {
+        server_errors += c.server_errors.load();
+        connect_failures += c.connect_failures.load();
+    }
+
+    // The first interval is the warm up: pools fill, the allocator grows its arenas, threads start
+    bool failed = server_gone || server_errors > 0;
+    std::vector<Sample> warm(samples.size() > 1 ? samples.begin() + 1 : samples.begin(), samples.end());
+    if (warm.size() >= 2) {
+        size_t half = warm.size() / 2;
+        std::vector<double> first, second, all;
+        for (size_t i = 0; i < warm.size(); i++) {
+            (i < half ? first : second).push_back(warm[i].rps);
+            all.push_back(warm[i].rps);
+        }
+        double average = mean(all), variance = 0;
+        for (double r : all)
+            variance += (r - average) * (r - average);
+        double deviation = std::sqrt(variance / all.size());
+        std::cout << "throughput : " << (size_t)mean(first) << " req/s in the first half, " << (size_t)mean(second)
+                  << " in the second, intervals vary by " << (average > 0 ? (int)(100 * deviation / average) : 0) << "%" << std::endl;
+
+        if (warm.front().rss_kb >= 0 && warm.back().rss_kb >= 0) {
+            long growth_kb = warm.back().rss_kb - warm.front().rss_kb;
+            double hours = (warm.back().elapsed_s - warm.front().elapsed_s) / 3600;
+            std::cout << "memory     : " << warm.front().rss_kb / 1024 << " MB after the warm up, " << warm.back().rss_kb / 1024
+                      << " MB at the end (" << (growth_kb >= 0 ? "+" : "") << growth_kb / 1024.0 << " MB";
+            if (hours > 0)
+                std::cout << ", " << growth_kb / 1024.0 / hours << " MB/h";
+            std::cout << ")" << std::endl;
+            if (growth_kb > options.max_rss_growth_mb * 1024L) {
+                std::cout << "memory grew more than " << options.max_rss_growth_mb << " MB" << std::endl;
+                failed = true;
+            }
+        }
+        if (warm.front().threads >= 0 && warm.back().threads >= 0) {
+            int most = 0;
+            for (auto& s : warm)
+                most = std::max(most, s.threads);
+            std::cout << "threads    : " << warm.front().threads << " after the warm up, " << warm.back().threads << " at the end, "
+                      << most << " at most" << std::endl;
+            if (warm.back().threads - warm.front().threads > options.max_thread_growth) {
+                std::cout << "thread count grew by more than " << options.max_thread_growth << std::endl;
+                failed = true;
+            }
+        }
+        if (warm.front().fds >= 0 && warm.back().fds >= 0)
+            std::cout << "descriptors: " << warm.front().fds << " after the warm up, " << warm.back().fds << " at the end" << std::endl;
+        if (warm.front().disk_kb >= 0) {
+            long most = 0;
+            for (auto& s : warm)
+                most = std::max(most, s.disk_kb);
+            long growth_kb = warm.back().disk_kb - warm.front().disk_kb;
+            std::cout << "disk       : " << warm.front().disk_kb / 1024 << " MB after the warm up, " << warm.back().disk_kb / 1024
+                      << " MB at the end, " << most / 1024 << " MB at most" << std::endl;
+            if (options.max_disk_growth_mb > 0 && growth_kb > options.max_disk_growth_mb * 1024L) {
+                std::cout << "disk usage grew more than " << options.max_disk_growth_mb << " MB" << std::endl;
+                failed = true;
+            }
+        }
+    }
+    if (server_errors > 0)
+        std::cout << server_errors << " answers were 5xx other than 503" << std::endl;
+    if (connect_failures > 0)
+        std::cout << connect_failures << " connection attempts failed" << std::endl;
+
+    // One line that scripts can grep for
+    std::cout << "RESULT requests=" << (samples.empty() ? 0 : samples.back().requests)
+              << " rpc_frames=" << (samples.empty() ? 0 : samples.back().rpc_frames) << " server_errors=" << server_errors
+              << " failed=" << (failed ? 1 : 0) << std::endl;
+    return failed ? 2 : 0;
+}
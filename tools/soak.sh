@@ -0,0 +1,39 @@
+#!/bin/sh
+# Starts one server binary, normally a sanitizer build, runs the soak client against it and stops it with SIGINT so
+# the leak check runs. The server runs its default configuration, so the state log, the timelapse and the server log
+# are written as in production and their size is sampled; only the rpc listener, off by default, is turned on for the
+# rpc clients. The server's output, sanitizer reports included, goes to <binary>.soak.log. Fails when soak fails or
+# the log has a sanitizer report. Environment: PORT, RPC_PORT, DURATION, CLIENTS, RPC_CLIENTS, INTERVAL, FUZZ, SEED.
+#
+#   DURATION=14400 ./tools/soak.sh cupthor-asan
+
+PORT=${PORT:-9184}
+RPC_PORT=${RPC_PORT:-9185}
+DURATION=${DURATION:-3600}
+CLIENTS=${CLIENTS:-64}
+RPC_CLIENTS=${RPC_CLIENTS:-4}
+INTERVAL=${INTERVAL:-60}
+FUZZ=${FUZZ:-30}
+SEED=${SEED:-1}
+BINARY=${1:-cupthor-asan}
+LOG="$BINARY.soak.log"
+
+# Reports go on stderr and don't stop the server, the run goes on and the log collects all of them
+ASAN_OPTIONS="detect_leaks=1:halt_on_error=0:$ASAN_OPTIONS" \
+UBSAN_OPTIONS="print_stacktrace=1:$UBSAN_OPTIONS" \
+TSAN_OPTIONS="halt_on_error=0:second_deadlock_stack=1:$TSAN_OPTIONS" \
+./"$BINARY" --port "$PORT" --rpc-port "$RPC_PORT" > "$LOG" 2>&1 &
+pid=$!
+sleep 2
+
+./soak --port "$PORT" --duration "$DURATION" --clients "$CLIENTS" --interval "$INTERVAL" --fuzz "$FUZZ" --seed "$SEED" --pid "$pid" \
+    --rpc-port "$RPC_PORT" --rpc-clients "$RPC_CLIENTS" --disk State --disk Timelapse --disk cupthor.log
+status=$?
+
+kill -INT $pid 2> /dev/null
+wait $pid
+server_status=$?
+
+reports=$(grep -c -E "ERROR: (AddressSanitizer|LeakSanitizer)|WARNING: ThreadSanitizer|runtime error:" "$LOG")
+echo "server exited with $server_status, $reports sanitizer reports in $LOG"
+[ "$status" -eq 0 ] && [ "$reports" -eq 0 ]